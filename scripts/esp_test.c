@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <netinet/ip.h>
+#include <library.h>
+#include <ipsec.h>
+
+/**
+ * Allocations done by decrypt() for the decapsulated ip_packet_t and its
+ * source and destination addresses, the data itself is decrypted in place
+ */
+#define DECRYPT_ALLOCS 3
+
+static void usage()
+{
+	printf("usage: esp_test plugins packets\n");
+	exit(1);
+}
+
+/**
+ * Whether to count allocations
+ */
+static bool counting;
+
+/**
+ * Number of counted allocations
+ */
+static int allocs;
+
+#ifdef __GLIBC__
+/*
+ * Count heap allocations by interposing the allocator functions
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	allocs += counting;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocs += counting;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs += counting;
+	return __libc_realloc(ptr, size);
+}
+#endif /* __GLIBC__ */
+
+/**
+ * Create an IPv4 packet with headroom and tailroom for ESP
+ */
+static ip_packet_t *create_packet(int i, size_t len)
+{
+	chunk_t buffer, packet;
+	struct ip *ip;
+
+	buffer = chunk_alloc(ESP_PACKET_HEADROOM + len + ESP_PACKET_TAILROOM);
+	packet = chunk_create(buffer.ptr + ESP_PACKET_HEADROOM, len);
+	memset(packet.ptr, i, packet.len);
+	ip = (struct ip*)packet.ptr;
+	ip->ip_v = 4;
+	ip->ip_hl = sizeof(struct ip) / 4;
+	return ip_packet_create_from_buffer(buffer, packet);
+}
+
+/**
+ * Encrypt and decrypt packets, counting allocations in steady state
+ */
+static bool run_test(int packets, encryption_algorithm_t encr, size_t encr_len,
+					 integrity_algorithm_t integ, size_t integ_len, bool esn)
+{
+	esp_context_t *out, *in;
+	esp_packet_t *esp;
+	ip_packet_t *payload;
+	host_t *src, *dst;
+	char key[64];
+	int i, encrypt_allocs = 0, decrypt_allocs = 0;
+	bool success = TRUE;
+	chunk_t data;
+
+	printf("%N/%N%s:\t", encryption_algorithm_names, encr,
+		   integrity_algorithm_names, integ, esn ? "/ESN" : "");
+
+	memset(key, 0x42, sizeof(key));
+	out = esp_context_create(encr, chunk_create(key, encr_len), integ,
+							 chunk_create(key, integ_len), FALSE, esn, 0);
+	in = esp_context_create(encr, chunk_create(key, encr_len), integ,
+							chunk_create(key, integ_len), TRUE, esn, 0);
+	if (!out || !in)
+	{
+		printf("not supported\n");
+		DESTROY_IF(out);
+		DESTROY_IF(in);
+		return TRUE;
+	}
+	src = host_create_from_string("192.0.2.1", 4500);
+	dst = host_create_from_string("192.0.2.2", 4500);
+
+	/* the first packet creates the RNG etc. */
+	for (i = 0; i <= packets && success; i++)
+	{
+		payload = create_packet(i, 64 + i % 1024);
+		esp = esp_packet_create_from_payload(src->clone(src), dst->clone(dst),
+											 payload);
+		allocs = 0;
+		counting = TRUE;
+		success = esp->encrypt(esp, out, htonl(0xc0000001)) == SUCCESS;
+		counting = FALSE;
+		encrypt_allocs += i ? allocs : 0;
+		if (!success)
+		{
+			printf("encryption failed\n");
+			esp->destroy(esp);
+			break;
+		}
+
+		/* the processor receives a copy from the socket */
+		data = chunk_clone(esp->packet.get_data(&esp->packet));
+		esp->destroy(esp);
+		esp = esp_packet_create_from_packet(packet_create_from_data(
+							src->clone(src), dst->clone(dst), data));
+		allocs = 0;
+		counting = TRUE;
+		success = esp->decrypt(esp, in) == SUCCESS;
+		counting = FALSE;
+		decrypt_allocs += i ? allocs : 0;
+		if (!success)
+		{
+			printf("decryption failed\n");
+		}
+		else
+		{
+			payload = esp->get_payload(esp);
+			data = payload->get_encoding(payload);
+			if (data.len != 64 + i % 1024 || data.ptr[data.len - 1] != (u_char)i)
+			{
+				printf("payload mismatch\n");
+				success = FALSE;
+			}
+		}
+		esp->destroy(esp);
+	}
+	if (success)
+	{
+		printf("allocations per packet: encrypt %.2f, decrypt %.2f\n",
+			   (double)encrypt_allocs / packets,
+			   (double)decrypt_allocs / packets);
+#ifdef __GLIBC__
+		if (encrypt_allocs || decrypt_allocs > DECRYPT_ALLOCS * packets)
+		{
+			printf("  unexpected allocations\n");
+			success = FALSE;
+		}
+#endif /* __GLIBC__ */
+	}
+	out->destroy(out);
+	in->destroy(in);
+	src->destroy(src);
+	dst->destroy(dst);
+	return success;
+}
+
+/**
+ * Create an inbound ESP context to test the anti-replay window
+ */
+static esp_context_t *create_inbound(bool esn, u_int window)
+{
+	char key[20];
+
+	memset(key, 0x42, sizeof(key));
+	return esp_context_create(ENCR_AES_GCM_ICV16, chunk_from_thing(key),
+							  AUTH_UNDEFINED, chunk_empty, TRUE, esn, window);
+}
+
+/**
+ * Pass a sequence number to the window, as decrypt() does
+ */
+static bool receive(esp_context_t *ctx, u_int64_t seqno, u_int64_t *full)
+{
+	if (!ctx->verify_seqno(ctx, (u_int32_t)seqno, full))
+	{
+		return FALSE;
+	}
+	if (*full == seqno)
+	{	/* otherwise the ICV verification would fail */
+		ctx->set_authenticated_seqno(ctx, *full);
+	}
+	return TRUE;
+}
+
+/**
+ * Maximum distance from the initial sequence number in the reordering test
+ */
+#define REORDER_RANGE (1 << 26)
+
+/**
+ * Receive sequence numbers with heavy reordering, replays and jumps, and
+ * compare the window against a full record of all received numbers
+ */
+static bool run_reorder_test(int packets, bool esn, u_int window)
+{
+	esp_context_t *ctx;
+	u_int64_t base, highest, seqno, full;
+	u_char *seen;
+	bool valid, expected, success = TRUE;
+	int i, r;
+
+	printf("replay window %4u%s:\treordering ", window, esn ? " (ESN)" : "");
+
+	ctx = create_inbound(esn, window);
+	if (!ctx)
+	{
+		printf("not supported\n");
+		return TRUE;
+	}
+	/* with ESN start just below the first 32-bit wraparound */
+	base = esn ? 0xfffff000 : 0;
+	if (base)
+	{
+		ctx->verify_seqno(ctx, base, &full);
+		ctx->set_authenticated_seqno(ctx, base);
+	}
+	highest = base;
+	seen = calloc(REORDER_RANGE / 8, 1);
+	seen[0] = 1;
+
+	for (i = 0; i < packets && success; i++)
+	{
+		r = random() % 100;
+		if (r == 0)
+		{	/* jump ahead, possibly beyond the window */
+			seqno = highest + 1 + random() % (2 * window);
+		}
+		else if (r < 50)
+		{	/* in order, with small gaps */
+			seqno = highest + 1 + random() % 4;
+		}
+		else
+		{	/* late, replayed or outside of the window */
+			seqno = highest - min(highest - base, random() % (window + 64));
+		}
+		if (seqno - base >= REORDER_RANGE)
+		{
+			break;
+		}
+		expected = seqno > 0 && highest - seqno < window &&
+				   !(seen[(seqno - base) / 8] & (1 << (seqno - base) % 8));
+		if (seqno > highest)
+		{
+			expected = TRUE;
+		}
+		valid = receive(ctx, seqno, &full);
+		if (expected && (!valid || full != seqno))
+		{
+			printf("failed, %llu rejected (highest %llu)\n", seqno, highest);
+			success = FALSE;
+		}
+		else if (!expected && valid && full == seqno)
+		{
+			printf("failed, %llu accepted (highest %llu)\n", seqno, highest);
+			success = FALSE;
+		}
+		else if (expected)
+		{
+			seen[(seqno - base) / 8] |= 1 << (seqno - base) % 8;
+			highest = max(highest, seqno);
+		}
+	}
+	if (success)
+	{
+		printf("ok (highest %llu)\n", highest);
+	}
+	free(seen);
+	ctx->destroy(ctx);
+	return success;
+}
+
+/**
+ * Receive sequence numbers across the 32-bit boundary
+ */
+static bool run_wraparound_test(bool esn, u_int window)
+{
+	esp_context_t *ctx;
+	u_int64_t seqno, full;
+	bool valid, success = TRUE;
+
+	printf("replay window %4u%s:\twraparound ", window, esn ? " (ESN)" : "");
+
+	ctx = create_inbound(esn, window);
+	if (!ctx)
+	{
+		printf("not supported\n");
+		return TRUE;
+	}
+	/* a new ESN context rejects numbers below its first one, so start just
+	 * below the numbers covered by the window once it reaches the boundary */
+	seqno = 0xffffffffULL - window;
+	ctx->verify_seqno(ctx, seqno, &full);
+	ctx->set_authenticated_seqno(ctx, seqno);
+
+	/* every other number up to the boundary, then the rest in reverse */
+	for (seqno = 0xffffffffULL - window + 2; seqno <= 0xffffffffULL &&
+		 success; seqno += 2)
+	{
+		success = receive(ctx, seqno, &full) && full == seqno;
+	}
+	for (seqno = 0xffffffffULL - 1; seqno > 0xffffffffULL - window &&
+		 success; seqno -= 2)
+	{
+		success = receive(ctx, seqno, &full) && full == seqno;
+	}
+	/* all of them are replays now */
+	for (seqno = 0xffffffffULL - window + 1; seqno <= 0xffffffffULL &&
+		 success; seqno++)
+	{
+		success = !receive(ctx, seqno, &full) || full != seqno;
+	}
+	if (success)
+	{	/* the low-order bits restart at zero */
+		seqno = 0x100000000ULL;
+		valid = receive(ctx, seqno, &full);
+		success = esn ? valid && full == seqno : !valid;
+	}
+	if (success && esn)
+	{	/* late packets from before the wraparound are still accepted */
+		success = !receive(ctx, 0xffffffffULL, &full) &&
+				  receive(ctx, 0x100000001ULL, &full) && full == 0x100000001ULL;
+		ctx->verify_seqno(ctx, 0xfffffff0, &full);
+		success = success && full == 0xfffffff0ULL;
+	}
+	printf("%s\n", success ? "ok" : "failed");
+	ctx->destroy(ctx);
+	return success;
+}
+
+int main(int argc, char *argv[])
+{
+	u_int windows[] = { 32, 128, 1000, 1024, 4096 };
+	bool success;
+	int packets, i;
+
+	if (argc < 3)
+	{
+		usage();
+	}
+
+	library_init(NULL);
+	atexit(library_deinit);
+	lib->plugins->load(lib->plugins, NULL, argv[1]);
+
+	packets = max(1, atoi(argv[2]));
+	success = run_test(packets, ENCR_AES_CBC, 16, AUTH_HMAC_SHA1_96, 20,
+					   FALSE);
+	success = run_test(packets, ENCR_AES_CBC, 32, AUTH_HMAC_SHA2_256_128,
+					   32, FALSE) && success;
+	success = run_test(packets, ENCR_AES_GCM_ICV16, 20, AUTH_UNDEFINED,
+					   0, FALSE) && success;
+	success = run_test(packets, ENCR_AES_GCM_ICV16, 20, AUTH_UNDEFINED,
+					   0, TRUE) && success;
+
+	for (i = 0; i < countof(windows); i++)
+	{
+		success = run_reorder_test(packets * 10, FALSE, windows[i]) && success;
+		success = run_reorder_test(packets * 10, TRUE, windows[i]) && success;
+		success = run_wraparound_test(FALSE, windows[i]) && success;
+		success = run_wraparound_test(TRUE, windows[i]) && success;
+	}
+	return success ? 0 : 1;
+}
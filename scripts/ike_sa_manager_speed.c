@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <hydra.h>
+#include <daemon.h>
+#include <threading/thread.h>
+
+static void usage()
+{
+	printf("usage: ike_sa_manager_speed plugins sas rounds segments "
+		   "threads1 [threads2 [...]]\n");
+	exit(1);
+}
+
+/**
+ * IDs of the IKE_SAs checked in to the manager
+ */
+static ike_sa_id_t **ids;
+
+/**
+ * Number of IKE_SAs
+ */
+static int count;
+
+/**
+ * Checkout/checkin cycles per thread
+ */
+static int rounds;
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+static void* run(void *data)
+{
+	u_int seed = (uintptr_t)data;
+	ike_sa_t *ike_sa;
+	int round;
+
+	for (round = 0; round < rounds; round++)
+	{
+		ike_sa = charon->ike_sa_manager->checkout(charon->ike_sa_manager,
+												  ids[rand_r(&seed) % count]);
+		if (ike_sa)
+		{
+			charon->ike_sa_manager->checkin(charon->ike_sa_manager, ike_sa);
+		}
+	}
+	return NULL;
+}
+
+static void run_test(int threads)
+{
+	thread_t *thread[threads];
+	struct timespec timing;
+	int i;
+
+	printf("%3d threads:\t", threads);
+
+	start_timing(&timing);
+	for (i = 0; i < threads; i++)
+	{
+		thread[i] = thread_create(run, (void*)(uintptr_t)(i + 1));
+	}
+	for (i = 0; i < threads; i++)
+	{
+		thread[i]->join(thread[i]);
+	}
+	printf("checkout/checkin/s: %10.1f\n",
+		   threads * rounds / end_timing(&timing));
+}
+
+int main(int argc, char *argv[])
+{
+	ike_sa_t *ike_sa;
+	int i;
+
+	if (argc < 6)
+	{
+		usage();
+	}
+
+	library_init(NULL);
+	atexit(library_deinit);
+	libhydra_init("ike_sa_manager_speed");
+	atexit(libhydra_deinit);
+	libcharon_init("ike_sa_manager_speed");
+	atexit(libcharon_deinit);
+	lib->plugins->load(lib->plugins, NULL, argv[1]);
+
+	count = max(1, atoi(argv[2]));
+	rounds = atoi(argv[3]);
+
+	lib->settings->set_int(lib->settings, "%s.ikesa_table_size", count,
+						   charon->name);
+	lib->settings->set_int(lib->settings, "%s.ikesa_table_segments",
+						   atoi(argv[4]), charon->name);
+	charon->ike_sa_manager = ike_sa_manager_create();
+	if (!charon->ike_sa_manager)
+	{
+		printf("creating IKE_SA manager failed, plugins missing?\n");
+		return 1;
+	}
+
+	ids = calloc(count, sizeof(ike_sa_id_t*));
+	for (i = 0; i < count; i++)
+	{
+		ike_sa = charon->ike_sa_manager->checkout_new(charon->ike_sa_manager,
+													  IKEV2, TRUE);
+		if (!ike_sa)
+		{
+			printf("creating IKE_SA failed\n");
+			return 1;
+		}
+		ids[i] = ike_sa->get_id(ike_sa);
+		ids[i] = ids[i]->clone(ids[i]);
+		charon->ike_sa_manager->checkin(charon->ike_sa_manager, ike_sa);
+	}
+
+	for (i = 5; i < argc; i++)
+	{
+		run_test(max(1, atoi(argv[i])));
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		ids[i]->destroy(ids[i]);
+	}
+	free(ids);
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <hydra.h>
+#include <threading/thread.h>
+
+static void usage()
+{
+	printf("usage: kernel_sa_speed plugins sas batch threads1 [threads2 [...]]\n");
+	exit(1);
+}
+
+/**
+ * Number of CHILD_SAs installed per thread
+ */
+static int count;
+
+/**
+ * Whether to install the SAs and policies of a CHILD_SA in a batch
+ */
+static bool batch;
+
+/**
+ * Addresses of the two peers
+ */
+static host_t *local, *remote;
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+/**
+ * Install or uninstall the SAs and policies of a CHILD_SA, similar to
+ * child_sa_t.install() and add_policies()
+ */
+static bool child_sa(u_int32_t id, bool install)
+{
+	kernel_interface_t *kernel = hydra->kernel_interface;
+	traffic_selector_t *my_ts, *other_ts;
+	u_int32_t spi_in = htonl(0xc0000000 | id), spi_out = htonl(0xd0000000 | id);
+	ipsec_sa_cfg_t sa = {
+		.mode = MODE_TUNNEL,
+		.reqid = id,
+		.esp = {
+			.use = TRUE,
+			.spi = spi_out,
+		},
+	};
+	lifetime_cfg_t lifetime = {
+		.time = {
+			.life = 3600,
+			.rekey = 3000,
+		},
+	};
+	mark_t mark = {};
+	char key[36], addr[20];
+	bool success;
+
+	memset(key, id, sizeof(key));
+	snprintf(addr, sizeof(addr), "10.%u.%u.%u/32", (id >> 16) & 0xff,
+			 (id >> 8) & 0xff, id & 0xff);
+	my_ts = traffic_selector_create_from_cidr("10.255.255.255/32", 0, 0, 65535);
+	other_ts = traffic_selector_create_from_cidr(addr, 0, 0, 65535);
+
+	if (install)
+	{
+		if (batch)
+		{
+			kernel->begin_batch(kernel);
+		}
+		success =
+			kernel->add_sa(kernel, remote, local, spi_in, IPPROTO_ESP, id, mark,
+						   0, &lifetime, ENCR_AES_CBC, chunk_from_thing(key),
+						   AUTH_HMAC_SHA1_96, chunk_create(key, 20),
+						   MODE_TUNNEL, IPCOMP_NONE, 0, FALSE, FALSE, TRUE,
+						   other_ts, my_ts) == SUCCESS &&
+			kernel->add_sa(kernel, local, remote, spi_out, IPPROTO_ESP, id,
+						   mark, 0, &lifetime, ENCR_AES_CBC,
+						   chunk_from_thing(key), AUTH_HMAC_SHA1_96,
+						   chunk_create(key, 20), MODE_TUNNEL, IPCOMP_NONE, 0,
+						   FALSE, FALSE, FALSE, my_ts, other_ts) == SUCCESS &&
+			kernel->add_policy(kernel, local, remote, my_ts, other_ts,
+							   POLICY_OUT, POLICY_IPSEC, &sa, mark,
+							   POLICY_PRIORITY_DEFAULT) == SUCCESS;
+		sa.esp.spi = spi_in;
+		success = success &&
+			kernel->add_policy(kernel, remote, local, other_ts, my_ts,
+							   POLICY_IN, POLICY_IPSEC, &sa, mark,
+							   POLICY_PRIORITY_DEFAULT) == SUCCESS;
+		if (batch)
+		{
+			success = kernel->end_batch(kernel, success) == SUCCESS && success;
+		}
+	}
+	else
+	{
+		success =
+			kernel->del_policy(kernel, my_ts, other_ts, POLICY_OUT, id, mark,
+							   POLICY_PRIORITY_DEFAULT) == SUCCESS &&
+			kernel->del_policy(kernel, other_ts, my_ts, POLICY_IN, id, mark,
+							   POLICY_PRIORITY_DEFAULT) == SUCCESS &&
+			kernel->del_sa(kernel, remote, local, spi_in, IPPROTO_ESP, 0,
+						   mark) == SUCCESS &&
+			kernel->del_sa(kernel, local, remote, spi_out, IPPROTO_ESP, 0,
+						   mark) == SUCCESS;
+	}
+	my_ts->destroy(my_ts);
+	other_ts->destroy(other_ts);
+	return success;
+}
+
+static void* run(void *data)
+{
+	u_int32_t base = (uintptr_t)data;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (!child_sa(base + i, TRUE))
+		{
+			printf("installing CHILD_SA %u failed\n", base + i);
+		}
+	}
+	return NULL;
+}
+
+static void* cleanup(void *data)
+{
+	u_int32_t base = (uintptr_t)data;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		child_sa(base + i, FALSE);
+	}
+	return NULL;
+}
+
+static void run_test(int threads)
+{
+	thread_t *thread[threads];
+	struct timespec timing;
+	int i;
+
+	printf("%3d threads:\t", threads);
+	fflush(stdout);
+
+	start_timing(&timing);
+	for (i = 0; i < threads; i++)
+	{
+		thread[i] = thread_create(run, (void*)(uintptr_t)(1 + i * count));
+	}
+	for (i = 0; i < threads; i++)
+	{
+		thread[i]->join(thread[i]);
+	}
+	printf("CHILD_SA installs/s: %10.1f\n", threads * count /
+		   end_timing(&timing));
+
+	for (i = 0; i < threads; i++)
+	{
+		thread[i] = thread_create(cleanup, (void*)(uintptr_t)(1 + i * count));
+	}
+	for (i = 0; i < threads; i++)
+	{
+		thread[i]->join(thread[i]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	if (argc < 5)
+	{
+		usage();
+	}
+
+	library_init(NULL);
+	atexit(library_deinit);
+	libhydra_init("kernel_sa_speed");
+	atexit(libhydra_deinit);
+	lib->plugins->load(lib->plugins, NULL, argv[1]);
+
+	count = atoi(argv[2]);
+	batch = atoi(argv[3]);
+	local = host_create_from_string("192.0.2.1", 0);
+	remote = host_create_from_string("192.0.2.2", 0);
+
+	for (i = 4; i < argc; i++)
+	{
+		run_test(max(1, atoi(argv[i])));
+	}
+
+	local->destroy(local);
+	remote->destroy(remote);
+	/* unload plugins before libhydra gets deinitialized */
+	lib->plugins->unload(lib->plugins);
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <hydra.h>
+#include <daemon.h>
+#include <threading/thread.h>
+
+static void usage()
+{
+	printf("usage: log_speed calls level threads1 [threads2 [...]]\n");
+	exit(1);
+}
+
+/**
+ * Log calls per thread
+ */
+static int calls;
+
+/**
+ * Level of the registered logger
+ */
+static level_t level;
+
+/**
+ * Number of messages the logger received
+ */
+static refcount_t logged;
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+static void log_(logger_t *this, debug_t group, level_t lvl, int thread,
+				 ike_sa_t *ike_sa, const char *message)
+{
+	ref_get(&logged);
+}
+
+static level_t get_level(logger_t *this, debug_t group)
+{
+	return level;
+}
+
+static void* run(void *data)
+{
+	int i;
+
+	for (i = 0; i < calls; i++)
+	{
+		DBG2(DBG_CFG, "message %d", i);
+	}
+	return NULL;
+}
+
+static void run_test(int threads)
+{
+	thread_t *thread[threads];
+	struct timespec timing;
+	double duration;
+	int i;
+
+	printf("%3d threads:\t", threads);
+	fflush(stdout);
+
+	logged = 0;
+	start_timing(&timing);
+	for (i = 0; i < threads; i++)
+	{
+		thread[i] = thread_create(run, NULL);
+	}
+	for (i = 0; i < threads; i++)
+	{
+		thread[i]->join(thread[i]);
+	}
+	duration = end_timing(&timing);
+	printf("calls/s: %12.1f, ns/call: %6.1f, logged: %u\n",
+		   threads * calls / duration,
+		   duration * 1000000000.0 / calls, logged);
+}
+
+int main(int argc, char *argv[])
+{
+	logger_t logger = {
+		.log = log_,
+		.get_level = get_level,
+	};
+	int i;
+
+	if (argc < 4)
+	{
+		usage();
+	}
+
+	library_init(NULL);
+	atexit(library_deinit);
+	libhydra_init("log_speed");
+	atexit(libhydra_deinit);
+	libcharon_init("log_speed");
+	atexit(libcharon_deinit);
+
+	calls = atoi(argv[1]);
+	level = atoi(argv[2]);
+
+	/* messages are logged with DBG2, so they are suppressed if the level of
+	 * the logger is lower than that */
+	charon->bus->add_logger(charon->bus, &logger);
+
+	for (i = 3; i < argc; i++)
+	{
+		run_test(max(1, atoi(argv[i])));
+	}
+
+	charon->bus->remove_logger(charon->bus, &logger);
+	return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <netinet/ip.h>
+#include <library.h>
+#include <ipsec.h>
+
+static void usage()
+{
+	printf("usage: policy_speed lookups policies1 [policies2 [...]]\n");
+	exit(1);
+}
+
+/**
+ * Number of packets looked up per test
+ */
+static int lookups;
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+/**
+ * Install the outbound policy of a hub to the remote subnet with the given id
+ */
+static void add_policy(ipsec_policy_mgr_t *mgr, host_t *local, host_t *remote,
+					   u_int32_t id)
+{
+	traffic_selector_t *my_ts, *other_ts;
+	ipsec_sa_cfg_t sa = {
+		.mode = MODE_TUNNEL,
+		.reqid = id,
+		.esp = {
+			.use = TRUE,
+		},
+	};
+	mark_t mark = {};
+	char addr[20];
+
+	snprintf(addr, sizeof(addr), "10.%u.%u.0/24", (id >> 8) & 0xff, id & 0xff);
+	my_ts = traffic_selector_create_from_cidr("192.168.0.0/16", 0, 0, 65535);
+	other_ts = traffic_selector_create_from_cidr(addr, 0, 0, 65535);
+	mgr->add_policy(mgr, local, remote, my_ts, other_ts, POLICY_OUT,
+					POLICY_IPSEC, &sa, mark, POLICY_PRIORITY_DEFAULT);
+	my_ts->destroy(my_ts);
+	other_ts->destroy(other_ts);
+}
+
+/**
+ * Create an IPv4 packet to a host in the remote subnet with the given id
+ */
+static ip_packet_t *create_packet(u_int32_t id)
+{
+	struct ip ip = {
+		.ip_v = 4,
+		.ip_hl = sizeof(ip) / 4,
+		.ip_len = htons(sizeof(ip)),
+		.ip_ttl = 64,
+		.ip_p = IPPROTO_UDP,
+		.ip_src.s_addr = htonl(0xc0a80001),
+		.ip_dst.s_addr = htonl(0x0a000001 | (id & 0xffff) << 8),
+	};
+
+	return ip_packet_create(chunk_clone(chunk_from_thing(ip)));
+}
+
+static void run_test(int policies)
+{
+	ipsec_policy_mgr_t *mgr;
+	ipsec_policy_t *policy;
+	ip_packet_t **packets;
+	host_t *local, *remote;
+	struct timespec timing;
+	int i, found = 0;
+
+	printf("%6d policies:\t", policies);
+	fflush(stdout);
+
+	local = host_create_from_string("192.0.2.1", 0);
+	remote = host_create_from_string("192.0.2.2", 0);
+	mgr = ipsec_policy_mgr_create();
+	for (i = 1; i <= policies; i++)
+	{
+		add_policy(mgr, local, remote, i);
+	}
+	packets = malloc(sizeof(ip_packet_t*) * policies);
+	for (i = 0; i < policies; i++)
+	{
+		packets[i] = create_packet(random() % policies + 1);
+	}
+
+	start_timing(&timing);
+	for (i = 0; i < lookups; i++)
+	{
+		policy = mgr->find_by_packet(mgr, packets[i % policies], FALSE);
+		if (policy)
+		{
+			found++;
+			policy->destroy(policy);
+		}
+	}
+	printf("lookups/s: %10.1f", lookups / end_timing(&timing));
+	if (found != lookups)
+	{
+		printf(" (%d without policy)", lookups - found);
+	}
+	printf("\n");
+
+	for (i = 0; i < policies; i++)
+	{
+		packets[i]->destroy(packets[i]);
+	}
+	free(packets);
+	mgr->destroy(mgr);
+	local->destroy(local);
+	remote->destroy(remote);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	if (argc < 3)
+	{
+		usage();
+	}
+
+	library_init(NULL);
+	atexit(library_deinit);
+
+	lookups = atoi(argv[1]);
+	for (i = 2; i < argc; i++)
+	{
+		run_test(max(1, min(atoi(argv[i]), 65535)));
+	}
+	return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <processing/processor.h>
+#include <processing/jobs/callback_job.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+
+static void usage()
+{
+	printf("usage: processor_speed jobs producers queues "
+		   "threads1 [threads2 [...]]\n");
+	exit(1);
+}
+
+/**
+ * Processor under test
+ */
+static processor_t *processor;
+
+/**
+ * Jobs queued by each producer
+ */
+static int jobs;
+
+/**
+ * Jobs not yet executed
+ */
+static refcount_t remaining;
+
+/**
+ * Signals completion of all jobs
+ */
+static mutex_t *mutex;
+static condvar_t *done;
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+static job_requeue_t execute(void *data)
+{
+	if (ref_put(&remaining))
+	{
+		mutex->lock(mutex);
+		done->signal(done);
+		mutex->unlock(mutex);
+	}
+	return JOB_REQUEUE_NONE;
+}
+
+static void* produce(void *data)
+{
+	int i;
+
+	for (i = 0; i < jobs; i++)
+	{
+		processor->queue_job(processor,
+					(job_t*)callback_job_create(execute, NULL, NULL, NULL));
+	}
+	return NULL;
+}
+
+static double run_test(int producers, int queues, int threads)
+{
+	thread_t *thread[producers];
+	struct timespec timing;
+	double rate;
+	int i;
+
+	lib->settings->set_int(lib->settings, "libstrongswan.processor.queues",
+						   queues);
+	processor = processor_create();
+	processor->set_threads(processor, threads);
+	remaining = producers * jobs;
+
+	start_timing(&timing);
+	for (i = 0; i < producers; i++)
+	{
+		thread[i] = thread_create(produce, NULL);
+	}
+	for (i = 0; i < producers; i++)
+	{
+		thread[i]->join(thread[i]);
+	}
+	mutex->lock(mutex);
+	while (remaining)
+	{
+		done->wait(done, mutex);
+	}
+	mutex->unlock(mutex);
+	rate = producers * jobs / end_timing(&timing);
+
+	processor->destroy(processor);
+	return rate;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, producers, queues, threads;
+
+	if (argc < 5)
+	{
+		usage();
+	}
+
+	library_init(NULL);
+	atexit(library_deinit);
+
+	jobs = atoi(argv[1]);
+	producers = max(1, atoi(argv[2]));
+	queues = max(1, atoi(argv[3]));
+
+	mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	done = condvar_create(CONDVAR_TYPE_DEFAULT);
+
+	for (i = 4; i < argc; i++)
+	{
+		threads = max(1, atoi(argv[i]));
+		printf("%3d threads:\t", threads);
+		/* a single queue shared by all threads serves as baseline */
+		printf("jobs/s: 1 queue: %10.1f, ", run_test(producers, 1, threads));
+		printf("%d queues: %10.1f\n", queues,
+			   run_test(producers, queues, threads));
+	}
+
+	done->destroy(done);
+	mutex->destroy(mutex);
+	return 0;
+}
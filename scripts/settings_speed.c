@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <library.h>
+#include <threading/thread.h>
+
+static void usage()
+{
+	printf("usage: settings_speed lookups sections keys threads1 [threads2 [...]]\n");
+	exit(1);
+}
+
+/**
+ * Lookups done by each thread
+ */
+static int lookups;
+
+/**
+ * Number of sections and keys per section
+ */
+static int sections, keys;
+
+static void start_timing(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static double end_timing(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_nsec - start->tv_nsec) / 1000000000.0 +
+			(end.tv_sec - start->tv_sec) * 1.0;
+}
+
+static void* run(void *data)
+{
+	u_int seed = (uintptr_t)data;
+	int i, section, key;
+
+	for (i = 0; i < lookups; i++)
+	{
+		section = rand_r(&seed) % sections;
+		key = rand_r(&seed) % keys;
+		if (lib->settings->get_int(lib->settings,
+					"settings_speed.plugins.section%d.key%d", -1,
+					section, key) != section * keys + key)
+		{
+			printf("lookup of section%d.key%d failed\n", section, key);
+		}
+	}
+	return NULL;
+}
+
+static void run_test(int threads)
+{
+	thread_t *thread[threads];
+	struct timespec timing;
+	int i;
+
+	printf("%3d threads:\t", threads);
+	fflush(stdout);
+
+	start_timing(&timing);
+	for (i = 0; i < threads; i++)
+	{
+		thread[i] = thread_create(run, (void*)(uintptr_t)(i + 1));
+	}
+	for (i = 0; i < threads; i++)
+	{
+		thread[i]->join(thread[i]);
+	}
+	printf("lookups/s: %12.1f\n", threads * lookups / end_timing(&timing));
+}
+
+int main(int argc, char *argv[])
+{
+	int i, j;
+
+	if (argc < 5)
+	{
+		usage();
+	}
+
+	library_init(NULL);
+	atexit(library_deinit);
+
+	lookups = atoi(argv[1]);
+	sections = max(1, atoi(argv[2]));
+	keys = max(1, atoi(argv[3]));
+
+	for (i = 0; i < sections; i++)
+	{
+		for (j = 0; j < keys; j++)
+		{
+			lib->settings->set_int(lib->settings,
+						"settings_speed.plugins.section%d.key%d", i * keys + j,
+						i, j);
+		}
+	}
+
+	for (i = 4; i < argc; i++)
+	{
+		run_test(max(1, atoi(argv[i])));
+	}
+	return 0;
+}
@@ -528,7 +528,7 @@ JNI_METHOD(CharonVpnService, initializeCharon, void,
 		return;
 	}
 
-	if (!libipsec_init())
+	if (!libipsec_init(0))
 	{
 		libipsec_deinit();
 		libhydra_deinit();
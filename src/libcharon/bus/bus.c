@@ -57,6 +57,13 @@ struct private_bus_t {
 	 */
 	level_t max_vlevel[DBG_MAX + 1];
 
+	/**
+	 * Maximum of max_level and max_vlevel for each log group.  This is read
+	 * without holding log_lock, so messages no logger is interested in are
+	 * dropped without any locking.
+	 */
+	level_t log_level[DBG_MAX + 1];
+
 	/**
 	 * Mutex for the list of listeners, recursively.
 	 */
@@ -146,6 +153,18 @@ METHOD(bus_t, remove_listener, void,
 	this->mutex->unlock(this->mutex);
 }
 
+/**
+ * Update the unlocked maximum log level of a group, after the maximum levels
+ * got changed while holding the write lock
+ */
+static inline void update_log_level(private_bus_t *this, debug_t group)
+{
+	this->log_level[group] = max(this->max_level[group],
+								 this->max_vlevel[group]);
+	/* make the new level visible to threads not taking log_lock */
+	memory_barrier();
+}
+
 /**
  * Register a logger on the given log group according to the requested level
  */
@@ -179,6 +198,7 @@ static inline void register_logger(private_bus_t *this, debug_t group,
 	{
 		this->max_vlevel[group] = max(this->max_vlevel[group], level);
 	}
+	update_log_level(this, group);
 }
 
 /**
@@ -216,11 +236,23 @@ static inline void unregister_logger(private_bus_t *this, logger_t *logger)
 
 				this->max_level[group] = LEVEL_SILENT;
 				this->max_vlevel[group] = LEVEL_SILENT;
-				if (loggers->get_first(loggers, (void**)&entry) == SUCCESS)
-				{
-					this->max_level[group] = entry->levels[group];
-					this->max_vlevel[group] = entry->levels[group];
+				enumerator = loggers->create_enumerator(loggers);
+				while (enumerator->enumerate(enumerator, &entry))
+				{	/* ordered by descending level, so the first of each
+					 * kind defines the maximum */
+					if (entry->logger->log &&
+						this->max_level[group] == LEVEL_SILENT)
+					{
+						this->max_level[group] = entry->levels[group];
+					}
+					if (entry->logger->vlog &&
+						this->max_vlevel[group] == LEVEL_SILENT)
+					{
+						this->max_vlevel[group] = entry->levels[group];
+					}
 				}
+				enumerator->destroy(enumerator);
+				update_log_level(this, group);
 			}
 		}
 		free(found);
@@ -324,6 +356,12 @@ METHOD(bus_t, vlog, void,
 	linked_list_t *loggers;
 	log_data_t data;
 
+	if (this->log_level[group] < level)
+	{	/* no logger is interested in this message, which is the common case
+		 * for the many debug messages, so avoid taking the lock */
+		return;
+	}
+
 	this->log_lock->read_lock(this->log_lock);
 	loggers = this->loggers[group];
 
@@ -895,6 +933,7 @@ bus_t *bus_create()
 		this->loggers[group] = linked_list_create();
 		this->max_level[group] = LEVEL_SILENT;
 		this->max_vlevel[group] = LEVEL_SILENT;
+		this->log_level[group] = LEVEL_SILENT;
 	}
 
 	return &this->public;
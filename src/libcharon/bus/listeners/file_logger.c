@@ -20,14 +20,44 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "file_logger.h"
 
 #include <daemon.h>
 #include <threading/mutex.h>
 #include <threading/rwlock.h>
+#include <threading/condvar.h>
+#include <threading/thread.h>
+
+/**
+ * Maximum number of log messages written with a single writev() call
+ */
+#define WRITE_BATCH_SIZE 64
 
 typedef struct private_file_logger_t private_file_logger_t;
+typedef struct log_entry_t log_entry_t;
+
+/**
+ * A formatted log message
+ */
+struct log_entry_t {
+
+	/**
+	 * Next queued message, in async mode
+	 */
+	log_entry_t *next;
+
+	/**
+	 * Length of the text
+	 */
+	size_t len;
+
+	/**
+	 * Text of the message, each line prefixed and terminated by a newline
+	 */
+	char text[];
+};
 
 /**
  * Private data of a file_logger_t object
@@ -65,7 +95,8 @@ struct private_file_logger_t {
 	bool ike_name;
 
 	/**
-	 * Mutex to ensure multi-line log messages are not torn apart
+	 * Mutex to ensure log messages are not torn apart, held by the writer
+	 * while writing a batch
 	 */
 	mutex_t *mutex;
 
@@ -73,23 +104,84 @@ struct private_file_logger_t {
 	 * Lock to read/write options (FD, levels, time_format, etc.)
 	 */
 	rwlock_t *lock;
+
+	/**
+	 * Writer thread in async mode, NULL if messages are written directly
+	 */
+	thread_t *writer;
+
+	/**
+	 * Messages queued for the writer, the most recent first.  Loggers push
+	 * messages with cas_ptr(), the writer takes the whole list in one go.
+	 */
+	log_entry_t *queue;
+
+	/**
+	 * Number of messages currently queued
+	 */
+	refcount_t queued;
+
+	/**
+	 * Maximum number of queued messages
+	 */
+	u_int max_queued;
+
+	/**
+	 * TRUE to block loggers while the queue is full, FALSE to drop messages
+	 */
+	bool block;
+
+	/**
+	 * Number of messages dropped because the queue was full
+	 */
+	refcount_t dropped;
+
+	/**
+	 * Number of dropped messages already reported in the log
+	 */
+	u_int reported;
+
+	/**
+	 * TRUE while the writer waits for messages
+	 */
+	bool sleeping;
+
+	/**
+	 * TRUE if the writer should terminate once the queue is empty
+	 */
+	bool stopping;
+
+	/**
+	 * Mutex used to wait for the writer or loggers
+	 */
+	mutex_t *queue_mutex;
+
+	/**
+	 * Signals the writer that messages are queued
+	 */
+	condvar_t *queued_cond;
+
+	/**
+	 * Signals blocked loggers that the queue has space again
+	 */
+	condvar_t *space_cond;
 };
 
-METHOD(logger_t, log_, void,
-	private_file_logger_t *this, debug_t group, level_t level, int thread,
-	ike_sa_t* ike_sa, const char *message)
+/**
+ * Format a log message, the timestamp is captured when this is called
+ */
+static log_entry_t *format_entry(private_file_logger_t *this, debug_t group,
+								 int thread, ike_sa_t *ike_sa,
+								 const char *message)
 {
-	char timestr[128], namestr[128] = "";
+	char timestr[128], namestr[128] = "", prefix[384];
 	const char *current = message, *next;
+	log_entry_t *entry;
+	size_t plen, len, lines = 1;
 	struct tm tm;
 	time_t t;
+	char *pos;
 
-	this->lock->read_lock(this->lock);
-	if (!this->out)
-	{	/* file is not open */
-		this->lock->unlock(this->lock);
-		return;
-	}
 	if (this->time_format)
 	{
 		t = time(NULL);
@@ -109,35 +201,263 @@ METHOD(logger_t, log_, void,
 				ike_sa->get_unique_id(ike_sa));
 		}
 	}
+	if (this->time_format)
+	{
+		plen = snprintf(prefix, sizeof(prefix), "%s %.2d[%N]%s ",
+						timestr, thread, debug_names, group, namestr);
+	}
 	else
 	{
-		namestr[0] = '\0';
+		plen = snprintf(prefix, sizeof(prefix), "%.2d[%N]%s ",
+						thread, debug_names, group, namestr);
 	}
+	plen = min(plen, sizeof(prefix) - 1);
+
+	len = strlen(message);
+	for (next = strchr(message, '\n'); next; next = strchr(next + 1, '\n'))
+	{
+		lines++;
+	}
+	entry = malloc(sizeof(log_entry_t) + lines * plen + len + 1);
+	entry->len = lines * plen + len + 1;
+	entry->next = NULL;
 
 	/* prepend a prefix in front of every line */
-	this->mutex->lock(this->mutex);
+	pos = entry->text;
 	while (TRUE)
 	{
 		next = strchr(current, '\n');
-		if (this->time_format)
+		memcpy(pos, prefix, plen);
+		pos += plen;
+		len = next ? next - current : strlen(current);
+		memcpy(pos, current, len);
+		pos += len;
+		*pos++ = '\n';
+		if (next == NULL)
 		{
-			fprintf(this->out, "%s %.2d[%N]%s ",
-					timestr, thread, debug_names, group, namestr);
+			break;
 		}
-		else
+		current = next + 1;
+	}
+	return entry;
+}
+
+/**
+ * Queue a message for the writer thread
+ */
+static void enqueue(private_file_logger_t *this, log_entry_t *entry)
+{
+	if (this->queued >= this->max_queued)
+	{
+		if (!this->block)
 		{
-			fprintf(this->out, "%.2d[%N]%s ",
-					thread, debug_names, group, namestr);
+			ref_get(&this->dropped);
+			free(entry);
+			return;
 		}
-		if (next == NULL)
+		this->queue_mutex->lock(this->queue_mutex);
+		while (this->queued >= this->max_queued && !this->stopping)
+		{	/* the timeout covers a missed signal from the writer */
+			this->space_cond->timed_wait(this->space_cond, this->queue_mutex,
+										 100);
+		}
+		this->queue_mutex->unlock(this->queue_mutex);
+	}
+	ref_get(&this->queued);
+	do
+	{
+		entry->next = this->queue;
+	}
+	while (!cas_ptr((void**)&this->queue, entry->next, entry));
+
+	if (this->sleeping)
+	{
+		this->queue_mutex->lock(this->queue_mutex);
+		this->queued_cond->signal(this->queued_cond);
+		this->queue_mutex->unlock(this->queue_mutex);
+	}
+}
+
+/**
+ * Write all data in the given iovecs, even if writev() writes partially
+ */
+static void write_all(int fd, struct iovec *iov, int count)
+{
+	ssize_t len;
+
+	while (count)
+	{
+		len = writev(fd, iov, count);
+		if (len < 0)
 		{
-			fprintf(this->out, "%s\n", current);
-			break;
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			/* can't do much about it, and we must not log ourselves */
+			return;
+		}
+		while (count && len >= iov->iov_len)
+		{
+			len -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count)
+		{
+			iov->iov_base += len;
+			iov->iov_len -= len;
+		}
+	}
+}
+
+/**
+ * Write a list of queued messages in batches, in the order they were queued
+ */
+static void write_entries(private_file_logger_t *this, log_entry_t *list)
+{
+	struct iovec iov[WRITE_BATCH_SIZE];
+	log_entry_t *entry, *batch[WRITE_BATCH_SIZE], *ordered = NULL;
+	char notice[64];
+	u_int dropped;
+	int count = 0, i;
+
+	while (list)
+	{	/* the most recent message is the first in the list */
+		entry = list;
+		list = entry->next;
+		entry->next = ordered;
+		ordered = entry;
+	}
+
+	this->mutex->lock(this->mutex);
+	dropped = this->dropped;
+	if (dropped != this->reported && this->out)
+	{
+		iov[0].iov_base = notice;
+		iov[0].iov_len = snprintf(notice, sizeof(notice),
+								  "%u log messages dropped\n",
+								  dropped - this->reported);
+		write_all(fileno(this->out), iov, 1);
+		this->reported = dropped;
+	}
+	while (ordered)
+	{
+		entry = ordered;
+		ordered = entry->next;
+		iov[count].iov_base = entry->text;
+		iov[count].iov_len = entry->len;
+		batch[count++] = entry;
+
+		if (count == WRITE_BATCH_SIZE || !ordered)
+		{
+			if (this->out)
+			{
+				write_all(fileno(this->out), iov, count);
+			}
+			for (i = 0; i < count; i++)
+			{
+				free(batch[i]);
+				ignore_result(ref_put(&this->queued));
+			}
+			count = 0;
 		}
-		fprintf(this->out, "%.*s\n", (int)(next - current), current);
-		current = next + 1;
 	}
 	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Writer thread in async mode, writes queued messages until stopped
+ */
+static void *write_queued(private_file_logger_t *this)
+{
+	log_entry_t *list;
+
+	while (TRUE)
+	{
+		do
+		{
+			list = this->queue;
+		}
+		while (!cas_ptr((void**)&this->queue, list, NULL));
+
+		if (list)
+		{
+			write_entries(this, list);
+			if (this->block)
+			{
+				this->queue_mutex->lock(this->queue_mutex);
+				this->space_cond->broadcast(this->space_cond);
+				this->queue_mutex->unlock(this->queue_mutex);
+			}
+			continue;
+		}
+
+		this->queue_mutex->lock(this->queue_mutex);
+		if (this->stopping)
+		{
+			this->queue_mutex->unlock(this->queue_mutex);
+			/* report messages dropped after the last batch */
+			write_entries(this, NULL);
+			break;
+		}
+		/* the barrier of cas_bool() makes sure loggers either see that we
+		 * are sleeping or we see their message */
+		cas_bool(&this->sleeping, FALSE, TRUE);
+		if (!this->queue)
+		{
+			this->queued_cond->wait(this->queued_cond, this->queue_mutex);
+		}
+		this->sleeping = FALSE;
+		this->queue_mutex->unlock(this->queue_mutex);
+	}
+	return NULL;
+}
+
+/**
+ * Stop the writer thread after it wrote all queued messages, if any.
+ * Must be called with the write lock held.
+ */
+static void stop_writer(private_file_logger_t *this)
+{
+	if (this->writer)
+	{
+		this->queue_mutex->lock(this->queue_mutex);
+		this->stopping = TRUE;
+		this->queued_cond->signal(this->queued_cond);
+		this->space_cond->broadcast(this->space_cond);
+		this->queue_mutex->unlock(this->queue_mutex);
+
+		this->writer->join(this->writer);
+		this->writer = NULL;
+		this->stopping = FALSE;
+	}
+}
+
+METHOD(logger_t, log_, void,
+	private_file_logger_t *this, debug_t group, level_t level, int thread,
+	ike_sa_t* ike_sa, const char *message)
+{
+	log_entry_t *entry;
+
+	this->lock->read_lock(this->lock);
+	if (!this->out)
+	{	/* file is not open */
+		this->lock->unlock(this->lock);
+		return;
+	}
+	entry = format_entry(this, group, thread, ike_sa, message);
+	if (this->writer)
+	{
+		enqueue(this, entry);
+	}
+	else
+	{
+		this->mutex->lock(this->mutex);
+		ignore_result(fwrite(entry->text, 1, entry->len, this->out));
+		this->mutex->unlock(this->mutex);
+		free(entry);
+	}
 	this->lock->unlock(this->lock);
 }
 
@@ -180,6 +500,30 @@ METHOD(file_logger_t, set_options, void,
 	this->lock->unlock(this->lock);
 }
 
+METHOD(file_logger_t, set_async, void,
+	private_file_logger_t *this, u_int max_queued, bool block)
+{
+	this->lock->write_lock(this->lock);
+	if (max_queued)
+	{
+		this->max_queued = max_queued;
+		this->block = block;
+		if (!this->writer)
+		{
+			if (this->out)
+			{	/* the writer bypasses the stdio buffer */
+				fflush(this->out);
+			}
+			this->writer = thread_create((thread_main_t)write_queued, this);
+		}
+	}
+	else
+	{
+		stop_writer(this);
+	}
+	this->lock->unlock(this->lock);
+}
+
 /**
  * Close the current file, if any
  */
@@ -220,8 +564,10 @@ METHOD(file_logger_t, open_, void,
 		}
 	}
 	this->lock->write_lock(this->lock);
+	this->mutex->lock(this->mutex);
 	close_file(this);
 	this->out = file;
+	this->mutex->unlock(this->mutex);
 	this->lock->unlock(this->lock);
 }
 
@@ -229,8 +575,12 @@ METHOD(file_logger_t, destroy, void,
 	private_file_logger_t *this)
 {
 	this->lock->write_lock(this->lock);
+	stop_writer(this);
 	close_file(this);
 	this->lock->unlock(this->lock);
+	this->queued_cond->destroy(this->queued_cond);
+	this->space_cond->destroy(this->space_cond);
+	this->queue_mutex->destroy(this->queue_mutex);
 	this->mutex->destroy(this->mutex);
 	this->lock->destroy(this->lock);
 	free(this->time_format);
@@ -253,12 +603,16 @@ file_logger_t *file_logger_create(char *filename)
 			},
 			.set_level = _set_level,
 			.set_options = _set_options,
+			.set_async = _set_async,
 			.open = _open_,
 			.destroy = _destroy,
 		},
 		.filename = strdup(filename),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
+		.queue_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.queued_cond = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.space_cond = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
 
 	set_level(this, DBG_ANY, LEVEL_SILENT);
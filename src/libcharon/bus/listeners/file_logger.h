@@ -52,6 +52,19 @@ struct file_logger_t {
 	 */
 	void (*set_options) (file_logger_t *this, char *time_format, bool ike_name);
 
+	/**
+	 * Write log messages asynchronously from a background thread.
+	 *
+	 * Messages are formatted (and timestamped) by the logging thread and
+	 * queued for the writer thread, which writes them in batches.
+	 *
+	 * @param max_queued	maximum number of queued messages, 0 to write
+	 *						messages directly from the logging thread
+	 * @param block			TRUE to block logging threads while the queue is
+	 *						full, FALSE to drop (and count) messages instead
+	 */
+	void (*set_async) (file_logger_t *this, u_int max_queued, bool block);
+
 	/**
 	 * Open (or reopen) the log file according to the given parameters
 	 *
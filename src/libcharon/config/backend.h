@@ -44,7 +44,10 @@ struct backend_t {
 	 *
 	 * There is no requirement for the backend to filter the configurations
 	 * using the supplied hosts; but it may do so if it increases lookup times
-	 * (e.g. include hosts in SQL query).
+	 * (e.g. include hosts in SQL query, or an index by address).
+	 * A filtering backend must still return configs with addresses matching
+	 * any host (%any, hostnames), in the order it would return them otherwise,
+	 * as the backend manager prefers earlier configs if matches are equal.
 	 *
 	 * @param me		address of local host
 	 * @param other		address of remote host
@@ -62,7 +65,11 @@ struct backend_t {
 	 * the identities to the first auth_cfgs only.
 	 * There is no requirement for the backend to filter the configurations
 	 * using the supplied identities; but it may do so if it increases lookup
-	 * times (e.g. include hosts in SQL query).
+	 * times (e.g. include hosts in SQL query, or an index by identity).
+	 * A filtering backend must still return configs with identities matching
+	 * other identities (%any, wildcards), in the order it would return them
+	 * otherwise, as the backend manager prefers earlier configs if matches are
+	 * equal.
 	 *
 	 * @param me		identity of ourself
 	 * @param other		identity of remote host
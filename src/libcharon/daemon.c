@@ -318,8 +318,9 @@ static void load_file_logger(private_daemon_t *this, char *filename,
 	file_logger_t *file_logger;
 	debug_t group;
 	level_t def;
-	bool ike_name, flush_line, append;
+	bool ike_name, flush_line, append, async_block;
 	char *time_format;
+	u_int async_queue = 0;
 
 	time_format = lib->settings->get_str(lib->settings,
 					"%s.filelog.%s.time_format", NULL, charon->name, filename);
@@ -329,10 +330,19 @@ static void load_file_logger(private_daemon_t *this, char *filename,
 					"%s.filelog.%s.flush_line", FALSE, charon->name, filename);
 	append = lib->settings->get_bool(lib->settings,
 					"%s.filelog.%s.append", TRUE, charon->name, filename);
+	if (lib->settings->get_bool(lib->settings,
+					"%s.filelog.%s.async", FALSE, charon->name, filename))
+	{
+		async_queue = lib->settings->get_int(lib->settings,
+					"%s.filelog.%s.async_queue", 4096, charon->name, filename);
+	}
+	async_block = lib->settings->get_bool(lib->settings,
+					"%s.filelog.%s.async_block", FALSE, charon->name, filename);
 
 	file_logger = add_file_logger(this, filename, current_loggers);
 	file_logger->set_options(file_logger, time_format, ike_name);
 	file_logger->open(file_logger, flush_line, append);
+	file_logger->set_async(file_logger, async_queue, async_block);
 
 	def = lib->settings->get_int(lib->settings, "%s.filelog.%s.default", 1,
 								 charon->name, filename);
@@ -434,6 +444,8 @@ METHOD(daemon_t, set_level, void,
  */
 static void destroy(private_daemon_t *this)
 {
+	dh_pool_t *pool;
+
 	/* terminate all idle threads */
 	lib->processor->set_threads(lib->processor, 0);
 	/* make sure nobody waits for a DNS query */
@@ -454,6 +466,14 @@ static void destroy(private_daemon_t *this)
 
 	/* cancel all threads and wait for their termination */
 	lib->processor->cancel(lib->processor);
+	/* stop offloaded DH computations, the flushed IKE_SA manager does not hold
+	 * any pooled DH objects anymore, but keypairs in the pool are owned by
+	 * plugins */
+	pool = this->public.dh_pool;
+	this->public.dh_pool = NULL;
+	DESTROY_IF(this->public.dh_offload);
+	this->public.dh_offload = NULL;
+	DESTROY_IF(pool);
 
 #ifdef ME
 	DESTROY_IF(this->public.connect_manager);
@@ -546,6 +566,8 @@ METHOD(daemon_t, initialize, bool,
 	{
 		return FALSE;
 	}
+	this->public.dh_offload = dh_offload_create();
+	this->public.dh_pool = dh_pool_create();
 
 	/* Queue start_action job */
 	lib->processor->queue_job(lib->processor, (job_t*)start_action_job_create());
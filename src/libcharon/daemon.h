@@ -160,6 +160,9 @@ typedef struct daemon_t daemon_t;
 #include <sa/ike_sa_manager.h>
 #include <sa/trap_manager.h>
 #include <sa/shunt_manager.h>
+#include <sa/dh_offload.h>
+#include <sa/dh_pool.h>
+#include <kernel/kernel_stats.h>
 #include <config/backend_manager.h>
 #include <sa/eap/eap_manager.h>
 #include <sa/xauth/xauth_manager.h>
@@ -225,6 +228,21 @@ struct daemon_t {
 	 */
 	shunt_manager_t *shunts;
 
+	/**
+	 * Thread pool computing DH exchanges of responders, NULL if disabled
+	 */
+	dh_offload_t *dh_offload;
+
+	/**
+	 * Pool of pre-generated DH keypairs, NULL if disabled
+	 */
+	dh_pool_t *dh_pool;
+
+	/**
+	 * Counters of a userspace IPsec backend, NULL if none registered
+	 */
+	kernel_stats_t *kernel_stats;
+
 	/**
 	 * Manager for the different configuration backends.
 	 */
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup kernel_stats kernel_stats
+ * @{ @ingroup ckernel
+ */
+
+#ifndef KERNEL_STATS_H_
+#define KERNEL_STATS_H_
+
+typedef struct kernel_stats_t kernel_stats_t;
+typedef struct kernel_worker_stats_t kernel_worker_stats_t;
+
+#include <library.h>
+
+/**
+ * Throughput counters of a worker processing ESP packets.
+ */
+struct kernel_worker_stats_t {
+
+	/**
+	 * Number of decrypted inbound ESP packets
+	 */
+	u_int64_t packets_in;
+
+	/**
+	 * Number of bytes of decrypted inbound ESP packets
+	 */
+	u_int64_t bytes_in;
+
+	/**
+	 * Number of encrypted outbound IP packets
+	 */
+	u_int64_t packets_out;
+
+	/**
+	 * Number of bytes of encrypted outbound IP packets (plaintext)
+	 */
+	u_int64_t bytes_out;
+
+	/**
+	 * Number of packets dropped by this worker
+	 */
+	u_int64_t dropped;
+};
+
+/**
+ * Counters of an IPsec backend processing ESP packets in userspace.
+ *
+ * Such a backend registers an implementation in charon->kernel_stats, so
+ * frontends can report them without knowing the backend.
+ */
+struct kernel_stats_t {
+
+	/**
+	 * Get the throughput counters of a worker.
+	 *
+	 * @param worker		index of the worker, starting at 0
+	 * @param stats			receives the counters of the worker
+	 * @return				TRUE if worker found
+	 */
+	bool (*get_worker_stats)(kernel_stats_t *this, u_int worker,
+							 kernel_worker_stats_t *stats);
+};
+
+#endif /** KERNEL_STATS_H_ @}*/
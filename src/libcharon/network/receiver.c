@@ -44,6 +44,28 @@
 #define SECRET_LENGTH 16
 /** Length of a notify payload header */
 #define NOTIFY_PAYLOAD_HEADER_LENGTH 8
+/** response flag in the IKE header */
+#define IKE_HEADER_RESPONSE 0x20
+/** number of rows of token buckets to limit the IKE_SA_INIT rate */
+#define RATE_ROWS 4
+/** default number of token buckets per row */
+#define RATE_BUCKETS_DEFAULT 4096
+/** default prefix length to group IPv4 sources */
+#define RATE_PREFIX4_DEFAULT 32
+/** default prefix length to group IPv6 sources */
+#define RATE_PREFIX6_DEFAULT 64
+/** number of mutexes the token buckets are striped over */
+#define RATE_LOCKS 64
+
+/**
+ * Token bucket to limit the IKE_SA_INIT rate
+ */
+typedef struct {
+	/** tokens used, in 1/1000 tokens */
+	u_int32_t used;
+	/** time of last update, in ms */
+	u_int32_t updated;
+} bucket_t;
 
 typedef struct private_receiver_t private_receiver_t;
 
@@ -69,6 +91,11 @@ struct private_receiver_t {
 	 */
 	mutex_t *esp_cb_mutex;
 
+	/**
+	 * Mutex for cookie state, as multiple threads might receive packets
+	 */
+	mutex_t *cookie_mutex;
+
 	/**
 	 * current secret to use for cookie calculation
 	 */
@@ -154,6 +181,50 @@ struct private_receiver_t {
 	 */
 	bool initiator_only;
 
+	/**
+	 * Token buckets, RATE_ROWS rows of rate_buckets each, NULL if disabled
+	 */
+	bucket_t *buckets;
+
+	/**
+	 * Number of token buckets per row
+	 */
+	u_int rate_buckets;
+
+	/**
+	 * Random seeds to hash source prefixes to buckets, one per row
+	 */
+	u_int32_t rate_seeds[RATE_ROWS];
+
+	/**
+	 * Tokens added to each bucket per second
+	 */
+	u_int rate_limit;
+
+	/**
+	 * Maximum number of tokens per bucket
+	 */
+	u_int rate_burst;
+
+	/**
+	 * Prefix length to group IPv4 sources
+	 */
+	u_int rate_prefix4;
+
+	/**
+	 * Prefix length to group IPv6 sources
+	 */
+	u_int rate_prefix6;
+
+	/**
+	 * Mutexes for token buckets, bucket n is protected by n % RATE_LOCKS
+	 */
+	mutex_t *rate_locks[RATE_LOCKS];
+
+	/**
+	 * Number of dropped requests initiating an IKE_SA, per receiver_drop_t
+	 */
+	refcount_t dropped[RECEIVER_DROP_MAX];
 };
 
 /**
@@ -322,29 +393,27 @@ static bool cookie_required(private_receiver_t *this,
 }
 
 /**
- * Check if we should drop IKE_SA_INIT because of cookie/overload checking
+ * Check if a cookie is required but the message does not contain a valid one,
+ * a COOKIE notify is sent back in this case
  */
-static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
+static bool drop_without_cookie(private_receiver_t *this, message_t *message,
+								u_int half_open, u_int32_t now)
 {
-	u_int half_open;
-	u_int32_t now;
+	chunk_t cookie;
+	bool drop = FALSE;
 
-	now = time_monotonic(NULL);
-	half_open = charon->ike_sa_manager->get_half_open_count(
-										charon->ike_sa_manager, NULL);
-
-	/* check for cookies in IKEv2 */
-	if (message->get_major_version(message) == IKEV2_MAJOR_VERSION &&
-		cookie_required(this, half_open, now) && !check_cookie(this, message))
+	/* the cookie state is shared between all receiver threads */
+	this->cookie_mutex->lock(this->cookie_mutex);
+	if (cookie_required(this, half_open, now) && !check_cookie(this, message))
 	{
-		chunk_t cookie;
-
+		drop = TRUE;
 		DBG2(DBG_NET, "received packet from: %#H to %#H",
 			 message->get_source(message),
 			 message->get_destination(message));
 		if (!cookie_build(this, message, now - this->secret_offset,
 						  chunk_from_thing(this->secret), &cookie))
 		{
+			this->cookie_mutex->unlock(this->cookie_mutex);
 			return TRUE;
 		}
 		DBG2(DBG_NET, "sending COOKIE notify to %H",
@@ -370,6 +439,28 @@ static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 				DBG1(DBG_NET, "failed to allocated cookie secret, keeping old");
 			}
 		}
+	}
+	this->cookie_mutex->unlock(this->cookie_mutex);
+	return drop;
+}
+
+/**
+ * Check if we should drop IKE_SA_INIT because of cookie/overload checking
+ */
+static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
+{
+	u_int half_open;
+	u_int32_t now;
+
+	now = time_monotonic(NULL);
+	half_open = charon->ike_sa_manager->get_half_open_count(
+										charon->ike_sa_manager, NULL);
+
+	/* check for cookies in IKEv2 */
+	if (message->get_major_version(message) == IKEV2_MAJOR_VERSION &&
+		drop_without_cookie(this, message, half_open, now))
+	{
+		ref_get(&this->dropped[RECEIVER_DROP_COOKIE]);
 		return TRUE;
 	}
 
@@ -380,6 +471,7 @@ static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 	{
 		DBG1(DBG_NET, "ignoring IKE_SA setup from %H, "
 			 "peer too aggressive", message->get_source(message));
+		ref_get(&this->dropped[RECEIVER_DROP_BLOCK]);
 		return TRUE;
 	}
 
@@ -390,6 +482,7 @@ static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 		DBG1(DBG_NET, "ignoring IKE_SA setup from %H, half open IKE_SA "
 			 "count of %d exceeds limit of %d", message->get_source(message),
 			 half_open, this->init_limit_half_open);
+		ref_get(&this->dropped[RECEIVER_DROP_HALF_OPEN]);
 		return TRUE;
 	}
 
@@ -407,12 +500,130 @@ static bool drop_ike_sa_init(private_receiver_t *this, message_t *message)
 			DBG1(DBG_NET, "ignoring IKE_SA setup from %H, job load of %d "
 				 "exceeds limit of %d", message->get_source(message),
 				 jobs, this->init_limit_job_load);
+			ref_get(&this->dropped[RECEIVER_DROP_JOB_LOAD]);
 			return TRUE;
 		}
 	}
 	return FALSE;
 }
 
+/**
+ * Check if a raw IKE packet is a request initiating an IKE_SA
+ */
+static bool is_ike_sa_init(chunk_t data)
+{
+	u_int64_t spi;
+
+	if (data.len < IKE_HEADER_LENGTH)
+	{
+		return FALSE;
+	}
+	/* the responder SPI is still zero */
+	memcpy(&spi, data.ptr + 8, sizeof(spi));
+	if (spi)
+	{
+		return FALSE;
+	}
+	switch (data.ptr[18])
+	{
+		case IKE_SA_INIT:
+			/* ignore responses with COOKIE or INVALID_KE_PAYLOAD notifies */
+			return !(data.ptr[19] & IKE_HEADER_RESPONSE);
+		case ID_PROT:
+		case AGGRESSIVE:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Compare two stripe indices, for qsort()
+ */
+static int lock_cmp(const void *a, const void *b)
+{
+	return *(u_int*)a - *(u_int*)b;
+}
+
+/**
+ * Consume a token of the buckets of the source prefix, returns FALSE if the
+ * prefix exceeded its rate
+ */
+static bool rate_accept(private_receiver_t *this, host_t *src)
+{
+	bucket_t *bucket[RATE_ROWS];
+	u_int index[RATE_ROWS], lock[RATE_ROWS];
+	timeval_t tv;
+	chunk_t prefix;
+	u_int32_t now, used, elapsed, min_used = ~0;
+	u_int i, bits;
+	bool accept;
+
+	prefix = chunk_clonea(src->get_address(src));
+	bits = prefix.len == 4 ? this->rate_prefix4 : this->rate_prefix6;
+	for (i = 0; i < prefix.len; i++)
+	{
+		if (bits < 8 * (i + 1))
+		{
+			prefix.ptr[i] &= bits > 8 * i ? 0xFF << (8 * (i + 1) - bits) : 0;
+		}
+	}
+	time_monotonic(&tv);
+	now = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+	for (i = 0; i < RATE_ROWS; i++)
+	{
+		index[i] = i * this->rate_buckets +
+				   chunk_hash_inc(prefix, this->rate_seeds[i]) %
+													this->rate_buckets;
+		lock[i] = index[i] % RATE_LOCKS;
+	}
+	/* lock the stripes of all rows in ascending order to avoid deadlocks */
+	qsort(lock, RATE_ROWS, sizeof(lock[0]), lock_cmp);
+	for (i = 0; i < RATE_ROWS; i++)
+	{
+		if (i == 0 || lock[i] != lock[i - 1])
+		{
+			this->rate_locks[lock[i]]->lock(this->rate_locks[lock[i]]);
+		}
+	}
+	for (i = 0; i < RATE_ROWS; i++)
+	{
+		bucket[i] = &this->buckets[index[i]];
+		/* a bucket regains rate_limit tokens per second, i.e. rate_limit
+		 * thousandths per ms */
+		elapsed = now - bucket[i]->updated;
+		used = bucket[i]->used;
+		if ((u_int64_t)elapsed * this->rate_limit >= used)
+		{
+			used = 0;
+		}
+		else
+		{
+			used -= elapsed * this->rate_limit;
+		}
+		bucket[i]->used = used;
+		bucket[i]->updated = now;
+		min_used = min(min_used, used);
+	}
+	accept = min_used + 1000 <= this->rate_burst * 1000;
+	if (accept)
+	{
+		for (i = 0; i < RATE_ROWS; i++)
+		{
+			bucket[i]->used += 1000;
+		}
+	}
+	for (i = 0; i < RATE_ROWS; i++)
+	{
+		if (i == 0 || lock[i] != lock[i - 1])
+		{
+			this->rate_locks[lock[i]]->unlock(this->rate_locks[lock[i]]);
+		}
+	}
+	return accept;
+}
+
 /**
  * Job callback to receive packets
  */
@@ -488,6 +699,17 @@ static job_requeue_t receive_packets(private_receiver_t *this)
 		}
 	}
 
+	/* limit the rate of new IKE_SAs per source before doing any other work */
+	if (this->buckets && is_ike_sa_init(packet->get_data(packet)) &&
+		!rate_accept(this, src))
+	{
+		DBG2(DBG_NET, "ignoring IKE_SA setup from %H, rate limit of %u/s "
+			 "exceeded", src, this->rate_limit);
+		ref_get(&this->dropped[RECEIVER_DROP_RATE]);
+		packet->destroy(packet);
+		return JOB_REQUEUE_DIRECT;
+	}
+
 	/* parse message header */
 	message = message_create_from_packet(packet);
 	if (message->parse_header(message) != SUCCESS)
@@ -608,12 +830,30 @@ METHOD(receiver_t, del_esp_cb, void,
 	this->esp_cb_mutex->unlock(this->esp_cb_mutex);
 }
 
+METHOD(receiver_t, get_dropped, u_int,
+	private_receiver_t *this, receiver_drop_t reason)
+{
+	if (reason < RECEIVER_DROP_MAX)
+	{
+		return this->dropped[reason];
+	}
+	return 0;
+}
+
 METHOD(receiver_t, destroy, void,
 	private_receiver_t *this)
 {
+	int i;
+
 	this->rng->destroy(this->rng);
 	this->hasher->destroy(this->hasher);
 	this->esp_cb_mutex->destroy(this->esp_cb_mutex);
+	this->cookie_mutex->destroy(this->cookie_mutex);
+	for (i = 0; i < RATE_LOCKS; i++)
+	{
+		this->rate_locks[i]->destroy(this->rate_locks[i]);
+	}
+	free(this->buckets);
 	free(this);
 }
 
@@ -624,18 +864,26 @@ receiver_t *receiver_create()
 {
 	private_receiver_t *this;
 	u_int32_t now = time_monotonic(NULL);
+	u_int receivers, i;
 
 	INIT(this,
 		.public = {
 			.add_esp_cb = _add_esp_cb,
 			.del_esp_cb = _del_esp_cb,
+			.get_dropped = _get_dropped,
 			.destroy = _destroy,
 		},
 		.esp_cb_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.cookie_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.secret_switch = now,
 		.secret_offset = random() % now,
 	);
 
+	for (i = 0; i < RATE_LOCKS; i++)
+	{
+		this->rate_locks[i] = mutex_create(MUTEX_TYPE_DEFAULT);
+	}
+
 	if (lib->settings->get_bool(lib->settings,
 				"%s.dos_protection", TRUE, charon->name))
 	{
@@ -648,6 +896,19 @@ receiver_t *receiver_create()
 				"%s.init_limit_job_load", 0, charon->name);
 	this->init_limit_half_open = lib->settings->get_int(lib->settings,
 				"%s.init_limit_half_open", 0, charon->name);
+	this->rate_limit = lib->settings->get_int(lib->settings,
+				"%s.init_limit_rate", 0, charon->name);
+	this->rate_burst = lib->settings->get_int(lib->settings,
+				"%s.init_limit_rate_burst", 2 * this->rate_limit, charon->name);
+	this->rate_buckets = lib->settings->get_int(lib->settings,
+				"%s.init_limit_rate_buckets", RATE_BUCKETS_DEFAULT,
+				charon->name);
+	this->rate_prefix4 = lib->settings->get_int(lib->settings,
+				"%s.init_limit_rate_prefix4", RATE_PREFIX4_DEFAULT,
+				charon->name);
+	this->rate_prefix6 = lib->settings->get_int(lib->settings,
+				"%s.init_limit_rate_prefix6", RATE_PREFIX6_DEFAULT,
+				charon->name);
 	this->receive_delay = lib->settings->get_int(lib->settings,
 				"%s.receive_delay", 0, charon->name);
 	this->receive_delay_type = lib->settings->get_int(lib->settings,
@@ -682,9 +943,30 @@ receiver_t *receiver_create()
 	}
 	memcpy(this->secret_old, this->secret, SECRET_LENGTH);
 
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create_with_prio((callback_job_cb_t)receive_packets,
-			this, NULL, (callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
+	if (this->rate_limit && this->rate_buckets)
+	{
+		if (!this->rng->get_bytes(this->rng, sizeof(this->rate_seeds),
+								  (u_int8_t*)this->rate_seeds))
+		{
+			DBG1(DBG_NET, "creating rate limit seeds failed");
+			destroy(this);
+			return NULL;
+		}
+		this->rate_burst = max(this->rate_burst, 1);
+		this->buckets = calloc(RATE_ROWS * this->rate_buckets,
+							   sizeof(bucket_t));
+		DBG2(DBG_NET, "limiting IKE_SA setup to %u/s per source prefix, "
+			 "burst %u", this->rate_limit, this->rate_burst);
+	}
+
+	receivers = charon->socket->get_receivers(charon->socket);
+	for (i = 0; i < receivers; i++)
+	{
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create_with_prio(
+				(callback_job_cb_t)receive_packets, this, NULL,
+				(callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
+	}
 
 	return &this->public;
 }
@@ -24,6 +24,7 @@
 #define RECEIVER_H_
 
 typedef struct receiver_t receiver_t;
+typedef enum receiver_drop_t receiver_drop_t;
 
 #include <library.h>
 #include <networking/host.h>
@@ -40,6 +41,24 @@ typedef struct receiver_t receiver_t;
  */
 typedef void (*receiver_esp_cb_t)(void *data, packet_t *packet);
 
+/**
+ * Reasons to drop requests initiating an IKE_SA.
+ */
+enum receiver_drop_t {
+	/** source prefix exceeded its request rate */
+	RECEIVER_DROP_RATE,
+	/** cookie required but none or an invalid one received */
+	RECEIVER_DROP_COOKIE,
+	/** too many half open IKE_SAs of the peer */
+	RECEIVER_DROP_BLOCK,
+	/** global half open IKE_SA limit reached */
+	RECEIVER_DROP_HALF_OPEN,
+	/** processor job load limit reached */
+	RECEIVER_DROP_JOB_LOAD,
+	/** number of reasons */
+	RECEIVER_DROP_MAX,
+};
+
 /**
  * Receives packets from the socket and adds them to the job queue.
  *
@@ -62,6 +81,12 @@ typedef void (*receiver_esp_cb_t)(void *data, packet_t *packet);
  *
  * Further, the number of half-initiated IKE_SAs is limited per peer. This
  * makes it impossible for a peer to flood the server with its real IP address.
+ *
+ * Optionally, the rate of requests initiating an IKE_SA is limited per source
+ * prefix using token buckets. Instead of keeping state per prefix, the buckets
+ * form a count-min sketch of a fixed size: each prefix is hashed to one bucket
+ * in each of several rows and the least used of these buckets decides. This
+ * check is done on the raw packet, before the message gets parsed.
  */
 struct receiver_t {
 
@@ -83,6 +108,14 @@ struct receiver_t {
 	 */
 	void (*del_esp_cb)(receiver_t *this, receiver_esp_cb_t callback);
 
+	/**
+	 * Get the number of requests initiating an IKE_SA dropped so far.
+	 *
+	 * @param reason		reason the requests got dropped
+	 * @return				number of dropped requests
+	 */
+	u_int (*get_dropped)(receiver_t *this, receiver_drop_t reason);
+
 	/**
 	 * Destroys a receiver_t object.
 	 */
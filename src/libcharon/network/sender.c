@@ -28,24 +28,36 @@
 #include <threading/mutex.h>
 
 
+/**
+ * Default number of threads sending packets
+ */
+#define DEFAULT_SENDER_THREADS 1
+
+/**
+ * Default maximum number of packets passed to the socket at once
+ */
+#define DEFAULT_BATCH_SIZE 16
+
+/**
+ * Maximum number of packets passed to the socket at once (UIO_MAXIOV)
+ */
+#define MAX_BATCH_SIZE 1024
+
 typedef struct private_sender_t private_sender_t;
+typedef struct send_queue_t send_queue_t;
 
 /**
- * Private data of a sender_t object.
+ * A queue of packets, sent by a single thread
  */
-struct private_sender_t {
-	/**
-	 * Public part of a sender_t object.
-	 */
-	sender_t public;
+struct send_queue_t {
 
 	/**
-	 * The packets are stored in a linked list
+	 * The queued_packet_t are stored in a linked list
 	 */
 	linked_list_t *list;
 
 	/**
-	 * mutex to synchronize access to list
+	 * mutex to synchronize access to list and statistics
 	 */
 	mutex_t *mutex;
 
@@ -59,6 +71,68 @@ struct private_sender_t {
 	 */
 	condvar_t *sent;
 
+	/**
+	 * Sum of the latencies of sent packets, in us
+	 */
+	u_int64_t latency_sum;
+
+	/**
+	 * Number of packets contributing to latency_sum
+	 */
+	u_int64_t latency_count;
+
+	/**
+	 * Maximum latency of a sent packet, in us
+	 */
+	u_int latency_max;
+
+	/**
+	 * Back-reference to the sender
+	 */
+	private_sender_t *sender;
+};
+
+/**
+ * A packet in a queue
+ */
+typedef struct {
+
+	/**
+	 * The packet to send
+	 */
+	packet_t *packet;
+
+	/**
+	 * Time the packet got queued
+	 */
+	timeval_t queued;
+
+} queued_packet_t;
+
+/**
+ * Private data of a sender_t object.
+ */
+struct private_sender_t {
+	/**
+	 * Public part of a sender_t object.
+	 */
+	sender_t public;
+
+	/**
+	 * Queues, one per sender thread
+	 */
+	send_queue_t *queues;
+
+	/**
+	 * Number of queues/sender threads
+	 */
+	u_int threads;
+
+	/**
+	 * Maximum number of packets sent at once
+	 */
+	u_int batch_size;
+
 	/**
 	 * Delay for sending outgoing packets, to simulate larger RTT
 	 */
@@ -80,13 +154,43 @@ struct private_sender_t {
 	bool send_delay_response;
 };
 
+/**
+ * Select the queue for a packet. Packets to the same destination always use
+ * the same queue to keep them in order.
+ */
+static send_queue_t *get_queue(private_sender_t *this, packet_t *packet)
+{
+	host_t *dst;
+	u_int16_t port;
+	u_int hash;
+
+	if (this->threads == 1)
+	{
+		return &this->queues[0];
+	}
+	dst = packet->get_destination(packet);
+	port = dst->get_port(dst);
+	hash = chunk_hash_inc(chunk_from_thing(port),
+						  chunk_hash(dst->get_address(dst)));
+	return &this->queues[hash % this->threads];
+}
+
 METHOD(sender_t, send_no_marker, void,
 	private_sender_t *this, packet_t *packet)
 {
-	this->mutex->lock(this->mutex);
-	this->list->insert_last(this->list, packet);
-	this->got->signal(this->got);
-	this->mutex->unlock(this->mutex);
+	queued_packet_t *queued;
+	send_queue_t *queue;
+
+	INIT(queued,
+		.packet = packet,
+	);
+	time_monotonic(&queued->queued);
+
+	queue = get_queue(this, packet);
+	queue->mutex->lock(queue->mutex);
+	queue->list->insert_last(queue->list, queued);
+	queue->got->signal(queue->got);
+	queue->mutex->unlock(queue->mutex);
 }
 
 METHOD(sender_t, send_, void,
@@ -137,9 +241,13 @@ METHOD(sender_t, send_, void,
 /**
  * Job callback function to send packets
  */
-static job_requeue_t send_packets(private_sender_t *this)
+static job_requeue_t send_packets(send_queue_t *this)
 {
-	packet_t *packet;
+	private_sender_t *sender = this->sender;
+	queued_packet_t *queued[sender->batch_size];
+	packet_t *packets[sender->batch_size];
+	timeval_t now;
+	u_int i, count = 0, latency;
 	bool oldstate;
 
 	this->mutex->lock(this->mutex);
@@ -154,34 +262,117 @@ static job_requeue_t send_packets(private_sender_t *this)
 		thread_cancelability(oldstate);
 		thread_cleanup_pop(FALSE);
 	}
-	this->list->remove_first(this->list, (void**)&packet);
-	this->sent->signal(this->sent);
+	while (count < sender->batch_size &&
+		   this->list->remove_first(this->list, (void**)&queued[count]) == SUCCESS)
+	{
+		packets[count] = queued[count]->packet;
+		count++;
+	}
+	this->sent->broadcast(this->sent);
+	this->mutex->unlock(this->mutex);
+
+	charon->socket->send_batch(charon->socket, packets, count);
+
+	time_monotonic(&now);
+	this->mutex->lock(this->mutex);
+	for (i = 0; i < count; i++)
+	{
+		latency = (now.tv_sec - queued[i]->queued.tv_sec) * 1000000 +
+				   now.tv_usec - queued[i]->queued.tv_usec;
+		this->latency_sum += latency;
+		this->latency_max = max(this->latency_max, latency);
+		this->latency_count++;
+	}
 	this->mutex->unlock(this->mutex);
 
-	charon->socket->send(charon->socket, packet);
-	packet->destroy(packet);
+	for (i = 0; i < count; i++)
+	{
+		packets[i]->destroy(packets[i]);
+		free(queued[i]);
+	}
 	return JOB_REQUEUE_DIRECT;
 }
 
 METHOD(sender_t, flush, void,
 	private_sender_t *this)
 {
-	/* send all packets in the queue */
-	this->mutex->lock(this->mutex);
-	while (this->list->get_count(this->list))
+	send_queue_t *queue;
+	u_int i;
+
+	/* send all packets in the queues */
+	for (i = 0; i < this->threads; i++)
 	{
-		this->sent->wait(this->sent, this->mutex);
+		queue = &this->queues[i];
+		queue->mutex->lock(queue->mutex);
+		while (queue->list->get_count(queue->list))
+		{
+			queue->sent->wait(queue->sent, queue->mutex);
+		}
+		queue->mutex->unlock(queue->mutex);
 	}
-	this->mutex->unlock(this->mutex);
+}
+
+METHOD(sender_t, get_queue_length, u_int,
+	private_sender_t *this)
+{
+	send_queue_t *queue;
+	u_int i, count = 0;
+
+	for (i = 0; i < this->threads; i++)
+	{
+		queue = &this->queues[i];
+		queue->mutex->lock(queue->mutex);
+		count += queue->list->get_count(queue->list);
+		queue->mutex->unlock(queue->mutex);
+	}
+	return count;
+}
+
+METHOD(sender_t, get_send_latency, void,
+	private_sender_t *this, u_int *avg, u_int *max)
+{
+	send_queue_t *queue;
+	u_int64_t sum = 0, count = 0;
+	u_int i;
+
+	*max = 0;
+	for (i = 0; i < this->threads; i++)
+	{
+		queue = &this->queues[i];
+		queue->mutex->lock(queue->mutex);
+		sum += queue->latency_sum;
+		count += queue->latency_count;
+		*max = max(*max, queue->latency_max);
+		queue->mutex->unlock(queue->mutex);
+	}
+	*avg = count ? sum / count : 0;
+}
+
+/**
+ * Destroy a queued packet
+ */
+static void queued_packet_destroy(queued_packet_t *queued)
+{
+	queued->packet->destroy(queued->packet);
+	free(queued);
 }
 
 METHOD(sender_t, destroy, void,
 	private_sender_t *this)
 {
-	this->list->destroy_offset(this->list, offsetof(packet_t, destroy));
-	this->got->destroy(this->got);
-	this->sent->destroy(this->sent);
-	this->mutex->destroy(this->mutex);
+	send_queue_t *queue;
+	u_int i;
+
+	for (i = 0; i < this->threads; i++)
+	{
+		queue = &this->queues[i];
+		queue->list->destroy_function(queue->list,
+									  (void*)queued_packet_destroy);
+		queue->got->destroy(queue->got);
+		queue->sent->destroy(queue->sent);
+		queue->mutex->destroy(queue->mutex);
+	}
+	free(this->queues);
 	free(this);
 }
 
@@ -191,18 +382,24 @@ METHOD(sender_t, destroy, void,
 sender_t * sender_create()
 {
 	private_sender_t *this;
+	send_queue_t *queue;
+	u_int i;
 
 	INIT(this,
 		.public = {
 			.send = _send_,
 			.send_no_marker = _send_no_marker,
 			.flush = _flush,
+			.get_queue_length = _get_queue_length,
+			.get_send_latency = _get_send_latency,
 			.destroy = _destroy,
 		},
-		.list = linked_list_create(),
-		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
-		.got = condvar_create(CONDVAR_TYPE_DEFAULT),
-		.sent = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.threads = lib->settings->get_int(lib->settings,
+								"%s.sender_threads", DEFAULT_SENDER_THREADS,
+								charon->name),
+		.batch_size = lib->settings->get_int(lib->settings,
+								"%s.sender_batch_size", DEFAULT_BATCH_SIZE,
+								charon->name),
 		.send_delay = lib->settings->get_int(lib->settings,
 								"%s.send_delay", 0, charon->name),
 		.send_delay_type = lib->settings->get_int(lib->settings,
@@ -212,11 +409,24 @@ sender_t * sender_create()
 		.send_delay_response = lib->settings->get_bool(lib->settings,
 								"%s.send_delay_response", TRUE, charon->name),
 	);
+	this->threads = max(this->threads, 1);
+	this->batch_size = max(this->batch_size, 1);
+	this->batch_size = min(this->batch_size, MAX_BATCH_SIZE);
+	this->queues = calloc(this->threads, sizeof(send_queue_t));
 
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create_with_prio((callback_job_cb_t)send_packets,
-			this, NULL, (callback_job_cancel_t)return_false, JOB_PRIO_CRITICAL));
-
+	for (i = 0; i < this->threads; i++)
+	{
+		queue = &this->queues[i];
+		queue->list = linked_list_create();
+		queue->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+		queue->got = condvar_create(CONDVAR_TYPE_DEFAULT);
+		queue->sent = condvar_create(CONDVAR_TYPE_DEFAULT);
+		queue->sender = this;
+
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create_with_prio((callback_job_cb_t)send_packets,
+				queue, NULL, (callback_job_cancel_t)return_false,
+				JOB_PRIO_CRITICAL));
+	}
 	return &this->public;
 }
-
@@ -58,6 +58,21 @@ struct sender_t {
 	 */
 	void (*flush)(sender_t *this);
 
+	/**
+	 * Get the number of packets currently queued for sending.
+	 *
+	 * @return			number of queued packets, over all send queues
+	 */
+	u_int (*get_queue_length)(sender_t *this);
+
+	/**
+	 * Get the latency between queueing and sending packets.
+	 *
+	 * @param avg		average latency of all sent packets, in us
+	 * @param max		maximum latency of a sent packet, in us
+	 */
+	void (*get_send_latency)(sender_t *this, u_int *avg, u_int *max);
+
 	/**
 	 * Destroys a sender object.
 	 */
@@ -65,10 +80,10 @@ struct sender_t {
 };
 
 /**
- * Create the sender thread.
+ * Create the sender threads.
  *
- * The thread will start to work, getting packets
- * from its queue and sends them out.
+ * The threads will start to work, getting packets
+ * from their queues and send them out in batches.
  *
  * @return		created sender object
  */
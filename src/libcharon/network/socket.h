@@ -67,6 +67,18 @@ struct socket_t {
 	 */
 	status_t (*send) (socket_t *this, packet_t *packet);
 
+	/**
+	 * Send a batch of packets.
+	 *
+	 * Implementations may pass multiple packets to the kernel at once, the
+	 * packets are sent in the order given.
+	 *
+	 * @param packets		array of packet_t to send
+	 * @param count			number of packets in the array
+	 * @return				number of packets successfully sent
+	 */
+	u_int (*send_batch) (socket_t *this, packet_t **packets, u_int count);
+
 	/**
 	 * Get the port this socket is listening on.
 	 *
@@ -75,6 +87,22 @@ struct socket_t {
 	 */
 	u_int16_t (*get_port) (socket_t *this, bool nat_t);
 
+	/**
+	 * Get the number of threads that should concurrently receive packets.
+	 *
+	 * @return				number of receiver threads
+	 */
+	u_int (*get_receivers) (socket_t *this);
+
+	/**
+	 * Get statistics about received packets.
+	 *
+	 * @param packets		number of packets received
+	 * @param batches		number of batches these packets were read in
+	 * @return				TRUE if statistics are available
+	 */
+	bool (*get_stats) (socket_t *this, u_int *packets, u_int *batches);
+
 	/**
 	 * Destroy a socket implementation.
 	 */
@@ -89,6 +89,22 @@ METHOD(socket_manager_t, sender, status_t,
 	return status;
 }
 
+METHOD(socket_manager_t, send_batch, u_int,
+	private_socket_manager_t *this, packet_t **packets, u_int count)
+{
+	u_int sent;
+	this->lock->read_lock(this->lock);
+	if (!this->socket)
+	{
+		DBG1(DBG_NET, "no socket implementation registered, sending failed");
+		this->lock->unlock(this->lock);
+		return 0;
+	}
+	sent = this->socket->send_batch(this->socket, packets, count);
+	this->lock->unlock(this->lock);
+	return sent;
+}
+
 METHOD(socket_manager_t, get_port, u_int16_t,
 	private_socket_manager_t *this, bool nat_t)
 {
@@ -102,6 +118,32 @@ METHOD(socket_manager_t, get_port, u_int16_t,
 	return port;
 }
 
+METHOD(socket_manager_t, get_receivers, u_int,
+	private_socket_manager_t *this)
+{
+	u_int receivers = 1;
+	this->lock->read_lock(this->lock);
+	if (this->socket)
+	{
+		receivers = this->socket->get_receivers(this->socket);
+	}
+	this->lock->unlock(this->lock);
+	return receivers;
+}
+
+METHOD(socket_manager_t, get_stats, bool,
+	private_socket_manager_t *this, u_int *packets, u_int *batches)
+{
+	bool success = FALSE;
+	this->lock->read_lock(this->lock);
+	if (this->socket)
+	{
+		success = this->socket->get_stats(this->socket, packets, batches);
+	}
+	this->lock->unlock(this->lock);
+	return success;
+}
+
 static void create_socket(private_socket_manager_t *this)
 {
 	socket_constructor_t create;
@@ -165,8 +207,11 @@ socket_manager_t *socket_manager_create()
 	INIT(this,
 		.public = {
 			.send = _sender,
+			.send_batch = _send_batch,
 			.receive = _receiver,
 			.get_port = _get_port,
+			.get_receivers = _get_receivers,
+			.get_stats = _get_stats,
 			.add_socket = _add_socket,
 			.remove_socket = _remove_socket,
 			.destroy = _destroy,
@@ -52,6 +52,16 @@ struct socket_manager_t {
 	 */
 	status_t (*send) (socket_manager_t *this, packet_t *packet);
 
+	/**
+	 * Send a batch of packets using the registered socket.
+	 *
+	 * @param packets		array of packets to send out
+	 * @param count			number of packets in the array
+	 * @return				number of packets successfully sent
+	 */
+	u_int (*send_batch) (socket_manager_t *this, packet_t **packets,
+						 u_int count);
+
 	/**
 	 * Get the port the registered socket is listening on.
 	 *
@@ -60,6 +70,24 @@ struct socket_manager_t {
 	 */
 	u_int16_t (*get_port) (socket_manager_t *this, bool nat_t);
 
+	/**
+	 * Get the number of threads that should concurrently receive packets.
+	 *
+	 * @return				number of receiver threads, 1 if no socket is
+	 *						registered
+	 */
+	u_int (*get_receivers) (socket_manager_t *this);
+
+	/**
+	 * Get statistics about packets received by the registered socket.
+	 *
+	 * @param packets		number of packets received
+	 * @param batches		number of batches these packets were read in
+	 * @return				TRUE if statistics are available
+	 */
+	bool (*get_stats) (socket_manager_t *this, u_int *packets,
+					   u_int *batches);
+
 	/**
 	 * Register a socket constructor.
 	 *
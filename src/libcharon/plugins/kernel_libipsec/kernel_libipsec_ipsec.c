@@ -0,0 +1,478 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "kernel_libipsec_ipsec.h"
+
+#include <library.h>
+#include <hydra.h>
+#include <ipsec.h>
+#include <utils/debug.h>
+#include <networking/tun_device.h>
+#include <threading/mutex.h>
+#include <collections/linked_list.h>
+
+typedef struct private_kernel_libipsec_ipsec_t private_kernel_libipsec_ipsec_t;
+
+struct private_kernel_libipsec_ipsec_t {
+
+	/**
+	 * Public libipsec_ipsec interface
+	 */
+	kernel_libipsec_ipsec_t public;
+
+	/**
+	 * Listener for lifetime expire events
+	 */
+	ipsec_event_listener_t ipsec_listener;
+
+	/**
+	 * Routes installed for outbound policies, as route_entry_t
+	 */
+	linked_list_t *routes;
+
+	/**
+	 * Outbound policies that use one of the routes, as policy_entry_t
+	 */
+	linked_list_t *policies;
+
+	/**
+	 * Mutex to lock access to routes and policies
+	 */
+	mutex_t *mutex;
+};
+
+/**
+ * Route installed via the TUN device
+ */
+typedef struct {
+
+	/**
+	 * Destination net
+	 */
+	chunk_t dst_net;
+
+	/**
+	 * Destination net prefixlen
+	 */
+	u_int8_t prefixlen;
+
+	/**
+	 * Source address for the route
+	 */
+	host_t *src_ip;
+
+	/**
+	 * Number of outbound policies using this route
+	 */
+	u_int refs;
+
+} route_entry_t;
+
+/**
+ * Destroy a route_entry_t object
+ */
+static void route_entry_destroy(route_entry_t *this)
+{
+	chunk_free(&this->dst_net);
+	this->src_ip->destroy(this->src_ip);
+	free(this);
+}
+
+/**
+ * Outbound policy for which a route got installed
+ */
+typedef struct {
+
+	/**
+	 * Source traffic selector of the policy
+	 */
+	traffic_selector_t *src_ts;
+
+	/**
+	 * Destination traffic selector of the policy
+	 */
+	traffic_selector_t *dst_ts;
+
+	/**
+	 * Reqid of the policy
+	 */
+	u_int32_t reqid;
+
+	/**
+	 * Mark of the policy
+	 */
+	mark_t mark;
+
+	/**
+	 * Route used by this policy
+	 */
+	route_entry_t *route;
+
+} policy_entry_t;
+
+/**
+ * Destroy a policy_entry_t object
+ */
+static void policy_entry_destroy(policy_entry_t *this)
+{
+	this->src_ts->destroy(this->src_ts);
+	this->dst_ts->destroy(this->dst_ts);
+	free(this);
+}
+
+/**
+ * Find the route for a destination net, if any
+ */
+static route_entry_t *find_route(private_kernel_libipsec_ipsec_t *this,
+								 chunk_t dst_net, u_int8_t prefixlen)
+{
+	enumerator_t *enumerator;
+	route_entry_t *route, *found = NULL;
+
+	enumerator = this->routes->create_enumerator(this->routes);
+	while (enumerator->enumerate(enumerator, &route))
+	{
+		if (route->prefixlen == prefixlen &&
+			chunk_equals(route->dst_net, dst_net))
+		{
+			found = route;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+/**
+ * Callback registrered with libipsec.
+ */
+static void expire(u_int32_t reqid, u_int8_t protocol, u_int32_t spi,
+				   bool hard)
+{
+	hydra->kernel_interface->expire(hydra->kernel_interface, reqid, protocol,
+									spi, hard);
+}
+
+METHOD(kernel_ipsec_t, get_spi, status_t,
+	private_kernel_libipsec_ipsec_t *this, host_t *src, host_t *dst,
+	u_int8_t protocol, u_int32_t reqid, u_int32_t *spi)
+{
+	return ipsec->sas->get_spi(ipsec->sas, src, dst, protocol, reqid, spi);
+}
+
+METHOD(kernel_ipsec_t, get_cpi, status_t,
+	private_kernel_libipsec_ipsec_t *this, host_t *src, host_t *dst,
+	u_int32_t reqid, u_int16_t *cpi)
+{
+	return NOT_SUPPORTED;
+}
+
+METHOD(kernel_ipsec_t, add_sa, status_t,
+	private_kernel_libipsec_ipsec_t *this, host_t *src, host_t *dst,
+	u_int32_t spi, u_int8_t protocol, u_int32_t reqid, mark_t mark,
+	u_int32_t tfc, lifetime_cfg_t *lifetime, u_int16_t enc_alg, chunk_t enc_key,
+	u_int16_t int_alg, chunk_t int_key, ipsec_mode_t mode, u_int16_t ipcomp,
+	u_int16_t cpi, bool encap, bool esn, bool inbound,
+	traffic_selector_t *src_ts, traffic_selector_t *dst_ts)
+{
+	return ipsec->sas->add_sa(ipsec->sas, src, dst, spi, protocol, reqid, mark,
+							  tfc, lifetime, enc_alg, enc_key, int_alg, int_key,
+							  mode, ipcomp, cpi, encap, esn, inbound, src_ts,
+							  dst_ts);
+}
+
+METHOD(kernel_ipsec_t, update_sa, status_t,
+	private_kernel_libipsec_ipsec_t *this, u_int32_t spi, u_int8_t protocol,
+	u_int16_t cpi, host_t *src, host_t *dst, host_t *new_src, host_t *new_dst,
+	bool encap, bool new_encap, mark_t mark)
+{
+	return ipsec->sas->update_sa(ipsec->sas, spi, protocol, cpi, src, dst,
+								 new_src, new_dst, encap, new_encap, mark);
+}
+
+METHOD(kernel_ipsec_t, query_sa, status_t,
+	private_kernel_libipsec_ipsec_t *this, host_t *src, host_t *dst,
+	u_int32_t spi, u_int8_t protocol, mark_t mark,
+	u_int64_t *bytes, u_int64_t *packets, u_int32_t *time)
+{
+	return NOT_SUPPORTED;
+}
+
+METHOD(kernel_ipsec_t, del_sa, status_t,
+	private_kernel_libipsec_ipsec_t *this, host_t *src, host_t *dst,
+	u_int32_t spi, u_int8_t protocol, u_int16_t cpi, mark_t mark)
+{
+	return ipsec->sas->del_sa(ipsec->sas, src, dst, spi, protocol, cpi, mark);
+}
+
+METHOD(kernel_ipsec_t, flush_sas, status_t,
+	private_kernel_libipsec_ipsec_t *this)
+{
+	return ipsec->sas->flush_sas(ipsec->sas);
+}
+
+/**
+ * Remember that an outbound policy uses a route, mutex must be held
+ */
+static void add_policy_entry(private_kernel_libipsec_ipsec_t *this,
+							 traffic_selector_t *src_ts,
+							 traffic_selector_t *dst_ts, u_int32_t reqid,
+							 mark_t mark, route_entry_t *route)
+{
+	policy_entry_t *policy;
+
+	INIT(policy,
+		.src_ts = src_ts->clone(src_ts),
+		.dst_ts = dst_ts->clone(dst_ts),
+		.reqid = reqid,
+		.mark = mark,
+		.route = route,
+	);
+	this->policies->insert_last(this->policies, policy);
+}
+
+/**
+ * Install a route via the TUN device for the destination of an outbound
+ * policy.  Traffic to the peer itself is never routed into the tunnel, as
+ * that would loop the ESP packets back to us.
+ */
+static void install_route(private_kernel_libipsec_ipsec_t *this,
+						  host_t *dst, traffic_selector_t *src_ts,
+						  traffic_selector_t *dst_ts, u_int32_t reqid,
+						  mark_t mark)
+{
+	route_entry_t *route;
+	tun_device_t *tun;
+	chunk_t dst_net;
+	u_int8_t prefixlen;
+	host_t *src_ip;
+
+	tun = lib->get(lib, "kernel-libipsec-tun");
+	if (!tun || dst_ts->includes(dst_ts, dst))
+	{
+		return;
+	}
+	/* for address ranges this is the smallest subnet covering the range */
+	dst_ts->to_subnet(dst_ts, &src_ip, &prefixlen);
+	dst_net = chunk_clone(src_ip->get_address(src_ip));
+	src_ip->destroy(src_ip);
+
+	this->mutex->lock(this->mutex);
+	route = find_route(this, dst_net, prefixlen);
+	if (route)
+	{
+		route->refs++;
+		add_policy_entry(this, src_ts, dst_ts, reqid, mark, route);
+		this->mutex->unlock(this->mutex);
+		chunk_free(&dst_net);
+		return;
+	}
+	if (hydra->kernel_interface->get_address_by_ts(hydra->kernel_interface,
+									src_ts, &src_ip, NULL) != SUCCESS)
+	{
+		this->mutex->unlock(this->mutex);
+		DBG2(DBG_KNL, "no local address found in %R, not installing route",
+			 src_ts);
+		chunk_free(&dst_net);
+		return;
+	}
+	INIT(route,
+		.dst_net = dst_net,
+		.prefixlen = prefixlen,
+		.src_ip = src_ip,
+		.refs = 1,
+	);
+	switch (hydra->kernel_interface->add_route(hydra->kernel_interface,
+								route->dst_net, route->prefixlen, NULL,
+								route->src_ip, tun->get_name(tun)))
+	{
+		case SUCCESS:
+		case ALREADY_DONE:
+			this->routes->insert_last(this->routes, route);
+			add_policy_entry(this, src_ts, dst_ts, reqid, mark, route);
+			break;
+		default:
+			DBG1(DBG_KNL, "unable to install route for policy %R === %R "
+				 "via %s", src_ts, dst_ts, tun->get_name(tun));
+			route_entry_destroy(route);
+			break;
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+/**
+ * Release the route used by an outbound policy, if install_route() installed
+ * or referenced one for it
+ */
+static void uninstall_route(private_kernel_libipsec_ipsec_t *this,
+							traffic_selector_t *src_ts,
+							traffic_selector_t *dst_ts, u_int32_t reqid,
+							mark_t mark)
+{
+	enumerator_t *enumerator;
+	policy_entry_t *policy, *found = NULL;
+	route_entry_t *route;
+	tun_device_t *tun;
+
+	this->mutex->lock(this->mutex);
+	enumerator = this->policies->create_enumerator(this->policies);
+	while (enumerator->enumerate(enumerator, &policy))
+	{
+		if (policy->reqid == reqid &&
+			policy->mark.value == mark.value &&
+			policy->mark.mask == mark.mask &&
+			policy->src_ts->equals(policy->src_ts, src_ts) &&
+			policy->dst_ts->equals(policy->dst_ts, dst_ts))
+		{
+			this->policies->remove_at(this->policies, enumerator);
+			found = policy;
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+	if (!found)
+	{
+		this->mutex->unlock(this->mutex);
+		return;
+	}
+	route = found->route;
+	policy_entry_destroy(found);
+	if (--route->refs == 0)
+	{
+		this->routes->remove(this->routes, route, NULL);
+		tun = lib->get(lib, "kernel-libipsec-tun");
+		if (tun && hydra->kernel_interface->del_route(hydra->kernel_interface,
+								route->dst_net, route->prefixlen, NULL,
+								route->src_ip, tun->get_name(tun)) != SUCCESS)
+		{
+			DBG1(DBG_KNL, "error uninstalling route to %R via %s", dst_ts,
+				 tun->get_name(tun));
+		}
+		route_entry_destroy(route);
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+METHOD(kernel_ipsec_t, add_policy, status_t,
+	private_kernel_libipsec_ipsec_t *this, host_t *src, host_t *dst,
+	traffic_selector_t *src_ts, traffic_selector_t *dst_ts,
+	policy_dir_t direction, policy_type_t type, ipsec_sa_cfg_t *sa, mark_t mark,
+	policy_priority_t priority)
+{
+	status_t status;
+
+	status = ipsec->policies->add_policy(ipsec->policies, src, dst, src_ts,
+									dst_ts, direction, type, sa, mark, priority);
+	if (status == SUCCESS && direction == POLICY_OUT && type == POLICY_IPSEC)
+	{
+		install_route(this, dst, src_ts, dst_ts, sa->reqid, mark);
+	}
+	return status;
+}
+
+METHOD(kernel_ipsec_t, query_policy, status_t,
+	private_kernel_libipsec_ipsec_t *this, traffic_selector_t *src_ts,
+	traffic_selector_t *dst_ts, policy_dir_t direction, mark_t mark,
+	u_int32_t *use_time)
+{
+	return NOT_SUPPORTED;
+}
+
+METHOD(kernel_ipsec_t, del_policy, status_t,
+	private_kernel_libipsec_ipsec_t *this, traffic_selector_t *src_ts,
+	traffic_selector_t *dst_ts, policy_dir_t direction, u_int32_t reqid,
+	mark_t mark, policy_priority_t priority)
+{
+	status_t status;
+
+	status = ipsec->policies->del_policy(ipsec->policies, src_ts, dst_ts,
+									direction, reqid, mark, priority);
+	if (status == SUCCESS && direction == POLICY_OUT)
+	{
+		/* only releases a route if the policy got one in add_policy() */
+		uninstall_route(this, src_ts, dst_ts, reqid, mark);
+	}
+	return status;
+}
+
+METHOD(kernel_ipsec_t, flush_policies, status_t,
+	private_kernel_libipsec_ipsec_t *this)
+{
+	ipsec->policies->flush_policies(ipsec->policies);
+	return SUCCESS;
+}
+
+METHOD(kernel_ipsec_t, bypass_socket, bool,
+	private_kernel_libipsec_ipsec_t *this, int fd, int family)
+{
+	/* our own packets are not subject to any policies */
+	return TRUE;
+}
+
+METHOD(kernel_ipsec_t, enable_udp_decap, bool,
+	private_kernel_libipsec_ipsec_t *this, int fd, int family, u_int16_t port)
+{
+	/* ESP is received on the IKE socket, no need to decapsulate in the kernel */
+	return TRUE;
+}
+
+METHOD(kernel_ipsec_t, destroy, void,
+	private_kernel_libipsec_ipsec_t *this)
+{
+	ipsec->events->unregister_listener(ipsec->events, &this->ipsec_listener);
+	this->policies->destroy_function(this->policies,
+									 (void*)policy_entry_destroy);
+	this->routes->destroy_function(this->routes, (void*)route_entry_destroy);
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+/*
+ * Described in header.
+ */
+kernel_libipsec_ipsec_t *kernel_libipsec_ipsec_create()
+{
+	private_kernel_libipsec_ipsec_t *this;
+
+	INIT(this,
+		.public = {
+			.interface = {
+				.get_spi = _get_spi,
+				.get_cpi = _get_cpi,
+				.add_sa  = _add_sa,
+				.update_sa = _update_sa,
+				.query_sa = _query_sa,
+				.del_sa = _del_sa,
+				.flush_sas = _flush_sas,
+				.add_policy = _add_policy,
+				.query_policy = _query_policy,
+				.del_policy = _del_policy,
+				.flush_policies = _flush_policies,
+				.bypass_socket = _bypass_socket,
+				.enable_udp_decap = _enable_udp_decap,
+				.destroy = _destroy,
+			},
+		},
+		.ipsec_listener = {
+			.expire = expire,
+		},
+		.routes = linked_list_create(),
+		.policies = linked_list_create(),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+
+	ipsec->events->register_listener(ipsec->events, &this->ipsec_listener);
+
+	return &this->public;
+}
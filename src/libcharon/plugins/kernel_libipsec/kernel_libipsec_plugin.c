@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "kernel_libipsec_plugin.h"
+#include "kernel_libipsec_ipsec.h"
+#include "kernel_libipsec_router.h"
+
+#include <daemon.h>
+#include <ipsec.h>
+#include <networking/tun_device.h>
+
+#define TUN_DEFAULT_MTU 1400
+
+typedef struct private_kernel_libipsec_plugin_t private_kernel_libipsec_plugin_t;
+
+/**
+ * private data of "kernel" libipsec plugin
+ */
+struct private_kernel_libipsec_plugin_t {
+
+	/**
+	 * implements plugin interface
+	 */
+	kernel_libipsec_plugin_t public;
+
+	/**
+	 * Counters of the crypto workers, registered with charon
+	 */
+	kernel_stats_t stats;
+
+	/**
+	 * TUN device created by this plugin
+	 */
+	tun_device_t *tun;
+
+	/**
+	 * Packet router
+	 */
+	kernel_libipsec_router_t *router;
+};
+
+METHOD(kernel_stats_t, get_worker_stats, bool,
+	private_kernel_libipsec_plugin_t *this, u_int worker,
+	kernel_worker_stats_t *stats)
+{
+	ipsec_worker_stats_t current;
+
+	if (!ipsec->processor->get_worker_stats(ipsec->processor, worker,
+											&current))
+	{
+		return FALSE;
+	}
+	*stats = (kernel_worker_stats_t){
+		.packets_in = current.packets_in,
+		.bytes_in = current.bytes_in,
+		.packets_out = current.packets_out,
+		.bytes_out = current.bytes_out,
+		.dropped = current.dropped,
+	};
+	return TRUE;
+}
+
+METHOD(plugin_t, get_name, char*,
+	private_kernel_libipsec_plugin_t *this)
+{
+	return "kernel-libipsec";
+}
+
+/**
+ * Create the packet router once the IKE socket is available
+ */
+static bool create_router(private_kernel_libipsec_plugin_t *this,
+						  plugin_feature_t *feature, bool reg, void *data)
+{
+	if (reg)
+	{
+		this->router = kernel_libipsec_router_create(this->tun);
+	}
+	else
+	{
+		DESTROY_IF(this->router);
+		this->router = NULL;
+	}
+	return TRUE;
+}
+
+METHOD(plugin_t, get_features, int,
+	private_kernel_libipsec_plugin_t *this, plugin_feature_t *features[])
+{
+	static plugin_feature_t f[] = {
+		PLUGIN_CALLBACK(kernel_ipsec_register, kernel_libipsec_ipsec_create),
+			PLUGIN_PROVIDE(CUSTOM, "kernel-ipsec"),
+		PLUGIN_CALLBACK((plugin_feature_callback_t)create_router, NULL),
+			PLUGIN_PROVIDE(CUSTOM, "kernel-libipsec-router"),
+				PLUGIN_DEPENDS(CUSTOM, "libcharon-receiver"),
+	};
+	*features = f;
+	return countof(f);
+}
+
+METHOD(plugin_t, destroy, void,
+	private_kernel_libipsec_plugin_t *this)
+{
+	if (this->tun)
+	{
+		lib->set(lib, "kernel-libipsec-tun", NULL);
+		this->tun->destroy(this->tun);
+	}
+	if (charon->kernel_stats == &this->stats)
+	{
+		charon->kernel_stats = NULL;
+	}
+	libipsec_deinit();
+	free(this);
+}
+
+/*
+ * see header file
+ */
+plugin_t *kernel_libipsec_plugin_create()
+{
+	private_kernel_libipsec_plugin_t *this;
+	int threads, workers, max_workers;
+	u_int queues;
+
+	INIT(this,
+		.public = {
+			.plugin = {
+				.get_name = _get_name,
+				.get_features = _get_features,
+				.destroy = _destroy,
+			},
+		},
+		.stats = {
+			.get_worker_stats = _get_worker_stats,
+		},
+	);
+
+	/* each crypto worker and the reader of its TUN queue, as well as the
+	 * libipsec event relay, permanently occupy a thread of the thread pool,
+	 * which is not started yet. Leave at least half of them for IKE */
+	threads = lib->settings->get_int(lib->settings, "%s.threads",
+									 DEFAULT_THREADS, charon->name);
+	max_workers = (threads / 2 - 1) / 2;
+	if (max_workers < 1)
+	{
+		DBG1(DBG_KNL, "%d threads are not enough for libipsec, at least 6 "
+			 "are required", threads);
+		free(this);
+		return NULL;
+	}
+	workers = lib->settings->get_int(lib->settings,
+									 "libipsec.processor.workers", 2);
+	if (workers > max_workers)
+	{
+		workers = max_workers;
+		DBG1(DBG_KNL, "limiting libipsec crypto workers to %d of %d threads",
+			 workers, threads);
+	}
+
+	if (!libipsec_init(max(1, workers)))
+	{
+		DBG1(DBG_LIB, "initialization of libipsec failed");
+		destroy(this);
+		return NULL;
+	}
+
+	/* one TUN queue per crypto worker */
+	queues = ipsec->processor->get_worker_count(ipsec->processor);
+	this->tun = tun_device_create_multi_queue("ipsec%d", queues);
+	if (!this->tun)
+	{
+		DBG1(DBG_KNL, "failed to create TUN device");
+		destroy(this);
+		return NULL;
+	}
+	if (!this->tun->set_mtu(this->tun, lib->settings->get_int(lib->settings,
+						"%s.plugins.kernel-libipsec.mtu", TUN_DEFAULT_MTU,
+						charon->name)) ||
+		!this->tun->up(this->tun))
+	{
+		DBG1(DBG_KNL, "failed to configure TUN device");
+		destroy(this);
+		return NULL;
+	}
+	lib->set(lib, "kernel-libipsec-tun", this->tun);
+	charon->kernel_stats = &this->stats;
+	return &this->public.plugin;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "kernel_libipsec_router.h"
+
+#include <daemon.h>
+#include <ipsec.h>
+#include <processing/jobs/callback_job.h>
+#include <threading/thread_value.h>
+#include <threading/mutex.h>
+
+/**
+ * Maximum number of packets read from a TUN queue in one go
+ */
+#define READ_BATCH_SIZE 32
+
+typedef struct private_kernel_libipsec_router_t private_kernel_libipsec_router_t;
+typedef struct queue_reader_t queue_reader_t;
+
+/**
+ * Private data of a kernel_libipsec_router_t object.
+ */
+struct private_kernel_libipsec_router_t {
+
+	/**
+	 * Public interface
+	 */
+	kernel_libipsec_router_t public;
+
+	/**
+	 * TUN device
+	 */
+	tun_device_t *tun;
+
+	/**
+	 * TUN queue assigned to the current crypto worker thread, plus one
+	 */
+	thread_value_t *queue;
+
+	/**
+	 * Number of TUN queues assigned to crypto workers so far
+	 */
+	u_int assigned;
+
+	/**
+	 * Mutex to assign TUN queues
+	 */
+	mutex_t *mutex;
+};
+
+/**
+ * Reads plaintext packets from a single TUN queue
+ */
+struct queue_reader_t {
+
+	/**
+	 * Router this reader belongs to
+	 */
+	private_kernel_libipsec_router_t *router;
+
+	/**
+	 * TUN queue to read from
+	 */
+	u_int queue;
+
+	/**
+	 * Size of the packet area in the buffers
+	 */
+	size_t mtu;
+
+	/**
+	 * Buffers to read packets into, with room to encapsulate them in place
+	 */
+	chunk_t buffers[READ_BATCH_SIZE];
+};
+
+/**
+ * Outbound callback
+ */
+static void send_esp(void *data, esp_packet_t *packet)
+{
+	charon->sender->send_no_marker(charon->sender, (packet_t*)packet);
+}
+
+/**
+ * Receiver callback
+ */
+static void receiver_esp_cb(void *data, packet_t *packet)
+{
+	esp_packet_t *esp_packet;
+
+	esp_packet = esp_packet_create_from_packet(packet);
+	ipsec->processor->queue_inbound(ipsec->processor, esp_packet);
+}
+
+/**
+ * Inbound callback, called by the crypto workers
+ */
+static void deliver_plain(private_kernel_libipsec_router_t *this,
+						  ip_packet_t *packet)
+{
+	uintptr_t queue;
+	chunk_t encoding;
+
+	queue = (uintptr_t)this->queue->get(this->queue);
+	if (!queue)
+	{	/* first packet delivered by this worker, assign it a queue of its own */
+		this->mutex->lock(this->mutex);
+		queue = ++this->assigned;
+		this->mutex->unlock(this->mutex);
+		this->queue->set(this->queue, (void*)queue);
+	}
+	encoding = packet->get_encoding(packet);
+	this->tun->write_packets(this->tun, queue - 1, &encoding, 1);
+	packet->destroy(packet);
+}
+
+/**
+ * Job handling outbound plaintext packets of a TUN queue
+ */
+static job_requeue_t handle_plain(queue_reader_t *this)
+{
+	tun_device_t *tun = this->router->tun;
+	chunk_t packets[READ_BATCH_SIZE];
+	ip_packet_t *packet;
+	u_int i, count;
+
+	for (i = 0; i < READ_BATCH_SIZE; i++)
+	{
+		if (!this->buffers[i].ptr)
+		{
+			this->buffers[i] = chunk_alloc(ESP_PACKET_HEADROOM + this->mtu +
+										   ESP_PACKET_TAILROOM);
+		}
+		packets[i] = chunk_create(this->buffers[i].ptr + ESP_PACKET_HEADROOM,
+								  this->mtu);
+	}
+
+	count = tun->read_packets(tun, this->queue, packets, READ_BATCH_SIZE);
+	for (i = 0; i < count; i++)
+	{
+		/* the packet takes over the buffer, a new one gets allocated for
+		 * the next batch */
+		packet = ip_packet_create_from_buffer(this->buffers[i], packets[i]);
+		this->buffers[i] = chunk_empty;
+		if (packet)
+		{
+			ipsec->processor->queue_outbound(ipsec->processor, packet);
+		}
+		else
+		{
+			DBG1(DBG_KNL, "invalid IP packet read from TUN device");
+		}
+	}
+	return JOB_REQUEUE_DIRECT;
+}
+
+/**
+ * Destroy a queue reader
+ */
+static void reader_destroy(queue_reader_t *this)
+{
+	int i;
+
+	for (i = 0; i < READ_BATCH_SIZE; i++)
+	{
+		chunk_free(&this->buffers[i]);
+	}
+	free(this);
+}
+
+METHOD(kernel_libipsec_router_t, destroy, void,
+	private_kernel_libipsec_router_t *this)
+{
+	charon->receiver->del_esp_cb(charon->receiver,
+								(receiver_esp_cb_t)receiver_esp_cb);
+	ipsec->processor->unregister_outbound(ipsec->processor,
+										 (ipsec_outbound_cb_t)send_esp);
+	ipsec->processor->unregister_inbound(ipsec->processor,
+										(ipsec_inbound_cb_t)deliver_plain);
+	this->queue->destroy(this->queue);
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+/*
+ * See header file
+ */
+kernel_libipsec_router_t *kernel_libipsec_router_create(tun_device_t *tun)
+{
+	private_kernel_libipsec_router_t *this;
+	queue_reader_t *reader;
+	u_int i;
+
+	INIT(this,
+		.public = {
+			.destroy = _destroy,
+		},
+		.tun = tun,
+		.queue = thread_value_create(NULL),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+
+	charon->receiver->add_esp_cb(charon->receiver,
+								(receiver_esp_cb_t)receiver_esp_cb, NULL);
+	ipsec->processor->register_inbound(ipsec->processor,
+									(ipsec_inbound_cb_t)deliver_plain, this);
+	ipsec->processor->register_outbound(ipsec->processor,
+									(ipsec_outbound_cb_t)send_esp, NULL);
+
+	for (i = 0; i < tun->get_queue_count(tun); i++)
+	{
+		INIT(reader,
+			.router = this,
+			.queue = i,
+			.mtu = tun->get_mtu(tun),
+		);
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create((callback_job_cb_t)handle_plain, reader,
+					(callback_job_cleanup_t)reader_destroy,
+					(callback_job_cancel_t)return_false));
+	}
+	return &this->public;
+}
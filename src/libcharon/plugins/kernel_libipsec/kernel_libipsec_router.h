@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+
+/**
+ * @defgroup kernel_libipsec_router kernel_libipsec_router
+ * @{ @ingroup kernel_libipsec
+ */
+
+#ifndef KERNEL_LIBIPSEC_ROUTER_H_
+#define KERNEL_LIBIPSEC_ROUTER_H_
+
+#include <library.h>
+#include <networking/tun_device.h>
+
+typedef struct kernel_libipsec_router_t kernel_libipsec_router_t;
+
+/**
+ * Moves packets between the TUN device, libipsec and the IKE socket.
+ *
+ * Each queue of the TUN device is read by a dedicated thread, which passes
+ * batches of plaintext packets to the IPsec processor.  Decrypted packets
+ * are written to the TUN queue assigned to the crypto worker delivering them,
+ * so no locking is required on the data path.
+ */
+struct kernel_libipsec_router_t {
+
+	/**
+	 * Destroy a kernel_libipsec_router_t
+	 */
+	void (*destroy)(kernel_libipsec_router_t *this);
+};
+
+/**
+ * Create a kernel_libipsec_router_t instance.
+ *
+ * @param tun		TUN device to route packets from/to
+ * @return			kernel_libipsec_router_t instance
+ */
+kernel_libipsec_router_t *kernel_libipsec_router_create(tun_device_t *tun);
+
+#endif /** KERNEL_LIBIPSEC_ROUTER_H_ @}*/
@@ -44,10 +44,22 @@
 #include <hydra.h>
 #include <daemon.h>
 #include <threading/thread.h>
+#include <threading/thread_value.h>
+#include <threading/mutex.h>
+#include <threading/rwlock.h>
 
 /* Maximum size of a packet */
 #define MAX_PACKET 10000
 
+/* Default number of receiver threads, each using its own set of sockets */
+#define DEFAULT_RECEIVERS 1
+
+/* Default number of packets read with a single system call */
+#define DEFAULT_BATCH_SIZE 16
+
+/* Maximum number of packets read with a single system call (UIO_MAXIOV) */
+#define MAX_BATCH_SIZE 1024
+
 /* these are not defined on some platforms */
 #ifndef SOL_IP
 #define SOL_IP IPPROTO_IP
@@ -74,6 +86,92 @@ static const struct in6_addr in6addr_any = IN6ADDR_ANY_INIT;
 #endif
 
 typedef struct private_socket_default_socket_t private_socket_default_socket_t;
+typedef struct socket_set_t socket_set_t;
+
+/**
+ * Buffers for a single message to receive
+ */
+typedef struct {
+	union {
+		struct sockaddr_in in4;
+		struct sockaddr_in6 in6;
+	} src;
+	char ancillary[64];
+	struct iovec iov;
+} msg_buf_t;
+
+/**
+ * Set of sockets bound to our ports, one set is used per receiver thread
+ */
+struct socket_set_t {
+
+	/**
+	 * IPv4 socket (500 or port)
+	 */
+	int ipv4;
+
+	/**
+	 * IPv4 socket for NAT-T (4500 or natt)
+	 */
+	int ipv4_natt;
+
+	/**
+	 * IPv6 socket (500 or port)
+	 */
+	int ipv6;
+
+	/**
+	 * IPv6 socket for NAT-T (4500 or natt)
+	 */
+	int ipv6_natt;
+
+	/**
+	 * Mutex to access the receive buffers, in case threads share a set
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Receive buffers, batch_size * max_packet bytes
+	 */
+	char *buffer;
+
+	/**
+	 * Address and ancillary data buffers, batch_size entries
+	 */
+	msg_buf_t *bufs;
+
+#ifdef HAVE_RECVMMSG
+	/**
+	 * Message headers passed to recvmmsg(), batch_size entries
+	 */
+	struct mmsghdr *msgs;
+#endif
+
+	/**
+	 * Packets received in the last batch
+	 */
+	packet_t **packets;
+
+	/**
+	 * Number of packets received in the last batch
+	 */
+	u_int received;
+
+	/**
+	 * Number of packets of the last batch already returned
+	 */
+	u_int returned;
+
+	/**
+	 * Number of packets received via this set
+	 */
+	u_int packet_count;
+
+	/**
+	 * Number of batches read via this set
+	 */
+	u_int batch_count;
+};
 
 /**
  * Private data of an socket_t object
@@ -96,24 +194,29 @@ struct private_socket_default_socket_t {
 	u_int16_t natt;
 
 	/**
-	 * IPv4 socket (500 or port)
+	 * Socket sets, the first one is also used to send packets
 	 */
-	int ipv4;
+	socket_set_t *sets;
 
 	/**
-	 * IPv4 socket for NAT-T (4500 or natt)
+	 * Number of socket sets, i.e. receiver threads
 	 */
-	int ipv4_natt;
+	u_int receivers;
 
 	/**
-	 * IPv6 socket (500 or port)
+	 * Number of sets assigned to receiver threads so far
 	 */
-	int ipv6;
+	u_int assigned;
 
 	/**
-	 * IPv6 socket for NAT-T (4500 or natt)
+	 * Mutex to assign socket sets to threads
 	 */
-	int ipv6_natt;
+	mutex_t *mutex;
+
+	/**
+	 * Socket set assigned to the current thread
+	 */
+	thread_value_t *current;
 
 	/**
 	 * DSCP value set on IPv4 socket
@@ -140,47 +243,168 @@ struct private_socket_default_socket_t {
 	 */
 	int max_packet;
 
+	/**
+	 * Maximum number of packets to read with a single call
+	 */
+	u_int batch_size;
+
+	/**
+	 * Lock to change DSCP values while no other thread sends packets
+	 */
+	rwlock_t *dscp_lock;
+
 	/**
 	 * TRUE if the source address should be set on outbound packets
 	 */
 	bool set_source;
 };
 
-METHOD(socket_t, receiver, status_t,
-	private_socket_default_socket_t *this, packet_t **packet)
+/**
+ * Create a packet from a received message, returns NULL if it is invalid
+ */
+static packet_t *parse_packet(struct msghdr *msg, char *buffer, int bytes_read,
+							  u_int16_t port)
 {
-	char buffer[this->max_packet];
-	chunk_t data;
+	struct cmsghdr *cmsgptr;
+	host_t *source, *dest = NULL;
 	packet_t *pkt;
-	host_t *source = NULL, *dest = NULL;
-	int bytes_read = 0;
-	bool oldstate;
 
+	if (msg->msg_flags & MSG_TRUNC)
+	{
+		DBG1(DBG_NET, "receive buffer too small, packet discarded");
+		return NULL;
+	}
+	DBG3(DBG_NET, "received packet %b", buffer, bytes_read);
+
+	/* read ancillary data to get destination address */
+	for (cmsgptr = CMSG_FIRSTHDR(msg); cmsgptr != NULL;
+		 cmsgptr = CMSG_NXTHDR(msg, cmsgptr))
+	{
+		if (cmsgptr->cmsg_len == 0)
+		{
+			DBG1(DBG_NET, "error reading ancillary data");
+			return NULL;
+		}
+
+#ifdef HAVE_IN6_PKTINFO
+		if (cmsgptr->cmsg_level == SOL_IPV6 &&
+			cmsgptr->cmsg_type == IPV6_PKTINFO)
+		{
+			struct in6_pktinfo *pktinfo;
+			pktinfo = (struct in6_pktinfo*)CMSG_DATA(cmsgptr);
+			struct sockaddr_in6 dst;
+
+			memset(&dst, 0, sizeof(dst));
+			memcpy(&dst.sin6_addr, &pktinfo->ipi6_addr, sizeof(dst.sin6_addr));
+			dst.sin6_family = AF_INET6;
+			dst.sin6_port = htons(port);
+			dest = host_create_from_sockaddr((sockaddr_t*)&dst);
+		}
+#endif /* HAVE_IN6_PKTINFO */
+		if (cmsgptr->cmsg_level == SOL_IP &&
+#ifdef IP_PKTINFO
+			cmsgptr->cmsg_type == IP_PKTINFO
+#elif defined(IP_RECVDSTADDR)
+			cmsgptr->cmsg_type == IP_RECVDSTADDR
+#else
+			FALSE
+#endif
+			)
+		{
+			struct in_addr *addr;
+			struct sockaddr_in dst;
+
+#ifdef IP_PKTINFO
+			struct in_pktinfo *pktinfo;
+			pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsgptr);
+			addr = &pktinfo->ipi_addr;
+#elif defined(IP_RECVDSTADDR)
+			addr = (struct in_addr*)CMSG_DATA(cmsgptr);
+#endif
+			memset(&dst, 0, sizeof(dst));
+			memcpy(&dst.sin_addr, addr, sizeof(dst.sin_addr));
+
+			dst.sin_family = AF_INET;
+			dst.sin_port = htons(port);
+			dest = host_create_from_sockaddr((sockaddr_t*)&dst);
+		}
+		if (dest)
+		{
+			break;
+		}
+	}
+	if (dest == NULL)
+	{
+		DBG1(DBG_NET, "error reading IP header");
+		return NULL;
+	}
+	source = host_create_from_sockaddr((sockaddr_t*)msg->msg_name);
+
+	pkt = packet_create();
+	pkt->set_source(pkt, source);
+	pkt->set_destination(pkt, dest);
+	DBG2(DBG_NET, "received packet: from %#H to %#H", source, dest);
+	pkt->set_data(pkt, chunk_clone(chunk_create(buffer, bytes_read)));
+	return pkt;
+}
+
+/**
+ * Prepare a message header to receive data into the given buffers
+ */
+static void init_msghdr(struct msghdr *msg, msg_buf_t *buf, char *data,
+						int len)
+{
+	buf->iov.iov_base = data;
+	buf->iov.iov_len = len;
+	msg->msg_name = &buf->src;
+	msg->msg_namelen = sizeof(buf->src);
+	msg->msg_iov = &buf->iov;
+	msg->msg_iovlen = 1;
+	msg->msg_control = buf->ancillary;
+	msg->msg_controllen = sizeof(buf->ancillary);
+	msg->msg_flags = 0;
+}
+
+/**
+ * Wait for data on the sockets of a set and read a batch of packets into it
+ */
+static status_t receive_batch(private_socket_default_socket_t *this,
+							  socket_set_t *set)
+{
+	msg_buf_t *bufs = set->bufs;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr *msgs = set->msgs;
+	int i;
+#else
+	struct msghdr msg;
+#endif
+	packet_t *pkt;
+	bool oldstate;
 	fd_set rfds;
-	int max_fd = 0, selected = 0;
+	int max_fd = 0, selected = 0, count;
 	u_int16_t port = 0;
 
 	FD_ZERO(&rfds);
 
-	if (this->ipv4 != -1)
+	if (set->ipv4 != -1)
 	{
-		FD_SET(this->ipv4, &rfds);
-		max_fd = max(max_fd, this->ipv4);
+		FD_SET(set->ipv4, &rfds);
+		max_fd = max(max_fd, set->ipv4);
 	}
-	if (this->ipv4_natt != -1)
+	if (set->ipv4_natt != -1)
 	{
-		FD_SET(this->ipv4_natt, &rfds);
-		max_fd = max(max_fd, this->ipv4_natt);
+		FD_SET(set->ipv4_natt, &rfds);
+		max_fd = max(max_fd, set->ipv4_natt);
 	}
-	if (this->ipv6 != -1)
+	if (set->ipv6 != -1)
 	{
-		FD_SET(this->ipv6, &rfds);
-		max_fd = max(max_fd, this->ipv6);
+		FD_SET(set->ipv6, &rfds);
+		max_fd = max(max_fd, set->ipv6);
 	}
-	if (this->ipv6_natt != -1)
+	if (set->ipv6_natt != -1)
 	{
-		FD_SET(this->ipv6_natt, &rfds);
-		max_fd = max(max_fd, this->ipv6_natt);
+		FD_SET(set->ipv6_natt, &rfds);
+		max_fd = max(max_fd, set->ipv6_natt);
 	}
 
 	DBG2(DBG_NET, "waiting for data on sockets");
@@ -192,159 +416,127 @@ METHOD(socket_t, receiver, status_t,
 	}
 	thread_cancelability(oldstate);
 
-	if (FD_ISSET(this->ipv4, &rfds))
+	if (FD_ISSET(set->ipv4, &rfds))
 	{
 		port = this->port;
-		selected = this->ipv4;
+		selected = set->ipv4;
 	}
-	if (FD_ISSET(this->ipv4_natt, &rfds))
+	if (FD_ISSET(set->ipv4_natt, &rfds))
 	{
 		port = this->natt;
-		selected = this->ipv4_natt;
+		selected = set->ipv4_natt;
 	}
-	if (FD_ISSET(this->ipv6, &rfds))
+	if (FD_ISSET(set->ipv6, &rfds))
 	{
 		port = this->port;
-		selected = this->ipv6;
+		selected = set->ipv6;
 	}
-	if (FD_ISSET(this->ipv6_natt, &rfds))
+	if (FD_ISSET(set->ipv6_natt, &rfds))
 	{
 		port = this->natt;
-		selected = this->ipv6_natt;
-	}
-	if (selected)
-	{
-		struct msghdr msg;
-		struct cmsghdr *cmsgptr;
-		struct iovec iov;
-		char ancillary[64];
-		union {
-			struct sockaddr_in in4;
-			struct sockaddr_in6 in6;
-		} src;
-
-		msg.msg_name = &src;
-		msg.msg_namelen = sizeof(src);
-		iov.iov_base = buffer;
-		iov.iov_len = this->max_packet;
-		msg.msg_iov = &iov;
-		msg.msg_iovlen = 1;
-		msg.msg_control = ancillary;
-		msg.msg_controllen = sizeof(ancillary);
-		msg.msg_flags = 0;
-		bytes_read = recvmsg(selected, &msg, 0);
-		if (bytes_read < 0)
-		{
-			DBG1(DBG_NET, "error reading socket: %s", strerror(errno));
-			return FAILED;
-		}
-		if (msg.msg_flags & MSG_TRUNC)
+		selected = set->ipv6_natt;
+	}
+	if (!selected)
+	{
+		/* oops, shouldn't happen */
+		return FAILED;
+	}
+
+#ifdef HAVE_RECVMMSG
+	for (i = 0; i < this->batch_size; i++)
+	{
+		init_msghdr(&msgs[i].msg_hdr, &bufs[i],
+					set->buffer + i * this->max_packet, this->max_packet);
+	}
+	/* returns after the first packet with whatever else is already queued */
+	count = recvmmsg(selected, msgs, this->batch_size, MSG_WAITFORONE, NULL);
+	if (count < 0)
+	{
+		DBG1(DBG_NET, "error reading socket: %s", strerror(errno));
+		return FAILED;
+	}
+	for (i = 0; i < count; i++)
+	{
+		pkt = parse_packet(&msgs[i].msg_hdr, bufs[i].iov.iov_base,
+						   msgs[i].msg_len, port);
+		if (pkt)
 		{
-			DBG1(DBG_NET, "receive buffer too small, packet discarded");
-			return FAILED;
+			set->packets[set->received++] = pkt;
 		}
-		DBG3(DBG_NET, "received packet %b", buffer, bytes_read);
+	}
+#else /* !HAVE_RECVMMSG */
+	init_msghdr(&msg, &bufs[0], set->buffer, this->max_packet);
+	count = recvmsg(selected, &msg, 0);
+	if (count < 0)
+	{
+		DBG1(DBG_NET, "error reading socket: %s", strerror(errno));
+		return FAILED;
+	}
+	pkt = parse_packet(&msg, set->buffer, count, port);
+	if (pkt)
+	{
+		set->packets[set->received++] = pkt;
+	}
+#endif /* HAVE_RECVMMSG */
+	set->batch_count++;
+	set->packet_count += set->received;
+	return set->received ? SUCCESS : FAILED;
+}
 
-		/* read ancillary data to get destination address */
-		for (cmsgptr = CMSG_FIRSTHDR(&msg); cmsgptr != NULL;
-			 cmsgptr = CMSG_NXTHDR(&msg, cmsgptr))
-		{
-			if (cmsgptr->cmsg_len == 0)
-			{
-				DBG1(DBG_NET, "error reading ancillary data");
-				return FAILED;
-			}
+/**
+ * Get the socket set assigned to the calling thread
+ */
+static socket_set_t *get_socket_set(private_socket_default_socket_t *this)
+{
+	socket_set_t *set;
 
-#ifdef HAVE_IN6_PKTINFO
-			if (cmsgptr->cmsg_level == SOL_IPV6 &&
-				cmsgptr->cmsg_type == IPV6_PKTINFO)
-			{
-				struct in6_pktinfo *pktinfo;
-				pktinfo = (struct in6_pktinfo*)CMSG_DATA(cmsgptr);
-				struct sockaddr_in6 dst;
-
-				memset(&dst, 0, sizeof(dst));
-				memcpy(&dst.sin6_addr, &pktinfo->ipi6_addr, sizeof(dst.sin6_addr));
-				dst.sin6_family = AF_INET6;
-				dst.sin6_port = htons(port);
-				dest = host_create_from_sockaddr((sockaddr_t*)&dst);
-			}
-#endif /* HAVE_IN6_PKTINFO */
-			if (cmsgptr->cmsg_level == SOL_IP &&
-#ifdef IP_PKTINFO
-				cmsgptr->cmsg_type == IP_PKTINFO
-#elif defined(IP_RECVDSTADDR)
-				cmsgptr->cmsg_type == IP_RECVDSTADDR
-#else
-				FALSE
-#endif
-				)
-			{
-				struct in_addr *addr;
-				struct sockaddr_in dst;
+	set = this->current->get(this->current);
+	if (!set)
+	{
+		this->mutex->lock(this->mutex);
+		set = &this->sets[this->assigned++ % this->receivers];
+		this->mutex->unlock(this->mutex);
+		this->current->set(this->current, set);
+	}
+	return set;
+}
 
-#ifdef IP_PKTINFO
-				struct in_pktinfo *pktinfo;
-				pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsgptr);
-				addr = &pktinfo->ipi_addr;
-#elif defined(IP_RECVDSTADDR)
-				addr = (struct in_addr*)CMSG_DATA(cmsgptr);
-#endif
-				memset(&dst, 0, sizeof(dst));
-				memcpy(&dst.sin_addr, addr, sizeof(dst.sin_addr));
+METHOD(socket_t, receiver, status_t,
+	private_socket_default_socket_t *this, packet_t **packet)
+{
+	socket_set_t *set;
+	status_t status = SUCCESS;
 
-				dst.sin_family = AF_INET;
-				dst.sin_port = htons(port);
-				dest = host_create_from_sockaddr((sockaddr_t*)&dst);
-			}
-			if (dest)
-			{
-				break;
-			}
-		}
-		if (dest == NULL)
-		{
-			DBG1(DBG_NET, "error reading IP header");
-			return FAILED;
-		}
-		source = host_create_from_sockaddr((sockaddr_t*)&src);
+	set = get_socket_set(this);
 
-		pkt = packet_create();
-		pkt->set_source(pkt, source);
-		pkt->set_destination(pkt, dest);
-		DBG2(DBG_NET, "received packet: from %#H to %#H", source, dest);
-		data = chunk_create(buffer, bytes_read);
-		pkt->set_data(pkt, chunk_clone(data));
+	set->mutex->lock(set->mutex);
+	/* receiving is blocking and the thread can be cancelled */
+	thread_cleanup_push((thread_cleanup_t)set->mutex->unlock, set->mutex);
+	if (set->returned == set->received)
+	{
+		set->returned = set->received = 0;
+		status = receive_batch(this, set);
 	}
-	else
+	if (status == SUCCESS)
 	{
-		/* oops, shouldn't happen */
-		return FAILED;
+		*packet = set->packets[set->returned++];
 	}
-	/* return packet */
-	*packet = pkt;
-	return SUCCESS;
+	thread_cleanup_pop(TRUE);
+	return status;
 }
 
-METHOD(socket_t, sender, status_t,
-	private_socket_default_socket_t *this, packet_t *packet)
+/**
+ * Select the socket to send a packet, returns -1 if none found
+ */
+static int get_send_socket(private_socket_default_socket_t *this,
+						   packet_t *packet, u_int8_t **dscp)
 {
 	int sport, skt = -1, family;
-	ssize_t bytes_sent;
-	chunk_t data;
 	host_t *src, *dst;
-	struct msghdr msg;
-	struct cmsghdr *cmsg;
-	struct iovec iov;
-	u_int8_t *dscp;
 
 	src = packet->get_source(packet);
 	dst = packet->get_destination(packet);
-	data = packet->get_data(packet);
-
-	DBG2(DBG_NET, "sending packet: from %#H to %#H", src, dst);
 
-	/* send data */
 	sport = src->get_port(src);
 	family = dst->get_family(dst);
 	if (sport == 0 || sport == this->port)
@@ -352,15 +544,15 @@ METHOD(socket_t, sender, status_t,
 		switch (family)
 		{
 			case AF_INET:
-				skt = this->ipv4;
-				dscp = &this->dscp4;
+				skt = this->sets[0].ipv4;
+				*dscp = &this->dscp4;
 				break;
 			case AF_INET6:
-				skt = this->ipv6;
-				dscp = &this->dscp6;
+				skt = this->sets[0].ipv6;
+				*dscp = &this->dscp6;
 				break;
 			default:
-				return FAILED;
+				return -1;
 		}
 	}
 	else if (sport == this->natt)
@@ -368,92 +560,121 @@ METHOD(socket_t, sender, status_t,
 		switch (family)
 		{
 			case AF_INET:
-				skt = this->ipv4_natt;
-				dscp = &this->dscp4_natt;
+				skt = this->sets[0].ipv4_natt;
+				*dscp = &this->dscp4_natt;
 				break;
 			case AF_INET6:
-				skt = this->ipv6_natt;
-				dscp = &this->dscp6_natt;
+				skt = this->sets[0].ipv6_natt;
+				*dscp = &this->dscp6_natt;
 				break;
 			default:
-				return FAILED;
+				return -1;
 		}
 	}
 	if (skt == -1)
 	{
 		DBG1(DBG_NET, "no socket found to send IPv%d packet from port %d",
 			 family == AF_INET ? 4 : 6, sport);
-		return FAILED;
 	}
+	return skt;
+}
+
+/**
+ * Set the DSCP value of a packet on the socket used to send it
+ */
+static void set_dscp(int skt, u_int8_t *dscp, packet_t *packet)
+{
+	host_t *dst;
 
-	/* setting DSCP values per-packet in a cmsg seems not to be supported
-	 * on Linux. We instead setsockopt() before sending it, this should be
-	 * safe as only a single thread calls send(). */
-	if (*dscp != packet->get_dscp(packet))
+	dst = packet->get_destination(packet);
+	if (dst->get_family(dst) == AF_INET)
 	{
-		if (family == AF_INET)
-		{
-			u_int8_t ds4;
+		u_int8_t ds4;
 
-			ds4 = packet->get_dscp(packet) << 2;
-			if (setsockopt(skt, SOL_IP, IP_TOS, &ds4, sizeof(ds4)) == 0)
-			{
-				*dscp = packet->get_dscp(packet);
-			}
-			else
-			{
-				DBG1(DBG_NET, "unable to set IP_TOS on socket: %s",
-					 strerror(errno));
-			}
+		ds4 = packet->get_dscp(packet) << 2;
+		if (setsockopt(skt, SOL_IP, IP_TOS, &ds4, sizeof(ds4)) == 0)
+		{
+			*dscp = packet->get_dscp(packet);
 		}
 		else
 		{
-			u_int ds6;
+			DBG1(DBG_NET, "unable to set IP_TOS on socket: %s",
+				 strerror(errno));
+		}
+	}
+	else
+	{
+		u_int ds6;
 
-			ds6 = packet->get_dscp(packet) << 2;
-			if (setsockopt(skt, SOL_IPV6, IPV6_TCLASS, &ds6, sizeof(ds6)) == 0)
-			{
-				*dscp = packet->get_dscp(packet);
-			}
-			else
-			{
-				DBG1(DBG_NET, "unable to set IPV6_TCLASS on socket: %s",
-					 strerror(errno));
-			}
+		ds6 = packet->get_dscp(packet) << 2;
+		if (setsockopt(skt, SOL_IPV6, IPV6_TCLASS, &ds6, sizeof(ds6)) == 0)
+		{
+			*dscp = packet->get_dscp(packet);
+		}
+		else
+		{
+			DBG1(DBG_NET, "unable to set IPV6_TCLASS on socket: %s",
+				 strerror(errno));
 		}
 	}
+}
+
+/**
+ * Buffers for a single message to send
+ */
+typedef struct {
+	struct iovec iov;
+	char ancillary[64];
+} send_buf_t;
+
+/**
+ * Prepare a message header to send the given packet
+ */
+static void init_send_msghdr(private_socket_default_socket_t *this,
+							 packet_t *packet, struct msghdr *msg,
+							 send_buf_t *buf)
+{
+	struct cmsghdr *cmsg;
+	host_t *src, *dst;
+	chunk_t data;
 
-	memset(&msg, 0, sizeof(struct msghdr));
-	msg.msg_name = dst->get_sockaddr(dst);;
-	msg.msg_namelen = *dst->get_sockaddr_len(dst);
-	iov.iov_base = data.ptr;
-	iov.iov_len = data.len;
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	msg.msg_flags = 0;
+	src = packet->get_source(packet);
+	dst = packet->get_destination(packet);
+	data = packet->get_data(packet);
+
+	DBG2(DBG_NET, "sending packet: from %#H to %#H", src, dst);
+
+	memset(msg, 0, sizeof(struct msghdr));
+	msg->msg_name = dst->get_sockaddr(dst);
+	msg->msg_namelen = *dst->get_sockaddr_len(dst);
+	buf->iov.iov_base = data.ptr;
+	buf->iov.iov_len = data.len;
+	msg->msg_iov = &buf->iov;
+	msg->msg_iovlen = 1;
+	msg->msg_flags = 0;
 
 	if (this->set_source && !src->is_anyaddr(src))
 	{
-		if (family == AF_INET)
+		memset(buf->ancillary, 0, sizeof(buf->ancillary));
+		if (dst->get_family(dst) == AF_INET)
 		{
 #if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
 			struct in_addr *addr;
 			struct sockaddr_in *sin;
 #ifdef IP_PKTINFO
-			char buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
 			struct in_pktinfo *pktinfo;
+
+			msg->msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
 #elif defined(IP_SENDSRCADDR)
-			char buf[CMSG_SPACE(sizeof(struct in_addr))];
+			msg->msg_controllen = CMSG_SPACE(sizeof(struct in_addr));
 #endif
-			msg.msg_control = buf;
-			msg.msg_controllen = sizeof(buf);
-			cmsg = CMSG_FIRSTHDR(&msg);
+			msg->msg_control = buf->ancillary;
+			cmsg = CMSG_FIRSTHDR(msg);
 			cmsg->cmsg_level = SOL_IP;
 #ifdef IP_PKTINFO
 			cmsg->cmsg_type = IP_PKTINFO;
 			cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
 			pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsg);
-			memset(pktinfo, 0, sizeof(struct in_pktinfo));
 			addr = &pktinfo->ipi_spec_dst;
 #elif defined(IP_SENDSRCADDR)
 			cmsg->cmsg_type = IP_SENDSRCADDR;
@@ -467,32 +688,154 @@ METHOD(socket_t, sender, status_t,
 #ifdef HAVE_IN6_PKTINFO
 		else
 		{
-			char buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
 			struct in6_pktinfo *pktinfo;
 			struct sockaddr_in6 *sin;
 
-			msg.msg_control = buf;
-			msg.msg_controllen = sizeof(buf);
-			cmsg = CMSG_FIRSTHDR(&msg);
+			msg->msg_control = buf->ancillary;
+			msg->msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
+			cmsg = CMSG_FIRSTHDR(msg);
 			cmsg->cmsg_level = SOL_IPV6;
 			cmsg->cmsg_type = IPV6_PKTINFO;
 			cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
 			pktinfo = (struct in6_pktinfo*)CMSG_DATA(cmsg);
-			memset(pktinfo, 0, sizeof(struct in6_pktinfo));
 			sin = (struct sockaddr_in6*)src->get_sockaddr(src);
 			memcpy(&pktinfo->ipi6_addr, &sin->sin6_addr, sizeof(struct in6_addr));
 		}
 #endif /* HAVE_IN6_PKTINFO */
 	}
+}
 
-	bytes_sent = sendmsg(skt, &msg, 0);
+/**
+ * Send a number of packets over the same socket without blocking. Returns the
+ * number of packets processed, which is less than count if the socket buffer
+ * is full, packets sent successfully are added to sent
+ */
+static u_int send_packets(private_socket_default_socket_t *this, int skt,
+						  packet_t **packets, u_int count, u_int *sent)
+{
+	send_buf_t bufs[count];
+	u_int done = 0;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[count];
+	u_int i;
+	int len;
+
+	for (i = 0; i < count; i++)
+	{
+		init_send_msghdr(this, packets[i], &msgs[i].msg_hdr, &bufs[i]);
+	}
+	while (done < count)
+	{
+		/* partially sent batches are continued with the next call, which
+		 * fails with EAGAIN if the socket buffer is still full */
+		len = sendmmsg(skt, &msgs[done], count - done, MSG_DONTWAIT);
+		if (len <= 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				break;
+			}
+			DBG1(DBG_NET, "error writing to socket: %s", strerror(errno));
+			/* skip the failed packet and try the remaining ones */
+			done++;
+			continue;
+		}
+		done += len;
+		*sent += len;
+	}
+#else /* !HAVE_SENDMMSG */
+	struct msghdr msg;
+	ssize_t bytes_sent;
 
-	if (bytes_sent != data.len)
+	for (; done < count; done++)
 	{
-		DBG1(DBG_NET, "error writing to socket: %s", strerror(errno));
-		return FAILED;
+		init_send_msghdr(this, packets[done], &msg, &bufs[done]);
+		bytes_sent = sendmsg(skt, &msg, MSG_DONTWAIT);
+		if (bytes_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			break;
+		}
+		if (bytes_sent != packets[done]->get_data(packets[done]).len)
+		{
+			DBG1(DBG_NET, "error writing to socket: %s", strerror(errno));
+			continue;
+		}
+		(*sent)++;
 	}
-	return SUCCESS;
+#endif /* HAVE_SENDMMSG */
+	return done;
+}
+
+/**
+ * Wait until a socket has room to send packets
+ */
+static void wait_writable(int skt)
+{
+	fd_set wfds;
+
+	FD_ZERO(&wfds);
+	FD_SET(skt, &wfds);
+	if (select(skt + 1, NULL, &wfds, NULL, NULL) < 0)
+	{
+		DBG1(DBG_NET, "waiting for socket failed: %s", strerror(errno));
+	}
+}
+
+METHOD(socket_t, send_batch, u_int,
+	private_socket_default_socket_t *this, packet_t **packets, u_int count)
+{
+	u_int8_t *dscp, *next_dscp;
+	u_int i = 0, j, done, sent = 0;
+	int skt;
+
+	while (i < count)
+	{
+		skt = get_send_socket(this, packets[i], &dscp);
+		if (skt == -1)
+		{
+			i++;
+			continue;
+		}
+		/* send consecutive packets using the same socket and DSCP value at
+		 * once */
+		for (j = i + 1; j < count; j++)
+		{
+			if (get_send_socket(this, packets[j], &next_dscp) != skt ||
+				packets[j]->get_dscp(packets[j]) !=
+									packets[i]->get_dscp(packets[i]))
+			{
+				break;
+			}
+		}
+		/* setting DSCP values per-packet in a cmsg seems not to be supported
+		 * on Linux. We instead setsockopt() before sending it, as multiple
+		 * threads might send, this is done while holding the write lock. */
+		this->dscp_lock->read_lock(this->dscp_lock);
+		if (*dscp != packets[i]->get_dscp(packets[i]))
+		{
+			this->dscp_lock->unlock(this->dscp_lock);
+			this->dscp_lock->write_lock(this->dscp_lock);
+			if (*dscp != packets[i]->get_dscp(packets[i]))
+			{
+				set_dscp(skt, dscp, packets[i]);
+			}
+		}
+		done = send_packets(this, skt, &packets[i], j - i, &sent);
+		this->dscp_lock->unlock(this->dscp_lock);
+		if (done < j - i)
+		{	/* the socket buffer is full, wait without holding the lock and
+			 * retry with the remaining packets */
+			wait_writable(skt);
+		}
+		i += done;
+	}
+	return sent;
+}
+
+METHOD(socket_t, sender, status_t,
+	private_socket_default_socket_t *this, packet_t *packet)
+{
+	return send_batch(this, &packet, 1) == 1 ? SUCCESS : FAILED;
 }
 
 METHOD(socket_t, get_port, u_int16_t,
@@ -556,6 +899,16 @@ static int open_socket(private_socket_default_socket_t *this,
 		close(skt);
 		return -1;
 	}
+#ifdef SO_REUSEPORT
+	/* let the kernel distribute packets to the sockets of all receivers */
+	if (this->receivers > 1 &&
+		setsockopt(skt, SOL_SOCKET, SO_REUSEPORT, (void*)&on, sizeof(on)) < 0)
+	{
+		DBG1(DBG_NET, "unable to set SO_REUSEPORT on socket: %s", strerror(errno));
+		close(skt);
+		return -1;
+	}
+#endif /* SO_REUSEPORT */
 
 	/* bind the socket */
 	if (bind(skt, &addr.sockaddr, addrlen) < 0)
@@ -635,41 +988,127 @@ static void open_socketpair(private_socket_default_socket_t *this, int family,
 	}
 }
 
-METHOD(socket_t, destroy, void,
-	private_socket_default_socket_t *this)
+/**
+ * Open the sockets of a socket set, returns FALSE if none could be opened
+ */
+static bool open_socket_set(private_socket_default_socket_t *this,
+							socket_set_t *set)
+{
+	set->ipv4 = set->ipv4_natt = set->ipv6 = set->ipv6_natt = -1;
+	set->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+	set->buffer = malloc(this->batch_size * this->max_packet);
+	set->packets = calloc(this->batch_size, sizeof(packet_t*));
+	set->bufs = calloc(this->batch_size, sizeof(msg_buf_t));
+#ifdef HAVE_RECVMMSG
+	set->msgs = calloc(this->batch_size, sizeof(struct mmsghdr));
+#endif
+
+	/* we allocate IPv6 sockets first as that will reserve randomly allocated
+	 * ports also for IPv4. On OS X, we have to do it the other way round
+	 * for the same effect. */
+#ifdef __APPLE__
+	open_socketpair(this, AF_INET, &set->ipv4, &set->ipv4_natt, "IPv4");
+	open_socketpair(this, AF_INET6, &set->ipv6, &set->ipv6_natt, "IPv6");
+#else /* !__APPLE__ */
+	open_socketpair(this, AF_INET6, &set->ipv6, &set->ipv6_natt, "IPv6");
+	open_socketpair(this, AF_INET, &set->ipv4, &set->ipv4_natt, "IPv4");
+#endif /* __APPLE__ */
+
+	return set->ipv4 != -1 || set->ipv6 != -1;
+}
+
+/**
+ * Close the sockets of a socket set and free its resources
+ */
+static void close_socket_set(socket_set_t *set)
 {
-	if (this->ipv4 != -1)
+	if (set->ipv4 != -1)
+	{
+		close(set->ipv4);
+	}
+	if (set->ipv4_natt != -1)
+	{
+		close(set->ipv4_natt);
+	}
+	if (set->ipv6 != -1)
 	{
-		close(this->ipv4);
+		close(set->ipv6);
 	}
-	if (this->ipv4_natt != -1)
+	if (set->ipv6_natt != -1)
 	{
-		close(this->ipv4_natt);
+		close(set->ipv6_natt);
 	}
-	if (this->ipv6 != -1)
+	while (set->returned < set->received)
 	{
-		close(this->ipv6);
+		packet_t *packet = set->packets[set->returned++];
+
+		packet->destroy(packet);
 	}
-	if (this->ipv6_natt != -1)
+	set->mutex->destroy(set->mutex);
+#ifdef HAVE_RECVMMSG
+	free(set->msgs);
+#endif
+	free(set->bufs);
+	free(set->packets);
+	free(set->buffer);
+}
+
+METHOD(socket_t, destroy, void,
+	private_socket_default_socket_t *this)
+{
+	u_int i;
+
+	for (i = 0; i < this->receivers; i++)
 	{
-		close(this->ipv6_natt);
+		DBG1(DBG_NET, "receiver %u received %u packets in %u batches", i,
+			 this->sets[i].packet_count, this->sets[i].batch_count);
+		close_socket_set(&this->sets[i]);
 	}
+	free(this->sets);
+	this->current->destroy(this->current);
+	this->mutex->destroy(this->mutex);
+	this->dscp_lock->destroy(this->dscp_lock);
 	free(this);
 }
 
+METHOD(socket_t, get_receivers, u_int,
+	private_socket_default_socket_t *this)
+{
+	return this->receivers;
+}
+
+METHOD(socket_t, get_stats, bool,
+	private_socket_default_socket_t *this, u_int *packets, u_int *batches)
+{
+	u_int i;
+
+	*packets = *batches = 0;
+	for (i = 0; i < this->receivers; i++)
+	{	/* counters are only updated by the receiving thread, reading them
+		 * without holding the set's mutex (held while receiving) is fine */
+		*packets += this->sets[i].packet_count;
+		*batches += this->sets[i].batch_count;
+	}
+	return TRUE;
+}
+
 /*
  * See header for description
  */
 socket_default_socket_t *socket_default_socket_create()
 {
 	private_socket_default_socket_t *this;
+	u_int i;
 
 	INIT(this,
 		.public = {
 			.socket = {
 				.send = _sender,
+				.send_batch = _send_batch,
 				.receive = _receiver,
 				.get_port = _get_port,
+				.get_receivers = _get_receivers,
+				.get_stats = _get_stats,
 				.destroy = _destroy,
 			},
 		},
@@ -682,6 +1121,15 @@ socket_default_socket_t *socket_default_socket_create()
 		.set_source = lib->settings->get_bool(lib->settings,
 							"%s.plugins.socket-default.set_source", TRUE,
 							charon->name),
+		.receivers = lib->settings->get_int(lib->settings,
+							"%s.plugins.socket-default.receivers",
+							DEFAULT_RECEIVERS, charon->name),
+		.batch_size = lib->settings->get_int(lib->settings,
+							"%s.plugins.socket-default.batch_size",
+							DEFAULT_BATCH_SIZE, charon->name),
+		.current = thread_value_create(NULL),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.dscp_lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 	);
 
 	if (this->port && this->port == this->natt)
@@ -690,24 +1138,39 @@ socket_default_socket_t *socket_default_socket_create()
 			 "port randomly");
 		this->natt = 0;
 	}
+	this->receivers = max(this->receivers, 1);
+	this->batch_size = max(this->batch_size, 1);
+	this->batch_size = min(this->batch_size, MAX_BATCH_SIZE);
+#ifndef SO_REUSEPORT
+	if (this->receivers > 1)
+	{
+		DBG1(DBG_NET, "SO_REUSEPORT not supported, using a single receiver");
+		this->receivers = 1;
+	}
+#endif /* SO_REUSEPORT */
 
-	/* we allocate IPv6 sockets first as that will reserve randomly allocated
-	 * ports also for IPv4. On OS X, we have to do it the other way round
-	 * for the same effect. */
-#ifdef __APPLE__
-	open_socketpair(this, AF_INET, &this->ipv4, &this->ipv4_natt, "IPv4");
-	open_socketpair(this, AF_INET6, &this->ipv6, &this->ipv6_natt, "IPv6");
-#else /* !__APPLE__ */
-	open_socketpair(this, AF_INET6, &this->ipv6, &this->ipv6_natt, "IPv6");
-	open_socketpair(this, AF_INET, &this->ipv4, &this->ipv4_natt, "IPv4");
-#endif /* __APPLE__ */
-
-	if (this->ipv4 == -1 && this->ipv6 == -1)
+	this->sets = calloc(this->receivers, sizeof(socket_set_t));
+	for (i = 0; i < this->receivers; i++)
+	{
+		if (!open_socket_set(this, &this->sets[i]))
+		{
+			close_socket_set(&this->sets[i]);
+			break;
+		}
+	}
+	if (i == 0)
 	{
 		DBG1(DBG_NET, "could not create any sockets");
+		this->receivers = 0;
 		destroy(this);
 		return NULL;
 	}
+	if (i < this->receivers)
+	{
+		DBG1(DBG_NET, "could only open sockets for %u of %u receivers",
+			 i, this->receivers);
+		this->receivers = i;
+	}
 
 	return &this->public;
 }
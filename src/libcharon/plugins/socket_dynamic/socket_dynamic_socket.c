@@ -612,6 +612,21 @@ METHOD(socket_t, sender, status_t,
 	return SUCCESS;
 }
 
+METHOD(socket_t, send_batch, u_int,
+	private_socket_dynamic_socket_t *this, packet_t **packets, u_int count)
+{
+	u_int i, sent = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		if (sender(this, packets[i]) == SUCCESS)
+		{
+			sent++;
+		}
+	}
+	return sent;
+}
+
 METHOD(socket_t, get_port, u_int16_t,
 	private_socket_dynamic_socket_t *this, bool nat_t)
 {
@@ -620,6 +635,18 @@ METHOD(socket_t, get_port, u_int16_t,
 	return 0;
 }
 
+METHOD(socket_t, get_receivers, u_int,
+	private_socket_dynamic_socket_t *this)
+{
+	return 1;
+}
+
+METHOD(socket_t, get_stats, bool,
+	private_socket_dynamic_socket_t *this, u_int *packets, u_int *batches)
+{
+	return FALSE;
+}
+
 METHOD(socket_t, destroy, void,
 	private_socket_dynamic_socket_t *this)
 {
@@ -652,8 +679,11 @@ socket_dynamic_socket_t *socket_dynamic_socket_create()
 		.public = {
 			.socket = {
 				.send = _sender,
+				.send_batch = _send_batch,
 				.receive = _receiver,
 				.get_port = _get_port,
+				.get_receivers = _get_receivers,
+				.get_stats = _get_stats,
 				.destroy = _destroy,
 			},
 		},
@@ -20,9 +20,43 @@
 #include <daemon.h>
 #include <threading/mutex.h>
 #include <utils/lexparser.h>
+#include <collections/hashtable.h>
 
 typedef struct private_stroke_config_t private_stroke_config_t;
 
+/**
+ * Keys configs are indexed by
+ */
+typedef enum {
+	/** identity of the first local auth_cfg */
+	INDEX_LOCAL_ID,
+	/** identity of the first remote auth_cfg */
+	INDEX_REMOTE_ID,
+	/** local address of the ike_cfg */
+	INDEX_LOCAL_HOST,
+	/** remote address of the ike_cfg */
+	INDEX_REMOTE_HOST,
+	/** number of indices */
+	INDEX_MAX,
+} index_type_t;
+
+/**
+ * Index over configs by one of the keys
+ */
+typedef struct {
+
+	/**
+	 * Configs with a specific key, identification_t/host_t => bucket_t
+	 */
+	hashtable_t *buckets;
+
+	/**
+	 * Configs matching any or multiple keys, as entry_t, in list order
+	 */
+	linked_list_t *wildcards;
+
+} index_t;
+
 /**
  * private data of stroke_config
  */
@@ -43,6 +77,16 @@ struct private_stroke_config_t {
 	 */
 	mutex_t *mutex;
 
+	/**
+	 * Indices over configs in list, by index_type_t
+	 */
+	index_t index[INDEX_MAX];
+
+	/**
+	 * Sequence number of the config added last to list
+	 */
+	u_int seq;
+
 	/**
 	 * ca sections
 	 */
@@ -59,10 +103,454 @@ struct private_stroke_config_t {
 	stroke_attribute_t *attributes;
 };
 
+/**
+ * A config in an index
+ */
+typedef struct {
+
+	/**
+	 * Indexed config
+	 */
+	peer_cfg_t *cfg;
+
+	/**
+	 * Sequence number, to enumerate configs in the order of list
+	 */
+	u_int seq;
+
+} entry_t;
+
+/**
+ * Configs sharing a specific key
+ */
+typedef struct {
+
+	/**
+	 * Key, identification_t or host_t
+	 */
+	void *key;
+
+	/**
+	 * Configs, as entry_t, in list order
+	 */
+	linked_list_t *entries;
+
+} bucket_t;
+
+/**
+ * Hash an identity
+ */
+static u_int id_hash(identification_t *id)
+{
+	return id->hash(id, 0);
+}
+
+/**
+ * Compare two identities, including their type
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	return a->get_type(a) == b->get_type(b) && a->equals(a, b);
+}
+
+/**
+ * Hash the address of a host
+ */
+static u_int host_hash(host_t *host)
+{
+	return chunk_hash(host->get_address(host));
+}
+
+/**
+ * Compare the addresses of two hosts
+ */
+static bool host_equals(host_t *a, host_t *b)
+{
+	return a->ip_equals(a, b);
+}
+
+/**
+ * Get the identity of the first local or remote auth_cfg, if it does not
+ * match other identities
+ */
+static identification_t *get_id_key(peer_cfg_t *cfg, bool local)
+{
+	identification_t *id = NULL;
+	enumerator_t *enumerator;
+	auth_cfg_t *auth;
+
+	enumerator = cfg->create_auth_cfg_enumerator(cfg, local);
+	if (enumerator->enumerate(enumerator, &auth))
+	{
+		id = auth->get(auth, AUTH_RULE_IDENTITY);
+	}
+	enumerator->destroy(enumerator);
+	if (!id || id->get_type(id) == ID_ANY || id->contains_wildcards(id))
+	{
+		return NULL;
+	}
+	return id->clone(id);
+}
+
+/**
+ * Get the local or remote address of the ike_cfg, if it does not match other
+ * addresses
+ */
+static host_t *get_host_key(peer_cfg_t *cfg, bool local)
+{
+	ike_cfg_t *ike_cfg;
+	bool allow_any;
+	char *addr;
+	host_t *host;
+
+	ike_cfg = cfg->get_ike_cfg(cfg);
+	if (local)
+	{
+		addr = ike_cfg->get_my_addr(ike_cfg, &allow_any);
+	}
+	else
+	{
+		addr = ike_cfg->get_other_addr(ike_cfg, &allow_any);
+	}
+	if (allow_any)
+	{
+		return NULL;
+	}
+	/* hostnames are resolved for each lookup, so we index literal IPs only */
+	host = host_create_from_string(addr, 0);
+	if (host && host->is_anyaddr(host))
+	{
+		host->destroy(host);
+		return NULL;
+	}
+	return host;
+}
+
+/**
+ * Get the key of a config for an index, NULL if it matches any key
+ */
+static void *get_key(peer_cfg_t *cfg, index_type_t type)
+{
+	switch (type)
+	{
+		case INDEX_LOCAL_ID:
+			return get_id_key(cfg, TRUE);
+		case INDEX_REMOTE_ID:
+			return get_id_key(cfg, FALSE);
+		case INDEX_LOCAL_HOST:
+			return get_host_key(cfg, TRUE);
+		case INDEX_REMOTE_HOST:
+			return get_host_key(cfg, FALSE);
+		default:
+			return NULL;
+	}
+}
+
+/**
+ * Destroy a key returned by get_key()
+ */
+static void destroy_key(void *key, index_type_t type)
+{
+	switch (type)
+	{
+		case INDEX_LOCAL_ID:
+		case INDEX_REMOTE_ID:
+			((identification_t*)key)->destroy(key);
+			break;
+		case INDEX_LOCAL_HOST:
+		case INDEX_REMOTE_HOST:
+			((host_t*)key)->destroy(key);
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * Add a config appended to list to all indices
+ */
+static void index_add(private_stroke_config_t *this, peer_cfg_t *cfg)
+{
+	index_type_t type;
+	bucket_t *bucket;
+	entry_t *entry;
+	void *key;
+
+	this->seq++;
+	for (type = 0; type < INDEX_MAX; type++)
+	{
+		INIT(entry,
+			.cfg = cfg,
+			.seq = this->seq,
+		);
+		key = get_key(cfg, type);
+		if (!key)
+		{
+			this->index[type].wildcards->insert_last(
+										this->index[type].wildcards, entry);
+			continue;
+		}
+		bucket = this->index[type].buckets->get(this->index[type].buckets, key);
+		if (bucket)
+		{
+			destroy_key(key, type);
+		}
+		else
+		{
+			INIT(bucket,
+				.key = key,
+				.entries = linked_list_create(),
+			);
+			this->index[type].buckets->put(this->index[type].buckets,
+										   bucket->key, bucket);
+		}
+		bucket->entries->insert_last(bucket->entries, entry);
+	}
+}
+
+/**
+ * Remove the entry of a config from a list of entries
+ */
+static void remove_entry(linked_list_t *entries, peer_cfg_t *cfg)
+{
+	enumerator_t *enumerator;
+	entry_t *entry;
+
+	enumerator = entries->create_enumerator(entries);
+	while (enumerator->enumerate(enumerator, &entry))
+	{
+		if (entry->cfg == cfg)
+		{
+			entries->remove_at(entries, enumerator);
+			free(entry);
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Destroy a bucket
+ */
+static void bucket_destroy(bucket_t *bucket, index_type_t type)
+{
+	bucket->entries->destroy_function(bucket->entries, free);
+	destroy_key(bucket->key, type);
+	free(bucket);
+}
+
+/**
+ * Remove a config from all indices
+ */
+static void index_remove(private_stroke_config_t *this, peer_cfg_t *cfg)
+{
+	index_type_t type;
+	bucket_t *bucket;
+	void *key;
+
+	for (type = 0; type < INDEX_MAX; type++)
+	{
+		key = get_key(cfg, type);
+		if (!key)
+		{
+			remove_entry(this->index[type].wildcards, cfg);
+			continue;
+		}
+		bucket = this->index[type].buckets->get(this->index[type].buckets, key);
+		if (bucket)
+		{
+			remove_entry(bucket->entries, cfg);
+			if (!bucket->entries->get_count(bucket->entries))
+			{
+				this->index[type].buckets->remove(this->index[type].buckets,
+												  bucket->key);
+				bucket_destroy(bucket, type);
+			}
+		}
+		destroy_key(key, type);
+	}
+}
+
+/**
+ * Look up the configs with a specific key in an index, returns the number of
+ * candidates or -1 if the key matches other keys and the index is not usable
+ */
+static int index_lookup(private_stroke_config_t *this, index_type_t type,
+						void *key, bucket_t **bucket)
+{
+	identification_t *id = key;
+	host_t *host = key;
+	int count;
+
+	switch (type)
+	{
+		case INDEX_LOCAL_ID:
+		case INDEX_REMOTE_ID:
+			if (!id || id->get_type(id) == ID_ANY || id->contains_wildcards(id))
+			{
+				return -1;
+			}
+			break;
+		case INDEX_LOCAL_HOST:
+		case INDEX_REMOTE_HOST:
+			if (!host || host->is_anyaddr(host))
+			{
+				return -1;
+			}
+			break;
+		default:
+			return -1;
+	}
+	*bucket = this->index[type].buckets->get(this->index[type].buckets, key);
+	count = this->index[type].wildcards->get_count(this->index[type].wildcards);
+	if (*bucket)
+	{
+		count += (*bucket)->entries->get_count((*bucket)->entries);
+	}
+	return count;
+}
+
+/**
+ * Enumerator over the candidates of an index
+ */
+typedef struct {
+
+	/**
+	 * Implements enumerator_t
+	 */
+	enumerator_t public;
+
+	/**
+	 * Enumerator over configs with the key, NULL if none
+	 */
+	enumerator_t *exact;
+
+	/**
+	 * Enumerator over configs matching any key
+	 */
+	enumerator_t *wildcards;
+
+	/**
+	 * Next entry of exact
+	 */
+	entry_t *next_exact;
+
+	/**
+	 * Next entry of wildcards
+	 */
+	entry_t *next_wildcard;
+
+	/**
+	 * Mutex to unlock on destruction
+	 */
+	mutex_t *mutex;
+
+} index_enumerator_t;
+
+/**
+ * Get the next entry of an enumerator, NULL if none left
+ */
+static entry_t *next_entry(enumerator_t *enumerator)
+{
+	entry_t *entry;
+
+	if (enumerator && enumerator->enumerate(enumerator, &entry))
+	{
+		return entry;
+	}
+	return NULL;
+}
+
+METHOD(enumerator_t, index_enumerate, bool,
+	index_enumerator_t *this, peer_cfg_t **cfg)
+{
+	/* merge both lists to enumerate configs in the order of the config list */
+	if (this->next_exact && (!this->next_wildcard ||
+							 this->next_exact->seq < this->next_wildcard->seq))
+	{
+		*cfg = this->next_exact->cfg;
+		this->next_exact = next_entry(this->exact);
+		return TRUE;
+	}
+	if (this->next_wildcard)
+	{
+		*cfg = this->next_wildcard->cfg;
+		this->next_wildcard = next_entry(this->wildcards);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+METHOD(enumerator_t, index_enumerator_destroy, void,
+	index_enumerator_t *this)
+{
+	DESTROY_IF(this->exact);
+	this->wildcards->destroy(this->wildcards);
+	this->mutex->unlock(this->mutex);
+	free(this);
+}
+
+/**
+ * Create an enumerator over the candidates of the more selective of two
+ * indices, NULL if neither is usable for the given keys.  The mutex has to be
+ * locked, it gets unlocked when the enumerator is destroyed.
+ */
+static enumerator_t *create_index_enumerator(private_stroke_config_t *this,
+											 index_type_t type_a, void *key_a,
+											 index_type_t type_b, void *key_b)
+{
+	index_enumerator_t *enumerator;
+	bucket_t *bucket_a = NULL, *bucket_b = NULL, *bucket;
+	int count_a, count_b;
+	index_type_t type;
+
+	count_a = index_lookup(this, type_a, key_a, &bucket_a);
+	count_b = index_lookup(this, type_b, key_b, &bucket_b);
+	if (count_a < 0 && count_b < 0)
+	{
+		return NULL;
+	}
+	if (count_b < 0 || (count_a >= 0 && count_a <= count_b))
+	{
+		type = type_a;
+		bucket = bucket_a;
+	}
+	else
+	{
+		type = type_b;
+		bucket = bucket_b;
+	}
+
+	INIT(enumerator,
+		.public = {
+			.enumerate = (void*)_index_enumerate,
+			.destroy = _index_enumerator_destroy,
+		},
+		.wildcards = this->index[type].wildcards->create_enumerator(
+												this->index[type].wildcards),
+		.mutex = this->mutex,
+	);
+	if (bucket)
+	{
+		enumerator->exact = bucket->entries->create_enumerator(bucket->entries);
+		enumerator->next_exact = next_entry(enumerator->exact);
+	}
+	enumerator->next_wildcard = next_entry(enumerator->wildcards);
+	return &enumerator->public;
+}
+
 METHOD(backend_t, create_peer_cfg_enumerator, enumerator_t*,
 	private_stroke_config_t *this, identification_t *me, identification_t *other)
 {
+	enumerator_t *enumerator;
+
 	this->mutex->lock(this->mutex);
+	enumerator = create_index_enumerator(this, INDEX_REMOTE_ID, other,
+										 INDEX_LOCAL_ID, me);
+	if (enumerator)
+	{
+		return enumerator;
+	}
 	return enumerator_create_cleaner(this->list->create_enumerator(this->list),
 									 (void*)this->mutex->unlock, this->mutex);
 }
@@ -79,7 +567,16 @@ static bool ike_filter(void *data, peer_cfg_t **in, ike_cfg_t **out)
 METHOD(backend_t, create_ike_cfg_enumerator, enumerator_t*,
 	private_stroke_config_t *this, host_t *me, host_t *other)
 {
+	enumerator_t *enumerator;
+
 	this->mutex->lock(this->mutex);
+	enumerator = create_index_enumerator(this, INDEX_REMOTE_HOST, other,
+										 INDEX_LOCAL_HOST, me);
+	if (enumerator)
+	{
+		return enumerator_create_filter(enumerator, (void*)ike_filter,
+										NULL, NULL);
+	}
 	return enumerator_create_filter(this->list->create_enumerator(this->list),
 									(void*)ike_filter, this->mutex,
 									(void*)this->mutex->unlock);
@@ -1057,6 +1554,7 @@ METHOD(stroke_config_t, add, void,
 		DBG1(DBG_CFG, "added configuration '%s'", msg->add_conn.name);
 		this->mutex->lock(this->mutex);
 		this->list->insert_last(this->list, peer_cfg);
+		index_add(this, peer_cfg);
 		this->mutex->unlock(this->mutex);
 	}
 }
@@ -1096,6 +1594,7 @@ METHOD(stroke_config_t, del, void,
 		if (!keep || streq(peer->get_name(peer), msg->del_conn.name))
 		{
 			this->list->remove_at(this->list, enumerator);
+			index_remove(this, peer);
 			peer->destroy(peer);
 			deleted = TRUE;
 		}
@@ -1294,6 +1793,24 @@ METHOD(stroke_config_t, set_user_credentials, void,
 METHOD(stroke_config_t, destroy, void,
 	private_stroke_config_t *this)
 {
+	enumerator_t *enumerator;
+	index_type_t type;
+	bucket_t *bucket;
+	void *key;
+
+	for (type = 0; type < INDEX_MAX; type++)
+	{
+		enumerator = this->index[type].buckets->create_enumerator(
+													this->index[type].buckets);
+		while (enumerator->enumerate(enumerator, &key, &bucket))
+		{
+			bucket_destroy(bucket, type);
+		}
+		enumerator->destroy(enumerator);
+		this->index[type].buckets->destroy(this->index[type].buckets);
+		this->index[type].wildcards->destroy_function(
+											this->index[type].wildcards, free);
+	}
 	this->list->destroy_offset(this->list, offsetof(peer_cfg_t, destroy));
 	this->mutex->destroy(this->mutex);
 	free(this);
@@ -1306,6 +1823,7 @@ stroke_config_t *stroke_config_create(stroke_ca_t *ca, stroke_cred_t *cred,
 									  stroke_attribute_t *attributes)
 {
 	private_stroke_config_t *this;
+	index_type_t type;
 
 	INIT(this,
 		.public = {
@@ -1326,5 +1844,22 @@ stroke_config_t *stroke_config_create(stroke_ca_t *ca, stroke_cred_t *cred,
 		.attributes = attributes,
 	);
 
+	for (type = 0; type < INDEX_MAX; type++)
+	{
+		this->index[type].wildcards = linked_list_create();
+		if (type == INDEX_LOCAL_ID || type == INDEX_REMOTE_ID)
+		{
+			this->index[type].buckets = hashtable_create(
+						(hashtable_hash_t)id_hash,
+						(hashtable_equals_t)id_equals, 32);
+		}
+		else
+		{
+			this->index[type].buckets = hashtable_create(
+						(hashtable_hash_t)host_hash,
+						(hashtable_equals_t)host_equals, 32);
+		}
+	}
+
 	return &this->public;
 }
@@ -1348,6 +1348,20 @@ METHOD(stroke_cred_t, reread, void,
 			 CRL_DIR);
 		load_certdir(this, CRL_DIR, CERT_X509_CRL, 0);
 	}
+	/* verify relations involving reloaded certificates again */
+	if (msg->reread.flags & (REREAD_CACERTS | REREAD_OCSPCERTS |
+							 REREAD_AACERTS))
+	{
+		lib->credmgr->flush_cache(lib->credmgr, CERT_X509);
+	}
+	if (msg->reread.flags & REREAD_ACERTS)
+	{
+		lib->credmgr->flush_cache(lib->credmgr, CERT_X509_AC);
+	}
+	if (msg->reread.flags & REREAD_CRLS)
+	{
+		lib->credmgr->flush_cache(lib->credmgr, CERT_X509_CRL);
+	}
 }
 
 METHOD(stroke_cred_t, add_shared, void,
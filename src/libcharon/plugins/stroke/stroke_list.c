@@ -464,7 +464,9 @@ METHOD(stroke_list_t, status, void,
 		host_t *host;
 		u_int32_t dpd;
 		time_t since, now;
-		u_int size, online, offline, i;
+		u_int size, online, offline, i, latency_avg, latency_max;
+		u_int entries, hits, misses, packets, batches;
+		kernel_worker_stats_t stats;
 		struct utsname utsname;
 
 		now = time_monotonic(NULL);
@@ -502,6 +504,55 @@ METHOD(stroke_list_t, status, void,
 		}
 		fprintf(out, ", scheduled: %d\n",
 				lib->scheduler->get_job_load(lib->scheduler));
+		if (charon->dh_offload)
+		{
+			online = charon->dh_offload->get_inflight(charon->dh_offload,
+													  &size);
+			fprintf(out, "  DH offload: %u of %u in-flight\n", online, size);
+		}
+		if (charon->dh_pool)
+		{
+			fprintf(out, "  DH pool: %u pre-generated keypairs\n",
+					charon->dh_pool->get_count(charon->dh_pool, MODP_NONE));
+		}
+		fprintf(out, "  dropped IKE_SA setups: %u rate limited, "
+				"%u without cookie, %u aggressive, %u half open, %u job load\n",
+				charon->receiver->get_dropped(charon->receiver,
+											  RECEIVER_DROP_RATE),
+				charon->receiver->get_dropped(charon->receiver,
+											  RECEIVER_DROP_COOKIE),
+				charon->receiver->get_dropped(charon->receiver,
+											  RECEIVER_DROP_BLOCK),
+				charon->receiver->get_dropped(charon->receiver,
+											  RECEIVER_DROP_HALF_OPEN),
+				charon->receiver->get_dropped(charon->receiver,
+											  RECEIVER_DROP_JOB_LOAD));
+		for (i = 0; charon->kernel_stats &&
+			 charon->kernel_stats->get_worker_stats(charon->kernel_stats, i,
+													&stats); i++)
+		{
+			fprintf(out, "  IPsec worker %u: %" PRIu64 " packets (%" PRIu64
+					" bytes) in, %" PRIu64 " packets (%" PRIu64 " bytes) out, "
+					"%" PRIu64 " dropped\n", i,
+					stats.packets_in, stats.bytes_in, stats.packets_out,
+					stats.bytes_out, stats.dropped);
+		}
+		if (charon->socket->get_stats(charon->socket, &packets, &batches))
+		{
+			fprintf(out, "  received packets: %u in %u batches\n",
+					packets, batches);
+		}
+		charon->sender->get_send_latency(charon->sender, &latency_avg,
+										 &latency_max);
+		fprintf(out, "  send queue: %u, send latency: %uus avg, %uus max\n",
+				charon->sender->get_queue_length(charon->sender),
+				latency_avg, latency_max);
+		if (lib->credmgr->get_cache_stats(lib->credmgr, &entries, &hits,
+										  &misses))
+		{
+			fprintf(out, "  certificate cache: %u relations, %u hits, "
+					"%u misses\n", entries, hits, misses);
+		}
 		fprintf(out, "  loaded plugins: %s\n",
 				lib->plugins->loaded_plugins(lib->plugins));
 
@@ -40,5 +40,9 @@ DEFINE_TEST("ID parts", test_id_parts, FALSE)
 DEFINE_TEST("ID wildcards", test_id_wildcards, FALSE)
 DEFINE_TEST("ID equals", test_id_equals, FALSE)
 DEFINE_TEST("ID matches", test_id_matches, FALSE)
+DEFINE_TEST("ID hash", test_id_hash, FALSE)
+DEFINE_TEST("mem_cred shared keys", test_mem_cred_shared, FALSE)
+DEFINE_TEST("mem_cred key identifiers", test_mem_cred_keyid, FALSE)
+DEFINE_TEST("mem_cred replace secrets", test_mem_cred_replace, FALSE)
 
 /** @}*/
@@ -247,3 +247,48 @@ bool test_id_matches()
 	a->destroy(a);
 	return TRUE;
 }
+
+/*******************************************************************************
+ * identification hashing test
+ ******************************************************************************/
+
+static bool test_id_hash_one(char *a_str, char *b_str)
+{
+	identification_t *a, *b;
+	bool equals;
+
+	a = identification_create_from_string(a_str);
+	b = identification_create_from_string(b_str);
+	equals = a->get_type(a) == b->get_type(b) && a->equals(a, b) &&
+			 a->hash(a, 0) == b->hash(b, 0) && a->hash(a, 7) == b->hash(b, 7);
+	a->destroy(a);
+	b->destroy(b);
+	return equals;
+}
+
+bool test_id_hash()
+{
+	if (!test_id_hash_one("C=CH, E=martin@strongswan.org, CN=martin",
+						  "C=CH, E=martin@strongswan.org, CN=martin"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("C=CH, E=martin@strongswan.org, CN=martin",
+						  "C=ch, E=martin@STRONGSWAN.ORG, CN=Martin"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("strongswan.org", "StrongSwan.ORG"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("martin@strongswan.org", "Martin@StrongSwan.org"))
+	{
+		return FALSE;
+	}
+	if (!test_id_hash_one("192.168.0.1", "192.168.0.1"))
+	{
+		return FALSE;
+	}
+	return TRUE;
+}
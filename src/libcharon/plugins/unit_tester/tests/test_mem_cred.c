@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <library.h>
+#include <credentials/sets/mem_cred.h>
+
+/**
+ * Create an IKE shared key with the given secret
+ */
+static shared_key_t *shared_create(char *secret)
+{
+	return shared_key_create(SHARED_IKE,
+							 chunk_clone(chunk_create(secret, strlen(secret))));
+}
+
+/**
+ * Count the shared keys found for me/other, check if the given one is found
+ */
+static int count_shared(mem_cred_t *creds, char *me_str, char *other_str,
+						shared_key_t *expected, bool *found)
+{
+	identification_t *me = NULL, *other = NULL;
+	enumerator_t *enumerator;
+	shared_key_t *shared;
+	int count = 0;
+
+	if (me_str)
+	{
+		me = identification_create_from_string(me_str);
+	}
+	if (other_str)
+	{
+		other = identification_create_from_string(other_str);
+	}
+	if (found)
+	{
+		*found = FALSE;
+	}
+	enumerator = creds->set.create_shared_enumerator(&creds->set, SHARED_ANY,
+													  me, other);
+	while (enumerator->enumerate(enumerator, &shared, NULL, NULL))
+	{
+		if (found && shared == expected)
+		{
+			*found = TRUE;
+		}
+		count++;
+	}
+	enumerator->destroy(enumerator);
+	DESTROY_IF(me);
+	DESTROY_IF(other);
+	return count;
+}
+
+/*******************************************************************************
+ * shared key lookups
+ ******************************************************************************/
+bool test_mem_cred_shared()
+{
+	mem_cred_t *creds;
+	shared_key_t *both, *moon, *wildcard;
+	bool found, success = FALSE;
+
+	creds = mem_cred_create();
+	both = shared_create("both");
+	moon = shared_create("moon");
+	creds->add_shared(creds, both,
+			identification_create_from_string("moon.strongswan.org"),
+			identification_create_from_string("sun.strongswan.org"), NULL);
+	creds->add_shared(creds, moon,
+			identification_create_from_string("moon.strongswan.org"), NULL);
+
+	/* keys matching other are preferred over those matching only me */
+	if (count_shared(creds, "moon.strongswan.org", "sun.strongswan.org",
+					 both, &found) != 1 || !found)
+	{
+		goto out;
+	}
+	/* if none match other, those matching me are returned */
+	if (count_shared(creds, "moon.strongswan.org", "venus.strongswan.org",
+					 moon, &found) != 2 || !found)
+	{
+		goto out;
+	}
+	/* the index is case insensitive, as equals() is */
+	if (count_shared(creds, NULL, "Sun.StrongSwan.ORG", both, &found) != 1 ||
+		!found)
+	{
+		goto out;
+	}
+	if (count_shared(creds, NULL, "venus.strongswan.org", NULL, NULL) != 0)
+	{
+		goto out;
+	}
+
+	/* wildcard owners match any identity they cover */
+	wildcard = shared_create("wildcard");
+	creds->add_shared(creds, wildcard,
+			identification_create_from_string("*@strongswan.org"), NULL);
+	if (count_shared(creds, NULL, "carol@strongswan.org",
+					 wildcard, &found) != 1 || !found)
+	{
+		goto out;
+	}
+	if (count_shared(creds, NULL, "carol@example.com", NULL, NULL) != 0)
+	{
+		goto out;
+	}
+	/* a wildcard match of other is preferred over an exact match of me */
+	if (count_shared(creds, "moon.strongswan.org", "carol@strongswan.org",
+					 wildcard, &found) != 1 || !found)
+	{
+		goto out;
+	}
+	if (count_shared(creds, NULL, NULL, NULL, NULL) != 3)
+	{
+		goto out;
+	}
+	success = TRUE;
+
+out:
+	creds->destroy(creds);
+	return success;
+}
+
+/*******************************************************************************
+ * key identifier lookups
+ ******************************************************************************/
+
+/**
+ * Check if the private key with the given key identifier is found
+ */
+static bool has_private(mem_cred_t *creds, private_key_t *key, chunk_t keyid)
+{
+	identification_t *id;
+	enumerator_t *enumerator;
+	private_key_t *current;
+	bool found = FALSE;
+
+	id = identification_create_from_encoding(ID_KEY_ID, keyid);
+	enumerator = creds->set.create_private_enumerator(&creds->set, KEY_ANY, id);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (current == key)
+		{
+			found = TRUE;
+		}
+	}
+	enumerator->destroy(enumerator);
+	id->destroy(id);
+	return found;
+}
+
+/**
+ * Check if the certificate is found by the given identity
+ */
+static bool has_cert(mem_cred_t *creds, certificate_t *cert,
+					 identification_t *id)
+{
+	enumerator_t *enumerator;
+	certificate_t *current;
+	bool found = FALSE;
+
+	enumerator = creds->set.create_cert_enumerator(&creds->set, CERT_ANY,
+												   KEY_ANY, id, FALSE);
+	while (enumerator->enumerate(enumerator, &current))
+	{
+		if (current->equals(current, cert))
+		{
+			found = TRUE;
+		}
+	}
+	enumerator->destroy(enumerator);
+	return found;
+}
+
+bool test_mem_cred_keyid()
+{
+	mem_cred_t *creds;
+	private_key_t *key;
+	certificate_t *cert;
+	identification_t *subject, *id;
+	u_int32_t serial = htonl(1);
+	chunk_t keyid, unknown = chunk_from_chars(0x01, 0x02, 0x03, 0x04);
+	bool success = FALSE;
+
+	key = lib->creds->create(lib->creds, CRED_PRIVATE_KEY, KEY_RSA,
+							 BUILD_KEY_SIZE, 1024, BUILD_END);
+	if (!key)
+	{
+		return FALSE;
+	}
+	subject = identification_create_from_string("C=CH, O=strongSwan, CN=moon");
+	cert = lib->creds->create(lib->creds, CRED_CERTIFICATE, CERT_X509,
+							  BUILD_SIGNING_KEY, key,
+							  BUILD_SUBJECT, subject,
+							  BUILD_SERIAL, chunk_from_thing(serial),
+							  BUILD_END);
+	subject->destroy(subject);
+	if (!cert)
+	{
+		key->destroy(key);
+		return FALSE;
+	}
+	creds = mem_cred_create();
+	creds->add_key(creds, key->get_ref(key));
+	creds->add_cert(creds, TRUE, cert->get_ref(cert));
+
+	if (!key->get_fingerprint(key, KEYID_PUBKEY_SHA1, &keyid) ||
+		!has_private(creds, key, keyid) || has_private(creds, key, unknown))
+	{
+		goto out;
+	}
+	id = identification_create_from_encoding(ID_KEY_ID, keyid);
+	success = has_cert(creds, cert, id);
+	id->destroy(id);
+	if (!success)
+	{
+		goto out;
+	}
+	success = FALSE;
+	id = identification_create_from_encoding(ID_KEY_ID, unknown);
+	if (has_cert(creds, cert, id))
+	{
+		id->destroy(id);
+		goto out;
+	}
+	id->destroy(id);
+	id = identification_create_from_string("C=ch, O=strongswan, CN=Moon");
+	success = has_cert(creds, cert, id);
+	id->destroy(id);
+
+out:
+	creds->destroy(creds);
+	cert->destroy(cert);
+	key->destroy(key);
+	return success;
+}
+
+/*******************************************************************************
+ * replacing secrets
+ ******************************************************************************/
+bool test_mem_cred_replace()
+{
+	mem_cred_t *creds, *other;
+	shared_key_t *old, *new;
+	bool found, success = FALSE;
+
+	creds = mem_cred_create();
+	other = mem_cred_create();
+	old = shared_create("old");
+	new = shared_create("new");
+	creds->add_shared(creds, old,
+			identification_create_from_string("moon.strongswan.org"), NULL);
+	other->add_shared(other, new,
+			identification_create_from_string("sun.strongswan.org"), NULL);
+
+	/* cloned secrets are found in both sets, the replaced ones not anymore */
+	creds->replace_secrets(creds, other, TRUE);
+	if (count_shared(creds, NULL, "moon.strongswan.org", NULL, NULL) != 0 ||
+		count_shared(creds, NULL, "sun.strongswan.org", new, &found) != 1 ||
+		!found ||
+		count_shared(other, NULL, "sun.strongswan.org", new, &found) != 1 ||
+		!found)
+	{
+		goto out;
+	}
+
+	/* adopted secrets are only found in the new set */
+	creds->clear_secrets(creds);
+	creds->replace_secrets(creds, other, FALSE);
+	if (count_shared(creds, NULL, "sun.strongswan.org", new, &found) != 1 ||
+		!found ||
+		count_shared(other, NULL, "sun.strongswan.org", NULL, NULL) != 0 ||
+		count_shared(other, NULL, NULL, NULL, NULL) != 0)
+	{
+		goto out;
+	}
+
+	/* the emptied set is still usable */
+	other->add_shared(other, shared_create("other"),
+			identification_create_from_string("sun.strongswan.org"), NULL);
+	if (count_shared(other, NULL, "sun.strongswan.org", NULL, NULL) != 1)
+	{
+		goto out;
+	}
+	success = TRUE;
+
+out:
+	creds->destroy(creds);
+	other->destroy(other);
+	return success;
+}
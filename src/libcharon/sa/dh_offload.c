@@ -0,0 +1,408 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "dh_offload.h"
+
+#include <daemon.h>
+#include <threading/thread.h>
+#include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <collections/linked_list.h>
+#include <processing/jobs/callback_job.h>
+
+/**
+ * Default maximum number of computations in-flight
+ */
+#define DEFAULT_MAX_INFLIGHT 64
+
+typedef struct private_dh_offload_t private_dh_offload_t;
+
+/**
+ * Private data of a dh_offload_t object.
+ */
+struct private_dh_offload_t {
+
+	/**
+	 * Public dh_offload_t interface.
+	 */
+	dh_offload_t public;
+
+	/**
+	 * Threads of the pool
+	 */
+	thread_t **threads;
+
+	/**
+	 * Number of threads
+	 */
+	u_int thread_count;
+
+	/**
+	 * Queued computations, as entry_t
+	 */
+	linked_list_t *queue;
+
+	/**
+	 * Computations currently in progress, as entry_t
+	 */
+	linked_list_t *active;
+
+	/**
+	 * Maximum number of queued and active computations
+	 */
+	u_int max_inflight;
+
+	/**
+	 * TRUE if the threads should terminate
+	 */
+	bool stopping;
+
+	/**
+	 * Mutex to access lists
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Signals queued computations to threads
+	 */
+	condvar_t *added;
+
+	/**
+	 * Signals completed computations to cancel()
+	 */
+	condvar_t *done;
+};
+
+/**
+ * A DH computation
+ */
+typedef struct {
+
+	/**
+	 * IKE_SA the computation belongs to, not to be accessed
+	 */
+	ike_sa_t *ike_sa;
+
+	/**
+	 * ID of the IKE_SA, to resume the exchange
+	 */
+	ike_sa_id_t *id;
+
+	/**
+	 * Keymat to create the DH object
+	 */
+	keymat_v2_t *keymat;
+
+	/**
+	 * TRUE to create the DH object for an IKE_SA_INIT exchange
+	 */
+	bool ike_sa_init;
+
+	/**
+	 * Location to store the DH object to
+	 */
+	diffie_hellman_t **dh;
+
+	/**
+	 * DH group
+	 */
+	diffie_hellman_group_t group;
+
+	/**
+	 * Public value of the peer
+	 */
+	chunk_t value;
+
+	/**
+	 * TRUE if the computation got cancelled while being computed
+	 */
+	bool cancelled;
+
+} entry_t;
+
+/**
+ * Destroy an entry
+ */
+static void entry_destroy(entry_t *entry)
+{
+	entry->id->destroy(entry->id);
+	chunk_free(&entry->value);
+	free(entry);
+}
+
+/**
+ * Resume the exchange of an IKE_SA after a computation completed
+ */
+static job_requeue_t resume(ike_sa_id_t *id)
+{
+	ike_sa_t *ike_sa;
+
+	ike_sa = charon->ike_sa_manager->checkout(charon->ike_sa_manager, id);
+	if (ike_sa)
+	{
+		if (ike_sa->resume(ike_sa) == DESTROY_ME)
+		{
+			charon->ike_sa_manager->checkin_and_destroy(
+												charon->ike_sa_manager, ike_sa);
+		}
+		else
+		{
+			charon->ike_sa_manager->checkin(charon->ike_sa_manager, ike_sa);
+		}
+	}
+	return JOB_REQUEUE_NONE;
+}
+
+/**
+ * Thread of the pool computing queued entries
+ */
+static void *compute(private_dh_offload_t *this)
+{
+	diffie_hellman_t *dh;
+	entry_t *entry;
+	job_t *job;
+
+	this->mutex->lock(this->mutex);
+	while (TRUE)
+	{
+		while (!this->stopping &&
+			   this->queue->remove_first(this->queue,
+										 (void**)&entry) != SUCCESS)
+		{
+			this->added->wait(this->added, this->mutex);
+		}
+		if (this->stopping)
+		{
+			break;
+		}
+		this->active->insert_last(this->active, entry);
+		this->mutex->unlock(this->mutex);
+
+		if (entry->ike_sa_init)
+		{
+			dh = entry->keymat->create_ike_dh(entry->keymat, entry->group);
+		}
+		else
+		{
+			dh = entry->keymat->keymat.create_dh(&entry->keymat->keymat,
+												 entry->group);
+		}
+		if (dh)
+		{
+			dh->set_other_public_value(dh, entry->value);
+		}
+
+		this->mutex->lock(this->mutex);
+		this->active->remove(this->active, entry, NULL);
+		*entry->dh = dh;
+		if (!entry->cancelled)
+		{
+			job = (job_t*)callback_job_create_with_prio(
+								(callback_job_cb_t)resume, entry->id,
+								(void*)entry->id->destroy, NULL, JOB_PRIO_HIGH);
+			entry->id = NULL;
+			lib->processor->queue_job(lib->processor, job);
+		}
+		else
+		{
+			entry->id->destroy(entry->id);
+			entry->id = NULL;
+		}
+		chunk_free(&entry->value);
+		free(entry);
+		this->done->broadcast(this->done);
+	}
+	this->mutex->unlock(this->mutex);
+	return NULL;
+}
+
+METHOD(dh_offload_t, create_dh, bool,
+	private_dh_offload_t *this, ike_sa_t *ike_sa, keymat_v2_t *keymat,
+	bool ike_sa_init, diffie_hellman_t **dh, diffie_hellman_group_t group,
+	chunk_t value)
+{
+	entry_t *entry;
+	ike_sa_id_t *id;
+
+	this->mutex->lock(this->mutex);
+	if (this->queue->get_count(this->queue) +
+		this->active->get_count(this->active) >= this->max_inflight)
+	{
+		this->mutex->unlock(this->mutex);
+		DBG2(DBG_IKE, "DH offload limit of %u reached, computing directly",
+			 this->max_inflight);
+		return FALSE;
+	}
+	id = ike_sa->get_id(ike_sa);
+	INIT(entry,
+		.ike_sa = ike_sa,
+		.id = id->clone(id),
+		.keymat = keymat,
+		.ike_sa_init = ike_sa_init,
+		.dh = dh,
+		.group = group,
+		.value = chunk_clone(value),
+	);
+	*dh = NULL;
+	this->queue->insert_last(this->queue, entry);
+	this->added->signal(this->added);
+	this->mutex->unlock(this->mutex);
+	return TRUE;
+}
+
+/**
+ * Check if an entry belongs to the given IKE_SA
+ */
+static bool match_ike_sa(entry_t *entry, ike_sa_t *ike_sa)
+{
+	return entry->ike_sa == ike_sa && !entry->cancelled;
+}
+
+/**
+ * Check if an entry stores the DH object at the given location
+ */
+static bool match_dh(entry_t *entry, diffie_hellman_t **dh)
+{
+	return entry->dh == dh;
+}
+
+METHOD(dh_offload_t, is_pending, bool,
+	private_dh_offload_t *this, ike_sa_t *ike_sa)
+{
+	bool pending;
+
+	this->mutex->lock(this->mutex);
+	pending = this->queue->find_first(this->queue, (void*)match_ike_sa,
+									  NULL, ike_sa) == SUCCESS ||
+			  this->active->find_first(this->active, (void*)match_ike_sa,
+									   NULL, ike_sa) == SUCCESS;
+	this->mutex->unlock(this->mutex);
+	return pending;
+}
+
+METHOD(dh_offload_t, cancel, void,
+	private_dh_offload_t *this, diffie_hellman_t **dh)
+{
+	entry_t *entry;
+
+	this->mutex->lock(this->mutex);
+	if (this->queue->find_first(this->queue, (void*)match_dh,
+								(void**)&entry, dh) == SUCCESS)
+	{
+		this->queue->remove(this->queue, entry, NULL);
+		entry_destroy(entry);
+	}
+	else
+	{
+		while (this->active->find_first(this->active, (void*)match_dh,
+										(void**)&entry, dh) == SUCCESS)
+		{
+			entry->cancelled = TRUE;
+			this->done->wait(this->done, this->mutex);
+		}
+	}
+	this->mutex->unlock(this->mutex);
+}
+
+METHOD(dh_offload_t, get_inflight, u_int,
+	private_dh_offload_t *this, u_int *max)
+{
+	u_int count;
+
+	this->mutex->lock(this->mutex);
+	count = this->queue->get_count(this->queue) +
+			this->active->get_count(this->active);
+	this->mutex->unlock(this->mutex);
+	if (max)
+	{
+		*max = this->max_inflight;
+	}
+	return count;
+}
+
+METHOD(dh_offload_t, destroy, void,
+	private_dh_offload_t *this)
+{
+	u_int i;
+
+	this->mutex->lock(this->mutex);
+	this->stopping = TRUE;
+	this->added->broadcast(this->added);
+	this->mutex->unlock(this->mutex);
+
+	for (i = 0; i < this->thread_count; i++)
+	{
+		if (this->threads[i])
+		{
+			this->threads[i]->join(this->threads[i]);
+		}
+	}
+	this->queue->destroy_function(this->queue, (void*)entry_destroy);
+	this->active->destroy(this->active);
+	this->added->destroy(this->added);
+	this->done->destroy(this->done);
+	this->mutex->destroy(this->mutex);
+	free(this->threads);
+	free(this);
+}
+
+/*
+ * Described in header.
+ */
+dh_offload_t *dh_offload_create()
+{
+	private_dh_offload_t *this;
+	u_int i, threads;
+
+	threads = lib->settings->get_int(lib->settings, "%s.dh_offload.threads",
+									 0, charon->name);
+	if (!threads)
+	{
+		return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.create_dh = _create_dh,
+			.is_pending = _is_pending,
+			.cancel = _cancel,
+			.get_inflight = _get_inflight,
+			.destroy = _destroy,
+		},
+		.threads = calloc(threads, sizeof(thread_t*)),
+		.thread_count = threads,
+		.queue = linked_list_create(),
+		.active = linked_list_create(),
+		.max_inflight = max(1, lib->settings->get_int(lib->settings,
+								"%s.dh_offload.max_inflight",
+								DEFAULT_MAX_INFLIGHT, charon->name)),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.added = condvar_create(CONDVAR_TYPE_DEFAULT),
+		.done = condvar_create(CONDVAR_TYPE_DEFAULT),
+	);
+
+	for (i = 0; i < threads; i++)
+	{
+		this->threads[i] = thread_create((thread_main_t)compute, this);
+		if (!this->threads[i])
+		{
+			DBG1(DBG_IKE, "creating DH offload thread failed");
+			destroy(this);
+			return NULL;
+		}
+	}
+	DBG2(DBG_IKE, "computing DH exchanges in %u threads, at most %u in-flight",
+		 threads, this->max_inflight);
+	return &this->public;
+}
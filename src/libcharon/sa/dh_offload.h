@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup dh_offload dh_offload
+ * @{ @ingroup sa
+ */
+
+#ifndef DH_OFFLOAD_H_
+#define DH_OFFLOAD_H_
+
+typedef struct dh_offload_t dh_offload_t;
+
+#include <library.h>
+#include <sa/ike_sa.h>
+#include <sa/ikev2/keymat_v2.h>
+
+/**
+ * Computes Diffie-Hellman exchanges of responders in a dedicated thread pool.
+ *
+ * Instead of blocking a worker thread that holds the checked out IKE_SA,
+ * a task hands the DH computation to this pool and the task manager delays
+ * the response. Once computed, a job checks out the IKE_SA and resumes the
+ * exchange via ike_sa_t.resume().
+ */
+struct dh_offload_t {
+
+	/**
+	 * Create a DH object and set the public value of the peer asynchronously.
+	 *
+	 * The DH object is stored to dh once computed, which might happen before
+	 * this method returns. Until the exchange is resumed or cancel() is
+	 * called, dh must not be accessed.
+	 *
+	 * @param ike_sa	IKE_SA the exchange belongs to
+	 * @param keymat	keymat to create the DH object with
+	 * @param ike_sa_init	TRUE to create it with keymat_v2_t.create_ike_dh()
+	 * @param dh		receives the DH object, NULL if group not supported
+	 * @param group		DH group proposed by the peer
+	 * @param value		public value of the peer, gets cloned
+	 * @return			TRUE if queued, FALSE if the in-flight limit is
+	 *					reached and the caller has to compute it directly
+	 */
+	bool (*create_dh)(dh_offload_t *this, ike_sa_t *ike_sa, keymat_v2_t *keymat,
+					  bool ike_sa_init, diffie_hellman_t **dh,
+					  diffie_hellman_group_t group, chunk_t value);
+
+	/**
+	 * Check if there are pending computations for an IKE_SA.
+	 *
+	 * @param ike_sa	IKE_SA to check
+	 * @return			TRUE if computations are pending
+	 */
+	bool (*is_pending)(dh_offload_t *this, ike_sa_t *ike_sa);
+
+	/**
+	 * Cancel a queued computation, or wait until it is done if it currently
+	 * is computed.
+	 *
+	 * If the computation completes, the created DH object is stored to dh
+	 * and owned by the caller.
+	 *
+	 * @param dh		location passed to create_dh()
+	 */
+	void (*cancel)(dh_offload_t *this, diffie_hellman_t **dh);
+
+	/**
+	 * Get the number of computations currently queued or computed.
+	 *
+	 * @param max		receives the maximum number of such computations
+	 * @return			number of computations in-flight
+	 */
+	u_int (*get_inflight)(dh_offload_t *this, u_int *max);
+
+	/**
+	 * Destroy a dh_offload_t, waits until all threads terminated.
+	 */
+	void (*destroy)(dh_offload_t *this);
+};
+
+/**
+ * Create a dh_offload instance.
+ *
+ * @return			instance, NULL if disabled in strongswan.conf
+ */
+dh_offload_t *dh_offload_create();
+
+#endif /** DH_OFFLOAD_H_ @}*/
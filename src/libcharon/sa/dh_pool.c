@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "dh_pool.h"
+
+#include <daemon.h>
+#include <threading/mutex.h>
+#include <collections/linked_list.h>
+#include <processing/jobs/callback_job.h>
+
+typedef struct private_dh_pool_t private_dh_pool_t;
+
+/**
+ * Private data of a dh_pool_t object.
+ */
+struct private_dh_pool_t {
+
+	/**
+	 * Public dh_pool_t interface.
+	 */
+	dh_pool_t public;
+
+	/**
+	 * Pools per DH group, as group_t
+	 */
+	linked_list_t *groups;
+
+	/**
+	 * Number of keypairs to keep per group
+	 */
+	u_int size;
+
+	/**
+	 * Number of times a keypair is handed out
+	 */
+	u_int reuse;
+
+	/**
+	 * Mutex to access pools
+	 */
+	mutex_t *mutex;
+};
+
+/**
+ * A pre-generated keypair, possibly shared by multiple pooled_dh_t
+ */
+typedef struct {
+
+	/**
+	 * DH object holding the keypair
+	 */
+	diffie_hellman_t *dh;
+
+	/**
+	 * Number of times this keypair may still be handed out
+	 */
+	u_int uses;
+
+	/**
+	 * Serializes shared secret computations
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * References held by the pool and by pooled_dh_t objects
+	 */
+	refcount_t refs;
+
+} keypair_t;
+
+/**
+ * Pool of a specific DH group
+ */
+typedef struct {
+
+	/**
+	 * DH group
+	 */
+	diffie_hellman_group_t group;
+
+	/**
+	 * Available keypairs, as keypair_t
+	 */
+	linked_list_t *keypairs;
+
+	/**
+	 * TRUE if a refill job is queued
+	 */
+	bool refilling;
+
+	/**
+	 * TRUE if generating keypairs for this group failed
+	 */
+	bool failed;
+
+	/**
+	 * Pool this group belongs to
+	 */
+	private_dh_pool_t *pool;
+
+} group_t;
+
+/**
+ * DH object using a shared keypair
+ */
+typedef struct {
+
+	/**
+	 * Implements diffie_hellman_t
+	 */
+	diffie_hellman_t public;
+
+	/**
+	 * Shared keypair
+	 */
+	keypair_t *keypair;
+
+	/**
+	 * Shared secret computed with this object
+	 */
+	chunk_t secret;
+
+} pooled_dh_t;
+
+/**
+ * Release a reference to a keypair
+ */
+static void keypair_unref(keypair_t *keypair)
+{
+	if (ref_put(&keypair->refs))
+	{
+		keypair->dh->destroy(keypair->dh);
+		keypair->mutex->destroy(keypair->mutex);
+		free(keypair);
+	}
+}
+
+METHOD(diffie_hellman_t, dh_get_shared_secret, status_t,
+	pooled_dh_t *this, chunk_t *secret)
+{
+	if (!this->secret.len)
+	{
+		return FAILED;
+	}
+	*secret = chunk_clone(this->secret);
+	return SUCCESS;
+}
+
+METHOD(diffie_hellman_t, dh_set_other_public_value, void,
+	pooled_dh_t *this, chunk_t value)
+{
+	diffie_hellman_t *dh = this->keypair->dh;
+
+	chunk_clear(&this->secret);
+	this->keypair->mutex->lock(this->keypair->mutex);
+	dh->set_other_public_value(dh, value);
+	if (dh->get_shared_secret(dh, &this->secret) != SUCCESS)
+	{
+		this->secret = chunk_empty;
+	}
+	this->keypair->mutex->unlock(this->keypair->mutex);
+}
+
+METHOD(diffie_hellman_t, dh_get_my_public_value, void,
+	pooled_dh_t *this, chunk_t *value)
+{
+	diffie_hellman_t *dh = this->keypair->dh;
+
+	this->keypair->mutex->lock(this->keypair->mutex);
+	dh->get_my_public_value(dh, value);
+	this->keypair->mutex->unlock(this->keypair->mutex);
+}
+
+METHOD(diffie_hellman_t, dh_get_dh_group, diffie_hellman_group_t,
+	pooled_dh_t *this)
+{
+	return this->keypair->dh->get_dh_group(this->keypair->dh);
+}
+
+METHOD(diffie_hellman_t, dh_destroy, void,
+	pooled_dh_t *this)
+{
+	chunk_clear(&this->secret);
+	keypair_unref(this->keypair);
+	free(this);
+}
+
+/**
+ * Create a DH object using a shared keypair, takes over a reference
+ */
+static diffie_hellman_t *pooled_dh_create(keypair_t *keypair)
+{
+	pooled_dh_t *this;
+
+	INIT(this,
+		.public = {
+			.get_shared_secret = _dh_get_shared_secret,
+			.set_other_public_value = _dh_set_other_public_value,
+			.get_my_public_value = _dh_get_my_public_value,
+			.get_dh_group = _dh_get_dh_group,
+			.destroy = _dh_destroy,
+		},
+		.keypair = keypair,
+	);
+	return &this->public;
+}
+
+/**
+ * Generate a keypair for a group, requeued until the pool is full
+ */
+static job_requeue_t refill(group_t *group)
+{
+	private_dh_pool_t *this = group->pool;
+	keypair_t *keypair = NULL;
+	diffie_hellman_t *dh;
+	bool more = FALSE;
+
+	dh = lib->crypto->create_dh(lib->crypto, group->group);
+	if (dh)
+	{
+		INIT(keypair,
+			.dh = dh,
+			.uses = this->reuse,
+			.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+			.refs = 1,
+		);
+	}
+	else
+	{
+		DBG1(DBG_IKE, "unable to pre-generate DH keypairs for %N",
+			 diffie_hellman_group_names, group->group);
+	}
+
+	this->mutex->lock(this->mutex);
+	if (keypair)
+	{
+		group->keypairs->insert_last(group->keypairs, keypair);
+		more = group->keypairs->get_count(group->keypairs) < this->size;
+	}
+	else
+	{
+		group->failed = TRUE;
+	}
+	group->refilling = more;
+	this->mutex->unlock(this->mutex);
+	return more ? JOB_REQUEUE_FAIR : JOB_REQUEUE_NONE;
+}
+
+/**
+ * Check if a pool is for the given group
+ */
+static bool match_group(group_t *group, diffie_hellman_group_t *num)
+{
+	return group->group == *num;
+}
+
+METHOD(dh_pool_t, get, diffie_hellman_t*,
+	private_dh_pool_t *this, diffie_hellman_group_t num)
+{
+	keypair_t *keypair = NULL;
+	group_t *group;
+	job_t *job;
+
+	this->mutex->lock(this->mutex);
+	if (this->groups->find_first(this->groups, (void*)match_group,
+								 (void**)&group, &num) != SUCCESS)
+	{
+		INIT(group,
+			.group = num,
+			.keypairs = linked_list_create(),
+			.pool = this,
+		);
+		this->groups->insert_last(this->groups, group);
+	}
+	if (group->keypairs->get_first(group->keypairs,
+								   (void**)&keypair) == SUCCESS)
+	{
+		if (--keypair->uses == 0)
+		{	/* the pool's reference is passed to the caller */
+			group->keypairs->remove_first(group->keypairs, (void**)&keypair);
+		}
+		else
+		{
+			ref_get(&keypair->refs);
+		}
+	}
+	if (!group->refilling && !group->failed &&
+		group->keypairs->get_count(group->keypairs) < this->size)
+	{
+		group->refilling = TRUE;
+		job = (job_t*)callback_job_create_with_prio((callback_job_cb_t)refill,
+									group, NULL, NULL, JOB_PRIO_LOW);
+		lib->processor->queue_job(lib->processor, job);
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (!keypair)
+	{
+		DBG2(DBG_IKE, "no pre-generated DH keypair for %N available",
+			 diffie_hellman_group_names, num);
+		return NULL;
+	}
+	if (this->reuse == 1)
+	{	/* not shared, hand out the DH object itself */
+		diffie_hellman_t *dh = keypair->dh;
+
+		keypair->mutex->destroy(keypair->mutex);
+		free(keypair);
+		return dh;
+	}
+	return pooled_dh_create(keypair);
+}
+
+METHOD(dh_pool_t, get_count, u_int,
+	private_dh_pool_t *this, diffie_hellman_group_t num)
+{
+	enumerator_t *enumerator;
+	group_t *group;
+	u_int count = 0;
+
+	this->mutex->lock(this->mutex);
+	enumerator = this->groups->create_enumerator(this->groups);
+	while (enumerator->enumerate(enumerator, &group))
+	{
+		if (num == MODP_NONE || group->group == num)
+		{
+			count += group->keypairs->get_count(group->keypairs);
+		}
+	}
+	enumerator->destroy(enumerator);
+	this->mutex->unlock(this->mutex);
+	return count;
+}
+
+/**
+ * Destroy a group's pool
+ */
+static void group_destroy(group_t *group)
+{
+	group->keypairs->destroy_function(group->keypairs, (void*)keypair_unref);
+	free(group);
+}
+
+METHOD(dh_pool_t, destroy, void,
+	private_dh_pool_t *this)
+{
+	this->groups->destroy_function(this->groups, (void*)group_destroy);
+	this->mutex->destroy(this->mutex);
+	free(this);
+}
+
+/*
+ * Described in header.
+ */
+dh_pool_t *dh_pool_create()
+{
+	private_dh_pool_t *this;
+	u_int size;
+
+	size = lib->settings->get_int(lib->settings, "%s.dh_pool.size",
+								  0, charon->name);
+	if (!size)
+	{
+		return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.get = _get,
+			.get_count = _get_count,
+			.destroy = _destroy,
+		},
+		.groups = linked_list_create(),
+		.size = size,
+		.reuse = max(1, lib->settings->get_int(lib->settings,
+								"%s.dh_pool.reuse", 1, charon->name)),
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+
+	DBG2(DBG_IKE, "pre-generating %u DH keypairs per group, each used %u "
+		 "time%s", this->size, this->reuse, this->reuse == 1 ? "" : "s");
+	return &this->public;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/**
+ * @defgroup dh_pool dh_pool
+ * @{ @ingroup sa
+ */
+
+#ifndef DH_POOL_H_
+#define DH_POOL_H_
+
+typedef struct dh_pool_t dh_pool_t;
+
+#include <library.h>
+#include <crypto/diffie_hellman.h>
+
+/**
+ * Pool of pre-generated DH keypairs.
+ *
+ * For each DH group requested, keypairs are generated in advance by low
+ * priority jobs, so the expensive generation of the private and public value
+ * does not delay the exchange. A keypair may optionally be handed out
+ * multiple times, each DH object returned computes its own shared secret.
+ */
+struct dh_pool_t {
+
+	/**
+	 * Get a pre-generated DH object for the given group.
+	 *
+	 * If the pool for the group is empty, a refill is scheduled.
+	 *
+	 * @param group		DH group
+	 * @return			DH object, NULL if none available
+	 */
+	diffie_hellman_t* (*get)(dh_pool_t *this, diffie_hellman_group_t group);
+
+	/**
+	 * Get the number of keypairs currently available in the pool.
+	 *
+	 * @param group		DH group, MODP_NONE for all groups
+	 * @return			number of pre-generated keypairs
+	 */
+	u_int (*get_count)(dh_pool_t *this, diffie_hellman_group_t group);
+
+	/**
+	 * Destroy a dh_pool_t, DH objects handed out stay valid.
+	 */
+	void (*destroy)(dh_pool_t *this);
+};
+
+/**
+ * Create a dh_pool instance.
+ *
+ * @return			instance, NULL if disabled in strongswan.conf
+ */
+dh_pool_t *dh_pool_create();
+
+#endif /** DH_POOL_H_ @}*/
@@ -1275,6 +1275,16 @@ METHOD(ike_sa_t, process_message, status_t,
 	return status;
 }
 
+METHOD(ike_sa_t, resume, status_t,
+	private_ike_sa_t *this)
+{
+	if (this->state == IKE_PASSIVE)
+	{
+		return SUCCESS;
+	}
+	return this->task_manager->resume(this->task_manager);
+}
+
 METHOD(ike_sa_t, get_id, ike_sa_id_t*,
 	private_ike_sa_t *this)
 {
@@ -2189,6 +2199,7 @@ ike_sa_t * ike_sa_create(ike_sa_id_t *ike_sa_id, bool initiator,
 			.get_statistic = _get_statistic,
 			.set_statistic = _set_statistic,
 			.process_message = _process_message,
+			.resume = _resume,
 			.initiate = _initiate,
 			.retry_initiate = _retry_initiate,
 			.get_ike_cfg = _get_ike_cfg,
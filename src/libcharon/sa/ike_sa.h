@@ -770,6 +770,18 @@ struct ike_sa_t {
 	 */
 	status_t (*process_message) (ike_sa_t *this, message_t *message);
 
+	/**
+	 * Resume an exchange delayed while processing a message.
+	 *
+	 * Called once computations offloaded while processing a request completed,
+	 * see dh_offload_t.
+	 *
+	 * @return
+	 *						- SUCCESS
+	 *						- DESTROY_ME if this IKE_SA MUST be deleted
+	 */
+	status_t (*resume) (ike_sa_t *this);
+
 	/**
 	 * Generate a IKE message to send it to the peer.
 	 *
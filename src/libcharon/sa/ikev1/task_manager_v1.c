@@ -1999,6 +1999,7 @@ task_manager_v1_t *task_manager_v1_create(ike_sa_t *ike_sa)
 		.public = {
 			.task_manager = {
 				.process_message = _process_message,
+				.resume = (void*)return_success,
 				.queue_task = _queue_task,
 				.queue_ike = _queue_ike,
 				.queue_ike_rekey = _queue_ike_rekey,
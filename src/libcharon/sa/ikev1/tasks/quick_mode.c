@@ -43,6 +43,7 @@
 #include <string.h>
 
 #include <daemon.h>
+#include <hydra.h>
 #include <sa/ikev1/keymat_v1.h>
 #include <encoding/payloads/sa_payload.h>
 #include <encoding/payloads/nonce_payload.h>
@@ -300,6 +301,8 @@ static bool install(private_quick_mode_t *this)
 		return FALSE;
 	}
 
+	/* stage SAs and policies to install them with a single kernel request */
+	hydra->kernel_interface->begin_batch(hydra->kernel_interface);
 	if (this->keymat->derive_child_keys(this->keymat, this->proposal, this->dh,
 						this->spi_i, this->spi_r, this->nonce_i, this->nonce_r,
 						&encr_i, &integ_i, &encr_r, &integ_r))
@@ -326,6 +329,7 @@ static bool install(private_quick_mode_t *this)
 
 	if (status_i != SUCCESS || status_o != SUCCESS)
 	{
+		hydra->kernel_interface->end_batch(hydra->kernel_interface, FALSE);
 		DBG1(DBG_IKE, "unable to install %s%s%sIPsec SA (SAD) in kernel",
 			(status_i != SUCCESS) ? "inbound " : "",
 			(status_i != SUCCESS && status_o != SUCCESS) ? "and ": "",
@@ -347,9 +351,16 @@ static bool install(private_quick_mode_t *this)
 	tsr->destroy_offset(tsr, offsetof(traffic_selector_t, destroy));
 	if (status != SUCCESS)
 	{
+		hydra->kernel_interface->end_batch(hydra->kernel_interface, FALSE);
 		DBG1(DBG_IKE, "unable to install IPsec policies (SPD) in kernel");
 		return FALSE;
 	}
+	if (hydra->kernel_interface->end_batch(hydra->kernel_interface,
+										   TRUE) != SUCCESS)
+	{
+		DBG1(DBG_IKE, "unable to install IPsec SAs and policies in kernel");
+		return FALSE;
+	}
 
 	charon->bus->child_keys(charon->bus, this->child_sa, this->initiator,
 							this->dh, this->nonce_i, this->nonce_r);
@@ -83,6 +83,22 @@ METHOD(keymat_t, create_dh, diffie_hellman_t*,
 	return lib->crypto->create_dh(lib->crypto, group);
 }
 
+METHOD(keymat_v2_t, create_ike_dh, diffie_hellman_t*,
+	private_keymat_v2_t *this, diffie_hellman_group_t group)
+{
+	diffie_hellman_t *dh;
+
+	if (!this->initiator && charon->dh_pool)
+	{
+		dh = charon->dh_pool->get(charon->dh_pool, group);
+		if (dh)
+		{
+			return dh;
+		}
+	}
+	return lib->crypto->create_dh(lib->crypto, group);
+}
+
 METHOD(keymat_t, create_nonce_gen, nonce_gen_t*,
 	private_keymat_v2_t *this)
 {
@@ -673,6 +689,7 @@ keymat_v2_t *keymat_v2_create(bool initiator)
 				.get_aead = _get_aead,
 				.destroy = _destroy,
 			},
+			.create_ike_dh = _create_ike_dh,
 			.derive_ike_keys = _derive_ike_keys,
 			.derive_child_keys = _derive_child_keys,
 			.get_skd = _get_skd,
@@ -35,6 +35,19 @@ struct keymat_v2_t {
 	 */
 	keymat_t keymat;
 
+	/**
+	 * Create a DH object for the IKE_SA_INIT exchange.
+	 *
+	 * Responders get a pre-generated keypair from the DH pool, if enabled.
+	 * All other exchanges use keymat_t.create_dh(), which never uses pooled
+	 * keypairs.
+	 *
+	 * @param group		DH group
+	 * @return			DH object, NULL if group not supported
+	 */
+	diffie_hellman_t* (*create_ike_dh)(keymat_v2_t *this,
+									   diffie_hellman_group_t group);
+
 	/**
 	 * Derive keys for the IKE_SA.
 	 *
@@ -93,6 +93,27 @@ struct private_task_manager_t {
 		 */
 		packet_t *packet;
 
+		/**
+		 * TRUE if building the response is delayed until offloaded
+		 * computations complete
+		 */
+		bool suspended;
+
+		/**
+		 * Exchange type of the delayed response
+		 */
+		exchange_type_t type;
+
+		/**
+		 * Source address of the delayed response
+		 */
+		host_t *me;
+
+		/**
+		 * Destination address of the delayed response
+		 */
+		host_t *other;
+
 	} responding;
 
 	/**
@@ -119,6 +140,11 @@ struct private_task_manager_t {
 		 */
 		exchange_type_t type;
 
+		/**
+		 * ID of the scheduled retransmit job, 0 if none
+		 */
+		u_int64_t job;
+
 	} initiating;
 
 	/**
@@ -157,6 +183,18 @@ struct private_task_manager_t {
 	double retransmit_base;
 };
 
+/**
+ * Forget about a delayed response
+ */
+static void clear_suspended(private_task_manager_t *this)
+{
+	this->responding.suspended = FALSE;
+	DESTROY_IF(this->responding.me);
+	DESTROY_IF(this->responding.other);
+	this->responding.me = NULL;
+	this->responding.other = NULL;
+}
+
 METHOD(task_manager_t, flush_queue, void,
 	private_task_manager_t *this, task_queue_t queue)
 {
@@ -170,6 +208,7 @@ METHOD(task_manager_t, flush_queue, void,
 			break;
 		case TASK_QUEUE_PASSIVE:
 			list = this->passive_tasks;
+			clear_suspended(this);
 			break;
 		case TASK_QUEUE_QUEUED:
 			list = this->queued_tasks;
@@ -218,6 +257,18 @@ static bool activate_task(private_task_manager_t *this, task_type_t type)
 	return found;
 }
 
+/**
+ * Remove the retransmit job of the current exchange from the scheduler
+ */
+static void unschedule_retransmit(private_task_manager_t *this)
+{
+	if (this->initiating.job)
+	{
+		lib->scheduler->unschedule_job(lib->scheduler, this->initiating.job);
+		this->initiating.job = 0;
+	}
+}
+
 METHOD(task_manager_t, retransmit, status_t,
 	private_task_manager_t *this, u_int32_t message_id)
 {
@@ -296,7 +347,9 @@ METHOD(task_manager_t, retransmit, status_t,
 		this->initiating.retransmitted++;
 		job = (job_t*)retransmit_job_create(this->initiating.mid,
 											this->ike_sa->get_id(this->ike_sa));
-		lib->scheduler->schedule_job_ms(lib->scheduler, job, timeout);
+		unschedule_retransmit(this);
+		this->initiating.job = lib->scheduler->schedule_job_ms_id(
+											lib->scheduler, job, timeout);
 	}
 	return SUCCESS;
 }
@@ -567,6 +620,8 @@ static status_t process_response(private_task_manager_t *this,
 	this->initiating.type = EXCHANGE_TYPE_UNDEFINED;
 	this->initiating.packet->destroy(this->initiating.packet);
 	this->initiating.packet = NULL;
+	/* the response arrived, no need to keep the retransmit job around */
+	unschedule_retransmit(this);
 
 	return initiate(this);
 }
@@ -622,24 +677,21 @@ static bool handle_collisions(private_task_manager_t *this, task_t *task)
 }
 
 /**
- * build a response depending on the "passive" task list
+ * build a response depending on the "passive" task list, sent from me to other
  */
-static status_t build_response(private_task_manager_t *this, message_t *request)
+static status_t build_response(private_task_manager_t *this,
+							   exchange_type_t type, host_t *me, host_t *other)
 {
 	enumerator_t *enumerator;
 	task_t *task;
 	message_t *message;
-	host_t *me, *other;
 	bool delete = FALSE, hook = FALSE;
 	ike_sa_id_t *id = NULL;
 	u_int64_t responder_spi;
 	status_t status;
 
-	me = request->get_destination(request);
-	other = request->get_source(request);
-
 	message = message_create(IKEV2_MAJOR_VERSION, IKEV2_MINOR_VERSION);
-	message->set_exchange_type(message, request->get_exchange_type(request));
+	message->set_exchange_type(message, type);
 	/* send response along the path the request came in */
 	message->set_source(message, me->clone(me));
 	message->set_destination(message, other->clone(other));
@@ -688,7 +740,7 @@ static status_t build_response(private_task_manager_t *this, message_t *request)
 	 * actually explicitly allows it to be non-zero.  Since we use the responder
 	 * SPI to create hashes in the IKE_SA manager we can only set the SPI to
 	 * zero temporarily, otherwise checking the SA in would fail. */
-	if (delete && request->get_exchange_type(request) == IKE_SA_INIT)
+	if (delete && type == IKE_SA_INIT)
 	{
 		id = this->ike_sa->get_id(this->ike_sa);
 		responder_spi = id->get_responder_spi(id);
@@ -926,7 +978,43 @@ static status_t process_request(private_task_manager_t *this,
 	}
 	enumerator->destroy(enumerator);
 
-	return build_response(this, message);
+	if (charon->dh_offload &&
+		charon->dh_offload->is_pending(charon->dh_offload, this->ike_sa))
+	{	/* the response is built by resume() once the DH is computed */
+		this->responding.suspended = TRUE;
+		this->responding.type = message->get_exchange_type(message);
+		this->responding.me = message->get_destination(message);
+		this->responding.me = this->responding.me->clone(this->responding.me);
+		this->responding.other = message->get_source(message);
+		this->responding.other = this->responding.other->clone(
+													this->responding.other);
+		return NEED_MORE;
+	}
+	return build_response(this, message->get_exchange_type(message),
+						  message->get_destination(message),
+						  message->get_source(message));
+}
+
+METHOD(task_manager_t, resume, status_t,
+	private_task_manager_t *this)
+{
+	status_t status;
+
+	if (!this->responding.suspended ||
+		charon->dh_offload->is_pending(charon->dh_offload, this->ike_sa))
+	{
+		return SUCCESS;
+	}
+	status = build_response(this, this->responding.type,
+							this->responding.me, this->responding.other);
+	clear_suspended(this);
+	if (status != SUCCESS)
+	{
+		flush(this);
+		return DESTROY_ME;
+	}
+	this->responding.mid++;
+	return SUCCESS;
 }
 
 METHOD(task_manager_t, incr_mid, void,
@@ -1122,7 +1210,13 @@ METHOD(task_manager_t, process_message, status_t,
 	mid = msg->get_message_id(msg);
 	if (msg->get_request(msg))
 	{
-		if (mid == this->responding.mid)
+		if (mid == this->responding.mid && this->responding.suspended)
+		{
+			DBG1(DBG_IKE, "received retransmit of request with ID %d, "
+				 "but no response to retransmit yet", mid);
+			return SUCCESS;
+		}
+		else if (mid == this->responding.mid)
 		{
 			/* reject initial messages once established */
 			if (msg->get_exchange_type(msg) == IKE_SA_INIT ||
@@ -1150,10 +1244,16 @@ METHOD(task_manager_t, process_message, status_t,
 			{	/* ignore messages altered to EXCHANGE_TYPE_UNDEFINED */
 				return SUCCESS;
 			}
-			if (process_request(this, msg) != SUCCESS)
+			switch (process_request(this, msg))
 			{
-				flush(this);
-				return DESTROY_ME;
+				case SUCCESS:
+					break;
+				case NEED_MORE:
+					/* response delayed until resume() */
+					return SUCCESS;
+				default:
+					flush(this);
+					return DESTROY_ME;
 			}
 			this->responding.mid++;
 		}
@@ -1430,6 +1530,7 @@ METHOD(task_manager_t, reset, void,
 	DESTROY_IF(this->initiating.packet);
 	this->responding.packet = NULL;
 	this->initiating.packet = NULL;
+	unschedule_retransmit(this);
 	if (initiate != UINT_MAX)
 	{
 		this->initiating.mid = initiate;
@@ -1486,6 +1587,8 @@ METHOD(task_manager_t, destroy, void,
 
 	DESTROY_IF(this->responding.packet);
 	DESTROY_IF(this->initiating.packet);
+	unschedule_retransmit(this);
+	clear_suspended(this);
 	free(this);
 }
 
@@ -1500,6 +1603,7 @@ task_manager_v2_t *task_manager_v2_create(ike_sa_t *ike_sa)
 		.public = {
 			.task_manager = {
 				.process_message = _process_message,
+				.resume = _resume,
 				.queue_task = _queue_task,
 				.queue_ike = _queue_ike,
 				.queue_ike_rekey = _queue_ike_rekey,
@@ -520,6 +520,8 @@ static status_t select_and_install(private_child_create_t *this,
 		this->ipcomp = IPCOMP_NONE;
 	}
 	status_i = status_o = FAILED;
+	/* stage SAs and policies to install them with a single kernel request */
+	hydra->kernel_interface->begin_batch(hydra->kernel_interface);
 	if (this->keymat->derive_child_keys(this->keymat, this->proposal,
 			this->dh, nonce_i, nonce_r, &encr_i, &integ_i, &encr_r, &integ_r))
 	{
@@ -549,6 +551,7 @@ static status_t select_and_install(private_child_create_t *this,
 
 	if (status_i != SUCCESS || status_o != SUCCESS)
 	{
+		hydra->kernel_interface->end_batch(hydra->kernel_interface, FALSE);
 		DBG1(DBG_IKE, "unable to install %s%s%sIPsec SA (SAD) in kernel",
 			(status_i != SUCCESS) ? "inbound " : "",
 			(status_i != SUCCESS && status_o != SUCCESS) ? "and ": "",
@@ -586,11 +589,20 @@ static status_t select_and_install(private_child_create_t *this,
 	}
 	if (status != SUCCESS)
 	{
+		hydra->kernel_interface->end_batch(hydra->kernel_interface, FALSE);
 		DBG1(DBG_IKE, "unable to install IPsec policies (SPD) in kernel");
 		charon->bus->alert(charon->bus, ALERT_INSTALL_CHILD_POLICY_FAILED,
 						   this->child_sa);
 		return NOT_FOUND;
 	}
+	if (hydra->kernel_interface->end_batch(hydra->kernel_interface,
+										   TRUE) != SUCCESS)
+	{
+		DBG1(DBG_IKE, "unable to install IPsec SAs and policies in kernel");
+		charon->bus->alert(charon->bus, ALERT_INSTALL_CHILD_SA_FAILED,
+						   this->child_sa);
+		return FAILED;
+	}
 
 	charon->bus->child_keys(charon->bus, this->child_sa, this->initiator,
 							this->dh, nonce_i, nonce_r);
@@ -783,6 +795,14 @@ static void process_payloads(private_child_create_t *this, message_t *message)
 				if (!this->initiator)
 				{
 					this->dh_group = ke_payload->get_dh_group_number(ke_payload);
+					if (charon->dh_offload &&
+						charon->dh_offload->create_dh(charon->dh_offload,
+							this->ike_sa, this->keymat, FALSE, &this->dh,
+							this->dh_group,
+							ke_payload->get_key_exchange_data(ke_payload)))
+					{	/* computed asynchronously, build_r() is delayed */
+						break;
+					}
 					this->dh = this->keymat->keymat.create_dh(
 										&this->keymat->keymat, this->dh_group);
 				}
@@ -1345,6 +1365,17 @@ METHOD(task_t, get_type, task_type_t,
 	return TASK_CHILD_CREATE;
 }
 
+/**
+ * Cancel or wait for an offloaded DH computation before accessing the DH object
+ */
+static void cancel_dh(private_child_create_t *this)
+{
+	if (!this->initiator && charon->dh_offload)
+	{
+		charon->dh_offload->cancel(charon->dh_offload, &this->dh);
+	}
+}
+
 METHOD(task_t, migrate, void,
 	private_child_create_t *this, ike_sa_t *ike_sa)
 {
@@ -1360,6 +1391,7 @@ METHOD(task_t, migrate, void,
 	}
 	DESTROY_IF(this->child_sa);
 	DESTROY_IF(this->proposal);
+	cancel_dh(this);
 	DESTROY_IF(this->dh);
 	if (this->proposals)
 	{
@@ -1402,6 +1434,7 @@ METHOD(task_t, destroy, void,
 	DESTROY_IF(this->packet_tsi);
 	DESTROY_IF(this->packet_tsr);
 	DESTROY_IF(this->proposal);
+	cancel_dh(this);
 	DESTROY_IF(this->dh);
 	if (this->proposals)
 	{
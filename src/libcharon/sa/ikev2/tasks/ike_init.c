@@ -203,8 +203,25 @@ static void process_payloads(private_ike_init_t *this, message_t *message)
 				this->dh_group = ke_payload->get_dh_group_number(ke_payload);
 				if (!this->initiator)
 				{
-					this->dh = this->keymat->keymat.create_dh(
+					/* when rekeying, the exchange belongs to the old SA */
+					if (charon->dh_offload &&
+						charon->dh_offload->create_dh(charon->dh_offload,
+							this->old_sa ?: this->ike_sa, this->keymat,
+							!this->old_sa, &this->dh, this->dh_group,
+							ke_payload->get_key_exchange_data(ke_payload)))
+					{	/* computed asynchronously, build_r() is delayed */
+						break;
+					}
+					if (this->old_sa)
+					{	/* no pooled keypairs when rekeying, for PFS */
+						this->dh = this->keymat->keymat.create_dh(
 										&this->keymat->keymat, this->dh_group);
+					}
+					else
+					{
+						this->dh = this->keymat->create_ike_dh(this->keymat,
+															   this->dh_group);
+					}
 				}
 				if (this->dh)
 				{
@@ -338,6 +355,17 @@ METHOD(task_t, process_r,  status_t,
 	return NEED_MORE;
 }
 
+/**
+ * Cancel or wait for an offloaded DH computation before accessing the DH object
+ */
+static void cancel_dh(private_ike_init_t *this)
+{
+	if (!this->initiator && charon->dh_offload)
+	{
+		charon->dh_offload->cancel(charon->dh_offload, &this->dh);
+	}
+}
+
 /**
  * Derive the keymat for the IKE_SA
  */
@@ -551,6 +579,7 @@ METHOD(task_t, migrate, void,
 	DESTROY_IF(this->proposal);
 	chunk_free(&this->other_nonce);
 
+	cancel_dh(this);
 	this->ike_sa = ike_sa;
 	this->keymat = (keymat_v2_t*)ike_sa->get_keymat(ike_sa);
 	this->proposal = NULL;
@@ -565,6 +594,7 @@ METHOD(task_t, migrate, void,
 METHOD(task_t, destroy, void,
 	private_ike_init_t *this)
 {
+	cancel_dh(this);
 	DESTROY_IF(this->dh);
 	DESTROY_IF(this->proposal);
 	chunk_free(&this->my_nonce);
@@ -112,6 +112,18 @@ struct task_manager_t {
 	 */
 	status_t (*process_message) (task_manager_t *this, message_t *message);
 
+	/**
+	 * Resume the exchange delayed by process_message().
+	 *
+	 * If tasks offloaded computations while processing a request, the response
+	 * is delayed until they complete. This method then builds and sends it.
+	 *
+	 * @return
+	 *						- DESTROY_ME if IKE_SA must be closed
+	 *						- SUCCESS otherwise
+	 */
+	status_t (*resume) (task_manager_t *this);
+
 	/**
 	 * Initiate an exchange with the currently queued tasks.
 	 */
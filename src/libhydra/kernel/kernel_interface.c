@@ -253,6 +253,26 @@ METHOD(kernel_interface_t, add_policy, status_t,
 								   direction, type, sa, mark, priority);
 }
 
+METHOD(kernel_interface_t, begin_batch, void,
+	private_kernel_interface_t *this)
+{
+	if (this->ipsec && this->ipsec->begin_batch)
+	{
+		this->ipsec->begin_batch(this->ipsec);
+	}
+}
+
+METHOD(kernel_interface_t, end_batch, status_t,
+	private_kernel_interface_t *this, bool commit)
+{
+	if (this->ipsec && this->ipsec->end_batch)
+	{
+		return this->ipsec->end_batch(this->ipsec, commit);
+	}
+	/* entries got installed directly */
+	return SUCCESS;
+}
+
 METHOD(kernel_interface_t, query_policy, status_t,
 	private_kernel_interface_t *this, traffic_selector_t *src_ts,
 	traffic_selector_t *dst_ts, policy_dir_t direction, mark_t mark,
@@ -733,6 +753,8 @@ kernel_interface_t *kernel_interface_create()
 			.del_sa = _del_sa,
 			.flush_sas = _flush_sas,
 			.add_policy = _add_policy,
+			.begin_batch = _begin_batch,
+			.end_batch = _end_batch,
 			.query_policy = _query_policy,
 			.del_policy = _del_policy,
 			.flush_policies = _flush_policies,
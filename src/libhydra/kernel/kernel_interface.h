@@ -251,6 +251,27 @@ struct kernel_interface_t {
 							ipsec_sa_cfg_t *sa, mark_t mark,
 							policy_priority_t priority);
 
+	/**
+	 * Start staging SAs and policies installed by the calling thread.
+	 *
+	 * While a batch is active, add_sa() and add_policy() calls of the calling
+	 * thread are queued and return SUCCESS without contacting the kernel.
+	 * The queued entries get installed together by end_batch().
+	 */
+	void (*begin_batch)(kernel_interface_t *this);
+
+	/**
+	 * Install or discard the SAs and policies staged since begin_batch().
+	 *
+	 * Staged entries are handled like entries installed individually, if
+	 * any of them can't be installed or they are discarded, the caller has
+	 * to remove them with del_sa() and del_policy().
+	 *
+	 * @param commit		TRUE to install staged entries, FALSE to discard them
+	 * @return				SUCCESS if all staged entries were installed
+	 */
+	status_t (*end_batch)(kernel_interface_t *this, bool commit);
+
 	/**
 	 * Query the use time of a policy.
 	 *
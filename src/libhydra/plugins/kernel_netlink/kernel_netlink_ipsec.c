@@ -39,6 +39,7 @@
 #include <utils/debug.h>
 #include <threading/thread.h>
 #include <threading/mutex.h>
+#include <threading/thread_value.h>
 #include <collections/hashtable.h>
 #include <collections/linked_list.h>
 #include <processing/jobs/callback_job.h>
@@ -301,6 +302,12 @@ struct private_kernel_netlink_ipsec_t {
 	 */
 	netlink_socket_t *socket_xfrm;
 
+	/**
+	 * Messages staged by the current thread (linked_list_t of nlmsghdr),
+	 * NULL if no batch is active
+	 */
+	thread_value_t *batch;
+
 	/**
 	 * Netlink xfrm socket to receive acquire and expire events
 	 */
@@ -1165,6 +1172,130 @@ static bool add_mark(struct nlmsghdr *hdr, int buflen, mark_t mark)
 	return TRUE;
 }
 
+/**
+ * Send a message and wait for its acknowledge, or stage it if the calling
+ * thread has an active batch
+ */
+static status_t send_ack_or_stage(private_kernel_netlink_ipsec_t *this,
+								  struct nlmsghdr *hdr)
+{
+	linked_list_t *batch;
+
+	batch = this->batch->get(this->batch);
+	if (batch)
+	{
+		batch->insert_last(batch, clalloc(hdr, hdr->nlmsg_len));
+		return SUCCESS;
+	}
+	return this->socket_xfrm->send_ack(this->socket_xfrm, hdr);
+}
+
+/**
+ * Destroy a staged message, which might contain keys
+ */
+static void staged_destroy(struct nlmsghdr *hdr)
+{
+	memwipe(hdr, hdr->nlmsg_len);
+	free(hdr);
+}
+
+/**
+ * Log a staged message that could not be installed
+ */
+static void log_staged_failure(struct nlmsghdr *in)
+{
+	switch (in->nlmsg_type)
+	{
+		case XFRM_MSG_NEWSA:
+		case XFRM_MSG_UPDSA:
+		{
+			struct xfrm_usersa_info *sa = NLMSG_DATA(in);
+
+			DBG1(DBG_KNL, "unable to add SAD entry with SPI %.8x",
+				 ntohl(sa->id.spi));
+			break;
+		}
+		case XFRM_MSG_NEWPOLICY:
+		case XFRM_MSG_UPDPOLICY:
+		{
+			struct xfrm_userpolicy_info *policy = NLMSG_DATA(in);
+			traffic_selector_t *src_ts, *dst_ts;
+
+			src_ts = selector2ts(&policy->sel, TRUE);
+			dst_ts = selector2ts(&policy->sel, FALSE);
+			DBG1(DBG_KNL, "unable to %s policy %R === %R %N",
+				 in->nlmsg_type == XFRM_MSG_NEWPOLICY ? "add" : "update",
+				 src_ts, dst_ts, policy_dir_names, policy->dir);
+			DESTROY_IF(src_ts);
+			DESTROY_IF(dst_ts);
+			break;
+		}
+		default:
+			DBG1(DBG_KNL, "unable to install %N", xfrm_msg_names,
+				 in->nlmsg_type);
+			break;
+	}
+}
+
+METHOD(kernel_ipsec_t, begin_batch, void,
+	private_kernel_netlink_ipsec_t *this)
+{
+	if (!this->batch->get(this->batch))
+	{
+		this->batch->set(this->batch, linked_list_create());
+	}
+}
+
+METHOD(kernel_ipsec_t, end_batch, status_t,
+	private_kernel_netlink_ipsec_t *this, bool commit)
+{
+	enumerator_t *enumerator;
+	linked_list_t *batch;
+	struct nlmsghdr *hdr;
+	status_t status = SUCCESS;
+	int i = 0, count;
+
+	batch = this->batch->get(this->batch);
+	if (!batch)
+	{
+		return SUCCESS;
+	}
+	this->batch->set(this->batch, NULL);
+
+	count = batch->get_count(batch);
+	if (commit && count)
+	{
+		struct nlmsghdr *in[count];
+		status_t result[count];
+
+		DBG2(DBG_KNL, "installing %d staged SAD/SPD entries", count);
+		enumerator = batch->create_enumerator(batch);
+		while (enumerator->enumerate(enumerator, &hdr))
+		{
+			in[i++] = hdr;
+		}
+		enumerator->destroy(enumerator);
+
+		if (this->socket_xfrm->send_ack_batch(this->socket_xfrm, in, count,
+											  result) != SUCCESS)
+		{	/* the entries were registered by add_sa()/add_policy() as if
+			 * installed individually, the caller removes them again with
+			 * del_sa()/del_policy(), which also updates policy refcounts and
+			 * routes */
+			for (i = 0; i < count; i++)
+			{
+				if (result[i] != SUCCESS)
+				{
+					log_staged_failure(in[i]);
+				}
+			}
+			status = FAILED;
+		}
+	}
+	batch->destroy_function(batch, (void*)staged_destroy);
+	return status;
+}
+
 METHOD(kernel_ipsec_t, add_sa, status_t,
 	private_kernel_netlink_ipsec_t *this, host_t *src, host_t *dst,
 	u_int32_t spi, u_int8_t protocol, u_int32_t reqid, mark_t mark,
@@ -1474,7 +1605,7 @@ METHOD(kernel_ipsec_t, add_sa, status_t,
 		}
 	}
 
-	if (this->socket_xfrm->send_ack(this->socket_xfrm, hdr) != SUCCESS)
+	if (send_ack_or_stage(this, hdr) != SUCCESS)
 	{
 		if (mark.value)
 		{
@@ -2075,7 +2206,7 @@ static status_t add_policy_internal(private_kernel_netlink_ipsec_t *this,
 	}
 	this->mutex->unlock(this->mutex);
 
-	if (this->socket_xfrm->send_ack(this->socket_xfrm, hdr) != SUCCESS)
+	if (send_ack_or_stage(this, hdr) != SUCCESS)
 	{
 		return FAILED;
 	}
@@ -2596,6 +2727,7 @@ METHOD(kernel_ipsec_t, destroy, void,
 	enumerator->destroy(enumerator);
 	this->policies->destroy(this->policies);
 	this->sas->destroy(this->sas);
+	this->batch->destroy(this->batch);
 	this->mutex->destroy(this->mutex);
 	free(this);
 }
@@ -2621,6 +2753,8 @@ kernel_netlink_ipsec_t *kernel_netlink_ipsec_create()
 				.del_sa = _del_sa,
 				.flush_sas = _flush_sas,
 				.add_policy = _add_policy,
+				.begin_batch = _begin_batch,
+				.end_batch = _end_batch,
 				.query_policy = _query_policy,
 				.del_policy = _del_policy,
 				.flush_policies = _flush_policies,
@@ -2634,6 +2768,7 @@ kernel_netlink_ipsec_t *kernel_netlink_ipsec_create()
 		.sas = hashtable_create((hashtable_hash_t)ipsec_sa_hash,
 								(hashtable_equals_t)ipsec_sa_equals, 32),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.batch = thread_value_create(NULL),
 		.policy_history = TRUE,
 		.install_routes = lib->settings->get_bool(lib->settings,
 					"%s.install_routes", TRUE, hydra->daemon),
@@ -23,6 +23,13 @@
 
 #include <utils/debug.h>
 #include <threading/mutex.h>
+#include <threading/condvar.h>
+#include <collections/hashtable.h>
+
+/**
+ * Maximum size of a datagram sent by send_ack_batch()
+ */
+#define NETLINK_BATCH_SIZE 32768
 
 typedef struct private_netlink_socket_t private_netlink_socket_t;
 
@@ -36,10 +43,25 @@ struct private_netlink_socket_t {
 	netlink_socket_t public;
 
 	/**
-	 * mutex to lock access to netlink socket
+	 * mutex to lock access to entries and the reader role
 	 */
 	mutex_t *mutex;
 
+	/**
+	 * mutex to serialize dump requests, the kernel handles only one at a time
+	 */
+	mutex_t *dump_mutex;
+
+	/**
+	 * Requests waiting for a response, uintptr_t seq => entry_t
+	 */
+	hashtable_t *entries;
+
+	/**
+	 * TRUE if a thread currently reads from the socket
+	 */
+	bool reading;
+
 	/**
 	 * current sequence number for netlink request
 	 */
@@ -56,141 +78,365 @@ struct private_netlink_socket_t {
 	int socket;
 };
 
+/**
+ * Request waiting for its response
+ */
+typedef struct {
+
+	/**
+	 * Condvar to wait for the response or the reader role
+	 */
+	condvar_t *condvar;
+
+	/**
+	 * Received response messages, concatenated
+	 */
+	chunk_t result;
+
+	/**
+	 * TRUE if the response is complete
+	 */
+	bool complete;
+
+	/**
+	 * TRUE if receiving the response failed
+	 */
+	bool failed;
+
+} entry_t;
+
 /**
  * Imported from kernel_netlink_ipsec.c
  */
 extern enum_name_t *xfrm_msg_names;
 
-METHOD(netlink_socket_t, netlink_send, status_t,
-	private_netlink_socket_t *this, struct nlmsghdr *in, struct nlmsghdr **out,
-	size_t *out_len)
+/**
+ * Hash a sequence number
+ */
+static u_int hash_seq(uintptr_t seq)
 {
-	int len, addr_len;
-	struct sockaddr_nl addr;
-	chunk_t result = chunk_empty, tmp;
-	struct nlmsghdr *msg, peek;
+	return seq;
+}
 
-	this->mutex->lock(this->mutex);
+/**
+ * Compare two sequence numbers
+ */
+static bool equals_seq(uintptr_t a, uintptr_t b)
+{
+	return a == b;
+}
 
-	in->nlmsg_seq = ++this->seq;
-	in->nlmsg_pid = getpid();
+/**
+ * Pass the reader role to another thread waiting for a response, unless a
+ * thread currently reads from the socket
+ */
+static void pass_reader(private_netlink_socket_t *this)
+{
+	enumerator_t *enumerator;
+	entry_t *entry;
 
-	memset(&addr, 0, sizeof(addr));
-	addr.nl_family = AF_NETLINK;
-	addr.nl_pid = 0;
-	addr.nl_groups = 0;
+	if (this->reading)
+	{
+		return;
+	}
+	enumerator = this->entries->create_enumerator(this->entries);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
+	{
+		if (!entry->complete)
+		{
+			entry->condvar->signal(entry->condvar);
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+}
 
-	if (this->protocol == NETLINK_XFRM)
+/**
+ * Mark all pending requests as failed
+ */
+static void fail_entries(private_netlink_socket_t *this)
+{
+	enumerator_t *enumerator;
+	entry_t *entry;
+
+	enumerator = this->entries->create_enumerator(this->entries);
+	while (enumerator->enumerate(enumerator, NULL, &entry))
 	{
-		chunk_t in_chunk = { (u_char*)in, in->nlmsg_len };
+		entry->failed = entry->complete = TRUE;
+		entry->condvar->signal(entry->condvar);
+	}
+	enumerator->destroy(enumerator);
+}
 
-		DBG3(DBG_KNL, "sending %N: %B", xfrm_msg_names, in->nlmsg_type, &in_chunk);
+/**
+ * Pass the messages in a received datagram to the requests waiting for them,
+ * next_seq is the sequence number of the next queued datagram, if any.
+ * this->mutex must be held
+ */
+static void dispatch(private_netlink_socket_t *this, struct nlmsghdr *msg,
+					 int len, u_int32_t next_seq)
+{
+	struct nlmsghdr *next;
+	entry_t *entry;
+	u_int32_t seq;
+	bool multi;
+
+	while (NLMSG_OK(msg, len))
+	{
+		seq = msg->nlmsg_seq;
+		entry = this->entries->get(this->entries, (void*)(uintptr_t)seq);
+		if (!entry || entry->complete)
+		{
+			DBG1(DBG_KNL, "received netlink message with unexpected sequence "
+				 "number %u", seq);
+			entry = NULL;
+		}
+		else
+		{
+			entry->result = chunk_cat("mc", entry->result,
+								chunk_create((u_char*)msg, msg->nlmsg_len));
+		}
+		multi = (msg->nlmsg_flags & NLM_F_MULTI) &&
+				 msg->nlmsg_type != NLMSG_DONE;
+		next = NLMSG_NEXT(msg, len);
+		/* NLM_F_MULTI flag does not seem to be set correctly, we use sequence
+		 * numbers to detect multi header messages. Dumps are only continued
+		 * while reading, so if other responses are queued we wait for
+		 * NLMSG_DONE of those that are flagged */
+		if (entry && !multi &&
+			(NLMSG_OK(next, len) ? next->nlmsg_seq : next_seq) != seq)
+		{
+			entry->complete = TRUE;
+			entry->condvar->signal(entry->condvar);
+		}
+		msg = next;
 	}
+}
+
+/**
+ * Read a single datagram from the socket and dispatch it, called without
+ * holding this->mutex, but as the only thread having the reader role
+ */
+static bool read_and_dispatch(private_netlink_socket_t *this)
+{
+	char buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *msg = (struct nlmsghdr*)buf, peek;
+	int len;
 
 	while (TRUE)
 	{
-		len = sendto(this->socket, in, in->nlmsg_len, 0,
-					 (struct sockaddr*)&addr, sizeof(addr));
-
-		if (len != in->nlmsg_len)
+		len = recv(this->socket, buf, sizeof(buf), 0);
+		if (len < 0)
 		{
 			if (errno == EINTR)
 			{
+				DBG1(DBG_KNL, "got interrupted");
 				/* interrupted, try again */
 				continue;
 			}
-			this->mutex->unlock(this->mutex);
-			DBG1(DBG_KNL, "error sending to netlink socket: %s", strerror(errno));
-			return FAILED;
+			DBG1(DBG_KNL, "error reading from netlink socket: %s",
+				 strerror(errno));
+			this->mutex->lock(this->mutex);
+			return FALSE;
 		}
 		break;
 	}
+	/* check if the response continues in the next datagram */
+	if (recv(this->socket, &peek, sizeof(peek),
+			 MSG_PEEK | MSG_DONTWAIT) != sizeof(peek))
+	{
+		peek.nlmsg_seq = 0;
+	}
+	this->mutex->lock(this->mutex);
+	if (!NLMSG_OK(msg, len))
+	{
+		DBG1(DBG_KNL, "received corrupted netlink message");
+		return TRUE;
+	}
+	dispatch(this, msg, len, peek.nlmsg_seq);
+	return TRUE;
+}
 
-	while (TRUE)
+/**
+ * Assign sequence numbers to the given messages and register an entry to
+ * collect the response for each of them
+ */
+static void register_entries(private_netlink_socket_t *this,
+							 struct nlmsghdr **in, entry_t *entries, int count)
+{
+	int i;
+
+	this->mutex->lock(this->mutex);
+	for (i = 0; i < count; i++)
 	{
-		char buf[4096];
-		tmp.len = sizeof(buf);
-		tmp.ptr = buf;
-		msg = (struct nlmsghdr*)tmp.ptr;
+		in[i]->nlmsg_seq = ++this->seq;
+		in[i]->nlmsg_pid = getpid();
+		this->entries->put(this->entries, (void*)(uintptr_t)in[i]->nlmsg_seq,
+						   &entries[i]);
+	}
+	this->mutex->unlock(this->mutex);
+}
 
-		memset(&addr, 0, sizeof(addr));
-		addr.nl_family = AF_NETLINK;
-		addr.nl_pid = getpid();
-		addr.nl_groups = 0;
-		addr_len = sizeof(addr);
+/**
+ * Send the given messages in a single datagram
+ */
+static bool send_datagram(private_netlink_socket_t *this, struct nlmsghdr **in,
+						  int count)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+	};
+	struct iovec iov[count];
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iov = iov,
+		.msg_iovlen = count,
+	};
+	size_t total = 0;
+	int i, len;
+
+	for (i = 0; i < count; i++)
+	{
+		if (this->protocol == NETLINK_XFRM)
+		{
+			chunk_t in_chunk = { (u_char*)in[i], in[i]->nlmsg_len };
 
-		len = recvfrom(this->socket, tmp.ptr, tmp.len, 0,
-					   (struct sockaddr*)&addr, &addr_len);
+			DBG3(DBG_KNL, "sending %N: %B", xfrm_msg_names, in[i]->nlmsg_type,
+				 &in_chunk);
+		}
+		iov[i].iov_base = in[i];
+		iov[i].iov_len = NLMSG_ALIGN(in[i]->nlmsg_len);
+		total += iov[i].iov_len;
+	}
+	/* the last message does not have to be padded */
+	total -= iov[count - 1].iov_len - in[count - 1]->nlmsg_len;
+	iov[count - 1].iov_len = in[count - 1]->nlmsg_len;
 
-		if (len < 0)
+	while (TRUE)
+	{
+		len = sendmsg(this->socket, &msg, 0);
+		if (len != total)
 		{
 			if (errno == EINTR)
 			{
-				DBG1(DBG_KNL, "got interrupted");
 				/* interrupted, try again */
 				continue;
 			}
-			DBG1(DBG_KNL, "error reading from netlink socket: %s", strerror(errno));
-			this->mutex->unlock(this->mutex);
-			free(result.ptr);
-			return FAILED;
+			DBG1(DBG_KNL, "error sending to netlink socket: %s", strerror(errno));
+			return FALSE;
 		}
-		if (!NLMSG_OK(msg, len))
+		return TRUE;
+	}
+}
+
+/**
+ * Wait until the responses to all the given entries are complete and
+ * unregister them
+ */
+static void wait_for_entries(private_netlink_socket_t *this,
+							 struct nlmsghdr **in, entry_t *entries, int count)
+{
+	int i = 0;
+
+	/* multiple requests may be in flight, the thread that reads from the
+	 * socket passes responses to the other threads based on the sequence
+	 * number. If our responses are complete, another waiting thread takes
+	 * over reading */
+	this->mutex->lock(this->mutex);
+	while (i < count)
+	{
+		if (entries[i].complete)
 		{
-			DBG1(DBG_KNL, "received corrupted netlink message");
-			this->mutex->unlock(this->mutex);
-			free(result.ptr);
-			return FAILED;
+			i++;
+			continue;
 		}
-		if (msg->nlmsg_seq != this->seq)
+		if (this->reading)
 		{
-			DBG1(DBG_KNL, "received invalid netlink sequence number");
-			if (msg->nlmsg_seq < this->seq)
-			{
-				continue;
-			}
-			this->mutex->unlock(this->mutex);
-			free(result.ptr);
-			return FAILED;
+			entries[i].condvar->wait(entries[i].condvar, this->mutex);
+			continue;
 		}
-
-		tmp.len = len;
-		result.ptr = realloc(result.ptr, result.len + tmp.len);
-		memcpy(result.ptr + result.len, tmp.ptr, tmp.len);
-		result.len += tmp.len;
-
-		/* NLM_F_MULTI flag does not seem to be set correctly, we use sequence
-		 * numbers to detect multi header messages */
-		len = recvfrom(this->socket, &peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT,
-					   (struct sockaddr*)&addr, &addr_len);
-
-		if (len == sizeof(peek) && peek.nlmsg_seq == this->seq)
+		this->reading = TRUE;
+		this->mutex->unlock(this->mutex);
+		if (!read_and_dispatch(this))
 		{
-			/* seems to be multipart */
-			continue;
+			fail_entries(this);
 		}
-		break;
+		this->reading = FALSE;
 	}
+	for (i = 0; i < count; i++)
+	{
+		this->entries->remove(this->entries,
+							  (void*)(uintptr_t)in[i]->nlmsg_seq);
+	}
+	pass_reader(this);
+	this->mutex->unlock(this->mutex);
+}
 
-	*out_len = result.len;
-	*out = (struct nlmsghdr*)result.ptr;
+/**
+ * Mark the given entries as failed without waiting for a response
+ */
+static void unregister_entries(private_netlink_socket_t *this,
+							   struct nlmsghdr **in, entry_t *entries, int count)
+{
+	int i;
 
+	this->mutex->lock(this->mutex);
+	for (i = 0; i < count; i++)
+	{
+		this->entries->remove(this->entries,
+							  (void*)(uintptr_t)in[i]->nlmsg_seq);
+		entries[i].failed = entries[i].complete = TRUE;
+	}
+	/* the reader role might have been passed to one of our entries while we
+	 * were sending, pass it on to a thread actually waiting */
+	pass_reader(this);
 	this->mutex->unlock(this->mutex);
-
-	return SUCCESS;
 }
 
-METHOD(netlink_socket_t, netlink_send_ack, status_t,
-	private_netlink_socket_t *this, struct nlmsghdr *in)
+METHOD(netlink_socket_t, netlink_send, status_t,
+	private_netlink_socket_t *this, struct nlmsghdr *in, struct nlmsghdr **out,
+	size_t *out_len)
 {
-	struct nlmsghdr *out, *hdr;
-	size_t len;
+	entry_t entry = {
+		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
+	};
+	bool dump = in->nlmsg_flags & NLM_F_DUMP;
+
+	if (dump)
+	{	/* concurrent dumps on the same socket fail with EBUSY */
+		this->dump_mutex->lock(this->dump_mutex);
+	}
+	register_entries(this, &in, &entry, 1);
+	if (send_datagram(this, &in, 1))
+	{
+		wait_for_entries(this, &in, &entry, 1);
+	}
+	else
+	{
+		unregister_entries(this, &in, &entry, 1);
+	}
+	if (dump)
+	{
+		this->dump_mutex->unlock(this->dump_mutex);
+	}
 
-	if (netlink_send(this, in, &out, &len) != SUCCESS)
+	entry.condvar->destroy(entry.condvar);
+	if (entry.failed)
 	{
+		free(entry.result.ptr);
 		return FAILED;
 	}
-	hdr = out;
+	*out_len = entry.result.len;
+	*out = (struct nlmsghdr*)entry.result.ptr;
+	return SUCCESS;
+}
+
+/**
+ * Check the response to a request sent with NLM_F_ACK
+ */
+static status_t check_ack(struct nlmsghdr *hdr, size_t len)
+{
 	while (NLMSG_OK(hdr, len))
 	{
 		switch (hdr->nlmsg_type)
@@ -203,20 +449,16 @@ METHOD(netlink_socket_t, netlink_send_ack, status_t,
 				{
 					if (-err->error == EEXIST)
 					{	/* do not report existing routes */
-						free(out);
 						return ALREADY_DONE;
 					}
 					if (-err->error == ESRCH)
 					{	/* do not report missing entries */
-						free(out);
 						return NOT_FOUND;
 					}
 					DBG1(DBG_KNL, "received netlink error: %s (%d)",
 						 strerror(-err->error), -err->error);
-					free(out);
 					return FAILED;
 				}
-				free(out);
 				return SUCCESS;
 			}
 			default:
@@ -228,10 +470,90 @@ METHOD(netlink_socket_t, netlink_send_ack, status_t,
 		break;
 	}
 	DBG1(DBG_KNL, "netlink request not acknowledged");
-	free(out);
 	return FAILED;
 }
 
+METHOD(netlink_socket_t, netlink_send_ack, status_t,
+	private_netlink_socket_t *this, struct nlmsghdr *in)
+{
+	struct nlmsghdr *out;
+	status_t status;
+	size_t len;
+
+	if (netlink_send(this, in, &out, &len) != SUCCESS)
+	{
+		return FAILED;
+	}
+	status = check_ack(out, len);
+	free(out);
+	return status;
+}
+
+METHOD(netlink_socket_t, netlink_send_ack_batch, status_t,
+	private_netlink_socket_t *this, struct nlmsghdr **in, int count,
+	status_t *status)
+{
+	entry_t entries[count];
+	condvar_t *condvar;
+	status_t result = SUCCESS;
+	size_t size;
+	int i, first;
+
+	if (!count)
+	{
+		return SUCCESS;
+	}
+	/* all entries share a condvar, we wait for them one after another */
+	condvar = condvar_create(CONDVAR_TYPE_DEFAULT);
+	for (i = 0; i < count; i++)
+	{
+		entries[i] = (entry_t){
+			.condvar = condvar,
+		};
+	}
+	register_entries(this, in, entries, count);
+
+	/* the kernel processes each message of a datagram separately, but limits
+	 * the size of a datagram to the socket's send buffer */
+	for (first = 0, size = 0, i = 0; i <= count; i++)
+	{
+		if (i < count && (i == first ||
+			size + NLMSG_ALIGN(in[i]->nlmsg_len) <= NETLINK_BATCH_SIZE))
+		{
+			size += NLMSG_ALIGN(in[i]->nlmsg_len);
+			continue;
+		}
+		if (!send_datagram(this, &in[first], i - first))
+		{
+			unregister_entries(this, &in[first], &entries[first], count - first);
+			break;
+		}
+		first = i;
+		size = i < count ? NLMSG_ALIGN(in[i]->nlmsg_len) : 0;
+	}
+	wait_for_entries(this, in, entries, first);
+
+	for (i = 0; i < count; i++)
+	{
+		if (entries[i].failed)
+		{
+			status[i] = FAILED;
+		}
+		else
+		{
+			status[i] = check_ack((struct nlmsghdr*)entries[i].result.ptr,
+								  entries[i].result.len);
+		}
+		if (status[i] != SUCCESS)
+		{
+			result = FAILED;
+		}
+		free(entries[i].result.ptr);
+	}
+	condvar->destroy(condvar);
+	return result;
+}
+
 METHOD(netlink_socket_t, destroy, void,
 	private_netlink_socket_t *this)
 {
@@ -239,7 +561,9 @@ METHOD(netlink_socket_t, destroy, void,
 	{
 		close(this->socket);
 	}
+	this->entries->destroy(this->entries);
 	this->mutex->destroy(this->mutex);
+	this->dump_mutex->destroy(this->dump_mutex);
 	free(this);
 }
 
@@ -255,10 +579,14 @@ netlink_socket_t *netlink_socket_create(int protocol)
 		.public = {
 			.send = _netlink_send,
 			.send_ack = _netlink_send_ack,
+			.send_ack_batch = _netlink_send_ack_batch,
 			.destroy = _destroy,
 		},
 		.seq = 200,
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.dump_mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+		.entries = hashtable_create((hashtable_hash_t)hash_seq,
+									(hashtable_equals_t)equals_seq, 8),
 		.protocol = protocol,
 	);
 
@@ -52,6 +52,18 @@ struct netlink_socket_t {
 	 */
 	status_t (*send_ack)(netlink_socket_t *this, struct nlmsghdr *in);
 
+	/**
+	 * Send multiple netlink messages in as few datagrams as possible and wait
+	 * for the acknowledges of all of them.
+	 *
+	 * @param	in		netlink messages to send
+	 * @param	count	number of messages in in
+	 * @param	status	receives the result of each message, as send_ack()
+	 * @return			SUCCESS if all messages got acknowledged successfully
+	 */
+	status_t (*send_ack_batch)(netlink_socket_t *this, struct nlmsghdr **in,
+							   int count, status_t *status);
+
 	/**
 	 * Destroy the socket.
 	 */
@@ -15,7 +15,6 @@
  * for more details.
  */
 
-#include <limits.h>
 #include <stdint.h>
 
 #include "esp_context.h"
@@ -24,9 +23,14 @@
 #include <utils/debug.h>
 
 /**
- * Should be a multiple of 8
+ * Default size of the anti-replay window, in packets
  */
-#define ESP_DEFAULT_WINDOW_SIZE 128
+#define ESP_DEFAULT_WINDOW_SIZE 1024
+
+/**
+ * Number of sequence numbers tracked per word of the window
+ */
+#define WINDOW_WORD_BITS 64
 
 typedef struct private_esp_context_t private_esp_context_t;
 
@@ -45,26 +49,38 @@ struct private_esp_context_t {
 	 */
 	aead_t *aead;
 
+	/**
+	 * RNG to generate IVs, created on demand
+	 */
+	rng_t *rng;
+
 	/**
 	 * The highest sequence number that was successfully verified
 	 * and authenticated, or assigned in an outbound context
 	 */
-	u_int32_t last_seqno;
+	u_int64_t last_seqno;
 
 	/**
-	 * The bit in the window of the highest authenticated sequence number
+	 * The size of the anti-replay window (in packets)
 	 */
-	u_int seqno_index;
+	u_int window_size;
 
 	/**
-	 * The size of the anti-replay window (in bits)
+	 * The anti-replay window, a ring buffer of words in which sequence number
+	 * n is tracked by bit n % 64 of word (n / 64) % window_words
 	 */
-	u_int window_size;
+	u_int64_t *window;
+
+	/**
+	 * Number of words in the window, a power of two, covering window_size
+	 * sequence numbers plus one spare word that is cleared when advancing
+	 */
+	u_int window_words;
 
 	/**
-	 * The anti-replay window buffer
+	 * TRUE if extended sequence numbers are used
 	 */
-	chunk_t window;
+	bool esn;
 
 	/**
 	 * TRUE in case of an inbound ESP context
@@ -73,67 +89,90 @@ struct private_esp_context_t {
 };
 
 /**
- * Set or unset a bit in the window.
+ * Get the word in the window that tracks the given sequence number
  */
-static inline void set_window_bit(private_esp_context_t *this,
-								  u_int index, bool set)
+static inline u_int64_t *window_word(private_esp_context_t *this,
+									 u_int64_t seqno)
 {
-	u_int i = index / CHAR_BIT;
-
-	if (set)
-	{
-		this->window.ptr[i] |= 1 << (index % CHAR_BIT);
-	}
-	else
-	{
-		this->window.ptr[i] &= ~(1 << (index % CHAR_BIT));
-	}
+	return &this->window[(seqno / WINDOW_WORD_BITS) & (this->window_words - 1)];
 }
 
 /**
- * Get a bit from the window.
+ * Get the bit within its word that tracks the given sequence number
  */
-static inline bool get_window_bit(private_esp_context_t *this, u_int index)
+static inline u_int64_t window_bit(u_int64_t seqno)
 {
-	u_int i = index / CHAR_BIT;
-
-	return this->window.ptr[i] & (1 << index % CHAR_BIT);
+	return (u_int64_t)1 << (seqno % WINDOW_WORD_BITS);
 }
 
 /**
- * Returns TRUE if the supplied seqno is not already marked in the window
+ * Determine the high-order bits of a received sequence number, as specified
+ * in RFC 4303, appendix A2.1 and A2.2. Returns 0, which is never valid, for
+ * sequence numbers that would precede the first one of the SA
  */
-static bool check_window(private_esp_context_t *this, u_int32_t seqno)
+static u_int64_t expand_seqno(private_esp_context_t *this, u_int32_t seqno)
 {
-	u_int offset;
+	u_int32_t tl, th, bottom;
 
-	offset = this->last_seqno - seqno;
-	offset = (this->seqno_index - offset) % this->window_size;
-	return !get_window_bit(this, offset);
+	if (!this->esn)
+	{
+		return seqno;
+	}
+	tl = (u_int32_t)this->last_seqno;
+	th = (u_int32_t)(this->last_seqno >> 32);
+	bottom = tl - this->window_size + 1;
+
+	if (tl >= this->window_size - 1)
+	{	/* the window lies within one subspace of the sequence numbers */
+		if (seqno < bottom)
+		{
+			th++;
+		}
+	}
+	else
+	{	/* the window spans two subspaces, it wraps below zero */
+		if (seqno >= bottom)
+		{
+			if (th == 0)
+			{	/* the lower subspace does not exist yet, this is an old
+				 * packet and not one far beyond the window */
+				return 0;
+			}
+			th--;
+		}
+	}
+	return ((u_int64_t)th << 32) | seqno;
 }
 
 METHOD(esp_context_t, verify_seqno, bool,
-	private_esp_context_t *this, u_int32_t seqno)
+	private_esp_context_t *this, u_int32_t seqno, u_int64_t *full)
 {
+	u_int64_t seq;
+
 	if (!this->inbound)
 	{
 		return FALSE;
 	}
 
-	if (seqno > this->last_seqno)
+	seq = expand_seqno(this, seqno);
+	if (full)
+	{
+		*full = seq;
+	}
+	if (seq > this->last_seqno)
 	{	/*       |----------------------------------------|
 		 *  <---------^   ^   or    <---------^     ^
 		 *     WIN    H   S            WIN    H     S
 		 */
 		return TRUE;
 	}
-	else if (seqno > 0 && this->window_size > this->last_seqno - seqno)
+	else if (seq > 0 && this->window_size > this->last_seqno - seq)
 	{	/*       |----------------------------------------|
 		 *  <---------^      or     <---------^
 		 *     WIN ^  H                WIN ^  H
 		 *         S                       S
 		 */
-		return check_window(this, seqno);
+		return !(*window_word(this, seq) & window_bit(seq));
 	}
 	else
 	{	/*       |----------------------------------------|
@@ -145,9 +184,9 @@ METHOD(esp_context_t, verify_seqno, bool,
 }
 
 METHOD(esp_context_t, set_authenticated_seqno, void,
-	private_esp_context_t *this, u_int32_t seqno)
+	private_esp_context_t *this, u_int64_t seqno)
 {
-	u_int i, shift;
+	u_int64_t words, i;
 
 	if (!this->inbound)
 	{
@@ -155,34 +194,37 @@ METHOD(esp_context_t, set_authenticated_seqno, void,
 	}
 
 	if (seqno > this->last_seqno)
-	{	/* shift the window to the new highest authenticated seqno */
-		shift = seqno - this->last_seqno;
-		shift = shift < this->window_size ? shift : this->window_size;
-		for (i = 0; i < shift; ++i)
+	{	/* advance the window by clearing the words the new highest seqno
+		 * moved past, at most the whole window */
+		words = seqno / WINDOW_WORD_BITS -
+				this->last_seqno / WINDOW_WORD_BITS;
+		if (words >= this->window_words)
 		{
-			this->seqno_index = (this->seqno_index + 1) % this->window_size;
-			set_window_bit(this, this->seqno_index, FALSE);
+			memset(this->window, 0, this->window_words * sizeof(u_int64_t));
+		}
+		else
+		{
+			for (i = 1; i <= words; i++)
+			{
+				*window_word(this, this->last_seqno + i * WINDOW_WORD_BITS) = 0;
+			}
 		}
-		set_window_bit(this, this->seqno_index, TRUE);
 		this->last_seqno = seqno;
 	}
-	else
-	{	/* seqno is inside the window, set the corresponding window bit */
-		i = this->last_seqno - seqno;
-		set_window_bit(this, (this->seqno_index - i) % this->window_size, TRUE);
-	}
+	*window_word(this, seqno) |= window_bit(seqno);
 }
 
-METHOD(esp_context_t, get_seqno, u_int32_t,
+METHOD(esp_context_t, get_seqno, u_int64_t,
 	private_esp_context_t *this)
 {
 	return this->last_seqno;
 }
 
 METHOD(esp_context_t, next_seqno, bool,
-	private_esp_context_t *this, u_int32_t *seqno)
+	private_esp_context_t *this, u_int64_t *seqno)
 {
-	if (this->inbound || this->last_seqno == UINT32_MAX)
+	if (this->inbound ||
+		this->last_seqno == (this->esn ? UINT64_MAX : UINT32_MAX))
 	{	/* inbound or segno would cycle */
 		return FALSE;
 	}
@@ -190,17 +232,34 @@ METHOD(esp_context_t, next_seqno, bool,
 	return TRUE;
 }
 
+METHOD(esp_context_t, use_esn, bool,
+	private_esp_context_t *this)
+{
+	return this->esn;
+}
+
 METHOD(esp_context_t, get_aead, aead_t*,
 	private_esp_context_t *this)
 {
 	return this->aead;
 }
 
+METHOD(esp_context_t, get_rng, rng_t*,
+	private_esp_context_t *this)
+{
+	if (!this->rng)
+	{
+		this->rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK);
+	}
+	return this->rng;
+}
+
 METHOD(esp_context_t, destroy, void,
 	private_esp_context_t *this)
 {
-	chunk_free(&this->window);
+	free(this->window);
 	DESTROY_IF(this->aead);
+	DESTROY_IF(this->rng);
 	free(this);
 }
 
@@ -302,21 +361,25 @@ failed:
  * Described in header.
  */
 esp_context_t *esp_context_create(int enc_alg, chunk_t enc_key,
-								  int int_alg, chunk_t int_key, bool inbound)
+								  int int_alg, chunk_t int_key, bool inbound,
+								  bool esn, u_int window_size)
 {
 	private_esp_context_t *this;
+	u_int words;
 
 	INIT(this,
 		.public = {
 			.get_aead = _get_aead,
+			.get_rng = _get_rng,
 			.get_seqno = _get_seqno,
 			.next_seqno = _next_seqno,
 			.verify_seqno = _verify_seqno,
 			.set_authenticated_seqno = _set_authenticated_seqno,
+			.use_esn = _use_esn,
 			.destroy = _destroy,
 		},
 		.inbound = inbound,
-		.window_size = ESP_DEFAULT_WINDOW_SIZE,
+		.esn = esn,
 	);
 
 	if (encryption_algorithm_is_aead(enc_alg))
@@ -336,10 +399,30 @@ esp_context_t *esp_context_create(int enc_alg, chunk_t enc_key,
 		}
 	}
 
+	if (esn && !encryption_algorithm_is_aead(enc_alg))
+	{	/* the high-order bits would have to be appended to the ICV input */
+		DBG1(DBG_ESP, "failed to create ESP context: ESN are only supported "
+			 "with AEAD algorithms");
+		destroy(this);
+		return NULL;
+	}
+
 	if (inbound)
 	{
-		this->window = chunk_alloc(this->window_size / CHAR_BIT + 1);
-		memset(this->window.ptr, 0, this->window.len);
+		if (!window_size)
+		{
+			window_size = lib->settings->get_int(lib->settings,
+							"libipsec.replay_window", ESP_DEFAULT_WINDOW_SIZE);
+		}
+		this->window_size = max(window_size, 1);
+		/* one spare word gets cleared when the window advances */
+		words = (this->window_size + WINDOW_WORD_BITS - 1) / WINDOW_WORD_BITS;
+		this->window_words = 1;
+		while (this->window_words <= words)
+		{
+			this->window_words *= 2;
+		}
+		this->window = calloc(this->window_words, sizeof(u_int64_t));
 	}
 	return &this->public;
 }
@@ -40,21 +40,31 @@ struct esp_context_t {
 	 */
 	aead_t *(*get_aead)(esp_context_t *this);
 
+	/**
+	 * Get the RNG used to generate IVs for outbound ESP packets.
+	 *
+	 * @return				RNG, NULL if none is available
+	 */
+	rng_t *(*get_rng)(esp_context_t *this);
+
 	/**
 	 * Get the current outbound ESP sequence number or the highest authenticated
 	 * inbound sequence number.
 	 *
 	 * @return			current sequence number, in host byte order
 	 */
-	u_int32_t (*get_seqno)(esp_context_t *this);
+	u_int64_t (*get_seqno)(esp_context_t *this);
 
 	/**
 	 * Allocate the next outbound ESP sequence number.
 	 *
+	 * Only the low-order 32 bits are transmitted, the high-order bits are
+	 * used for the ICV if extended sequence numbers are enabled.
+	 *
 	 * @param seqno		the sequence number, in host byte order
 	 * @return			FALSE if the sequence number cycled or inbound context
 	 */
-	bool (*next_seqno)(esp_context_t *this, u_int32_t *seqno);
+	bool (*next_seqno)(esp_context_t *this, u_int64_t *seqno);
 
 	/**
 	 * Verify an ESP sequence number.  Checks whether a packet with this
@@ -63,20 +73,33 @@ struct esp_context_t {
 	 * number is successfully verified and the ESP packet is authenticated,
 	 * set_authenticated_seqno() should be called.
 	 *
-	 * @param seqno		the sequence number to verify, in host byte order
+	 * If extended sequence numbers are used, the high-order bits of the
+	 * sequence number are derived from the current window (RFC 4303, A2.1).
+	 *
+	 * @param seqno		the received sequence number, in host byte order
+	 * @param full		receives the full 64-bit sequence number, or NULL
 	 * @return			TRUE when sequence number is valid
 	 */
-	bool (*verify_seqno)(esp_context_t *this, u_int32_t seqno);
+	bool (*verify_seqno)(esp_context_t *this, u_int32_t seqno,
+						 u_int64_t *full);
 
 	/**
 	 * Adds a sequence number that was successfully verified and
 	 * authenticated.  A user MUST call verify_seqno() immediately before
 	 * calling this method.
 	 *
-	 * @param seqno		verified and authenticated seq number in host byte order
+	 * @param seqno		full sequence number returned by verify_seqno()
 	 */
 	void (*set_authenticated_seqno)(esp_context_t *this,
-									u_int32_t seqno);
+									u_int64_t seqno);
+
+	/**
+	 * Check if extended sequence numbers are used.  If so, the high-order
+	 * bits of the sequence number are included in the associated data.
+	 *
+	 * @return			TRUE if ESN are used
+	 */
+	bool (*use_esn)(esp_context_t *this);
 
 	/**
 	 * Destroy an esp_context_t
@@ -93,10 +116,14 @@ struct esp_context_t {
  * @param int_alg		integrity protection algorithm
  * @param int_key		integrity protection key
  * @param inbound		TRUE to create an inbound ESP context
+ * @param esn			TRUE to use 64-bit extended sequence numbers
+ * @param window_size	size of the anti-replay window in packets, 0 to use
+ *						the configured default
  * @return				ESP context instance, or NULL if creation fails
  */
 esp_context_t *esp_context_create(int enc_alg, chunk_t enc_key, int int_alg,
-								  chunk_t int_key, bool inbound);
+								  chunk_t int_key, bool inbound, bool esn,
+								  u_int window_size);
 
 #endif /** ESP_CONTEXT_H_ @}*/
 
@@ -22,8 +22,6 @@
 #include <utils/debug.h>
 #include <crypto/crypters/crypter.h>
 #include <crypto/signers/signer.h>
-#include <bio/bio_reader.h>
-#include <bio/bio_writer.h>
 
 #include <netinet/in.h>
 
@@ -115,6 +113,18 @@ METHOD(packet_t, skip_bytes, void,
 	return this->packet->skip_bytes(this->packet, bytes);
 }
 
+METHOD(packet_t, set_buffer, void,
+	private_esp_packet_t *this, chunk_t buffer, chunk_t data)
+{
+	return this->packet->set_buffer(this->packet, buffer, data);
+}
+
+METHOD(packet_t, extract_buffer, chunk_t,
+	private_esp_packet_t *this)
+{
+	return this->packet->extract_buffer(this->packet);
+}
+
 METHOD(packet_t, clone, packet_t*,
 	private_esp_packet_t *this)
 {
@@ -129,18 +139,17 @@ METHOD(packet_t, clone, packet_t*,
 METHOD(esp_packet_t, parse_header, bool,
 	private_esp_packet_t *this, u_int32_t *spi)
 {
-	bio_reader_t *reader;
+	chunk_t data;
 	u_int32_t seq;
 
-	reader = bio_reader_create(this->packet->get_data(this->packet));
-	if (!reader->read_uint32(reader, spi) ||
-		!reader->read_uint32(reader, &seq))
+	data = this->packet->get_data(this->packet);
+	if (data.len < 2 * sizeof(u_int32_t))
 	{
 		DBG1(DBG_ESP, "failed to parse ESP header: invalid length");
-		reader->destroy(reader);
 		return FALSE;
 	}
-	reader->destroy(reader);
+	*spi = untoh32(data.ptr);
+	seq = untoh32(data.ptr + sizeof(u_int32_t));
 
 	DBG2(DBG_ESP, "parsed ESP header with SPI %.8x [seq %u]", *spi, seq);
 	*spi = htonl(*spi);
@@ -165,29 +174,38 @@ static bool check_padding(chunk_t padding)
 }
 
 /**
- * Remove the padding from the payload and set the next header info
+ * Remove the padding from the payload and set the next header info.  The
+ * payload is decrypted in place, so the buffer of the ESP packet is handed
+ * over to the IP packet.
  */
 static bool remove_padding(private_esp_packet_t *this, chunk_t plaintext)
 {
 	u_int8_t next_header, pad_length;
 	chunk_t padding, payload;
-	bio_reader_t *reader;
 
-	reader = bio_reader_create(plaintext);
-	if (!reader->read_uint8_end(reader, &next_header) ||
-		!reader->read_uint8_end(reader, &pad_length))
+	if (plaintext.len < 2)
 	{
 		DBG1(DBG_ESP, "parsing ESP payload failed: invalid length");
-		goto failed;
+		return FALSE;
 	}
-	if (!reader->read_data_end(reader, pad_length, &padding) ||
-		!check_padding(padding))
+	next_header = plaintext.ptr[plaintext.len - 1];
+	pad_length = plaintext.ptr[plaintext.len - 2];
+	plaintext.len -= 2;
+	if (plaintext.len < pad_length)
 	{
 		DBG1(DBG_ESP, "parsing ESP payload failed: invalid padding");
-		goto failed;
+		return FALSE;
+	}
+	padding = chunk_create(plaintext.ptr + plaintext.len - pad_length,
+						   pad_length);
+	if (!check_padding(padding))
+	{
+		DBG1(DBG_ESP, "parsing ESP payload failed: invalid padding");
+		return FALSE;
 	}
-	this->payload = ip_packet_create(reader->peek(reader));
-	reader->destroy(reader);
+	plaintext.len -= pad_length;
+	this->payload = ip_packet_create_from_buffer(
+						this->packet->extract_buffer(this->packet), plaintext);
 	if (!this->payload)
 	{
 		DBG1(DBG_ESP, "parsing ESP payload failed: unsupported payload");
@@ -200,19 +218,35 @@ static bool remove_padding(private_esp_packet_t *this, chunk_t plaintext)
 		 "padding length = %hhu, next header = %hhu", &payload, &padding,
 		 pad_length, this->next_header);
 	return TRUE;
+}
 
-failed:
-	reader->destroy(reader);
-	chunk_free(&plaintext);
-	return FALSE;
+/**
+ * Build the associated data of an ESP packet, the SPI and sequence number.
+ * With ESN the high-order bits of the sequence number get inserted between
+ * the two (RFC 4303, section 2.2.1 and RFC 4106, section 5).
+ */
+static chunk_t build_aad(esp_context_t *esp_context, chunk_t data,
+						 u_int64_t seqno, u_int8_t buf[12])
+{
+	if (!esp_context->use_esn(esp_context))
+	{
+		return chunk_create(data.ptr, 2 * sizeof(u_int32_t));
+	}
+	memcpy(buf, data.ptr, sizeof(u_int32_t));
+	htoun32(buf + sizeof(u_int32_t), seqno >> 32);
+	memcpy(buf + 2 * sizeof(u_int32_t), data.ptr + sizeof(u_int32_t),
+		   sizeof(u_int32_t));
+	return chunk_create(buf, 3 * sizeof(u_int32_t));
 }
 
 METHOD(esp_packet_t, decrypt, status_t,
 	private_esp_packet_t *this, esp_context_t *esp_context)
 {
-	bio_reader_t *reader;
+	u_int8_t aad_buf[12];
 	u_int32_t spi, seq;
-	chunk_t data, iv, icv, aad, ciphertext, plaintext;
+	u_int64_t full_seq;
+	chunk_t data, iv, icv, aad, ciphertext;
+	size_t hdrlen;
 	aead_t *aead;
 
 	DESTROY_IF(this->payload);
@@ -221,21 +255,23 @@ METHOD(esp_packet_t, decrypt, status_t,
 	data = this->packet->get_data(this->packet);
 	aead = esp_context->get_aead(esp_context);
 
-	reader = bio_reader_create(data);
-	if (!reader->read_uint32(reader, &spi) ||
-		!reader->read_uint32(reader, &seq) ||
-		!reader->read_data(reader, aead->get_iv_size(aead), &iv) ||
-		!reader->read_data_end(reader, aead->get_icv_size(aead), &icv) ||
-		reader->remaining(reader) % aead->get_block_size(aead))
+	/* data = spi, seq, IV, ciphertext, ICV */
+	iv.len = aead->get_iv_size(aead);
+	icv.len = aead->get_icv_size(aead);
+	hdrlen = 2 * sizeof(u_int32_t) + iv.len;
+	if (data.len < hdrlen + icv.len ||
+		(data.len - hdrlen - icv.len) % aead->get_block_size(aead))
 	{
 		DBG1(DBG_ESP, "ESP decryption failed: invalid length");
 		return PARSE_ERROR;
 	}
-	ciphertext = reader->peek(reader);
-	ciphertext.len += icv.len;
-	reader->destroy(reader);
+	spi = untoh32(data.ptr);
+	seq = untoh32(data.ptr + sizeof(u_int32_t));
+	iv.ptr = data.ptr + 2 * sizeof(u_int32_t);
+	ciphertext = chunk_create(data.ptr + hdrlen, data.len - hdrlen);
+	icv.ptr = ciphertext.ptr + ciphertext.len - icv.len;
 
-	if (!esp_context->verify_seqno(esp_context, seq))
+	if (!esp_context->verify_seqno(esp_context, seq, &full_seq))
 	{
 		DBG1(DBG_ESP, "ESP sequence number verification failed:\n  "
 			 "src %H, dst %H, SPI %.8x [seq %u]",
@@ -245,17 +281,18 @@ METHOD(esp_packet_t, decrypt, status_t,
 	DBG3(DBG_ESP, "ESP decryption:\n  SPI %.8x [seq %u]\n  IV %B\n  "
 		 "encrypted %B\n  ICV %B", spi, seq, &iv, &ciphertext, &icv);
 
-	/* aad = spi + seq */
-	aad = chunk_create(data.ptr, 8);
+	aad = build_aad(esp_context, data, full_seq, aad_buf);
 
-	if (!aead->decrypt(aead, ciphertext, aad, iv, &plaintext))
+	/* decrypt the content inline, the plaintext excludes the ICV */
+	if (!aead->decrypt(aead, ciphertext, aad, iv, NULL))
 	{
 		DBG1(DBG_ESP, "ESP decryption or ICV verification failed");
 		return FAILED;
 	}
-	esp_context->set_authenticated_seqno(esp_context, seq);
+	esp_context->set_authenticated_seqno(esp_context, full_seq);
 
-	if (!remove_padding(this, plaintext))
+	ciphertext.len -= icv.len;
+	if (!remove_padding(this, ciphertext))
 	{
 		return PARSE_ERROR;
 	}
@@ -278,10 +315,11 @@ static void generate_padding(chunk_t padding)
 METHOD(esp_packet_t, encrypt, status_t,
 	private_esp_packet_t *this, esp_context_t *esp_context, u_int32_t spi)
 {
-	chunk_t iv, icv, aad, padding, payload, ciphertext;
-	bio_writer_t *writer;
-	u_int32_t next_seqno;
-	size_t blocksize, plainlen;
+	chunk_t iv, icv, aad, padding, payload, ciphertext, buffer, data;
+	u_int8_t aad_buf[12];
+	u_int64_t next_seqno;
+	size_t blocksize, plainlen, hdrlen;
+	bool inplace = FALSE;
 	aead_t *aead;
 	rng_t *rng;
 
@@ -293,7 +331,7 @@ METHOD(esp_packet_t, encrypt, status_t,
 		return FAILED;
 	}
 
-	rng = lib->crypto->create_rng(lib->crypto, RNG_WEAK);
+	rng = esp_context->get_rng(esp_context);
 	if (!rng)
 	{
 		DBG1(DBG_ESP, "ESP encryption failed: could not find RNG");
@@ -312,39 +350,52 @@ METHOD(esp_packet_t, encrypt, status_t,
 	padding.len = blocksize - (plainlen % blocksize);
 	plainlen += padding.len;
 
-	/* len = spi, seq, IV, plaintext, ICV */
-	writer = bio_writer_create(2 * sizeof(u_int32_t) + iv.len + plainlen +
-							   icv.len);
-	writer->write_uint32(writer, ntohl(spi));
-	writer->write_uint32(writer, next_seqno);
+	/* data = spi, seq, IV, plaintext, ICV */
+	hdrlen = 2 * sizeof(u_int32_t) + iv.len;
+	data.len = hdrlen + plainlen + icv.len;
 
-	iv = writer->skip(writer, iv.len);
+	/* build the ESP packet around the payload if its buffer has enough
+	 * headroom and tailroom, otherwise copy it to a new buffer */
+	buffer = this->payload ? this->payload->get_buffer(this->payload)
+						   : chunk_empty;
+	if (payload.len && payload.ptr >= buffer.ptr + hdrlen &&
+		payload.ptr + data.len - hdrlen <= buffer.ptr + buffer.len)
+	{
+		data.ptr = payload.ptr - hdrlen;
+		inplace = TRUE;
+	}
+	else
+	{
+		buffer = chunk_alloc(data.len);
+		data.ptr = buffer.ptr;
+		memcpy(data.ptr + hdrlen, payload.ptr, payload.len);
+	}
+	htoun32(data.ptr, ntohl(spi));
+	htoun32(data.ptr + sizeof(u_int32_t), (u_int32_t)next_seqno);
+
+	iv.ptr = data.ptr + 2 * sizeof(u_int32_t);
 	if (!rng->get_bytes(rng, iv.len, iv.ptr))
 	{
 		DBG1(DBG_ESP, "ESP encryption failed: could not generate IV");
-		writer->destroy(writer);
-		rng->destroy(rng);
+		if (!inplace)
+		{
+			chunk_free(&buffer);
+		}
 		return FAILED;
 	}
-	rng->destroy(rng);
 
-	/* plain-/ciphertext will start here */
-	ciphertext = writer->get_buf(writer);
-	ciphertext.ptr += ciphertext.len;
-	ciphertext.len = plainlen;
+	/* plain-/ciphertext starts after the IV */
+	ciphertext = chunk_create(data.ptr + hdrlen, plainlen);
+	payload = chunk_create(ciphertext.ptr, payload.len);
 
-	writer->write_data(writer, payload);
-
-	padding = writer->skip(writer, padding.len);
+	padding.ptr = ciphertext.ptr + payload.len;
 	generate_padding(padding);
 
-	writer->write_uint8(writer, padding.len);
-	writer->write_uint8(writer, this->next_header);
+	ciphertext.ptr[plainlen - 2] = padding.len;
+	ciphertext.ptr[plainlen - 1] = this->next_header;
 
-	/* aad = spi + seq */
-	aad = writer->get_buf(writer);
-	aad.len = 8;
-	icv = writer->skip(writer, icv.len);
+	aad = build_aad(esp_context, data, next_seqno, aad_buf);
+	icv.ptr = ciphertext.ptr + ciphertext.len;
 
 	DBG3(DBG_ESP, "ESP before encryption:\n  payload = %B\n  padding = %B\n  "
 		 "padding length = %hhu, next header = %hhu", &payload, &padding,
@@ -354,16 +405,24 @@ METHOD(esp_packet_t, encrypt, status_t,
 	if (!aead->encrypt(aead, ciphertext, aad, iv, NULL))
 	{
 		DBG1(DBG_ESP, "ESP encryption or ICV generation failed");
-		writer->destroy(writer);
+		if (!inplace)
+		{
+			chunk_free(&buffer);
+		}
 		return FAILED;
 	}
 
-	DBG3(DBG_ESP, "ESP packet:\n  SPI %.8x [seq %u]\n  IV %B\n  "
+	DBG3(DBG_ESP, "ESP packet:\n  SPI %.8x [seq %llu]\n  IV %B\n  "
 		 "encrypted %B\n  ICV %B", ntohl(spi), next_seqno, &iv,
 		 &ciphertext, &icv);
 
-	this->packet->set_data(this->packet, writer->extract_buf(writer));
-	writer->destroy(writer);
+	if (inplace)
+	{	/* the payload got encrypted, take over its buffer */
+		buffer = this->payload->extract_buffer(this->payload);
+		this->payload->destroy(this->payload);
+		this->payload = NULL;
+	}
+	this->packet->set_buffer(this->packet, buffer, data);
 	return SUCCESS;
 }
 
@@ -413,6 +472,8 @@ static private_esp_packet_t *esp_packet_create_internal(packet_t *packet)
 				.get_dscp = _get_dscp,
 				.set_dscp = _set_dscp,
 				.skip_bytes = _skip_bytes,
+				.set_buffer = _set_buffer,
+				.extract_buffer = _extract_buffer,
 				.clone = _clone,
 				.destroy = _destroy,
 			},
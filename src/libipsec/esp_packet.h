@@ -30,6 +30,18 @@
 #include <networking/host.h>
 #include <networking/packet.h>
 
+/**
+ * Headroom to reserve in front of IP packets to encapsulate them in place
+ * (SPI, sequence number and IV)
+ */
+#define ESP_PACKET_HEADROOM 32
+
+/**
+ * Tailroom to reserve after IP packets to encapsulate them in place
+ * (padding, pad length, next header and ICV)
+ */
+#define ESP_PACKET_TAILROOM 64
+
 typedef struct esp_packet_t esp_packet_t;
 
 /**
@@ -70,6 +82,9 @@ struct esp_packet_t {
 	 * Authenticate and decrypt the packet. Also verifies the sequence number
 	 * using the supplied ESP context and updates the anti-replay window.
 	 *
+	 * The packet is decrypted in place, its buffer is handed over to the
+	 * payload, so the raw ESP data is not available afterwards.
+	 *
 	 * @param esp_context		ESP context of corresponding inbound IPsec SA
 	 * @return					- SUCCESS if successfully authenticated,
 	 *							  decrypted and parsed
@@ -86,6 +101,10 @@ struct esp_packet_t {
 	 * Encapsulate and encrypt the packet. The sequence number will be generated
 	 * using the supplied ESP context.
 	 *
+	 * If the buffer of the payload provides ESP_PACKET_HEADROOM and
+	 * ESP_PACKET_TAILROOM around it, the packet is encapsulated and encrypted
+	 * in place, and the payload is not available afterwards.
+	 *
 	 * @param esp_context		ESP context of corresponding outbound IPsec SA
 	 * @param spi				SPI value to use, in network byte order
 	 * @return					- SUCCESS if encrypted
@@ -53,6 +53,11 @@ struct private_ip_packet_t {
 	 */
 	chunk_t packet;
 
+	/**
+	 * Allocated buffer the IP packet is located in
+	 */
+	chunk_t buffer;
+
 	/**
 	 * IP version
 	 */
@@ -89,6 +94,21 @@ METHOD(ip_packet_t, get_encoding, chunk_t,
 	return this->packet;
 }
 
+METHOD(ip_packet_t, get_buffer, chunk_t,
+	private_ip_packet_t *this)
+{
+	return this->buffer;
+}
+
+METHOD(ip_packet_t, extract_buffer, chunk_t,
+	private_ip_packet_t *this)
+{
+	chunk_t buffer = this->buffer;
+
+	this->buffer = this->packet = chunk_empty;
+	return buffer;
+}
+
 METHOD(ip_packet_t, get_next_header, u_int8_t,
 	private_ip_packet_t *this)
 {
@@ -98,7 +118,7 @@ METHOD(ip_packet_t, get_next_header, u_int8_t,
 METHOD(ip_packet_t, clone, ip_packet_t*,
 	private_ip_packet_t *this)
 {
-	return ip_packet_create(this->packet);
+	return ip_packet_create(chunk_clone(this->packet));
 }
 
 METHOD(ip_packet_t, destroy, void,
@@ -106,14 +126,14 @@ METHOD(ip_packet_t, destroy, void,
 {
 	this->src->destroy(this->src);
 	this->dst->destroy(this->dst);
-	chunk_free(&this->packet);
+	chunk_free(&this->buffer);
 	free(this);
 }
 
 /**
  * Described in header.
  */
-ip_packet_t *ip_packet_create(chunk_t packet)
+ip_packet_t *ip_packet_create_from_buffer(chunk_t buffer, chunk_t packet)
 {
 	private_ip_packet_t *this;
 	u_int8_t version, next_header;
@@ -177,18 +197,29 @@ ip_packet_t *ip_packet_create(chunk_t packet)
 			.get_destination = _get_destination,
 			.get_next_header = _get_next_header,
 			.get_encoding = _get_encoding,
+			.get_buffer = _get_buffer,
+			.extract_buffer = _extract_buffer,
 			.clone = _clone,
 			.destroy = _destroy,
 		},
 		.src = src,
 		.dst = dst,
 		.packet = packet,
+		.buffer = buffer,
 		.version = version,
 		.next_header = next_header,
 	);
 	return &this->public;
 
 failed:
-	chunk_free(&packet);
+	chunk_free(&buffer);
 	return NULL;
 }
+
+/**
+ * Described in header.
+ */
+ip_packet_t *ip_packet_create(chunk_t packet)
+{
+	return ip_packet_create_from_buffer(packet, packet);
+}
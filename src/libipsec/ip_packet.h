@@ -67,6 +67,22 @@ struct ip_packet_t {
 	 */
 	chunk_t (*get_encoding)(ip_packet_t *this);
 
+	/**
+	 * Get the buffer the IP packet is located in.  It may provide headroom
+	 * and tailroom around the packet, e.g. to encapsulate it in place.
+	 *
+	 * @return				buffer (internal data)
+	 */
+	chunk_t (*get_buffer)(ip_packet_t *this);
+
+	/**
+	 * Extract the buffer the IP packet is located in, e.g. after the packet
+	 * got encapsulated in place.  The packet has no data afterwards.
+	 *
+	 * @return				allocated buffer, has to be freed by the caller
+	 */
+	chunk_t (*extract_buffer)(ip_packet_t *this);
+
 	/**
 	 * Clone the IP packet
 	 *
@@ -93,4 +109,17 @@ struct ip_packet_t {
  */
 ip_packet_t *ip_packet_create(chunk_t packet);
 
+/**
+ * Create an IP packet located in a larger buffer, which provides headroom
+ * and/or tailroom around it.
+ *
+ * @note The buffer gets either owned by the new object, or destroyed, if the
+ * data is invalid.
+ *
+ * @param buffer		allocated buffer containing the packet, gets owned
+ * @param packet		the IP packet (including header), located in buffer
+ * @return				ip_packet_t instance, or NULL if invalid
+ */
+ip_packet_t *ip_packet_create_from_buffer(chunk_t buffer, chunk_t packet);
+
 #endif /** IP_PACKET_H_ @}*/
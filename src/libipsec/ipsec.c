@@ -54,7 +54,7 @@ void libipsec_deinit()
 /**
  * Described in header.
  */
-bool libipsec_init()
+bool libipsec_init(u_int workers)
 {
 	private_ipsec_t *this;
 
@@ -71,7 +71,12 @@ bool libipsec_init()
 	this->public.sas = ipsec_sa_mgr_create();
 	this->public.policies = ipsec_policy_mgr_create();
 	this->public.events = ipsec_event_relay_create();
-	this->public.processor = ipsec_processor_create();
+	if (!workers)
+	{
+		workers = lib->settings->get_int(lib->settings,
+										 "libipsec.processor.workers", 2);
+	}
+	this->public.processor = ipsec_processor_create(workers);
 	return TRUE;
 }
 
@@ -71,9 +71,11 @@ extern ipsec_t *ipsec;
 /**
  * Initialize libipsec.
  *
+ * @param workers		number of crypto workers of the IPsec processor, 0 to
+ *						use libipsec.processor.workers
  * @return				FALSE if integrity check failed
  */
-bool libipsec_init();
+bool libipsec_init(u_int workers);
 
 /**
  * Deinitialize libipsec.
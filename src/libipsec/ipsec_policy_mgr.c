@@ -24,7 +24,32 @@
 /** Base priority for installed policies */
 #define PRIO_BASE 512
 
+/** Number of address bits consumed per level of the policy index */
+#define TRIE_STRIDE 4
+
+/** Number of children of a node in the policy index */
+#define TRIE_CHILDREN (1 << TRIE_STRIDE)
+
 typedef struct private_ipsec_policy_mgr_t private_ipsec_policy_mgr_t;
+typedef struct trie_node_t trie_node_t;
+
+/**
+ * Node of the policy index, a multi-bit trie on the remote address of the
+ * policies (i.e. the destination of outbound, the source of inbound policies)
+ */
+struct trie_node_t {
+
+	/**
+	 * Policies whose remote subnet ends at this level, sorted like the
+	 * list of policies (ipsec_policy_entry_t*)
+	 */
+	linked_list_t *policies;
+
+	/**
+	 * Children, indexed by the next TRIE_STRIDE bits of the address
+	 */
+	trie_node_t *children[TRIE_CHILDREN];
+};
 
 /**
  * Private additions to ipsec_policy_mgr_t.
@@ -37,12 +62,24 @@ struct private_ipsec_policy_mgr_t {
 	ipsec_policy_mgr_t public;
 
 	/**
-	 * Installed policies (ipsec_policy_entry_t*)
+	 * Installed policies, in the order they got installed
+	 * (ipsec_policy_entry_t*)
 	 */
 	linked_list_t *policies;
 
 	/**
-	 * Lock to safely access the list of policies
+	 * Policy index, by direction (outbound/inbound) and address family
+	 * (IPv4/IPv6)
+	 */
+	trie_node_t *index[2][2];
+
+	/**
+	 * Sequence number of the last installed policy
+	 */
+	u_int32_t seq;
+
+	/**
+	 * Lock to safely access the list of policies and the index
 	 */
 	rwlock_t *lock;
 
@@ -59,6 +96,12 @@ typedef struct {
 	 */
 	u_int32_t priority;
 
+	/**
+	 * Sequence number, policies installed later are preferred over policies
+	 * with the same priority
+	 */
+	u_int32_t seq;
+
 	/**
 	 * The policy
 	 */
@@ -134,14 +177,199 @@ static void policy_entry_destroy(ipsec_policy_entry_t *this)
 	free(this);
 }
 
+/**
+ * Check if a policy entry is sorted before another one
+ */
+static bool policy_entry_before(ipsec_policy_entry_t *this,
+								ipsec_policy_entry_t *other)
+{
+	return this->priority < other->priority ||
+		  (this->priority == other->priority && this->seq > other->seq);
+}
+
+/**
+ * Get the nibble of an address at the given level of the index
+ */
+static inline u_int8_t get_nibble(u_char *addr, int level)
+{
+	return (addr[level / 2] >> ((level % 2) ? 0 : 4)) & 0x0f;
+}
+
+/**
+ * Get the root of the index for the given direction and address family
+ */
+static trie_node_t **get_root(private_ipsec_policy_mgr_t *this, bool inbound,
+							  bool ipv6)
+{
+	return &this->index[inbound ? 1 : 0][ipv6 ? 1 : 0];
+}
+
+/**
+ * Get the traffic selector a policy is indexed by, its remote subnet
+ */
+static traffic_selector_t *get_index_ts(policy_dir_t direction,
+										traffic_selector_t *src_ts,
+										traffic_selector_t *dst_ts)
+{
+	return direction == POLICY_IN ? src_ts : dst_ts;
+}
+
+/**
+ * Find the node of the index a policy is stored at, optionally creating
+ * missing nodes
+ */
+static trie_node_t *find_node(private_ipsec_policy_mgr_t *this,
+							  policy_dir_t direction,
+							  traffic_selector_t *src_ts,
+							  traffic_selector_t *dst_ts, bool create)
+{
+	traffic_selector_t *ts;
+	trie_node_t **node;
+	host_t *net;
+	u_int8_t mask;
+	chunk_t addr;
+	int level;
+
+	ts = get_index_ts(direction, src_ts, dst_ts);
+	ts->to_subnet(ts, &net, &mask);
+	addr = net->get_address(net);
+	node = get_root(this, direction == POLICY_IN,
+					ts->get_type(ts) == TS_IPV6_ADDR_RANGE);
+	for (level = 0; ; level++)
+	{
+		if (!*node)
+		{
+			if (!create)
+			{
+				break;
+			}
+			INIT(*node,
+				.policies = linked_list_create(),
+			);
+		}
+		if (level == mask / TRIE_STRIDE)
+		{
+			break;
+		}
+		node = &(*node)->children[get_nibble(addr.ptr, level)];
+	}
+	net->destroy(net);
+	return *node;
+}
+
+/**
+ * Add a policy entry to the index
+ */
+static void index_add(private_ipsec_policy_mgr_t *this,
+					  ipsec_policy_entry_t *entry)
+{
+	ipsec_policy_t *policy = entry->policy;
+	ipsec_policy_entry_t *current;
+	enumerator_t *enumerator;
+	trie_node_t *node;
+
+	node = find_node(this, policy->get_direction(policy),
+					 policy->get_source_ts(policy),
+					 policy->get_destination_ts(policy), TRUE);
+	enumerator = node->policies->create_enumerator(node->policies);
+	while (enumerator->enumerate(enumerator, (void**)&current))
+	{
+		if (policy_entry_before(entry, current))
+		{
+			break;
+		}
+	}
+	node->policies->insert_before(node->policies, enumerator, entry);
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Remove nodes without policies and children along the path to an address
+ *
+ * @return			TRUE if the given node got removed
+ */
+static bool prune_path(trie_node_t **node, u_char *addr, int level, int depth)
+{
+	int i;
+
+	if (level < depth && (*node)->children[get_nibble(addr, level)])
+	{
+		prune_path(&(*node)->children[get_nibble(addr, level)], addr,
+				   level + 1, depth);
+	}
+	if ((*node)->policies->get_count((*node)->policies))
+	{
+		return FALSE;
+	}
+	for (i = 0; i < TRIE_CHILDREN; i++)
+	{
+		if ((*node)->children[i])
+		{
+			return FALSE;
+		}
+	}
+	(*node)->policies->destroy((*node)->policies);
+	free(*node);
+	*node = NULL;
+	return TRUE;
+}
+
+/**
+ * Destroy a subtree of the index, but not the policy entries
+ */
+static void destroy_node(trie_node_t *node)
+{
+	int i;
+
+	if (node)
+	{
+		for (i = 0; i < TRIE_CHILDREN; i++)
+		{
+			destroy_node(node->children[i]);
+		}
+		node->policies->destroy(node->policies);
+		free(node);
+	}
+}
+
+/**
+ * Remove a policy entry from the index
+ */
+static void index_remove(private_ipsec_policy_mgr_t *this,
+						 ipsec_policy_entry_t *entry)
+{
+	ipsec_policy_t *policy = entry->policy;
+	traffic_selector_t *ts;
+	trie_node_t **root, *node;
+	host_t *net;
+	u_int8_t mask;
+	chunk_t addr;
+
+	ts = get_index_ts(policy->get_direction(policy),
+					  policy->get_source_ts(policy),
+					  policy->get_destination_ts(policy));
+	ts->to_subnet(ts, &net, &mask);
+	addr = net->get_address(net);
+	root = get_root(this, policy->get_direction(policy) == POLICY_IN,
+					ts->get_type(ts) == TS_IPV6_ADDR_RANGE);
+	node = find_node(this, policy->get_direction(policy),
+					 policy->get_source_ts(policy),
+					 policy->get_destination_ts(policy), FALSE);
+	if (node)
+	{
+		node->policies->remove(node->policies, entry, NULL);
+		prune_path(root, addr.ptr, 0, mask / TRIE_STRIDE);
+	}
+	net->destroy(net);
+}
+
 METHOD(ipsec_policy_mgr_t, add_policy, status_t,
 	private_ipsec_policy_mgr_t *this, host_t *src, host_t *dst,
 	traffic_selector_t *src_ts, traffic_selector_t *dst_ts,
 	policy_dir_t direction, policy_type_t type, ipsec_sa_cfg_t *sa, mark_t mark,
 	policy_priority_t priority)
 {
-	enumerator_t *enumerator;
-	ipsec_policy_entry_t *entry, *current;
+	ipsec_policy_entry_t *entry;
 	ipsec_policy_t *policy;
 
 	if (type != POLICY_IPSEC || direction == POLICY_FWD)
@@ -157,16 +385,9 @@ METHOD(ipsec_policy_mgr_t, add_policy, status_t,
 	entry = policy_entry_create(policy);
 
 	this->lock->write_lock(this->lock);
-	enumerator = this->policies->create_enumerator(this->policies);
-	while (enumerator->enumerate(enumerator, (void**)&current))
-	{
-		if (current->priority >= entry->priority)
-		{
-			break;
-		}
-	}
-	this->policies->insert_before(this->policies, enumerator, entry);
-	enumerator->destroy(enumerator);
+	entry->seq = ++this->seq;
+	index_add(this, entry);
+	this->policies->insert_last(this->policies, entry);
 	this->lock->unlock(this->lock);
 	return SUCCESS;
 }
@@ -178,6 +399,7 @@ METHOD(ipsec_policy_mgr_t, del_policy, status_t,
 {
 	enumerator_t *enumerator;
 	ipsec_policy_entry_t *current, *found = NULL;
+	trie_node_t *node;
 	u_int32_t priority;
 
 	if (direction == POLICY_FWD)
@@ -190,19 +412,27 @@ METHOD(ipsec_policy_mgr_t, del_policy, status_t,
 	priority = calculate_priority(policy_priority, src_ts, dst_ts);
 
 	this->lock->write_lock(this->lock);
-	enumerator = this->policies->create_enumerator(this->policies);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	node = find_node(this, direction, src_ts, dst_ts, FALSE);
+	if (node)
 	{
-		if (current->priority == priority &&
-			current->policy->match(current->policy, src_ts, dst_ts, direction,
-								   reqid, mark, policy_priority))
+		enumerator = node->policies->create_enumerator(node->policies);
+		while (enumerator->enumerate(enumerator, (void**)&current))
 		{
-			this->policies->remove_at(this->policies, enumerator);
-			found = current;
-			break;
+			if (current->priority == priority &&
+				current->policy->match(current->policy, src_ts, dst_ts,
+									   direction, reqid, mark, policy_priority))
+			{
+				found = current;
+				break;
+			}
 		}
+		enumerator->destroy(enumerator);
+	}
+	if (found)
+	{
+		index_remove(this, found);
+		this->policies->remove(this->policies, found, NULL);
 	}
-	enumerator->destroy(enumerator);
 	this->lock->unlock(this->lock);
 	if (found)
 	{
@@ -216,10 +446,19 @@ METHOD(ipsec_policy_mgr_t, flush_policies, status_t,
 	private_ipsec_policy_mgr_t *this)
 {
 	ipsec_policy_entry_t *entry;
+	int i, j;
 
 	DBG2(DBG_ESP, "flushing policies");
 
 	this->lock->write_lock(this->lock);
+	for (i = 0; i < countof(this->index); i++)
+	{
+		for (j = 0; j < countof(this->index[i]); j++)
+		{
+			destroy_node(this->index[i][j]);
+			this->index[i][j] = NULL;
+		}
+	}
 	while (this->policies->remove_last(this->policies,
 									  (void**)&entry) == SUCCESS)
 	{
@@ -233,25 +472,53 @@ METHOD(ipsec_policy_mgr_t, find_by_packet, ipsec_policy_t*,
 	private_ipsec_policy_mgr_t *this, ip_packet_t *packet, bool inbound)
 {
 	enumerator_t *enumerator;
-	ipsec_policy_entry_t *current;
-	ipsec_policy_t *found = NULL;
+	ipsec_policy_entry_t *current, *found = NULL;
+	ipsec_policy_t *policy = NULL;
+	trie_node_t *node;
+	host_t *host;
+	chunk_t addr;
+	int level, levels;
+
+	/* policies are indexed by their remote subnet */
+	host = inbound ? packet->get_source(packet)
+				   : packet->get_destination(packet);
+	addr = host->get_address(host);
+	levels = addr.len * 8 / TRIE_STRIDE;
 
 	this->lock->read_lock(this->lock);
-	enumerator = this->policies->create_enumerator(this->policies);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	node = *get_root(this, inbound, packet->get_version(packet) == 6);
+	/* each node on the path to the address may contain a matching policy,
+	 * as they are sorted we only have to check until we find one, or until
+	 * they are sorted after the best policy found so far */
+	for (level = 0; node; level++)
 	{
-		ipsec_policy_t *policy = current->policy;
+		enumerator = node->policies->create_enumerator(node->policies);
+		while (enumerator->enumerate(enumerator, (void**)&current))
+		{
+			if (found && !policy_entry_before(current, found))
+			{
+				break;
+			}
+			if (current->policy->match_packet(current->policy, packet))
+			{
+				found = current;
+				break;
+			}
+		}
+		enumerator->destroy(enumerator);
 
-		if ((inbound == (policy->get_direction(policy) == POLICY_IN)) &&
-			 policy->match_packet(policy, packet))
+		if (level == levels)
 		{
-			found = policy->get_ref(policy);
 			break;
 		}
+		node = node->children[get_nibble(addr.ptr, level)];
+	}
+	if (found)
+	{
+		policy = found->policy->get_ref(found->policy);
 	}
-	enumerator->destroy(enumerator);
 	this->lock->unlock(this->lock);
-	return found;
+	return policy;
 }
 
 METHOD(ipsec_policy_mgr_t, destroy, void,
@@ -23,6 +23,7 @@
 #include <processing/jobs/callback_job.h>
 
 typedef struct private_ipsec_processor_t private_ipsec_processor_t;
+typedef struct worker_t worker_t;
 
 /**
  * Private additions to ipsec_processor_t.
@@ -35,14 +36,14 @@ struct private_ipsec_processor_t {
 	ipsec_processor_t public;
 
 	/**
-	 * Queue for inbound packets (esp_packet_t*)
+	 * Crypto workers, each processing the packets of a subset of the SAs
 	 */
-	blocking_queue_t *inbound_queue;
+	worker_t *workers;
 
 	/**
-	 * Queue for outbound packets (ip_packet_t*)
+	 * Number of workers
 	 */
-	blocking_queue_t *outbound_queue;
+	u_int count;
 
 	/**
 	 * Registered inbound callback
@@ -66,6 +67,65 @@ struct private_ipsec_processor_t {
 	rwlock_t *lock;
 };
 
+/**
+ * A crypto worker with its own queue
+ */
+struct worker_t {
+
+	/**
+	 * Processor this worker belongs to
+	 */
+	private_ipsec_processor_t *processor;
+
+	/**
+	 * Queue for inbound and outbound packets (queued_packet_t*)
+	 */
+	blocking_queue_t *queue;
+
+	/**
+	 * Throughput counters, only changed by the worker thread
+	 */
+	ipsec_worker_stats_t stats;
+};
+
+/**
+ * Packet queued to a worker
+ */
+typedef struct {
+
+	/**
+	 * Inbound ESP packet, NULL for outbound packets
+	 */
+	esp_packet_t *esp;
+
+	/**
+	 * SPI of the inbound ESP packet
+	 */
+	u_int32_t spi;
+
+	/**
+	 * Outbound plaintext IP packet, NULL for inbound packets
+	 */
+	ip_packet_t *ip;
+
+	/**
+	 * Policy matching the outbound IP packet
+	 */
+	ipsec_policy_t *policy;
+
+} queued_packet_t;
+
+/**
+ * Destroy a queued packet
+ */
+static void queued_packet_destroy(queued_packet_t *this)
+{
+	DESTROY_IF(this->esp);
+	DESTROY_IF(this->ip);
+	DESTROY_IF(this->policy);
+	free(this);
+}
+
 /**
  * Deliver an inbound IP packet to the registered listener
  */
@@ -86,22 +146,15 @@ static void deliver_inbound(private_ipsec_processor_t *this,
 }
 
 /**
- * Processes inbound packets
+ * Processes an inbound packet with a parsed SPI
  */
-static job_requeue_t process_inbound(private_ipsec_processor_t *this)
+static bool process_inbound(worker_t *worker, esp_packet_t *packet,
+							u_int32_t spi)
 {
-	esp_packet_t *packet;
+	private_ipsec_processor_t *this = worker->processor;
 	ipsec_sa_t *sa;
 	u_int8_t next_header;
-	u_int32_t spi;
-
-	packet = (esp_packet_t*)this->inbound_queue->dequeue(this->inbound_queue);
-
-	if (!packet->parse_header(packet, &spi))
-	{
-		packet->destroy(packet);
-		return JOB_REQUEUE_DIRECT;
-	}
+	size_t len;
 
 	sa = ipsec->sas->checkout_by_spi(ipsec->sas, spi,
 									 packet->get_destination(packet));
@@ -109,7 +162,7 @@ static job_requeue_t process_inbound(private_ipsec_processor_t *this)
 	{
 		DBG2(DBG_ESP, "inbound ESP packet does not belong to an installed SA");
 		packet->destroy(packet);
-		return JOB_REQUEUE_DIRECT;
+		return FALSE;
 	}
 
 	if (!sa->is_inbound(sa))
@@ -117,16 +170,19 @@ static job_requeue_t process_inbound(private_ipsec_processor_t *this)
 		DBG1(DBG_ESP, "error: IPsec SA is not inbound");
 		packet->destroy(packet);
 		ipsec->sas->checkin(ipsec->sas, sa);
-		return JOB_REQUEUE_DIRECT;
+		return FALSE;
 	}
 
+	len = packet->packet.get_data(&packet->packet).len;
 	if (packet->decrypt(packet, sa->get_esp_context(sa)) != SUCCESS)
 	{
 		ipsec->sas->checkin(ipsec->sas, sa);
 		packet->destroy(packet);
-		return JOB_REQUEUE_DIRECT;
+		return FALSE;
 	}
 	ipsec->sas->checkin(ipsec->sas, sa);
+	worker->stats.packets_in++;
+	worker->stats.bytes_in += len;
 
 	next_header = packet->get_next_header(packet);
 	switch (next_header)
@@ -158,7 +214,7 @@ static job_requeue_t process_inbound(private_ipsec_processor_t *this)
 			packet->destroy(packet);
 			break;
 	}
-	return JOB_REQUEUE_DIRECT;
+	return TRUE;
 }
 
 /**
@@ -181,26 +237,16 @@ static void send_outbound(private_ipsec_processor_t *this,
 }
 
 /**
- * Processes outbound packets
+ * Processes an outbound packet with a matching policy
  */
-static job_requeue_t process_outbound(private_ipsec_processor_t *this)
+static bool process_outbound(worker_t *worker, ip_packet_t *packet,
+							 ipsec_policy_t *policy)
 {
-	ipsec_policy_t *policy;
+	private_ipsec_processor_t *this = worker->processor;
 	esp_packet_t *esp_packet;
-	ip_packet_t *packet;
 	ipsec_sa_t *sa;
 	host_t *src, *dst;
-
-	packet = (ip_packet_t*)this->outbound_queue->dequeue(this->outbound_queue);
-
-	policy = ipsec->policies->find_by_packet(ipsec->policies, packet, FALSE);
-	if (!policy)
-	{
-		DBG2(DBG_ESP, "no matching outbound IPsec policy for %H == %H",
-			 packet->get_source(packet), packet->get_destination(packet));
-		packet->destroy(packet);
-		return JOB_REQUEUE_DIRECT;
-	}
+	size_t len;
 
 	sa = ipsec->sas->checkout_by_reqid(ipsec->sas, policy->get_reqid(policy),
 									   FALSE);
@@ -210,8 +256,9 @@ static job_requeue_t process_outbound(private_ipsec_processor_t *this)
 			 "dropping packet", policy->get_reqid(policy));
 		packet->destroy(packet);
 		policy->destroy(policy);
-		return JOB_REQUEUE_DIRECT;
+		return FALSE;
 	}
+	len = packet->get_encoding(packet).len;
 	src = sa->get_source(sa);
 	dst = sa->get_destination(sa);
 	esp_packet = esp_packet_create_from_payload(src->clone(src),
@@ -222,25 +269,87 @@ static job_requeue_t process_outbound(private_ipsec_processor_t *this)
 		ipsec->sas->checkin(ipsec->sas, sa);
 		esp_packet->destroy(esp_packet);
 		policy->destroy(policy);
-		return JOB_REQUEUE_DIRECT;
+		return FALSE;
 	}
 	/* TODO-IPSEC: update policy/sa counters? */
 	ipsec->sas->checkin(ipsec->sas, sa);
 	policy->destroy(policy);
+	worker->stats.packets_out++;
+	worker->stats.bytes_out += len;
 	send_outbound(this, esp_packet);
+	return TRUE;
+}
+
+/**
+ * Processes the packets queued to a worker
+ */
+static job_requeue_t process_packets(worker_t *worker)
+{
+	queued_packet_t *queued;
+	bool success;
+
+	queued = worker->queue->dequeue(worker->queue);
+	if (queued->esp)
+	{
+		success = process_inbound(worker, queued->esp, queued->spi);
+	}
+	else
+	{
+		success = process_outbound(worker, queued->ip, queued->policy);
+	}
+	if (!success)
+	{
+		worker->stats.dropped++;
+	}
+	free(queued);
 	return JOB_REQUEUE_DIRECT;
 }
 
 METHOD(ipsec_processor_t, queue_inbound, void,
 	private_ipsec_processor_t *this, esp_packet_t *packet)
 {
-	this->inbound_queue->enqueue(this->inbound_queue, packet);
+	queued_packet_t *queued;
+	worker_t *worker;
+	u_int32_t spi;
+
+	if (!packet->parse_header(packet, &spi))
+	{
+		packet->destroy(packet);
+		return;
+	}
+	/* the packets of an SA are always processed by the same worker, which
+	 * keeps them in order for the replay check */
+	worker = &this->workers[spi % this->count];
+	INIT(queued,
+		.esp = packet,
+		.spi = spi,
+	);
+	worker->queue->enqueue(worker->queue, queued);
 }
 
 METHOD(ipsec_processor_t, queue_outbound, void,
 	private_ipsec_processor_t *this, ip_packet_t *packet)
 {
-	this->outbound_queue->enqueue(this->outbound_queue, packet);
+	queued_packet_t *queued;
+	ipsec_policy_t *policy;
+	worker_t *worker;
+
+	policy = ipsec->policies->find_by_packet(ipsec->policies, packet, FALSE);
+	if (!policy)
+	{
+		DBG2(DBG_ESP, "no matching outbound IPsec policy for %H == %H",
+			 packet->get_source(packet), packet->get_destination(packet));
+		packet->destroy(packet);
+		return;
+	}
+	/* the outbound SA is selected by reqid, so this keeps the packets of an
+	 * SA in order and their sequence numbers ascending */
+	worker = &this->workers[policy->get_reqid(policy) % this->count];
+	INIT(queued,
+		.ip = packet,
+		.policy = policy,
+	);
+	worker->queue->enqueue(worker->queue, queued);
 }
 
 METHOD(ipsec_processor_t, register_inbound, void,
@@ -283,13 +392,34 @@ METHOD(ipsec_processor_t, unregister_outbound, void,
 	this->lock->unlock(this->lock);
 }
 
+METHOD(ipsec_processor_t, get_worker_count, u_int,
+	private_ipsec_processor_t *this)
+{
+	return this->count;
+}
+
+METHOD(ipsec_processor_t, get_worker_stats, bool,
+	private_ipsec_processor_t *this, u_int worker, ipsec_worker_stats_t *stats)
+{
+	if (worker >= this->count)
+	{
+		return FALSE;
+	}
+	*stats = this->workers[worker].stats;
+	return TRUE;
+}
+
 METHOD(ipsec_processor_t, destroy, void,
 	private_ipsec_processor_t *this)
 {
-	this->inbound_queue->destroy_offset(this->inbound_queue,
-										offsetof(esp_packet_t, destroy));
-	this->outbound_queue->destroy_offset(this->outbound_queue,
-										 offsetof(ip_packet_t, destroy));
+	u_int i;
+
+	for (i = 0; i < this->count; i++)
+	{
+		this->workers[i].queue->destroy_function(this->workers[i].queue,
+											(void*)queued_packet_destroy);
+	}
+	free(this->workers);
 	this->lock->destroy(this->lock);
 	free(this);
 }
@@ -297,9 +427,10 @@ METHOD(ipsec_processor_t, destroy, void,
 /**
  * Described in header.
  */
-ipsec_processor_t *ipsec_processor_create()
+ipsec_processor_t *ipsec_processor_create(u_int workers)
 {
 	private_ipsec_processor_t *this;
+	u_int i;
 
 	INIT(this,
 		.public = {
@@ -309,18 +440,23 @@ ipsec_processor_t *ipsec_processor_create()
 			.unregister_inbound = _unregister_inbound,
 			.register_outbound = _register_outbound,
 			.unregister_outbound = _unregister_outbound,
+			.get_worker_count = _get_worker_count,
+			.get_worker_stats = _get_worker_stats,
 			.destroy = _destroy,
 		},
-		.inbound_queue = blocking_queue_create(),
-		.outbound_queue = blocking_queue_create(),
+		.count = max(1, workers),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 	);
 
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create((callback_job_cb_t)process_inbound, this,
-									NULL, (callback_job_cancel_t)return_false));
-	lib->processor->queue_job(lib->processor,
-		(job_t*)callback_job_create((callback_job_cb_t)process_outbound, this,
-									NULL, (callback_job_cancel_t)return_false));
+	this->workers = calloc(this->count, sizeof(worker_t));
+	for (i = 0; i < this->count; i++)
+	{
+		this->workers[i].processor = this;
+		this->workers[i].queue = blocking_queue_create();
+		lib->processor->queue_job(lib->processor,
+			(job_t*)callback_job_create((callback_job_cb_t)process_packets,
+									&this->workers[i], NULL,
+									(callback_job_cancel_t)return_false));
+	}
 	return &this->public;
 }
@@ -25,6 +25,38 @@
 #include "esp_packet.h"
 
 typedef struct ipsec_processor_t ipsec_processor_t;
+typedef struct ipsec_worker_stats_t ipsec_worker_stats_t;
+
+/**
+ * Throughput counters of a crypto worker of the IPsec processor.
+ */
+struct ipsec_worker_stats_t {
+
+	/**
+	 * Number of decrypted inbound ESP packets
+	 */
+	u_int64_t packets_in;
+
+	/**
+	 * Number of bytes of decrypted inbound ESP packets
+	 */
+	u_int64_t bytes_in;
+
+	/**
+	 * Number of encrypted outbound IP packets
+	 */
+	u_int64_t packets_out;
+
+	/**
+	 * Number of bytes of encrypted outbound IP packets (plaintext)
+	 */
+	u_int64_t bytes_out;
+
+	/**
+	 * Number of packets dropped by this worker
+	 */
+	u_int64_t dropped;
+};
 
 /**
  * Callback called to deliver an inbound plaintext packet.
@@ -98,6 +130,26 @@ struct ipsec_processor_t {
 	void (*unregister_outbound)(ipsec_processor_t *this,
 								ipsec_outbound_cb_t cb);
 
+	/**
+	 * Get the number of crypto workers processing packets.
+	 *
+	 * Packets are distributed to the workers by SA, so the packets of an SA
+	 * are always processed in order by the same worker.
+	 *
+	 * @return				number of workers
+	 */
+	u_int (*get_worker_count)(ipsec_processor_t *this);
+
+	/**
+	 * Get the throughput counters of a crypto worker.
+	 *
+	 * @param worker		index of the worker, < get_worker_count()
+	 * @param stats			receives the counters of the worker
+	 * @return				TRUE if worker found
+	 */
+	bool (*get_worker_stats)(ipsec_processor_t *this, u_int worker,
+							 ipsec_worker_stats_t *stats);
+
 	/**
 	 * Destroy an ipsec_processor_t.
 	 */
@@ -108,8 +160,9 @@ struct ipsec_processor_t {
 /**
  * Create an ipsec_processor_t instance
  *
+ * @param workers			number of crypto workers to start
  * @return					IPsec processor instance
  */
-ipsec_processor_t *ipsec_processor_create();
+ipsec_processor_t *ipsec_processor_create(u_int workers);
 
 #endif /** IPSEC_PROCESSOR_H_ @}*/
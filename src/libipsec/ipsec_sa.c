@@ -195,11 +195,6 @@ ipsec_sa_t *ipsec_sa_create(u_int32_t spi, host_t *src, host_t *dst,
 		DBG1(DBG_ESP, "  IPsec SA: only UDP encapsulation is supported");
 		return NULL;
 	}
-	if (esn)
-	{
-		DBG1(DBG_ESP, "  IPsec SA: ESN not supported");
-		return NULL;
-	}
 	if (ipcomp != IPCOMP_NONE)
 	{
 		DBG1(DBG_ESP, "  IPsec SA: compression not supported");
@@ -240,7 +235,7 @@ ipsec_sa_t *ipsec_sa_create(u_int32_t spi, host_t *src, host_t *dst,
 	);
 
 	this->esp_context = esp_context_create(enc_alg, enc_key, int_alg, int_key,
-										   inbound);
+										   inbound, esn, 0);
 	if (!this->esp_context)
 	{
 		destroy(this);
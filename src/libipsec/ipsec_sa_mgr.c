@@ -23,6 +23,7 @@
 #include <processing/jobs/callback_job.h>
 #include <threading/condvar.h>
 #include <threading/mutex.h>
+#include <threading/rwlock.h>
 #include <collections/hashtable.h>
 #include <collections/linked_list.h>
 
@@ -39,9 +40,19 @@ struct private_ipsec_sa_mgr_t {
 	ipsec_sa_mgr_t public;
 
 	/**
-	 * Installed SAs
+	 * Installed SAs by SPI and destination (sa_key_t, ipsec_sa_entry_t)
 	 */
-	linked_list_t *sas;
+	hashtable_t *sas;
+
+	/**
+	 * Installed SAs by reqid and direction (reqid_key_t, reqid_bucket_t)
+	 */
+	hashtable_t *reqids;
+
+	/**
+	 * Lock for the two tables above, the SA entries have their own locks
+	 */
+	rwlock_t *lock;
 
 	/**
 	 * SPIs allocated using get_spi()
@@ -49,7 +60,7 @@ struct private_ipsec_sa_mgr_t {
 	hashtable_t *allocated_spis;
 
 	/**
-	 * Mutex used to synchronize access to the SA manager
+	 * Mutex used to synchronize access to the allocated SPIs and the RNG
 	 */
 	mutex_t *mutex;
 
@@ -59,16 +70,83 @@ struct private_ipsec_sa_mgr_t {
 	rng_t *rng;
 };
 
+/**
+ * Key of the table of SAs, like the kernel we identify SAs by SPI and
+ * destination address
+ */
+typedef struct {
+
+	/**
+	 * SPI of the SA
+	 */
+	u_int32_t spi;
+
+	/**
+	 * Destination address of the SA
+	 */
+	host_t *dst;
+
+	/**
+	 * Whether the SA is inbound (not compared by sa_key_equals())
+	 */
+	bool inbound;
+
+} sa_key_t;
+
+/**
+ * Key of the table of reqids
+ */
+typedef struct {
+
+	/**
+	 * Reqid of the SAs
+	 */
+	u_int32_t reqid;
+
+	/**
+	 * Whether the SAs are inbound
+	 */
+	bool inbound;
+
+} reqid_key_t;
+
+/**
+ * SAs with the same reqid and direction
+ */
+typedef struct {
+
+	/**
+	 * Key of this bucket
+	 */
+	reqid_key_t key;
+
+	/**
+	 * SA entries, in the order they got installed (ipsec_sa_entry_t*)
+	 */
+	linked_list_t *entries;
+
+} reqid_bucket_t;
+
 /**
  * Struct to keep track of locked IPsec SAs
  */
 typedef struct {
 
+	/**
+	 * Key of this entry in the table of SAs
+	 */
+	sa_key_t key;
+
 	/**
 	 * IPsec SA
 	 */
 	ipsec_sa_t *sa;
 
+	/**
+	 * Mutex protecting the fields below
+	 */
+	mutex_t *mutex;
+
 	/**
 	 * Set if this SA is currently in use by a thread
 	 */
@@ -106,6 +184,11 @@ typedef struct {
 	 */
 	ipsec_sa_entry_t *entry;
 
+	/**
+	 * Reqid and direction of the entry, used to check that it still exists
+	 */
+	reqid_key_t key;
+
 	/**
 	 * 0 if this is a hard expire, otherwise the offset in s (soft->hard)
 	 */
@@ -126,6 +209,40 @@ static u_int spi_hash(u_int32_t *spi)
 	return chunk_hash(chunk_from_thing(*spi));
 }
 
+/*
+ * Used for the hash table of SAs, only the SPI is hashed so SAs may also be
+ * looked up by SPI alone using get_match()
+ */
+static bool sa_key_equals(sa_key_t *key, sa_key_t *other_key)
+{
+	return key->spi == other_key->spi &&
+		   key->dst->ip_equals(key->dst, other_key->dst);
+}
+
+static bool sa_key_match_spi_inbound(sa_key_t *key, sa_key_t *other_key)
+{
+	return key->spi == other_key->spi && other_key->inbound;
+}
+
+static u_int sa_key_hash(sa_key_t *key)
+{
+	return chunk_hash(chunk_from_thing(key->spi));
+}
+
+/*
+ * Used for the hash table of reqids
+ */
+static bool reqid_key_equals(reqid_key_t *key, reqid_key_t *other_key)
+{
+	return key->reqid == other_key->reqid &&
+		   key->inbound == other_key->inbound;
+}
+
+static u_int reqid_key_hash(reqid_key_t *key)
+{
+	return chunk_hash_inc(chunk_from_thing(key->reqid), key->inbound);
+}
+
 /**
  * Create an SA entry
  */
@@ -134,6 +251,12 @@ static ipsec_sa_entry_t *create_entry(ipsec_sa_t *sa)
 	ipsec_sa_entry_t *this;
 
 	INIT(this,
+		.key = {
+			.spi = sa->get_spi(sa),
+			.dst = sa->get_destination(sa),
+			.inbound = sa->is_inbound(sa),
+		},
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 		.sa = sa,
 	);
@@ -141,54 +264,180 @@ static ipsec_sa_entry_t *create_entry(ipsec_sa_t *sa)
 }
 
 /**
- * Destroy an SA entry
+ * Destroy an SA entry, which must not be in the tables anymore
  */
 static void destroy_entry(ipsec_sa_entry_t *entry)
 {
+	/* threads that found the entry before it got removed from the tables
+	 * hold its mutex until they noticed it awaits deletion */
+	entry->mutex->lock(entry->mutex);
+	entry->mutex->unlock(entry->mutex);
+
 	entry->condvar->destroy(entry->condvar);
+	entry->mutex->destroy(entry->mutex);
 	entry->sa->destroy(entry->sa);
 	free(entry);
 }
 
 /**
- * Makes sure an entry is safe to remove
- * Must be called with this->mutex held.
+ * Add an entry to the tables.
+ * Must be called with this->lock write locked.
+ */
+static void link_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
+{
+	reqid_bucket_t *bucket;
+	reqid_key_t key = {
+		.reqid = entry->sa->get_reqid(entry->sa),
+		.inbound = entry->key.inbound,
+	};
+
+	this->sas->put(this->sas, &entry->key, entry);
+
+	bucket = this->reqids->get(this->reqids, &key);
+	if (!bucket)
+	{
+		INIT(bucket,
+			.key = key,
+			.entries = linked_list_create(),
+		);
+		this->reqids->put(this->reqids, &bucket->key, bucket);
+	}
+	bucket->entries->insert_last(bucket->entries, entry);
+}
+
+/**
+ * Remove an entry from the tables.
+ * Must be called with this->lock write locked.
+ */
+static void unlink_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
+{
+	reqid_bucket_t *bucket;
+	reqid_key_t key = {
+		.reqid = entry->sa->get_reqid(entry->sa),
+		.inbound = entry->key.inbound,
+	};
+
+	this->sas->remove(this->sas, &entry->key);
+
+	bucket = this->reqids->get(this->reqids, &key);
+	if (bucket)
+	{
+		bucket->entries->remove(bucket->entries, entry, NULL);
+		if (bucket->entries->get_count(bucket->entries) == 0)
+		{
+			this->reqids->remove(this->reqids, &bucket->key);
+			bucket->entries->destroy(bucket->entries);
+			free(bucket);
+		}
+	}
+}
+
+/**
+ * Find an entry by SPI and destination address.
+ * Must be called with this->lock held.
+ */
+static ipsec_sa_entry_t *find_entry(private_ipsec_sa_mgr_t *this,
+									u_int32_t spi, host_t *dst)
+{
+	sa_key_t key = {
+		.spi = spi,
+		.dst = dst,
+	};
+
+	return this->sas->get(this->sas, &key);
+}
+
+/**
+ * Check if the given entry is still installed with the given reqid.
+ * Must be called with this->lock held.
+ */
+static bool entry_installed(private_ipsec_sa_mgr_t *this,
+							ipsec_sa_entry_t *entry, reqid_key_t *key)
+{
+	reqid_bucket_t *bucket;
+
+	bucket = this->reqids->get(this->reqids, key);
+	return bucket && bucket->entries->find_first(bucket->entries, NULL,
+												 (void**)&entry) == SUCCESS;
+}
+
+/**
+ * Mark an entry for deletion, no thread is able to check it out afterwards.
+ * Must be called with this->lock held.
  *
  * @return			TRUE if entry can be removed, FALSE if entry is already
 *					being removed by another thread
  */
-static bool wait_remove_entry(private_ipsec_sa_mgr_t *this,
-							  ipsec_sa_entry_t *entry)
+static bool mark_entry(ipsec_sa_entry_t *entry)
 {
-	if (entry->awaits_deletion)
+	bool marked = FALSE;
+
+	entry->mutex->lock(entry->mutex);
+	if (!entry->awaits_deletion)
 	{
-		/* this will be deleted by another thread already */
-		return FALSE;
+		entry->awaits_deletion = TRUE;
+		marked = TRUE;
 	}
-	entry->awaits_deletion = TRUE;
+	entry->mutex->unlock(entry->mutex);
+	return marked;
+}
+
+/**
+ * Makes sure an entry marked for deletion is safe to remove.
+ * Must be called without this->lock held, as the entry might have to be
+ * checked in by another thread.
+ */
+static void wait_remove_entry(ipsec_sa_entry_t *entry)
+{
+	entry->mutex->lock(entry->mutex);
 	while (entry->locked)
 	{
-		entry->condvar->wait(entry->condvar, this->mutex);
+		entry->condvar->wait(entry->condvar, entry->mutex);
 	}
 	while (entry->waiting_threads > 0)
 	{
 		entry->condvar->broadcast(entry->condvar);
-		entry->condvar->wait(entry->condvar, this->mutex);
+		entry->condvar->wait(entry->condvar, entry->mutex);
 	}
+	entry->mutex->unlock(entry->mutex);
+}
+
+/**
+ * Remove and destroy an entry.
+ * Must be called with this->lock held (in any mode), which gets released.
+ *
+ * @return			TRUE if entry got removed, FALSE if entry is already
+*					being removed by another thread
+ */
+static bool remove_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
+{
+	if (!mark_entry(entry))
+	{
+		this->lock->unlock(this->lock);
+		return FALSE;
+	}
+	this->lock->unlock(this->lock);
+
+	wait_remove_entry(entry);
+
+	this->lock->write_lock(this->lock);
+	unlink_entry(this, entry);
+	this->lock->unlock(this->lock);
+
+	destroy_entry(entry);
 	return TRUE;
 }
 
 /**
- * Waits until an is available and then locks it.
- * Must only be called with this->mutex held
+ * Waits until an entry is available and then locks it.
+ * Must only be called with entry->mutex held
  */
-static bool wait_for_entry(private_ipsec_sa_mgr_t *this,
-						   ipsec_sa_entry_t *entry)
+static bool wait_for_entry(ipsec_sa_entry_t *entry)
 {
 	while (entry->locked && !entry->awaits_deletion)
 	{
 		entry->waiting_threads++;
-		entry->condvar->wait(entry->condvar, this->mutex);
+		entry->condvar->wait(entry->condvar, entry->mutex);
 		entry->waiting_threads--;
 	}
 	if (entry->awaits_deletion)
@@ -201,91 +450,74 @@ static bool wait_for_entry(private_ipsec_sa_mgr_t *this,
 	return TRUE;
 }
 
+/**
+ * Check out an entry, waiting until it is available.
+ * Must be called with this->lock held (in any mode), which gets released.
+ */
+static bool checkout_entry(private_ipsec_sa_mgr_t *this,
+						   ipsec_sa_entry_t *entry)
+{
+	bool success;
+
+	/* acquire the entry's lock before releasing the table lock, so the entry
+	 * can't get destroyed before we noticed that it awaits deletion */
+	entry->mutex->lock(entry->mutex);
+	this->lock->unlock(this->lock);
+	success = wait_for_entry(entry);
+	entry->mutex->unlock(entry->mutex);
+	return success;
+}
+
+/**
+ * Check in an entry that is checked out by the current thread
+ */
+static void checkin_entry(ipsec_sa_entry_t *entry)
+{
+	entry->mutex->lock(entry->mutex);
+	if (entry->locked)
+	{
+		entry->locked = FALSE;
+		entry->condvar->signal(entry->condvar);
+	}
+	entry->mutex->unlock(entry->mutex);
+}
+
 /**
  * Flushes all entries
- * Must be called with this->mutex held.
  */
 static void flush_entries(private_ipsec_sa_mgr_t *this)
 {
 	ipsec_sa_entry_t *current;
 	enumerator_t *enumerator;
+	linked_list_t *entries;
 
 	DBG2(DBG_ESP, "flushing SAD");
 
+	entries = linked_list_create();
+	this->lock->read_lock(this->lock);
 	enumerator = this->sas->create_enumerator(this->sas);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	while (enumerator->enumerate(enumerator, NULL, (void**)&current))
 	{
-		if (wait_remove_entry(this, current))
+		if (mark_entry(current))
 		{
-			this->sas->remove_at(this->sas, enumerator);
-			destroy_entry(current);
+			entries->insert_last(entries, current);
 		}
 	}
 	enumerator->destroy(enumerator);
-}
+	this->lock->unlock(this->lock);
 
-/*
- * Different match functions to find SAs in the linked list
- */
-static bool match_entry_by_ptr(ipsec_sa_entry_t *item, ipsec_sa_entry_t *entry)
-{
-	return item == entry;
-}
+	entries->invoke_function(entries, (void*)wait_remove_entry);
 
-static bool match_entry_by_sa_ptr(ipsec_sa_entry_t *item, ipsec_sa_t *sa)
-{
-	return item->sa == sa;
-}
-
-static bool match_entry_by_spi_inbound(ipsec_sa_entry_t *item, u_int32_t *spi,
-									   bool *inbound)
-{
-	return item->sa->get_spi(item->sa) == *spi &&
-		   item->sa->is_inbound(item->sa) == *inbound;
-}
-
-static bool match_entry_by_spi_src_dst(ipsec_sa_entry_t *item, u_int32_t *spi,
-									   host_t *src, host_t *dst)
-{
-	return item->sa->match_by_spi_src_dst(item->sa, *spi, src, dst);
-}
-
-static bool match_entry_by_reqid_inbound(ipsec_sa_entry_t *item,
-										 u_int32_t *reqid, bool *inbound)
-{
-	return item->sa->match_by_reqid(item->sa, *reqid, *inbound);
-}
-
-static bool match_entry_by_spi_dst(ipsec_sa_entry_t *item, u_int32_t *spi,
-								   host_t *dst)
-{
-	return item->sa->match_by_spi_dst(item->sa, *spi, dst);
-}
-
-/**
- * Remove an entry
- */
-static bool remove_entry(private_ipsec_sa_mgr_t *this, ipsec_sa_entry_t *entry)
-{
-	ipsec_sa_entry_t *current;
-	enumerator_t *enumerator;
-	bool removed = FALSE;
-
-	enumerator = this->sas->create_enumerator(this->sas);
+	this->lock->write_lock(this->lock);
+	enumerator = entries->create_enumerator(entries);
 	while (enumerator->enumerate(enumerator, (void**)&current))
 	{
-		if (current == entry)
-		{
-			if (wait_remove_entry(this, current))
-			{
-				this->sas->remove_at(this->sas, enumerator);
-				removed = TRUE;
-			}
-			break;
-		}
+		unlink_entry(this, current);
 	}
 	enumerator->destroy(enumerator);
-	return removed;
+	this->lock->unlock(this->lock);
+
+	entries->destroy_function(entries, (void*)destroy_entry);
 }
 
 /**
@@ -295,9 +527,8 @@ static job_requeue_t sa_expired(ipsec_sa_expired_t *expired)
 {
 	private_ipsec_sa_mgr_t *this = expired->manager;
 
-	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_ptr,
-							  NULL, expired->entry) == SUCCESS)
+	this->lock->read_lock(this->lock);
+	if (entry_installed(this, expired->entry, &expired->key))
 	{
 		u_int32_t hard_offset = expired->hard_offset;
 		ipsec_sa_t *sa = expired->entry->sa;
@@ -308,16 +539,14 @@ static job_requeue_t sa_expired(ipsec_sa_expired_t *expired)
 		if (hard_offset)
 		{	/* soft limit reached, schedule hard expire */
 			expired->hard_offset = 0;
-			this->mutex->unlock(this->mutex);
+			this->lock->unlock(this->lock);
 			return JOB_RESCHEDULE(hard_offset);
 		}
 		/* hard limit reached */
-		if (remove_entry(this, expired->entry))
-		{
-			destroy_entry(expired->entry);
-		}
+		remove_entry(this, expired->entry);
+		return JOB_REQUEUE_NONE;
 	}
-	this->mutex->unlock(this->mutex);
+	this->lock->unlock(this->lock);
 	return JOB_REQUEUE_NONE;
 }
 
@@ -335,6 +564,10 @@ static void schedule_expiration(private_ipsec_sa_mgr_t *this,
 	INIT(expired,
 		.manager = this,
 		.entry = entry,
+		.key = {
+			.reqid = entry->sa->get_reqid(entry->sa),
+			.inbound = entry->key.inbound,
+		},
 	);
 
 	/* schedule a rekey first, a hard timeout will be scheduled then, if any */
@@ -374,14 +607,22 @@ static void flush_allocated_spis(private_ipsec_sa_mgr_t *this)
 
 /**
  * Pre-allocate an SPI for an inbound SA
+ * Must be called with this->mutex held.
  */
 static bool allocate_spi(private_ipsec_sa_mgr_t *this, u_int32_t spi)
 {
 	u_int32_t *spi_alloc;
+	sa_key_t key = {
+		.spi = spi,
+	};
+	bool installed;
 
-	if (this->allocated_spis->get(this->allocated_spis, &spi) ||
-		this->sas->find_first(this->sas, (void*)match_entry_by_spi_inbound,
-							  NULL, &spi, TRUE) == SUCCESS)
+	this->lock->read_lock(this->lock);
+	installed = this->sas->get_match(this->sas, &key,
+							(hashtable_equals_t)sa_key_match_spi_inbound) != NULL;
+	this->lock->unlock(this->lock);
+
+	if (installed || this->allocated_spis->get(this->allocated_spis, &spi))
 	{
 		return FALSE;
 	}
@@ -460,20 +701,20 @@ METHOD(ipsec_sa_mgr_t, add_sa, status_t,
 		return FAILED;
 	}
 
-	this->mutex->lock(this->mutex);
-
 	if (inbound)
 	{	/* remove any pre-allocated SPIs */
 		u_int32_t *spi_alloc;
 
+		this->mutex->lock(this->mutex);
 		spi_alloc = this->allocated_spis->remove(this->allocated_spis, &spi);
+		this->mutex->unlock(this->mutex);
 		free(spi_alloc);
 	}
 
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_spi_src_dst,
-							  NULL, &spi, src, dst) == SUCCESS)
+	this->lock->write_lock(this->lock);
+	if (find_entry(this, spi, dst))
 	{
-		this->mutex->unlock(this->mutex);
+		this->lock->unlock(this->lock);
 		DBG1(DBG_ESP, "failed to install SAD entry: already installed");
 		sa_new->destroy(sa_new);
 		return FAILED;
@@ -481,9 +722,9 @@ METHOD(ipsec_sa_mgr_t, add_sa, status_t,
 
 	entry = create_entry(sa_new);
 	schedule_expiration(this, entry);
-	this->sas->insert_last(this->sas, entry);
+	link_entry(this, entry);
 
-	this->mutex->unlock(this->mutex);
+	this->lock->unlock(this->lock);
 	return SUCCESS;
 }
 
@@ -492,7 +733,8 @@ METHOD(ipsec_sa_mgr_t, update_sa, status_t,
 	u_int16_t cpi, host_t *src, host_t *dst, host_t *new_src, host_t *new_dst,
 	bool encap, bool new_encap, mark_t mark)
 {
-	ipsec_sa_entry_t *entry = NULL;
+	ipsec_sa_entry_t *entry;
+	status_t status = FAILED;
 
 	DBG2(DBG_ESP, "updating SAD entry with SPI %.8x from %#H..%#H to %#H..%#H",
 		 ntohl(spi), src, dst, new_src, new_dst);
@@ -504,58 +746,59 @@ METHOD(ipsec_sa_mgr_t, update_sa, status_t,
 		return NOT_SUPPORTED;
 	}
 
-	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_spi_src_dst,
-							 (void**)&entry, &spi, src, dst) == SUCCESS &&
-		wait_for_entry(this, entry))
-	{
-		entry->sa->set_source(entry->sa, new_src);
-		entry->sa->set_destination(entry->sa, new_dst);
-		/* checkin the entry */
-		entry->locked = FALSE;
-		entry->condvar->signal(entry->condvar);
-	}
-	this->mutex->unlock(this->mutex);
-
-	if (!entry)
+	this->lock->read_lock(this->lock);
+	entry = find_entry(this, spi, dst);
+	if (!entry || !entry->sa->match_by_spi_src_dst(entry->sa, spi, src, dst))
 	{
+		this->lock->unlock(this->lock);
 		DBG1(DBG_ESP, "failed to update SAD entry: not found");
 		return FAILED;
 	}
-	return SUCCESS;
+	if (checkout_entry(this, entry))
+	{
+		/* the destination is part of the key, so rehash the entry */
+		this->lock->write_lock(this->lock);
+		if (dst->ip_equals(dst, new_dst) || !find_entry(this, spi, new_dst))
+		{
+			this->sas->remove(this->sas, &entry->key);
+			entry->sa->set_source(entry->sa, new_src);
+			entry->sa->set_destination(entry->sa, new_dst);
+			entry->key.dst = entry->sa->get_destination(entry->sa);
+			this->sas->put(this->sas, &entry->key, entry);
+			status = SUCCESS;
+		}
+		else
+		{
+			DBG1(DBG_ESP, "failed to update SAD entry: SA with SPI %.8x to "
+				 "%H already installed", ntohl(spi), new_dst);
+		}
+		this->lock->unlock(this->lock);
+		checkin_entry(entry);
+	}
+	return status;
 }
 
 METHOD(ipsec_sa_mgr_t, del_sa, status_t,
 	private_ipsec_sa_mgr_t *this, host_t *src, host_t *dst, u_int32_t spi,
 	u_int8_t protocol, u_int16_t cpi, mark_t mark)
 {
-	ipsec_sa_entry_t *current, *found = NULL;
-	enumerator_t *enumerator;
+	ipsec_sa_entry_t *entry;
+	bool inbound;
 
-	this->mutex->lock(this->mutex);
-	enumerator = this->sas->create_enumerator(this->sas);
-	while (enumerator->enumerate(enumerator, (void**)&current))
+	this->lock->read_lock(this->lock);
+	entry = find_entry(this, spi, dst);
+	if (entry && entry->sa->match_by_spi_src_dst(entry->sa, spi, src, dst))
 	{
-		if (match_entry_by_spi_src_dst(current, &spi, src, dst))
+		inbound = entry->key.inbound;
+		if (remove_entry(this, entry))
 		{
-			if (wait_remove_entry(this, current))
-			{
-				this->sas->remove_at(this->sas, enumerator);
-				found = current;
-			}
-			break;
+			DBG2(DBG_ESP, "deleted %sbound SAD entry with SPI %.8x",
+				 inbound ? "in" : "out", ntohl(spi));
+			return SUCCESS;
 		}
+		return FAILED;
 	}
-	enumerator->destroy(enumerator);
-	this->mutex->unlock(this->mutex);
-
-	if (found)
-	{
-		DBG2(DBG_ESP, "deleted %sbound SAD entry with SPI %.8x",
-			 found->sa->is_inbound(found->sa) ? "in" : "out", ntohl(spi));
-		destroy_entry(found);
-		return SUCCESS;
-	}
+	this->lock->unlock(this->lock);
 	return FAILED;
 }
 
@@ -563,34 +806,44 @@ METHOD(ipsec_sa_mgr_t, checkout_by_reqid, ipsec_sa_t*,
 	private_ipsec_sa_mgr_t *this, u_int32_t reqid, bool inbound)
 {
 	ipsec_sa_entry_t *entry;
-	ipsec_sa_t *sa = NULL;
-
-	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_reqid_inbound,
-							 (void**)&entry, &reqid, &inbound) == SUCCESS &&
-		wait_for_entry(this, entry))
+	reqid_bucket_t *bucket;
+	reqid_key_t key = {
+		.reqid = reqid,
+		.inbound = inbound,
+	};
+
+	this->lock->read_lock(this->lock);
+	bucket = this->reqids->get(this->reqids, &key);
+	if (!bucket || bucket->entries->get_first(bucket->entries,
+											  (void**)&entry) != SUCCESS)
 	{
-		sa = entry->sa;
+		this->lock->unlock(this->lock);
+		return NULL;
 	}
-	this->mutex->unlock(this->mutex);
-	return sa;
+	if (checkout_entry(this, entry))
+	{
+		return entry->sa;
+	}
+	return NULL;
 }
 
 METHOD(ipsec_sa_mgr_t, checkout_by_spi, ipsec_sa_t*,
 	private_ipsec_sa_mgr_t *this, u_int32_t spi, host_t *dst)
 {
 	ipsec_sa_entry_t *entry;
-	ipsec_sa_t *sa = NULL;
 
-	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_spi_dst,
-							 (void**)&entry, &spi, dst) == SUCCESS &&
-		wait_for_entry(this, entry))
+	this->lock->read_lock(this->lock);
+	entry = find_entry(this, spi, dst);
+	if (!entry)
 	{
-		sa = entry->sa;
+		this->lock->unlock(this->lock);
+		return NULL;
 	}
-	this->mutex->unlock(this->mutex);
-	return sa;
+	if (checkout_entry(this, entry))
+	{
+		return entry->sa;
+	}
+	return NULL;
 }
 
 METHOD(ipsec_sa_mgr_t, checkin, void,
@@ -598,39 +851,35 @@ METHOD(ipsec_sa_mgr_t, checkin, void,
 {
 	ipsec_sa_entry_t *entry;
 
-	this->mutex->lock(this->mutex);
-	if (this->sas->find_first(this->sas, (void*)match_entry_by_sa_ptr,
-							 (void**)&entry, sa) == SUCCESS)
+	this->lock->read_lock(this->lock);
+	entry = find_entry(this, sa->get_spi(sa), sa->get_destination(sa));
+	if (entry && entry->sa == sa)
 	{
-		if (entry->locked)
-		{
-			entry->locked = FALSE;
-			entry->condvar->signal(entry->condvar);
-		}
+		checkin_entry(entry);
 	}
-	this->mutex->unlock(this->mutex);
+	this->lock->unlock(this->lock);
 }
 
 METHOD(ipsec_sa_mgr_t, flush_sas, status_t,
 	private_ipsec_sa_mgr_t *this)
 {
-	this->mutex->lock(this->mutex);
 	flush_entries(this);
-	this->mutex->unlock(this->mutex);
 	return SUCCESS;
 }
 
 METHOD(ipsec_sa_mgr_t, destroy, void,
 	private_ipsec_sa_mgr_t *this)
 {
-	this->mutex->lock(this->mutex);
 	flush_entries(this);
+	this->mutex->lock(this->mutex);
 	flush_allocated_spis(this);
 	this->mutex->unlock(this->mutex);
 
 	this->allocated_spis->destroy(this->allocated_spis);
 	this->sas->destroy(this->sas);
+	this->reqids->destroy(this->reqids);
 
+	this->lock->destroy(this->lock);
 	this->mutex->destroy(this->mutex);
 	DESTROY_IF(this->rng);
 	free(this);
@@ -655,7 +904,11 @@ ipsec_sa_mgr_t *ipsec_sa_mgr_create()
 			.flush_sas = _flush_sas,
 			.destroy = _destroy,
 		},
-		.sas = linked_list_create(),
+		.sas = hashtable_create((hashtable_hash_t)sa_key_hash,
+								(hashtable_equals_t)sa_key_equals, 128),
+		.reqids = hashtable_create((hashtable_hash_t)reqid_key_hash,
+								   (hashtable_equals_t)reqid_key_equals, 64),
+		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.allocated_spis = hashtable_create((hashtable_hash_t)spi_hash,
 										   (hashtable_equals_t)spi_equals, 16),
@@ -196,6 +196,17 @@ struct credential_manager_t {
 	 */
 	void (*flush_cache)(credential_manager_t *this, certificate_type_t type);
 
+	/**
+	 * Get statistics about the managers local certificate cache.
+	 *
+	 * @param entries	receives the number of cached relations
+	 * @param hits		receives the number of cache hits
+	 * @param misses	receives the number of cache misses
+	 * @return			FALSE if the cache is disabled
+	 */
+	bool (*get_cache_stats)(credential_manager_t *this, u_int *entries,
+							u_int *hits, u_int *misses);
+
 	/**
 	 * Check if a given subject certificate is issued by an issuer certificate.
 	 *
@@ -15,21 +15,26 @@
 
 #include "cert_cache.h"
 
-#include <time.h>
-#include <sched.h>
-
 #include <library.h>
-#include <threading/rwlock.h>
+#include <threading/mutex.h>
+#include <collections/hashtable.h>
 #include <collections/linked_list.h>
+#include <credentials/certificates/x509.h>
+#include <credentials/certificates/crl.h>
+
+/** default number of cached relations */
+#define DEFAULT_CACHE_SIZE 1024
 
-/** cache size, a power of 2 for fast modulo */
-#define CACHE_SIZE 32
+/** default number of segments, a power of 2 for fast modulo */
+#define DEFAULT_CACHE_SEGMENTS 16
 
-/** attempts to acquire a cache lock */
-#define REPLACE_TRIES 5
+/** maximum number of segments */
+#define MAX_CACHE_SEGMENTS 256
 
 typedef struct private_cert_cache_t private_cert_cache_t;
 typedef struct relation_t relation_t;
+typedef struct segment_t segment_t;
+typedef struct bucket_t bucket_t;
 
 /**
  * A trusted relation between subject and issuer
@@ -37,7 +42,7 @@ typedef struct relation_t relation_t;
 struct relation_t {
 
 	/**
-	 * subject of this relation
+	 * subject of this relation, NULL if slot is unused
 	 */
 	certificate_t *subject;
 
@@ -52,14 +57,106 @@ struct relation_t {
 	signature_scheme_t scheme;
 
 	/**
-	 * Cache hits
+	 * Hash of subject and issuer
+	 */
+	u_int hash;
+
+	/**
+	 * Previous relation in LRU list (more recently used)
+	 */
+	relation_t *prev;
+
+	/**
+	 * Next relation in LRU list (less recently used), or in the free list
+	 */
+	relation_t *next;
+
+	/**
+	 * Index buckets the relation is stored in, as bucket_t
 	 */
-	u_int hits;
+	linked_list_t *buckets;
 
 	/**
-	 * Lock for this relation
+	 * TRUE if the relation is in the fallback list of its segment
 	 */
-	rwlock_t *lock;
+	bool fallback;
+};
+
+/**
+ * Relations stored under the same identity or key identifier of the subject
+ */
+struct bucket_t {
+
+	/**
+	 * Identity of the relations, NULL for key identifiers
+	 */
+	identification_t *id;
+
+	/**
+	 * Key identifier of the relations
+	 */
+	chunk_t keyid;
+
+	/**
+	 * Relations, as relation_t
+	 */
+	linked_list_t *relations;
+};
+
+/**
+ * A segment of the cache, with its own lock
+ */
+struct segment_t {
+
+	/**
+	 * Mutex to access this segment
+	 */
+	mutex_t *mutex;
+
+	/**
+	 * Relations in this segment, relation_t => relation_t
+	 */
+	hashtable_t *index;
+
+	/**
+	 * Relations by identity of the subject, identification_t => bucket_t
+	 */
+	hashtable_t *ids;
+
+	/**
+	 * Relations by key identifier of the subject, chunk_t => bucket_t
+	 */
+	hashtable_t *keyids;
+
+	/**
+	 * Relations to consider for any lookup, as relation_t
+	 */
+	linked_list_t *fallback;
+
+	/**
+	 * Slots for relations of this segment
+	 */
+	relation_t *relations;
+
+	/**
+	 * Most recently used relation
+	 */
+	relation_t *head;
+
+	/**
+	 * Least recently used relation, replaced if the segment is full
+	 */
+	relation_t *tail;
+
+	/**
+	 * Unused slots
+	 */
+	relation_t *free;
+
+	/**
+	 * Number of used slots
+	 */
+	u_int count;
 };
 
 /**
@@ -73,115 +170,429 @@ struct private_cert_cache_t {
 	cert_cache_t public;
 
 	/**
-	 * array of trusted subject-issuer relations
+	 * Segments of the cache
+	 */
+	segment_t *segments;
+
+	/**
+	 * Number of segments, a power of 2
+	 */
+	u_int segment_count;
+
+	/**
+	 * Number of slots in each segment
+	 */
+	u_int segment_size;
+
+	/**
+	 * Number of issued_by() calls answered from the cache
+	 */
+	refcount_t hits;
+
+	/**
+	 * Number of issued_by() calls that had to verify the signature
 	 */
-	relation_t relations[CACHE_SIZE];
+	refcount_t misses;
 };
 
 /**
- * Cache relation in a free slot/replace an other
+ * Hash the subject of a certificate
  */
-static void cache(private_cert_cache_t *this,
-				  certificate_t *subject, certificate_t *issuer,
-				  signature_scheme_t scheme)
+static u_int32_t hash_subject(certificate_t *cert, u_int32_t hash)
 {
-	relation_t *rel;
-	int i, offset, try;
-	u_int total_hits = 0;
+	identification_t *id;
+
+	id = cert->get_subject(cert);
+	if (id)
+	{
+		return chunk_hash_inc(id->get_encoding(id), hash);
+	}
+	return hash;
+}
+
+/**
+ * Hashtable hash function, the hash is precalculated
+ */
+static u_int relation_hash(relation_t *rel)
+{
+	return rel->hash;
+}
+
+/**
+ * Hashtable equals function
+ */
+static bool relation_equals(relation_t *a, relation_t *b)
+{
+	return a->issuer->equals(a->issuer, b->issuer) &&
+		   a->subject->equals(a->subject, b->subject);
+}
+
+/**
+ * Hash an identity
+ */
+static u_int id_hash(identification_t *id)
+{
+	return id->hash(id, 0);
+}
+
+/**
+ * Compare two identities, hash() only covers identities of the same type
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	return a->get_type(a) == b->get_type(b) && a->equals(a, b);
+}
+
+/**
+ * Hash a key identifier
+ */
+static u_int keyid_hash(chunk_t *keyid)
+{
+	return chunk_hash(*keyid);
+}
+
+/**
+ * Compare two key identifiers
+ */
+static bool keyid_equals(chunk_t *a, chunk_t *b)
+{
+	return chunk_equals(*a, *b);
+}
+
+/**
+ * Get the segment responsible for a hash
+ */
+static inline segment_t *get_segment(private_cert_cache_t *this, u_int hash)
+{
+	/* the hashtables use the lower bits, use higher ones to select segment */
+	return &this->segments[(hash >> 16) & (this->segment_count - 1)];
+}
+
+/**
+ * Remove a relation from the LRU list
+ */
+static void lru_unlink(segment_t *segment, relation_t *rel)
+{
+	if (rel->prev)
+	{
+		rel->prev->next = rel->next;
+	}
+	else
+	{
+		segment->head = rel->next;
+	}
+	if (rel->next)
+	{
+		rel->next->prev = rel->prev;
+	}
+	else
+	{
+		segment->tail = rel->prev;
+	}
+	rel->prev = rel->next = NULL;
+}
+
+/**
+ * Insert a relation as the most recently used to the LRU list
+ */
+static void lru_push(segment_t *segment, relation_t *rel)
+{
+	rel->prev = NULL;
+	rel->next = segment->head;
+	if (segment->head)
+	{
+		segment->head->prev = rel;
+	}
+	else
+	{
+		segment->tail = rel;
+	}
+	segment->head = rel;
+}
+
+/**
+ * Make a relation available for any lookup
+ */
+static void index_fallback(segment_t *segment, relation_t *rel)
+{
+	if (!rel->fallback)
+	{
+		segment->fallback->insert_last(segment->fallback, rel);
+		rel->fallback = TRUE;
+	}
+}
+
+/**
+ * Add a relation to an index bucket, if it is not already in it
+ */
+static void index_bucket(relation_t *rel, bucket_t *bucket)
+{
+	if (rel->buckets->find_first(rel->buckets, NULL,
+								 (void**)&bucket) != SUCCESS)
+	{
+		bucket->relations->insert_last(bucket->relations, rel);
+		rel->buckets->insert_last(rel->buckets, bucket);
+	}
+}
+
+/**
+ * Make a relation available by an identity of its subject
+ */
+static void index_id(segment_t *segment, relation_t *rel,
+					 identification_t *id)
+{
+	bucket_t *bucket;
+
+	if (id->contains_wildcards(id))
+	{
+		index_fallback(segment, rel);
+		return;
+	}
+	bucket = segment->ids->get(segment->ids, id);
+	if (!bucket)
+	{
+		INIT(bucket,
+			.id = id->clone(id),
+			.relations = linked_list_create(),
+		);
+		segment->ids->put(segment->ids, bucket->id, bucket);
+	}
+	index_bucket(rel, bucket);
+}
+
+/**
+ * Make a relation available by a key identifier of its subject
+ */
+static void index_keyid(segment_t *segment, relation_t *rel, chunk_t keyid)
+{
+	bucket_t *bucket;
 
-	/* check for a unused relation slot first */
-	for (i = 0; i < CACHE_SIZE; i++)
+	if (!keyid.len)
 	{
-		rel = &this->relations[i];
+		return;
+	}
+	bucket = segment->keyids->get(segment->keyids, &keyid);
+	if (!bucket)
+	{
+		INIT(bucket,
+			.keyid = chunk_clone(keyid),
+			.relations = linked_list_create(),
+		);
+		segment->keyids->put(segment->keyids, &bucket->keyid, bucket);
+	}
+	index_bucket(rel, bucket);
+}
 
-		if (!rel->subject && rel->lock->try_write_lock(rel->lock))
+/**
+ * Index an X.509 certificate by the identities has_subject() matches
+ */
+static void index_x509(segment_t *segment, relation_t *rel, x509_t *x509)
+{
+	certificate_t *cert = &x509->interface;
+	identification_t *id;
+	enumerator_t *enumerator;
+	public_key_t *public;
+	hasher_t *hasher;
+	cred_encoding_type_t type;
+	chunk_t chunk, hash;
+
+	index_id(segment, rel, cert->get_subject(cert));
+	enumerator = x509->create_subjectAltName_enumerator(x509);
+	while (enumerator->enumerate(enumerator, &id))
+	{
+		index_id(segment, rel, id);
+	}
+	enumerator->destroy(enumerator);
+
+	public = cert->get_public_key(cert);
+	if (public)
+	{
+		for (type = 0; type < KEYID_MAX; type++)
 		{
-			/* double-check having lock */
-			if (!rel->subject)
+			if (public->get_fingerprint(public, type, &chunk))
 			{
-				rel->subject = subject->get_ref(subject);
-				rel->issuer = issuer->get_ref(issuer);
-				rel->scheme = scheme;
-				return rel->lock->unlock(rel->lock);
+				index_keyid(segment, rel, chunk);
 			}
-			rel->lock->unlock(rel->lock);
 		}
-		total_hits += rel->hits;
+		public->destroy(public);
 	}
-	/* run several attempts to replace a random slot, never block. */
-	for (try = 0; try < REPLACE_TRIES; try++)
+	index_keyid(segment, rel, x509->get_subjectKeyIdentifier(x509));
+	index_keyid(segment, rel, x509->get_serial(x509));
+
+	hasher = lib->crypto->create_hasher(lib->crypto, HASH_SHA1);
+	if (hasher && cert->get_encoding(cert, CERT_ASN1_DER, &chunk))
 	{
-		/* replace a random relation */
-		offset = random();
-		for (i = 0; i < CACHE_SIZE; i++)
+		if (hasher->allocate_hash(hasher, chunk, &hash))
+		{
+			index_keyid(segment, rel, hash);
+			free(hash.ptr);
+		}
+		else
 		{
-			rel = &this->relations[(i + offset) % CACHE_SIZE];
+			index_fallback(segment, rel);
+		}
+		free(chunk.ptr);
+	}
+	else
+	{	/* can't index by the hash of the encoding */
+		index_fallback(segment, rel);
+	}
+	DESTROY_IF(hasher);
+}
 
-			if (rel->hits > total_hits / CACHE_SIZE)
-			{	/* skip often used slots */
-				continue;
-			}
-			if (rel->lock->try_write_lock(rel->lock))
-			{
-				if (rel->subject)
-				{
-					rel->subject->destroy(rel->subject);
-					rel->issuer->destroy(rel->issuer);
-				}
-				rel->subject = subject->get_ref(subject);
-				rel->issuer = issuer->get_ref(issuer);
-				rel->scheme = scheme;
-				rel->hits = 0;
-				return rel->lock->unlock(rel->lock);
-			}
+/**
+ * Index a relation by the identities and key identifiers of its subject
+ */
+static void index_relation(segment_t *segment, relation_t *rel)
+{
+	certificate_t *subject = rel->subject;
+	crl_t *crl;
+
+	switch (subject->get_type(subject))
+	{
+		case CERT_X509:
+			index_x509(segment, rel, (x509_t*)subject);
+			break;
+		case CERT_X509_CRL:
+			/* has_subject() and has_issuer() both match the issuer */
+			crl = (crl_t*)subject;
+			index_id(segment, rel, subject->get_issuer(subject));
+			index_keyid(segment, rel, crl->get_authKeyIdentifier(crl));
+			break;
+		default:
+			/* we don't know what other certificates match */
+			index_fallback(segment, rel);
+			break;
+	}
+}
+
+/**
+ * Remove a relation from the index of a segment
+ */
+static void unindex_relation(segment_t *segment, relation_t *rel)
+{
+	bucket_t *bucket;
+
+	while (rel->buckets->remove_last(rel->buckets,
+									 (void**)&bucket) == SUCCESS)
+	{
+		bucket->relations->remove(bucket->relations, rel, NULL);
+		if (bucket->relations->get_count(bucket->relations))
+		{
+			continue;
+		}
+		if (bucket->id)
+		{
+			segment->ids->remove(segment->ids, bucket->id);
+			bucket->id->destroy(bucket->id);
 		}
-		/* give other threads a chance to release locks */
-		sched_yield();
+		else
+		{
+			segment->keyids->remove(segment->keyids, &bucket->keyid);
+			chunk_free(&bucket->keyid);
+		}
+		bucket->relations->destroy(bucket->relations);
+		free(bucket);
+	}
+	if (rel->fallback)
+	{
+		segment->fallback->remove(segment->fallback, rel, NULL);
+		rel->fallback = FALSE;
+	}
+}
+
+/**
+ * Remove a relation from a segment and release its slot
+ */
+static void remove_relation(segment_t *segment, relation_t *rel)
+{
+	segment->index->remove(segment->index, rel);
+	unindex_relation(segment, rel);
+	lru_unlink(segment, rel);
+	rel->subject->destroy(rel->subject);
+	rel->issuer->destroy(rel->issuer);
+	rel->subject = NULL;
+	rel->issuer = NULL;
+	rel->next = segment->free;
+	segment->free = rel;
+	segment->count--;
+}
+
+/**
+ * Cache relation in a free slot, or replace the least recently used one
+ */
+static void cache(private_cert_cache_t *this, relation_t *lookup,
+				  signature_scheme_t scheme)
+{
+	segment_t *segment;
+	relation_t *rel;
+
+	segment = get_segment(this, lookup->hash);
+	segment->mutex->lock(segment->mutex);
+	if (segment->index->get(segment->index, lookup))
+	{	/* cached concurrently by another thread */
+		segment->mutex->unlock(segment->mutex);
+		return;
+	}
+	if (!segment->free)
+	{
+		remove_relation(segment, segment->tail);
 	}
+	rel = segment->free;
+	segment->free = rel->next;
+	rel->subject = lookup->subject->get_ref(lookup->subject);
+	rel->issuer = lookup->issuer->get_ref(lookup->issuer);
+	rel->scheme = scheme;
+	rel->hash = lookup->hash;
+	segment->index->put(segment->index, rel, rel);
+	index_relation(segment, rel);
+	lru_push(segment, rel);
+	segment->count++;
+	segment->mutex->unlock(segment->mutex);
 }
 
 METHOD(cert_cache_t, issued_by, bool,
 	private_cert_cache_t *this, certificate_t *subject, certificate_t *issuer,
 	signature_scheme_t *schemep)
 {
-	relation_t *found = NULL, *current;
+	relation_t *found, lookup = {
+		.subject = subject,
+		.issuer = issuer,
+	};
 	signature_scheme_t scheme;
-	int i;
+	segment_t *segment;
 
-	for (i = 0; i < CACHE_SIZE; i++)
-	{
-		current = &this->relations[i];
+	lookup.hash = hash_subject(issuer, hash_subject(subject, 0));
+	segment = get_segment(this, lookup.hash);
 
-		current->lock->read_lock(current->lock);
-		if (current->subject)
+	segment->mutex->lock(segment->mutex);
+	found = segment->index->get(segment->index, &lookup);
+	if (found)
+	{
+		if (segment->head != found)
 		{
-			/* check for equal issuer */
-			if (issuer->equals(issuer, current->issuer))
-			{
-				/* reuse issuer instance in cache() */
-				issuer = current->issuer;
-				if (subject->equals(subject, current->subject))
-				{
-					/* write hit counter is not locked, but not critical */
-					current->hits++;
-					found = current;;
-					if (schemep)
-					{
-						*schemep = current->scheme;
-					}
-				}
-			}
+			lru_unlink(segment, found);
+			lru_push(segment, found);
 		}
-		current->lock->unlock(current->lock);
-		if (found)
+		scheme = found->scheme;
+	}
+	segment->mutex->unlock(segment->mutex);
+
+	if (found)
+	{
+		ref_get(&this->hits);
+		if (schemep)
 		{
-			return TRUE;
+			*schemep = scheme;
 		}
+		return TRUE;
 	}
+	ref_get(&this->misses);
+
 	/* no cache hit, check and cache signature */
 	if (subject->issued_by(subject, issuer, &scheme))
 	{
-		cache(this, subject, issuer, scheme);
+		cache(this, &lookup, scheme);
 		if (schemep)
 		{
 			*schemep = scheme;
@@ -192,179 +603,259 @@ METHOD(cert_cache_t, issued_by, bool,
 }
 
 /**
- * certificate enumerator implemenation
+ * Parameters of a certificate lookup
  */
 typedef struct {
-	/** implements enumerator_t interface */
-	enumerator_t public;
 	/** type of requested certificate */
 	certificate_type_t cert;
 	/** type of requested key */
 	key_type_t key;
 	/** ID to get a cert for */
 	identification_t *id;
-	/** cache */
-	relation_t *relations;
-	/** current position in array cache */
-	int index;
-	/** currently locked relation */
-	int locked;
-} cert_enumerator_t;
+} cert_lookup_t;
 
 /**
- * filter function for certs enumerator
+ * Check if the subject of a relation matches the lookup
  */
-static bool cert_enumerate(cert_enumerator_t *this, certificate_t **out)
+static bool cert_matches(cert_lookup_t *this, certificate_t *subject)
 {
 	public_key_t *public;
-	relation_t *rel;
+	bool match = FALSE;
 
-	if (this->locked >= 0)
+	/* CRL lookup is done using issuer/authkeyidentifier */
+	if (this->key == KEY_ANY && this->id &&
+		(this->cert == CERT_ANY || this->cert == CERT_X509_CRL) &&
+		subject->get_type(subject) == CERT_X509_CRL &&
+		subject->has_issuer(subject, this->id))
 	{
-		rel = &this->relations[this->locked];
-		rel->lock->unlock(rel->lock);
-		this->locked = -1;
+		return TRUE;
+	}
+	if ((this->cert == CERT_ANY ||
+		 subject->get_type(subject) == this->cert) &&
+		(!this->id || subject->has_subject(subject, this->id)))
+	{
+		if (this->key == KEY_ANY)
+		{
+			return TRUE;
+		}
+		public = subject->get_public_key(subject);
+		if (public)
+		{
+			match = public->get_type(public) == this->key;
+			public->destroy(public);
+		}
 	}
+	return match;
+}
+
+/**
+ * Add the subjects of the matching relations in a list to certs
+ */
+static void collect_list(cert_lookup_t *lookup, linked_list_t *relations,
+						 linked_list_t *seen, linked_list_t *certs)
+{
+	enumerator_t *enumerator;
+	relation_t *rel;
 
-	while (++this->index < CACHE_SIZE)
+	enumerator = relations->create_enumerator(relations);
+	while (enumerator->enumerate(enumerator, &rel))
 	{
-		rel = &this->relations[this->index];
-		rel->lock->read_lock(rel->lock);
-		this->locked = this->index;
-		if (rel->subject)
+		if (seen->find_first(seen, NULL, (void**)&rel) == SUCCESS)
+		{	/* stored under multiple identities and key identifiers */
+			continue;
+		}
+		seen->insert_last(seen, rel);
+		if (cert_matches(lookup, rel->subject))
 		{
-			/* CRL lookup is done using issuer/authkeyidentifier */
-			if (this->key == KEY_ANY && this->id &&
-				(this->cert == CERT_ANY || this->cert == CERT_X509_CRL) &&
-				rel->subject->get_type(rel->subject) == CERT_X509_CRL &&
-				rel->subject->has_issuer(rel->subject, this->id))
-			{
-				*out = rel->subject;
-				return TRUE;
-			}
-			if ((this->cert == CERT_ANY ||
-				 rel->subject->get_type(rel->subject) == this->cert) &&
-				(!this->id || rel->subject->has_subject(rel->subject, this->id)))
-			{
-				if (this->key == KEY_ANY)
-				{
-					*out = rel->subject;
-					return TRUE;
-				}
-				public = rel->subject->get_public_key(rel->subject);
-				if (public)
-				{
-					if (public->get_type(public) == this->key)
-					{
-						public->destroy(public);
-						*out = rel->subject;
-						return TRUE;
-					}
-					public->destroy(public);
-				}
-			}
+			certs->insert_last(certs, rel->subject->get_ref(rel->subject));
 		}
-		this->locked = -1;
-		rel->lock->unlock(rel->lock);
 	}
-	return FALSE;
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Add the subjects of the matching relations in a segment to certs, using the
+ * index of the segment
+ */
+static void collect_indexed(cert_lookup_t *lookup, segment_t *segment,
+							linked_list_t *certs)
+{
+	linked_list_t *seen;
+	bucket_t *bucket;
+	chunk_t keyid;
+
+	seen = linked_list_create();
+	collect_list(lookup, segment->fallback, seen, certs);
+	bucket = segment->ids->get(segment->ids, lookup->id);
+	if (bucket)
+	{
+		collect_list(lookup, bucket->relations, seen, certs);
+	}
+	keyid = lookup->id->get_encoding(lookup->id);
+	bucket = segment->keyids->get(segment->keyids, &keyid);
+	if (bucket)
+	{
+		collect_list(lookup, bucket->relations, seen, certs);
+	}
+	seen->destroy(seen);
 }
 
 /**
- * clean up enumeration data
+ * Add the subjects of all matching relations in a segment to certs
  */
-static void cert_enumerator_destroy(cert_enumerator_t *this)
+static void collect_all(cert_lookup_t *lookup, segment_t *segment,
+						u_int size, linked_list_t *certs)
 {
 	relation_t *rel;
+	int i;
 
-	if (this->locked >= 0)
+	for (i = 0; i < size && segment->count; i++)
 	{
-		rel = &this->relations[this->locked];
-		rel->lock->unlock(rel->lock);
+		rel = &segment->relations[i];
+		if (rel->subject && cert_matches(lookup, rel->subject))
+		{
+			certs->insert_last(certs, rel->subject->get_ref(rel->subject));
+		}
 	}
-	free(this);
+}
+
+/**
+ * Destroy the list of certificates returned by the enumerator
+ */
+static void certs_destroy(linked_list_t *certs)
+{
+	certs->destroy_offset(certs, offsetof(certificate_t, destroy));
 }
 
 METHOD(credential_set_t, create_enumerator, enumerator_t*,
 	private_cert_cache_t *this, certificate_type_t cert, key_type_t key,
 	identification_t *id, bool trusted)
 {
-	cert_enumerator_t *enumerator;
+	cert_lookup_t lookup = {
+		.cert = cert,
+		.key = key,
+		.id = id,
+	};
+	segment_t *segment;
+	linked_list_t *certs;
+	bool indexed;
+	int i;
 
 	if (trusted)
 	{
 		return NULL;
 	}
-	enumerator = malloc_thing(cert_enumerator_t);
-	enumerator->public.enumerate = (void*)cert_enumerate;
-	enumerator->public.destroy = (void*)cert_enumerator_destroy;
-	enumerator->cert = cert;
-	enumerator->key = key;
-	enumerator->id = id;
-	enumerator->relations = this->relations;
-	enumerator->index = -1;
-	enumerator->locked = -1;
-
-	return &enumerator->public;
+	/* wildcard lookups might match any relation */
+	indexed = id && !id->contains_wildcards(id);
+
+	/* the matching subjects are collected, so the segments are not kept
+	 * locked while the caller uses them */
+	certs = linked_list_create();
+	for (i = 0; i < this->segment_count; i++)
+	{
+		segment = &this->segments[i];
+		segment->mutex->lock(segment->mutex);
+		if (indexed)
+		{
+			collect_indexed(&lookup, segment, certs);
+		}
+		else
+		{
+			collect_all(&lookup, segment, this->segment_size, certs);
+		}
+		segment->mutex->unlock(segment->mutex);
+	}
+	return enumerator_create_cleaner(certs->create_enumerator(certs),
+									 (void*)certs_destroy, certs);
 }
 
 METHOD(cert_cache_t, flush, void,
 	private_cert_cache_t *this, certificate_type_t type)
 {
+	segment_t *segment;
 	relation_t *rel;
-	int i;
+	int i, j;
 
-	for (i = 0; i < CACHE_SIZE; i++)
+	for (i = 0; i < this->segment_count; i++)
 	{
-		rel = &this->relations[i];
-		if (!rel->subject)
-		{
-			continue;
-		}
-		/* check with cheap read lock first */
-		if (type != CERT_ANY)
+		segment = &this->segments[i];
+		segment->mutex->lock(segment->mutex);
+		for (j = 0; j < this->segment_size && segment->count; j++)
 		{
-			rel->lock->read_lock(rel->lock);
-			if (!rel->subject || type != rel->subject->get_type(rel->subject))
+			rel = &segment->relations[j];
+			if (!rel->subject)
 			{
-				rel->lock->unlock(rel->lock);
 				continue;
 			}
-			rel->lock->unlock(rel->lock);
-		}
-		/* double check in write lock */
-		rel->lock->write_lock(rel->lock);
-		if (rel->subject)
-		{
-			if (type == CERT_ANY || type == rel->subject->get_type(rel->subject))
+			/* relations depending on a reloaded issuer are flushed, too */
+			if (type == CERT_ANY ||
+				type == rel->subject->get_type(rel->subject) ||
+				type == rel->issuer->get_type(rel->issuer))
 			{
-				rel->subject->destroy(rel->subject);
-				rel->issuer->destroy(rel->issuer);
-				rel->subject = NULL;
-				rel->issuer = NULL;
-				rel->hits = 0;
+				remove_relation(segment, rel);
 			}
 		}
-		rel->lock->unlock(rel->lock);
+		segment->mutex->unlock(segment->mutex);
+	}
+}
+
+METHOD(cert_cache_t, get_stats, void,
+	private_cert_cache_t *this, u_int *entries, u_int *hits, u_int *misses)
+{
+	segment_t *segment;
+	u_int count = 0;
+	int i;
+
+	for (i = 0; i < this->segment_count; i++)
+	{
+		segment = &this->segments[i];
+		segment->mutex->lock(segment->mutex);
+		count += segment->count;
+		segment->mutex->unlock(segment->mutex);
+	}
+	if (entries)
+	{
+		*entries = count;
+	}
+	if (hits)
+	{
+		*hits = this->hits;
+	}
+	if (misses)
+	{
+		*misses = this->misses;
 	}
 }
 
 METHOD(cert_cache_t, destroy, void,
 	private_cert_cache_t *this)
 {
+	segment_t *segment;
 	relation_t *rel;
-	int i;
+	int i, j;
 
-	for (i = 0; i < CACHE_SIZE; i++)
+	for (i = 0; i < this->segment_count; i++)
 	{
-		rel = &this->relations[i];
-		if (rel->subject)
+		segment = &this->segments[i];
+		for (j = 0; j < this->segment_size; j++)
 		{
-			rel->subject->destroy(rel->subject);
-			rel->issuer->destroy(rel->issuer);
+			rel = &segment->relations[j];
+			if (rel->subject)
+			{
+				unindex_relation(segment, rel);
+				rel->subject->destroy(rel->subject);
+				rel->issuer->destroy(rel->issuer);
+			}
+			rel->buckets->destroy(rel->buckets);
 		}
-		rel->lock->destroy(rel->lock);
+		segment->index->destroy(segment->index);
+		segment->ids->destroy(segment->ids);
+		segment->keyids->destroy(segment->keyids);
+		segment->fallback->destroy(segment->fallback);
+		segment->mutex->destroy(segment->mutex);
+		free(segment->relations);
 	}
+	free(this->segments);
 	free(this);
 }
 
@@ -374,7 +865,9 @@ METHOD(cert_cache_t, destroy, void,
 cert_cache_t *cert_cache_create()
 {
 	private_cert_cache_t *this;
-	int i;
+	segment_t *segment;
+	u_int size, segments;
+	int i, j;
 
 	INIT(this,
 		.public = {
@@ -387,16 +880,48 @@ cert_cache_t *cert_cache_create()
 			},
 			.issued_by = _issued_by,
 			.flush = _flush,
+			.get_stats = _get_stats,
 			.destroy = _destroy,
 		},
 	);
 
-	for (i = 0; i < CACHE_SIZE; i++)
+	size = lib->settings->get_int(lib->settings,
+						"libstrongswan.cert_cache_size", DEFAULT_CACHE_SIZE);
+	segments = lib->settings->get_int(lib->settings,
+						"libstrongswan.cert_cache_segments",
+						DEFAULT_CACHE_SEGMENTS);
+	segments = max(1, min(segments, MAX_CACHE_SEGMENTS));
+	/* round up to the next power of 2 */
+	this->segment_count = 1;
+	while (this->segment_count < segments)
 	{
-		this->relations[i].subject = NULL;
-		this->relations[i].issuer = NULL;
-		this->relations[i].hits = 0;
-		this->relations[i].lock = rwlock_create(RWLOCK_TYPE_DEFAULT);
+		this->segment_count <<= 1;
+	}
+	this->segment_size = max(1, (size + this->segment_count - 1) /
+								 this->segment_count);
+
+	this->segments = calloc(this->segment_count, sizeof(segment_t));
+	for (i = 0; i < this->segment_count; i++)
+	{
+		segment = &this->segments[i];
+		segment->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+		segment->index = hashtable_create((hashtable_hash_t)relation_hash,
+										  (hashtable_equals_t)relation_equals,
+										  this->segment_size);
+		segment->ids = hashtable_create((hashtable_hash_t)id_hash,
+										(hashtable_equals_t)id_equals,
+										this->segment_size);
+		segment->keyids = hashtable_create((hashtable_hash_t)keyid_hash,
+										   (hashtable_equals_t)keyid_equals,
+										   this->segment_size);
+		segment->fallback = linked_list_create();
+		segment->relations = calloc(this->segment_size, sizeof(relation_t));
+		for (j = this->segment_size - 1; j >= 0; j--)
+		{
+			segment->relations[j].buckets = linked_list_create();
+			segment->relations[j].next = segment->free;
+			segment->free = &segment->relations[j];
+		}
 	}
 
 	return &this->public;
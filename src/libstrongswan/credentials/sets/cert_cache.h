@@ -28,10 +28,12 @@ typedef struct cert_cache_t cert_cache_t;
 /**
  * Certificate signature verification and certificate cache.
  *
- * This cache serves all certificates seen in its issued_by method
- * and serves them as untrusted through the credential set interface. Further,
- * it caches valid subject-issuer relationships to speed up the issued_by
- * method.
+ * This cache caches valid subject-issuer relationships to speed up the
+ * issued_by method. Relations are stored in a segmented hashtable, the least
+ * recently used relation of a segment gets replaced if it is full. Subject
+ * certificates seen in its issued_by method are served as untrusted through
+ * the credential set interface. Each segment indexes them by their identities
+ * and key identifiers, so only lookups with wildcards check all relations.
  */
 struct cert_cache_t {
 
@@ -59,6 +61,16 @@ struct cert_cache_t {
 	 */
 	void (*flush)(cert_cache_t *this, certificate_type_t type);
 
+	/**
+	 * Get statistics about the cache.
+	 *
+	 * @param entries		receives the number of cached relations, if given
+	 * @param hits			receives the number of cache hits, if given
+	 * @param misses		receives the number of cache misses, if given
+	 */
+	void (*get_stats)(cert_cache_t *this, u_int *entries, u_int *hits,
+					  u_int *misses);
+
 	/**
 	 * Destroy a cert_cache instance.
 	 */
@@ -67,6 +79,9 @@ struct cert_cache_t {
 
 /**
  * Create a cert_cache instance.
+ *
+ * The size is configured with libstrongswan.cert_cache_size and
+ * libstrongswan.cert_cache_segments.
  */
 cert_cache_t *cert_cache_create();
 
@@ -19,8 +19,11 @@
 
 #include <threading/rwlock.h>
 #include <collections/linked_list.h>
+#include <collections/hashtable.h>
+#include <credentials/certificates/x509.h>
 
 typedef struct private_mem_cred_t private_mem_cred_t;
+typedef struct cred_index_t cred_index_t;
 
 /**
  * Private data of an mem_cred_t object.
@@ -42,27 +45,532 @@ struct private_mem_cred_t {
 	 */
 	linked_list_t *trusted;
 
+	/**
+	 * Index over trusted certificates
+	 */
+	cred_index_t *trusted_index;
+
 	/**
 	 * List of trusted and untrusted certificates, certificate_t
 	 */
 	linked_list_t *untrusted;
 
+	/**
+	 * Index over trusted and untrusted certificates
+	 */
+	cred_index_t *untrusted_index;
+
 	/**
 	 * List of private keys, private_key_t
 	 */
 	linked_list_t *keys;
 
+	/**
+	 * Index over private keys
+	 */
+	cred_index_t *keys_index;
+
 	/**
 	 * List of shared keys, as shared_entry_t
 	 */
 	linked_list_t *shared;
 
+	/**
+	 * Index over shared keys, by owner
+	 */
+	cred_index_t *shared_index;
+
 	/**
 	 * List of CDPs, as cdp_t
 	 */
 	linked_list_t *cdps;
 };
 
+/**
+ * Index over the credentials stored in a list, by identity and key identifier
+ */
+struct cred_index_t {
+
+	/**
+	 * Buckets by identity, identification_t => index_bucket_t
+	 */
+	hashtable_t *ids;
+
+	/**
+	 * Buckets by key identifier, chunk_t => index_bucket_t
+	 */
+	hashtable_t *keyids;
+
+	/**
+	 * Items to consider for any lookup (wildcards etc.), as index_item_t
+	 */
+	linked_list_t *fallback;
+
+	/**
+	 * All indexed items, as index_item_t
+	 */
+	linked_list_t *items;
+
+	/**
+	 * Positions of the items inserted first/last in the list
+	 */
+	int first, last;
+};
+
+/**
+ * Indexed credential
+ */
+typedef struct {
+	/** certificate_t, private_key_t or shared_entry_t */
+	void *cred;
+	/** position in the indexed list, higher values come first */
+	int pos;
+} index_item_t;
+
+/**
+ * Items stored under the same identity or key identifier
+ */
+typedef struct {
+	/** identity of the items */
+	identification_t *id;
+	/** key identifier of the items */
+	chunk_t keyid;
+	/** items, as index_item_t */
+	linked_list_t *items;
+} index_bucket_t;
+
+/**
+ * Hash an identity
+ */
+static u_int id_hash(identification_t *id)
+{
+	return id->hash(id, 0);
+}
+
+/**
+ * Compare two identities, hash() only covers identities of the same type
+ */
+static bool id_equals(identification_t *a, identification_t *b)
+{
+	return a->get_type(a) == b->get_type(b) && a->equals(a, b);
+}
+
+/**
+ * Hash a key identifier
+ */
+static u_int keyid_hash(chunk_t *keyid)
+{
+	return chunk_hash(*keyid);
+}
+
+/**
+ * Compare two key identifiers
+ */
+static bool keyid_equals(chunk_t *a, chunk_t *b)
+{
+	return chunk_equals(*a, *b);
+}
+
+/**
+ * Create an empty index
+ */
+static cred_index_t *index_create()
+{
+	cred_index_t *index;
+
+	INIT(index,
+		.ids = hashtable_create((hashtable_hash_t)id_hash,
+								(hashtable_equals_t)id_equals, 8),
+		.keyids = hashtable_create((hashtable_hash_t)keyid_hash,
+								   (hashtable_equals_t)keyid_equals, 8),
+		.fallback = linked_list_create(),
+		.items = linked_list_create(),
+	);
+	return index;
+}
+
+/**
+ * Destroy an index bucket
+ */
+static void index_bucket_destroy(index_bucket_t *bucket)
+{
+	DESTROY_IF(bucket->id);
+	chunk_free(&bucket->keyid);
+	bucket->items->destroy(bucket->items);
+	free(bucket);
+}
+
+/**
+ * Destroy an index, but not the indexed credentials
+ */
+static void index_destroy(cred_index_t *index)
+{
+	enumerator_t *enumerator;
+	index_bucket_t *bucket;
+
+	enumerator = index->ids->create_enumerator(index->ids);
+	while (enumerator->enumerate(enumerator, NULL, &bucket))
+	{
+		index_bucket_destroy(bucket);
+	}
+	enumerator->destroy(enumerator);
+	enumerator = index->keyids->create_enumerator(index->keyids);
+	while (enumerator->enumerate(enumerator, NULL, &bucket))
+	{
+		index_bucket_destroy(bucket);
+	}
+	enumerator->destroy(enumerator);
+	index->ids->destroy(index->ids);
+	index->keyids->destroy(index->keyids);
+	index->fallback->destroy(index->fallback);
+	index->items->destroy_function(index->items, free);
+	free(index);
+}
+
+/**
+ * Add a credential to the index, inserted first or last into its list
+ */
+static index_item_t *index_add(cred_index_t *index, void *cred, bool first)
+{
+	index_item_t *item;
+
+	INIT(item,
+		.cred = cred,
+		.pos = first ? ++index->first : index->last--,
+	);
+	index->items->insert_last(index->items, item);
+	return item;
+}
+
+/**
+ * Add an item to a list, unless it has just been added
+ */
+static void add_item(linked_list_t *items, index_item_t *item)
+{
+	index_item_t *last;
+
+	if (items->get_last(items, (void**)&last) != SUCCESS || last != item)
+	{
+		items->insert_last(items, item);
+	}
+}
+
+/**
+ * Consider an item for any lookup
+ */
+static void index_fallback(cred_index_t *index, index_item_t *item)
+{
+	add_item(index->fallback, item);
+}
+
+/**
+ * Make an item available by identity
+ */
+static void index_id(cred_index_t *index, index_item_t *item,
+					 identification_t *id)
+{
+	index_bucket_t *bucket;
+
+	if (id->contains_wildcards(id))
+	{
+		index_fallback(index, item);
+		return;
+	}
+	bucket = index->ids->get(index->ids, id);
+	if (!bucket)
+	{
+		INIT(bucket,
+			.id = id->clone(id),
+			.items = linked_list_create(),
+		);
+		index->ids->put(index->ids, bucket->id, bucket);
+	}
+	add_item(bucket->items, item);
+}
+
+/**
+ * Make an item available by key identifier
+ */
+static void index_keyid(cred_index_t *index, index_item_t *item, chunk_t keyid)
+{
+	index_bucket_t *bucket;
+
+	if (!keyid.len)
+	{
+		return;
+	}
+	bucket = index->keyids->get(index->keyids, &keyid);
+	if (!bucket)
+	{
+		INIT(bucket,
+			.keyid = chunk_clone(keyid),
+			.items = linked_list_create(),
+		);
+		index->keyids->put(index->keyids, &bucket->keyid, bucket);
+	}
+	add_item(bucket->items, item);
+}
+
+/**
+ * Remove a credential from the index, which must only be in the fallback list
+ */
+static void index_remove(cred_index_t *index, void *cred)
+{
+	enumerator_t *enumerator;
+	index_item_t *item;
+
+	enumerator = index->items->create_enumerator(index->items);
+	while (enumerator->enumerate(enumerator, &item))
+	{
+		if (item->cred == cred)
+		{
+			index->items->remove_at(index->items, enumerator);
+			index->fallback->remove(index->fallback, item, NULL);
+			free(item);
+			break;
+		}
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Maximum number of item lists index_sources() adds
+ */
+#define MAX_SOURCES 2
+
+/**
+ * Get the item lists of an index that contain the credentials that might
+ * match the given identity, by identity or by key identifier
+ */
+static void index_sources(cred_index_t *index, identification_t *id,
+						  linked_list_t **sources, int *count)
+{
+	index_bucket_t *bucket;
+	chunk_t keyid;
+
+	if (index->ids->get_count(index->ids))
+	{
+		bucket = index->ids->get(index->ids, id);
+		if (bucket)
+		{
+			sources[(*count)++] = bucket->items;
+		}
+	}
+	if (index->keyids->get_count(index->keyids))
+	{
+		keyid = id->get_encoding(id);
+		bucket = index->keyids->get(index->keyids, &keyid);
+		if (bucket)
+		{
+			sources[(*count)++] = bucket->items;
+		}
+	}
+}
+
+/**
+ * Copy the items of the given lists to an array
+ */
+static index_item_t **get_items(linked_list_t **sources, int count, int *len)
+{
+	enumerator_t *enumerator;
+	index_item_t **array, *item;
+	int i, max = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		max += sources[i]->get_count(sources[i]);
+	}
+	array = malloc(sizeof(index_item_t*) * (max + 1));
+	*len = 0;
+	for (i = 0; i < count; i++)
+	{
+		enumerator = sources[i]->create_enumerator(sources[i]);
+		while (enumerator->enumerate(enumerator, &item))
+		{
+			array[(*len)++] = item;
+		}
+		enumerator->destroy(enumerator);
+	}
+	return array;
+}
+
+/**
+ * Sort items by their position in the indexed list
+ */
+static int item_cmp(const void *a, const void *b)
+{
+	const index_item_t *item_a = *(const index_item_t**)a;
+	const index_item_t *item_b = *(const index_item_t**)b;
+
+	return item_b->pos - item_a->pos;
+}
+
+/**
+ * Sort items by address
+ */
+static int item_ptr_cmp(const void *a, const void *b)
+{
+	uintptr_t item_a = *(const uintptr_t*)a;
+	uintptr_t item_b = *(const uintptr_t*)b;
+
+	return item_a < item_b ? -1 : item_a > item_b;
+}
+
+/**
+ * Create a list of the credentials in the given item lists, in the order of
+ * the indexed list.  Credentials that are also in one of the excluded lists
+ * are skipped.
+ */
+static linked_list_t *index_collect(linked_list_t **sources, int count,
+									linked_list_t **exclude, int excount)
+{
+	index_item_t **array, **excluded;
+	linked_list_t *creds;
+	int i, len, exlen;
+
+	array = get_items(sources, count, &len);
+	excluded = get_items(exclude, excount, &exlen);
+	qsort(array, len, sizeof(index_item_t*), item_cmp);
+	qsort(excluded, exlen, sizeof(index_item_t*), item_ptr_cmp);
+
+	creds = linked_list_create();
+	for (i = 0; i < len; i++)
+	{
+		if (i > 0 && array[i] == array[i - 1])
+		{
+			continue;
+		}
+		if (exlen && bsearch(&array[i], excluded, exlen, sizeof(index_item_t*),
+							 item_ptr_cmp))
+		{
+			continue;
+		}
+		creds->insert_last(creds, array[i]->cred);
+	}
+	free(excluded);
+	free(array);
+	return creds;
+}
+
+/**
+ * Create an enumerator over a list of credentials, destroying the list
+ */
+static enumerator_t *create_list_enumerator(linked_list_t *creds)
+{
+	return enumerator_create_cleaner(creds->create_enumerator(creds),
+									 (void*)creds->destroy, creds);
+}
+
+/**
+ * Create an enumerator over the credentials of an index that might match the
+ * given identity, in the order of the indexed list
+ */
+static enumerator_t *index_create_enumerator(cred_index_t *index,
+											 identification_t *id)
+{
+	linked_list_t *sources[MAX_SOURCES + 1];
+	int count = 0;
+
+	sources[count++] = index->fallback;
+	index_sources(index, id, sources, &count);
+	return create_list_enumerator(index_collect(sources, count, NULL, 0));
+}
+
+/**
+ * Index a certificate, inserted first into its list
+ */
+static void index_cert(cred_index_t *index, certificate_t *cert)
+{
+	index_item_t *item;
+	identification_t *id;
+	enumerator_t *enumerator;
+	public_key_t *public;
+	hasher_t *hasher;
+	x509_t *x509;
+	chunk_t chunk;
+	cred_encoding_type_t type;
+
+	item = index_add(index, cert, TRUE);
+	if (cert->get_type(cert) != CERT_X509)
+	{	/* we don't know what other certificates match */
+		index_fallback(index, item);
+		return;
+	}
+	x509 = (x509_t*)cert;
+
+	/* identities matched by has_subject() */
+	index_id(index, item, cert->get_subject(cert));
+	enumerator = x509->create_subjectAltName_enumerator(x509);
+	while (enumerator->enumerate(enumerator, &id))
+	{
+		index_id(index, item, id);
+	}
+	enumerator->destroy(enumerator);
+
+	/* key identifiers matched by has_subject() and the key's fingerprints */
+	public = cert->get_public_key(cert);
+	if (public)
+	{
+		for (type = 0; type < KEYID_MAX; type++)
+		{
+			if (public->get_fingerprint(public, type, &chunk))
+			{
+				index_keyid(index, item, chunk);
+			}
+		}
+		public->destroy(public);
+	}
+	index_keyid(index, item, x509->get_subjectKeyIdentifier(x509));
+	index_keyid(index, item, x509->get_serial(x509));
+
+	hasher = lib->crypto->create_hasher(lib->crypto, HASH_SHA1);
+	if (hasher && cert->get_encoding(cert, CERT_ASN1_DER, &chunk))
+	{
+		chunk_t hash;
+
+		if (hasher->allocate_hash(hasher, chunk, &hash))
+		{
+			index_keyid(index, item, hash);
+			free(hash.ptr);
+		}
+		else
+		{
+			index_fallback(index, item);
+		}
+		free(chunk.ptr);
+	}
+	else
+	{	/* can't index by the hash of the encoding */
+		index_fallback(index, item);
+	}
+	DESTROY_IF(hasher);
+}
+
+/**
+ * Index a private key, inserted first or last into its list
+ */
+static void index_key(cred_index_t *index, private_key_t *key, bool first)
+{
+	index_item_t *item;
+	cred_encoding_type_t type;
+	chunk_t keyid;
+	bool indexed = FALSE;
+
+	item = index_add(index, key, first);
+	for (type = 0; type < KEYID_MAX; type++)
+	{
+		if (key->get_fingerprint(key, type, &keyid))
+		{
+			index_keyid(index, item, keyid);
+			indexed = TRUE;
+		}
+	}
+	if (!indexed)
+	{
+		index_fallback(index, item);
+	}
+}
+
 /**
  * Data for the certificate enumerator
  */
@@ -134,7 +642,12 @@ METHOD(credential_set_t, create_cert_enumerator, enumerator_t*,
 		.id = id,
 	);
 	this->lock->read_lock(this->lock);
-	if (trusted)
+	if (id && !id->contains_wildcards(id))
+	{
+		enumerator = index_create_enumerator(trusted ? this->trusted_index
+														: this->untrusted_index, id);
+	}
+	else if (trusted)
 	{
 		enumerator = this->trusted->create_enumerator(this->trusted);
 	}
@@ -172,8 +685,10 @@ static certificate_t *add_cert_internal(private_mem_cred_t *this, bool trusted,
 		if (trusted)
 		{
 			this->trusted->insert_first(this->trusted, cert->get_ref(cert));
+			index_cert(this->trusted_index, cert);
 		}
 		this->untrusted->insert_first(this->untrusted, cert->get_ref(cert));
+		index_cert(this->untrusted_index, cert);
 	}
 	this->lock->unlock(this->lock);
 	return cert;
@@ -232,6 +747,7 @@ METHOD(mem_cred_t, add_crl, bool,
 				if (new)
 				{
 					this->untrusted->remove_at(this->untrusted, enumerator);
+					index_remove(this->untrusted_index, current);
 				}
 				else
 				{
@@ -246,6 +762,7 @@ METHOD(mem_cred_t, add_crl, bool,
 	if (new)
 	{
 		this->untrusted->insert_first(this->untrusted, cert);
+		index_cert(this->untrusted_index, cert);
 	}
 	this->lock->unlock(this->lock);
 	return new;
@@ -292,6 +809,7 @@ static bool key_filter(key_data_t *data, private_key_t **in, private_key_t **out
 METHOD(credential_set_t, create_private_enumerator, enumerator_t*,
 	private_mem_cred_t *this, key_type_t type, identification_t *id)
 {
+	enumerator_t *enumerator;
 	key_data_t *data;
 
 	INIT(data,
@@ -300,8 +818,16 @@ METHOD(credential_set_t, create_private_enumerator, enumerator_t*,
 		.id = id,
 	);
 	this->lock->read_lock(this->lock);
-	return enumerator_create_filter(this->keys->create_enumerator(this->keys),
-							(void*)key_filter, data, (void*)key_data_destroy);
+	if (id)
+	{
+		enumerator = index_create_enumerator(this->keys_index, id);
+	}
+	else
+	{
+		enumerator = this->keys->create_enumerator(this->keys);
+	}
+	return enumerator_create_filter(enumerator, (void*)key_filter, data,
+									(void*)key_data_destroy);
 }
 
 METHOD(mem_cred_t, add_key, void,
@@ -309,6 +835,7 @@ METHOD(mem_cred_t, add_key, void,
 {
 	this->lock->write_lock(this->lock);
 	this->keys->insert_first(this->keys, key);
+	index_key(this->keys_index, key, TRUE);
 	this->lock->unlock(this->lock);
 }
 
@@ -333,6 +860,28 @@ static void shared_entry_destroy(shared_entry_t *entry)
 	free(entry);
 }
 
+/**
+ * Index a shared key entry by its owners, inserted first or last into its list
+ */
+static void index_shared(cred_index_t *index, shared_entry_t *entry, bool first)
+{
+	enumerator_t *enumerator;
+	identification_t *id;
+	index_item_t *item;
+
+	item = index_add(index, entry, first);
+	if (!entry->owners->get_count(entry->owners))
+	{
+		index_fallback(index, item);
+	}
+	enumerator = entry->owners->create_enumerator(entry->owners);
+	while (enumerator->enumerate(enumerator, &id))
+	{	/* wildcard owners end up in the fallback list */
+		index_id(index, item, id);
+	}
+	enumerator->destroy(enumerator);
+}
+
 /**
  * Data for the shared_key enumerator
  */
@@ -414,11 +963,97 @@ static bool shared_filter(shared_data_t *data,
 	return TRUE;
 }
 
+/**
+ * Enumerator over the shared keys matching me or other
+ */
+typedef struct {
+	/** implements enumerator_t */
+	enumerator_t public;
+	/** enumerator over the current candidates, as shared_entry_t */
+	enumerator_t *inner;
+	/** index over shared keys */
+	cred_index_t *index;
+	/** enumerator data */
+	shared_data_t *data;
+	/** TRUE if any of the enumerated entries matched other */
+	bool other_matched;
+	/** TRUE if entries only matching me are enumerated */
+	bool me_only;
+} shared_enumerator_t;
+
+/**
+ * Create an enumerator over the entries that might match me, but not other
+ */
+static enumerator_t *create_me_only_enumerator(shared_enumerator_t *this)
+{
+	linked_list_t *sources[MAX_SOURCES], *exclude[MAX_SOURCES + 1];
+	int count = 0, excount = 0;
+
+	index_sources(this->index, this->data->me, sources, &count);
+	exclude[excount++] = this->index->fallback;
+	index_sources(this->index, this->data->other, exclude, &excount);
+	return create_list_enumerator(index_collect(sources, count,
+												exclude, excount));
+}
+
+METHOD(enumerator_t, shared_enumerate, bool,
+	shared_enumerator_t *this, shared_key_t **out, id_match_t *me,
+	id_match_t *other)
+{
+	id_match_t my_match, other_match;
+	shared_entry_t *entry;
+
+	while (TRUE)
+	{
+		while (this->inner->enumerate(this->inner, &entry))
+		{
+			if (shared_filter(this->data, &entry, out, NULL, &my_match,
+							  NULL, &other_match))
+			{
+				if (other_match != ID_MATCH_NONE)
+				{
+					this->other_matched = TRUE;
+				}
+				if (me)
+				{
+					*me = my_match;
+				}
+				if (other)
+				{
+					*other = other_match;
+				}
+				return TRUE;
+			}
+		}
+		if (this->me_only || this->other_matched ||
+			!this->data->me || !this->data->other)
+		{
+			return FALSE;
+		}
+		/* entries matching other are always preferred, only if there are none
+		 * we return those that match me only */
+		this->me_only = TRUE;
+		this->inner->destroy(this->inner);
+		this->inner = create_me_only_enumerator(this);
+	}
+}
+
+METHOD(enumerator_t, shared_enumerator_destroy, void,
+	shared_enumerator_t *this)
+{
+	this->inner->destroy(this->inner);
+	shared_data_destroy(this->data);
+	free(this);
+}
+
 METHOD(credential_set_t, create_shared_enumerator, enumerator_t*,
 	private_mem_cred_t *this, shared_key_type_t type,
 	identification_t *me, identification_t *other)
 {
+	linked_list_t *sources[MAX_SOURCES + 1];
+	shared_enumerator_t *enumerator;
 	shared_data_t *data;
+	int count = 0;
 
 	INIT(data,
 		.lock = this->lock,
@@ -427,9 +1062,28 @@ METHOD(credential_set_t, create_shared_enumerator, enumerator_t*,
 		.type = type,
 	);
 	data->lock->read_lock(data->lock);
-	return enumerator_create_filter(
+	if (!me && !other)
+	{
+		return enumerator_create_filter(
 						this->shared->create_enumerator(this->shared),
 						(void*)shared_filter, data, (void*)shared_data_destroy);
+	}
+	/* entries matching an identity are either stored under it or have
+	 * wildcard owners, we start with those matching other, if given */
+	sources[count++] = this->shared_index->fallback;
+	index_sources(this->shared_index, other ?: me, sources, &count);
+
+	INIT(enumerator,
+		.public = {
+			.enumerate = (void*)_shared_enumerate,
+			.destroy = _shared_enumerator_destroy,
+		},
+		.inner = create_list_enumerator(index_collect(sources, count,
+													  NULL, 0)),
+		.index = this->shared_index,
+		.data = data,
+	);
+	return &enumerator->public;
 }
 
 METHOD(mem_cred_t, add_shared_list, void,
@@ -444,6 +1098,7 @@ METHOD(mem_cred_t, add_shared_list, void,
 
 	this->lock->write_lock(this->lock);
 	this->shared->insert_first(this->shared, entry);
+	index_shared(this->shared_index, entry, TRUE);
 	this->lock->unlock(this->lock);
 }
 
@@ -561,6 +1216,10 @@ static void reset_secrets(private_mem_cred_t *this)
 	this->shared->destroy_function(this->shared, (void*)shared_entry_destroy);
 	this->keys = linked_list_create();
 	this->shared = linked_list_create();
+	index_destroy(this->keys_index);
+	index_destroy(this->shared_index);
+	this->keys_index = index_create();
+	this->shared_index = index_create();
 }
 
 METHOD(mem_cred_t, replace_secrets, void,
@@ -581,6 +1240,7 @@ METHOD(mem_cred_t, replace_secrets, void,
 		while (enumerator->enumerate(enumerator, &key))
 		{
 			this->keys->insert_last(this->keys, key->get_ref(key));
+			index_key(this->keys_index, key, FALSE);
 		}
 		enumerator->destroy(enumerator);
 		enumerator = other->shared->create_enumerator(other->shared);
@@ -592,6 +1252,7 @@ METHOD(mem_cred_t, replace_secrets, void,
 											offsetof(identification_t, clone)),
 			);
 			this->shared->insert_last(this->shared, new_entry);
+			index_shared(this->shared_index, new_entry, FALSE);
 		}
 		enumerator->destroy(enumerator);
 	}
@@ -600,12 +1261,19 @@ METHOD(mem_cred_t, replace_secrets, void,
 		while (other->keys->remove_first(other->keys, (void**)&key) == SUCCESS)
 		{
 			this->keys->insert_last(this->keys, key);
+			index_key(this->keys_index, key, FALSE);
 		}
 		while (other->shared->remove_first(other->shared,
 										  (void**)&entry) == SUCCESS)
 		{
 			this->shared->insert_last(this->shared, entry);
+			index_shared(this->shared_index, entry, FALSE);
 		}
+		/* the other set does not own these anymore */
+		index_destroy(other->keys_index);
+		index_destroy(other->shared_index);
+		other->keys_index = index_create();
+		other->shared_index = index_create();
 	}
 	this->lock->unlock(this->lock);
 }
@@ -630,6 +1298,10 @@ METHOD(mem_cred_t, clear_, void,
 	this->trusted = linked_list_create();
 	this->untrusted = linked_list_create();
 	this->cdps = linked_list_create();
+	index_destroy(this->trusted_index);
+	index_destroy(this->untrusted_index);
+	this->trusted_index = index_create();
+	this->untrusted_index = index_create();
 	this->lock->unlock(this->lock);
 
 	clear_secrets(this);
@@ -644,6 +1316,10 @@ METHOD(mem_cred_t, destroy, void,
 	this->keys->destroy(this->keys);
 	this->shared->destroy(this->shared);
 	this->cdps->destroy(this->cdps);
+	index_destroy(this->trusted_index);
+	index_destroy(this->untrusted_index);
+	index_destroy(this->keys_index);
+	index_destroy(this->shared_index);
 	this->lock->destroy(this->lock);
 	free(this);
 }
@@ -677,9 +1353,13 @@ mem_cred_t *mem_cred_create()
 			.destroy = _destroy,
 		},
 		.trusted = linked_list_create(),
+		.trusted_index = index_create(),
 		.untrusted = linked_list_create(),
+		.untrusted_index = index_create(),
 		.keys = linked_list_create(),
+		.keys_index = index_create(),
 		.shared = linked_list_create(),
+		.shared_index = index_create(),
 		.cdps = linked_list_create(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
 	);
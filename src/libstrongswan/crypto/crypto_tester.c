@@ -1128,6 +1128,97 @@ failure:
 	return !failed;
 }
 
+/**
+ * Benchmark a DH implementation, counts the generated public values
+ */
+static u_int bench_dh(private_crypto_tester_t *this,
+					  diffie_hellman_group_t group, dh_constructor_t create)
+{
+	diffie_hellman_t *dh;
+	struct timespec start;
+	chunk_t value;
+	u_int runs;
+
+	runs = 0;
+	start_timing(&start);
+	while (end_timing(&start) < this->bench_time)
+	{
+		dh = create(group);
+		if (!dh)
+		{
+			return 0;
+		}
+		dh->get_my_public_value(dh, &value);
+		chunk_free(&value);
+		dh->destroy(dh);
+		runs++;
+	}
+	return runs;
+}
+
+METHOD(crypto_tester_t, test_dh, bool,
+	private_crypto_tester_t *this, diffie_hellman_group_t group,
+	dh_constructor_t create, u_int *speed, const char *plugin_name)
+{
+	diffie_hellman_t *a, *b = NULL;
+	chunk_t value, secret_a = chunk_empty, secret_b = chunk_empty;
+	bool failed = TRUE;
+
+	if (group == MODP_CUSTOM)
+	{
+		DBG1(DBG_LIB, "enabled  %N[%s]: skipping test (no group parameters)",
+			 diffie_hellman_group_names, group, plugin_name);
+		return TRUE;
+	}
+
+	a = create(group);
+	if (a)
+	{
+		b = create(group);
+	}
+	if (!a || !b)
+	{
+		DBG1(DBG_LIB, "disabled %N[%s]: creating instance failed",
+			 diffie_hellman_group_names, group, plugin_name);
+		DESTROY_IF(a);
+		return FALSE;
+	}
+	a->get_my_public_value(a, &value);
+	b->set_other_public_value(b, value);
+	chunk_free(&value);
+	b->get_my_public_value(b, &value);
+	a->set_other_public_value(a, value);
+	chunk_free(&value);
+	if (a->get_shared_secret(a, &secret_a) == SUCCESS &&
+		b->get_shared_secret(b, &secret_b) == SUCCESS &&
+		chunk_equals(secret_a, secret_b))
+	{
+		failed = FALSE;
+	}
+	chunk_clear(&secret_a);
+	chunk_clear(&secret_b);
+	a->destroy(a);
+	b->destroy(b);
+	if (failed)
+	{
+		DBG1(DBG_LIB, "disabled %N[%s]: key exchange test failed",
+			 diffie_hellman_group_names, group, plugin_name);
+		return FALSE;
+	}
+	if (speed)
+	{
+		*speed = bench_dh(this, group, create);
+		DBG1(DBG_LIB, "enabled  %N[%s]: passed key exchange test, %d points",
+			 diffie_hellman_group_names, group, plugin_name, *speed);
+	}
+	else
+	{
+		DBG1(DBG_LIB, "enabled  %N[%s]: passed key exchange test",
+			 diffie_hellman_group_names, group, plugin_name);
+	}
+	return TRUE;
+}
+
 METHOD(crypto_tester_t, add_crypter_vector, void,
 	private_crypto_tester_t *this, crypter_test_vector_t *vector)
 {
@@ -1191,6 +1282,7 @@ crypto_tester_t *crypto_tester_create()
 			.test_hasher = _test_hasher,
 			.test_prf = _test_prf,
 			.test_rng = _test_rng,
+			.test_dh = _test_dh,
 			.add_crypter_vector = _add_crypter_vector,
 			.add_aead_vector = _add_aead_vector,
 			.add_signer_vector = _add_signer_vector,
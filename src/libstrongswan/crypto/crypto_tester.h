@@ -201,6 +201,20 @@ struct crypto_tester_t {
 	bool (*test_rng)(crypto_tester_t *this, rng_quality_t quality,
 					 rng_constructor_t create,
 					 u_int *speed, const char *plugin_name);
+	/**
+	 * Test a Diffie-Hellman implementation.
+	 *
+	 * As there are no test vectors, two instances exchange public values
+	 * and have to derive the same shared secret.
+	 *
+	 * @param group			DH group to test
+	 * @param create		constructor function for the DH object
+	 * @param speed			speed test result, NULL to omit
+	 * @return				TRUE if test passed
+	 */
+	bool (*test_dh)(crypto_tester_t *this, diffie_hellman_group_t group,
+					dh_constructor_t create,
+					u_int *speed, const char *plugin_name);
 	/**
 	 * Add a test vector to test a crypter.
 	 *
@@ -84,7 +84,9 @@ struct diffie_hellman_t {
 	/**
 	 * Sets the public value of partner.
 	 *
-	 * Chunk gets cloned and can be destroyed afterwards.
+	 * Chunk gets cloned and can be destroyed afterwards. The method may be
+	 * called again to compute a shared secret with a different public value,
+	 * a previously computed secret is discarded in any case.
 	 *
 	 * @param value		public value of partner
 	 */
@@ -111,6 +111,23 @@ METHOD(packet_t, skip_bytes, void,
 	this->adjusted_data = chunk_skip(this->adjusted_data, bytes);
 }
 
+METHOD(packet_t, set_buffer, void,
+	private_packet_t *this, chunk_t buffer, chunk_t data)
+{
+	free(this->data.ptr);
+	this->data = buffer;
+	this->adjusted_data = data;
+}
+
+METHOD(packet_t, extract_buffer, chunk_t,
+	private_packet_t *this)
+{
+	chunk_t buffer = this->data;
+
+	this->adjusted_data = this->data = chunk_empty;
+	return buffer;
+}
+
 METHOD(packet_t, destroy, void,
 	private_packet_t *this)
 {
@@ -161,6 +178,8 @@ packet_t *packet_create_from_data(host_t *src, host_t *dst, chunk_t data)
 			.get_dscp = _get_dscp,
 			.set_dscp = _set_dscp,
 			.skip_bytes = _skip_bytes,
+			.set_buffer = _set_buffer,
+			.extract_buffer = _extract_buffer,
 			.clone = _clone_,
 			.destroy = _destroy,
 		},
@@ -100,6 +100,26 @@ struct packet_t {
 	 */
 	void (*skip_bytes)(packet_t *packet, size_t bytes);
 
+	/**
+	 * Set the data of the packet, located in a larger buffer that provides
+	 * headroom and tailroom around it (e.g. to add headers in place).
+	 *
+	 * @param buffer	allocated buffer containing the data (gets owned)
+	 * @param data		data in buffer, as returned by get_data()
+	 */
+	void (*set_buffer)(packet_t *packet, chunk_t buffer, chunk_t data);
+
+	/**
+	 * Extract the buffer the data of this packet is located in, e.g. to
+	 * reuse it for data decapsulated in place.
+	 *
+	 * The data returned by get_data() before stays valid, the packet has no
+	 * data afterwards.
+	 *
+	 * @return			allocated buffer, has to be freed by the caller
+	 */
+	chunk_t (*extract_buffer)(packet_t *packet);
+
 	/**
 	 * Clones a packet_t object.
 	 *
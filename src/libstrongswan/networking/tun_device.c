@@ -59,6 +59,16 @@ struct private_tun_device_t {
 	 */
 	int tunfd;
 
+	/**
+	 * File descriptors of all queues, the first one being tunfd
+	 */
+	int *queues;
+
+	/**
+	 * Number of queues opened on the device
+	 */
+	u_int queue_count;
+
 	/**
 	 * Name of the TUN device
 	 */
@@ -239,6 +249,80 @@ METHOD(tun_device_t, write_packet, bool,
 	return TRUE;
 }
 
+METHOD(tun_device_t, get_queue_count, u_int,
+	private_tun_device_t *this)
+{
+	return this->queue_count;
+}
+
+METHOD(tun_device_t, write_packets, u_int,
+	private_tun_device_t *this, u_int queue, chunk_t *packets, u_int count)
+{
+	ssize_t s;
+	u_int i;
+	int fd;
+
+	fd = this->queues[queue % this->queue_count];
+	for (i = 0; i < count; i++)
+	{
+		s = write(fd, packets[i].ptr, packets[i].len);
+		if (s < 0)
+		{
+			DBG1(DBG_LIB, "failed to write packet to TUN device %s: %s",
+				 this->if_name, strerror(errno));
+			break;
+		}
+	}
+	return i;
+}
+
+METHOD(tun_device_t, read_packets, u_int,
+	private_tun_device_t *this, u_int queue, chunk_t *packets, u_int count)
+{
+	ssize_t len;
+	fd_set set;
+	bool old;
+	u_int i;
+	int fd;
+
+	fd = this->queues[queue % this->queue_count];
+
+	FD_ZERO(&set);
+	FD_SET(fd, &set);
+
+	old = thread_cancelability(TRUE);
+	len = select(fd + 1, &set, NULL, NULL, NULL);
+	thread_cancelability(old);
+
+	if (len < 0)
+	{
+		DBG1(DBG_LIB, "select on TUN device %s failed: %s", this->if_name,
+			 strerror(errno));
+		return 0;
+	}
+	for (i = 0; i < count; i++)
+	{
+		len = read(fd, packets[i].ptr, packets[i].len);
+		if (len < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				DBG1(DBG_LIB, "reading from TUN device %s failed: %s",
+					 this->if_name, strerror(errno));
+			}
+			break;
+		}
+		packets[i].len = len;
+		if (this->queue_count == 1)
+		{	/* only multi-queue devices are non-blocking, we can't drain the
+			 * single queue without risking to block */
+			i++;
+			break;
+		}
+	}
+	return i;
+}
+
 METHOD(tun_device_t, read_packet, bool,
 	private_tun_device_t *this, chunk_t *packet)
 {
@@ -277,6 +361,12 @@ METHOD(tun_device_t, read_packet, bool,
 METHOD(tun_device_t, destroy, void,
 	private_tun_device_t *this)
 {
+	u_int i;
+
+	for (i = 1; i < this->queue_count; i++)
+	{
+		close(this->queues[i]);
+	}
 	if (this->tunfd > 0)
 	{
 		close(this->tunfd);
@@ -300,6 +390,7 @@ METHOD(tun_device_t, destroy, void,
 		close(this->sock);
 	}
 	DESTROY_IF(this->address);
+	free(this->queues);
 	free(this);
 }
 
@@ -374,10 +465,24 @@ static bool init_tun(private_tun_device_t *this, const char *name_tmpl)
 
 	/* TUN device, no packet info */
 	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+#ifdef IFF_MULTI_QUEUE
+	if (this->queue_count > 1)
+	{
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+	}
+#endif
 
 	strncpy(ifr.ifr_name, this->if_name, IFNAMSIZ);
 	if (ioctl(this->tunfd, TUNSETIFF, (void*)&ifr) < 0)
 	{
+		if (this->queue_count > 1 && errno == EINVAL)
+		{	/* kernel does not support multi-queue devices */
+			DBG1(DBG_LIB, "multi-queue TUN devices not supported, falling "
+				 "back to a single queue");
+			close(this->tunfd);
+			this->queue_count = 1;
+			return init_tun(this, name_tmpl);
+		}
 		DBG1(DBG_LIB, "failed to configure TUN device: %s", strerror(errno));
 		close(this->tunfd);
 		return FALSE;
@@ -413,10 +518,78 @@ static bool init_tun(private_tun_device_t *this, const char *name_tmpl)
 #endif /* !__APPLE__ */
 }
 
+/**
+ * Attach additional queues to a multi-queue TUN device, put all queues into
+ * non-blocking mode so they can be drained in batches
+ */
+static bool init_queues(private_tun_device_t *this)
+{
+#ifndef IFF_MULTI_QUEUE
+	this->queue_count = 1;
+#endif
+	this->queues = calloc(this->queue_count, sizeof(int));
+	this->queues[0] = this->tunfd;
+	if (this->queue_count == 1)
+	{
+		return TRUE;
+	}
+
+#ifdef IFF_MULTI_QUEUE
+	struct ifreq ifr;
+	u_int i;
+	int fd;
+
+	for (i = 0; i < this->queue_count; i++)
+	{
+		if (i > 0)
+		{
+			fd = open("/dev/net/tun", O_RDWR);
+			if (fd < 0)
+			{
+				DBG1(DBG_LIB, "failed to open /dev/net/tun: %s",
+					 strerror(errno));
+				this->queue_count = i;
+				return FALSE;
+			}
+			memset(&ifr, 0, sizeof(ifr));
+			ifr.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+			strncpy(ifr.ifr_name, this->if_name, IFNAMSIZ);
+			if (ioctl(fd, TUNSETIFF, (void*)&ifr) < 0)
+			{
+				DBG1(DBG_LIB, "failed to attach queue %u to TUN device %s: %s",
+					 i, this->if_name, strerror(errno));
+				close(fd);
+				this->queue_count = i;
+				return FALSE;
+			}
+			this->queues[i] = fd;
+		}
+		if (fcntl(this->queues[i], F_SETFL,
+				  fcntl(this->queues[i], F_GETFL) | O_NONBLOCK) < 0)
+		{
+			DBG1(DBG_LIB, "failed to set TUN queue %u non-blocking: %s", i,
+				 strerror(errno));
+			this->queue_count = i + 1;
+			return FALSE;
+		}
+	}
+#endif /* IFF_MULTI_QUEUE */
+	return TRUE;
+}
+
 /*
  * Described in header
  */
 tun_device_t *tun_device_create(const char *name_tmpl)
+{
+	return tun_device_create_multi_queue(name_tmpl, 1);
+}
+
+/*
+ * Described in header
+ */
+tun_device_t *tun_device_create_multi_queue(const char *name_tmpl,
+											u_int queues)
 {
 	private_tun_device_t *this;
 
@@ -424,6 +597,9 @@ tun_device_t *tun_device_create(const char *name_tmpl)
 		.public = {
 			.read_packet = _read_packet,
 			.write_packet = _write_packet,
+			.read_packets = _read_packets,
+			.write_packets = _write_packets,
+			.get_queue_count = _get_queue_count,
 			.get_mtu = _get_mtu,
 			.set_mtu = _set_mtu,
 			.get_name = _get_name,
@@ -435,6 +611,7 @@ tun_device_t *tun_device_create(const char *name_tmpl)
 		},
 		.tunfd = -1,
 		.sock = -1,
+		.queue_count = max(1, queues),
 	);
 
 	if (!init_tun(this, name_tmpl))
@@ -442,7 +619,13 @@ tun_device_t *tun_device_create(const char *name_tmpl)
 		free(this);
 		return NULL;
 	}
-	DBG1(DBG_LIB, "created TUN device: %s", this->if_name);
+	if (!init_queues(this))
+	{
+		destroy(this);
+		return NULL;
+	}
+	DBG1(DBG_LIB, "created TUN device: %s (%u queue%s)", this->if_name,
+		 this->queue_count, this->queue_count == 1 ? "" : "s");
 
 	this->sock = socket(AF_INET, SOCK_DGRAM, 0);
 	if (this->sock < 0)
@@ -56,6 +56,43 @@ struct tun_device_t {
 	 */
 	bool (*write_packet)(tun_device_t *this, chunk_t packet);
 
+	/**
+	 * Read a batch of packets from a specific queue of the TUN device.
+	 *
+	 * The packets are read into buffers provided by the caller, their length
+	 * gets adjusted to the size of each packet read.  On multi-queue devices
+	 * all packets pending on the queue are read (up to count), otherwise a
+	 * single packet is returned per call.
+	 *
+	 * @note This call blocks until a packet is available. It is a thread
+	 * cancellation point.
+	 *
+	 * @param queue			queue to read from (0 to get_queue_count() - 1)
+	 * @param packets		array of count buffers to read packets into
+	 * @param count			number of buffers in packets
+	 * @return				number of packets read, 0 on failure
+	 */
+	u_int (*read_packets)(tun_device_t *this, u_int queue, chunk_t *packets,
+						  u_int count);
+
+	/**
+	 * Write a batch of packets to a specific queue of the TUN device.
+	 *
+	 * @param queue			queue to write to (0 to get_queue_count() - 1)
+	 * @param packets		array of packets to write
+	 * @param count			number of packets in packets
+	 * @return				number of packets written
+	 */
+	u_int (*write_packets)(tun_device_t *this, u_int queue, chunk_t *packets,
+						   u_int count);
+
+	/**
+	 * Get the number of queues opened on the TUN device.
+	 *
+	 * @return				number of queues, 1 unless multi-queue
+	 */
+	u_int (*get_queue_count)(tun_device_t *this);
+
 	/**
 	 * Set the IP address of the device
 	 *
@@ -124,4 +161,19 @@ struct tun_device_t {
  */
 tun_device_t *tun_device_create(const char *name_tmpl);
 
+/**
+ * Create a multi-queue TUN device using the given name template.
+ *
+ * Each queue gets its own file descriptor, allowing multiple threads to read
+ * and write packets concurrently.  The queues are non-blocking.  If the
+ * platform does not support multi-queue TUN devices a device with a single
+ * queue is created.
+ *
+ * @param name_tmpl			name template, defaults to "tun%d" if not given
+ * @param queues			number of queues to open
+ * @return					TUN device
+ */
+tun_device_t *tun_device_create_multi_queue(const char *name_tmpl,
+											u_int queues);
+
 #endif /** TUN_DEVICE_H_ @}*/
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+
+#include "aesni_ctr.h"
+#include "aesni_key.h"
+
+/**
+ * Number of counter blocks encrypted in parallel
+ */
+#define CTR_CRYPT_PARALLELISM 4
+
+typedef struct private_aesni_ctr_t private_aesni_ctr_t;
+
+/**
+ * Private data of an aesni_ctr_t object.
+ */
+struct private_aesni_ctr_t {
+
+	/**
+	 * Public aesni_ctr_t interface.
+	 */
+	aesni_ctr_t public;
+
+	/**
+	 * Key size
+	 */
+	u_int key_size;
+
+	/**
+	 * Key schedule
+	 */
+	aesni_key_t *key;
+
+	/**
+	 * Counter state
+	 */
+	struct {
+		char nonce[4];
+		char iv[8];
+		u_int32_t counter;
+	} __attribute__((packed)) state;
+};
+
+/**
+ * Get the counter block with the given counter value, base has a zero counter
+ */
+static inline __m128i counter_block(__m128i base, u_int32_t counter)
+{
+	return _mm_or_si128(base, _mm_set_epi32(htonl(counter), 0, 0, 0));
+}
+
+/**
+ * En-/decrypt data with the given key, starting with the given counter
+ */
+static void crypt_ctr(aesni_key_t *key, __m128i base, u_int32_t counter,
+					  u_char *in, size_t len, u_char *out)
+{
+	__m128i ks[AES_ROUNDS_MAX + 1], t[CTR_CRYPT_PARALLELISM];
+	u_char block[AES_BLOCK_SIZE];
+	int i, round;
+
+	aesni_key_load(key, ks);
+
+	while (len >= CTR_CRYPT_PARALLELISM * AES_BLOCK_SIZE)
+	{
+		for (i = 0; i < CTR_CRYPT_PARALLELISM; i++)
+		{
+			t[i] = _mm_xor_si128(counter_block(base, counter++), ks[0]);
+		}
+		for (round = 1; round < key->rounds; round++)
+		{
+			for (i = 0; i < CTR_CRYPT_PARALLELISM; i++)
+			{
+				t[i] = _mm_aesenc_si128(t[i], ks[round]);
+			}
+		}
+		for (i = 0; i < CTR_CRYPT_PARALLELISM; i++)
+		{
+			t[i] = _mm_aesenclast_si128(t[i], ks[key->rounds]);
+			t[i] = _mm_xor_si128(t[i], _mm_loadu_si128((__m128i*)in + i));
+			_mm_storeu_si128((__m128i*)out + i, t[i]);
+		}
+		in += CTR_CRYPT_PARALLELISM * AES_BLOCK_SIZE;
+		out += CTR_CRYPT_PARALLELISM * AES_BLOCK_SIZE;
+		len -= CTR_CRYPT_PARALLELISM * AES_BLOCK_SIZE;
+	}
+	while (len)
+	{
+		t[0] = _mm_xor_si128(counter_block(base, counter++), ks[0]);
+		for (round = 1; round < key->rounds; round++)
+		{
+			t[0] = _mm_aesenc_si128(t[0], ks[round]);
+		}
+		t[0] = _mm_aesenclast_si128(t[0], ks[key->rounds]);
+		if (len >= AES_BLOCK_SIZE)
+		{
+			t[0] = _mm_xor_si128(t[0], _mm_loadu_si128((__m128i*)in));
+			_mm_storeu_si128((__m128i*)out, t[0]);
+			in += AES_BLOCK_SIZE;
+			out += AES_BLOCK_SIZE;
+			len -= AES_BLOCK_SIZE;
+		}
+		else
+		{	/* partial last block */
+			_mm_storeu_si128((__m128i*)block, t[0]);
+			memxor(block, in, len);
+			memcpy(out, block, len);
+			memwipe(block, sizeof(block));
+			len = 0;
+		}
+	}
+	memwipe(ks, sizeof(ks));
+}
+
+METHOD(crypter_t, crypt, bool,
+	private_aesni_ctr_t *this, chunk_t in, chunk_t iv, chunk_t *out)
+{
+	u_char *buf;
+
+	if (!this->key || iv.len != sizeof(this->state.iv))
+	{
+		return FALSE;
+	}
+	memcpy(this->state.iv, iv.ptr, sizeof(this->state.iv));
+	this->state.counter = 0;
+
+	if (out)
+	{
+		*out = chunk_alloc(in.len);
+		buf = out->ptr;
+	}
+	else
+	{
+		buf = in.ptr;
+	}
+	crypt_ctr(this->key, _mm_loadu_si128((__m128i*)&this->state), 1,
+			  in.ptr, in.len, buf);
+	return TRUE;
+}
+
+METHOD(crypter_t, get_block_size, size_t,
+	private_aesni_ctr_t *this)
+{
+	return 1;
+}
+
+METHOD(crypter_t, get_iv_size, size_t,
+	private_aesni_ctr_t *this)
+{
+	return sizeof(this->state.iv);
+}
+
+METHOD(crypter_t, get_key_size, size_t,
+	private_aesni_ctr_t *this)
+{
+	return this->key_size + sizeof(this->state.nonce);
+}
+
+METHOD(crypter_t, set_key, bool,
+	private_aesni_ctr_t *this, chunk_t key)
+{
+	if (key.len != get_key_size(this))
+	{
+		return FALSE;
+	}
+
+	memcpy(this->state.nonce, key.ptr + key.len - sizeof(this->state.nonce),
+		   sizeof(this->state.nonce));
+	key.len -= sizeof(this->state.nonce);
+
+	aesni_key_destroy(this->key);
+	this->key = aesni_key_create(TRUE, key);
+
+	return this->key != NULL;
+}
+
+METHOD(crypter_t, destroy, void,
+	private_aesni_ctr_t *this)
+{
+	aesni_key_destroy(this->key);
+	free(this);
+}
+
+/**
+ * See header
+ */
+aesni_ctr_t *aesni_ctr_create(encryption_algorithm_t algo, size_t key_size)
+{
+	private_aesni_ctr_t *this;
+
+	if (algo != ENCR_AES_CTR)
+	{
+		return NULL;
+	}
+	switch (key_size)
+	{
+		case 0:
+			key_size = 16;
+			break;
+		case 16:
+		case 24:
+		case 32:
+			break;
+		default:
+			return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.crypter = {
+				.encrypt = _crypt,
+				.decrypt = _crypt,
+				.get_block_size = _get_block_size,
+				.get_iv_size = _get_iv_size,
+				.get_key_size = _get_key_size,
+				.set_key = _set_key,
+				.destroy = _destroy,
+			},
+		},
+		.key_size = key_size,
+	);
+
+	return &this->public;
+}
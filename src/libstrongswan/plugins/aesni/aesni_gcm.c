@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+
+#include "aesni_gcm.h"
+#include "aesni_key.h"
+
+#include <tmmintrin.h>
+
+#define NONCE_SIZE 12
+#define IV_SIZE 8
+#define SALT_SIZE (NONCE_SIZE - IV_SIZE)
+
+/**
+ * Number of blocks en-/decrypted and hashed in parallel
+ */
+#define GCM_CRYPT_PARALLELISM 4
+
+typedef struct private_aesni_gcm_t private_aesni_gcm_t;
+
+/**
+ * Private data of an aesni_gcm_t object.
+ */
+struct private_aesni_gcm_t {
+
+	/**
+	 * Public aesni_gcm_t interface.
+	 */
+	aesni_gcm_t public;
+
+	/**
+	 * Key size
+	 */
+	u_int key_size;
+
+	/**
+	 * Size of the integrity check value
+	 */
+	size_t icv_size;
+
+	/**
+	 * Key schedule
+	 */
+	aesni_key_t *key;
+
+	/**
+	 * Salt value
+	 */
+	char salt[SALT_SIZE];
+
+	/**
+	 * H^1 to H^4, byte-reflected, for the aggregated GHASH reduction
+	 */
+	u_char h[GCM_CRYPT_PARALLELISM][AES_BLOCK_SIZE];
+};
+
+/**
+ * Byte-swap a 128-bit integer
+ */
+static inline __m128i swap128(__m128i x)
+{
+	return _mm_shuffle_epi8(x,
+			_mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+/**
+ * Carry-less multiplication of a and b to the 256-bit result hi:lo, added
+ * to the previous contents of hi and lo.
+ */
+static inline void mult_add(__m128i a, __m128i b, __m128i *lo, __m128i *hi)
+{
+	__m128i t0, t1, t2, t3;
+
+	t0 = _mm_clmulepi64_si128(a, b, 0x00);
+	t1 = _mm_clmulepi64_si128(a, b, 0x10);
+	t2 = _mm_clmulepi64_si128(a, b, 0x01);
+	t3 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t1 = _mm_xor_si128(t1, t2);
+	*lo = _mm_xor_si128(*lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+	*hi = _mm_xor_si128(*hi, _mm_xor_si128(t3, _mm_srli_si128(t1, 8)));
+}
+
+/**
+ * Reduce a 256-bit product of bit-reflected operands modulo the GCM
+ * polynomial, as in Intel's "Carry-Less Multiplication Instruction and its
+ * Usage for Computing the GCM Mode" white paper
+ */
+static inline __m128i reduce(__m128i lo, __m128i hi)
+{
+	__m128i t2, t4, t5;
+
+	/* shift the product left by one bit */
+	t4 = _mm_srli_epi32(lo, 31);
+	t5 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t2 = _mm_srli_si128(t4, 12);
+	t5 = _mm_slli_si128(t5, 4);
+	t4 = _mm_slli_si128(t4, 4);
+	lo = _mm_or_si128(lo, t4);
+	hi = _mm_or_si128(hi, t5);
+	hi = _mm_or_si128(hi, t2);
+
+	/* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t4 = _mm_slli_epi32(lo, 31);
+	t5 = _mm_slli_epi32(lo, 30);
+	t2 = _mm_slli_epi32(lo, 25);
+	t4 = _mm_xor_si128(t4, t5);
+	t4 = _mm_xor_si128(t4, t2);
+	t5 = _mm_srli_si128(t4, 4);
+	t4 = _mm_slli_si128(t4, 12);
+	lo = _mm_xor_si128(lo, t4);
+
+	t2 = _mm_srli_epi32(lo, 1);
+	t4 = _mm_srli_epi32(lo, 2);
+	t2 = _mm_xor_si128(t2, t4);
+	t4 = _mm_srli_epi32(lo, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	lo = _mm_xor_si128(lo, t2);
+	return _mm_xor_si128(hi, lo);
+}
+
+/**
+ * Multiply a byte-reflected block by H
+ */
+static inline __m128i mult_h(__m128i y, __m128i h)
+{
+	__m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+
+	mult_add(y, h, &lo, &hi);
+	return reduce(lo, hi);
+}
+
+/**
+ * GHASH data (zero padded to the block size) into the byte-reflected y,
+ * reducing once every GCM_CRYPT_PARALLELISM blocks
+ */
+static __m128i ghash(private_aesni_gcm_t *this, __m128i y, u_char *data,
+					 size_t len)
+{
+	__m128i h[GCM_CRYPT_PARALLELISM], lo, hi;
+	u_char block[AES_BLOCK_SIZE];
+	int i;
+
+	for (i = 0; i < GCM_CRYPT_PARALLELISM; i++)
+	{
+		h[i] = _mm_loadu_si128((__m128i*)this->h[i]);
+	}
+
+	/* Y' = (Y + X1) * H^4 + X2 * H^3 + X3 * H^2 + X4 * H */
+	while (len >= GCM_CRYPT_PARALLELISM * AES_BLOCK_SIZE)
+	{
+		lo = hi = _mm_setzero_si128();
+		for (i = 0; i < GCM_CRYPT_PARALLELISM; i++)
+		{
+			__m128i x = swap128(_mm_loadu_si128((__m128i*)data + i));
+			if (i == 0)
+			{
+				x = _mm_xor_si128(x, y);
+			}
+			mult_add(x, h[GCM_CRYPT_PARALLELISM - 1 - i], &lo, &hi);
+		}
+		y = reduce(lo, hi);
+		data += GCM_CRYPT_PARALLELISM * AES_BLOCK_SIZE;
+		len -= GCM_CRYPT_PARALLELISM * AES_BLOCK_SIZE;
+	}
+	while (len >= AES_BLOCK_SIZE)
+	{
+		y = _mm_xor_si128(y, swap128(_mm_loadu_si128((__m128i*)data)));
+		y = mult_h(y, h[0]);
+		data += AES_BLOCK_SIZE;
+		len -= AES_BLOCK_SIZE;
+	}
+	if (len)
+	{
+		memset(block, 0, sizeof(block));
+		memcpy(block, data, len);
+		y = _mm_xor_si128(y, swap128(_mm_loadu_si128((__m128i*)block)));
+		y = mult_h(y, h[0]);
+	}
+	return y;
+}
+
+/**
+ * Get the counter block with the given 32-bit counter, j has a zero counter
+ */
+static inline __m128i counter_block(__m128i j, u_int32_t counter)
+{
+	return _mm_or_si128(j, _mm_set_epi32(htonl(counter), 0, 0, 0));
+}
+
+/**
+ * Encrypt a single block with the loaded key schedule
+ */
+static inline __m128i encrypt_block(__m128i *ks, int rounds, __m128i t)
+{
+	int round;
+
+	t = _mm_xor_si128(t, ks[0]);
+	for (round = 1; round < rounds; round++)
+	{
+		t = _mm_aesenc_si128(t, ks[round]);
+	}
+	return _mm_aesenclast_si128(t, ks[rounds]);
+}
+
+/**
+ * GCTR function, en-/decrypts data, with counters starting at 2
+ */
+static void gctr(private_aesni_gcm_t *this, __m128i j, u_char *in, size_t len,
+				 u_char *out)
+{
+	__m128i ks[AES_ROUNDS_MAX + 1], t[GCM_CRYPT_PARALLELISM];
+	u_char block[AES_BLOCK_SIZE];
+	u_int32_t counter = 2;
+	int i, round, rounds;
+
+	aesni_key_load(this->key, ks);
+	rounds = this->key->rounds;
+
+	while (len >= GCM_CRYPT_PARALLELISM * AES_BLOCK_SIZE)
+	{
+		for (i = 0; i < GCM_CRYPT_PARALLELISM; i++)
+		{
+			t[i] = _mm_xor_si128(counter_block(j, counter++), ks[0]);
+		}
+		for (round = 1; round < rounds; round++)
+		{
+			for (i = 0; i < GCM_CRYPT_PARALLELISM; i++)
+			{
+				t[i] = _mm_aesenc_si128(t[i], ks[round]);
+			}
+		}
+		for (i = 0; i < GCM_CRYPT_PARALLELISM; i++)
+		{
+			t[i] = _mm_aesenclast_si128(t[i], ks[rounds]);
+			t[i] = _mm_xor_si128(t[i], _mm_loadu_si128((__m128i*)in + i));
+			_mm_storeu_si128((__m128i*)out + i, t[i]);
+		}
+		in += GCM_CRYPT_PARALLELISM * AES_BLOCK_SIZE;
+		out += GCM_CRYPT_PARALLELISM * AES_BLOCK_SIZE;
+		len -= GCM_CRYPT_PARALLELISM * AES_BLOCK_SIZE;
+	}
+	while (len >= AES_BLOCK_SIZE)
+	{
+		t[0] = encrypt_block(ks, rounds, counter_block(j, counter++));
+		t[0] = _mm_xor_si128(t[0], _mm_loadu_si128((__m128i*)in));
+		_mm_storeu_si128((__m128i*)out, t[0]);
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+		len -= AES_BLOCK_SIZE;
+	}
+	if (len)
+	{
+		t[0] = encrypt_block(ks, rounds, counter_block(j, counter));
+		_mm_storeu_si128((__m128i*)block, t[0]);
+		memxor(block, in, len);
+		memcpy(out, block, len);
+		memwipe(block, sizeof(block));
+	}
+	memwipe(ks, sizeof(ks));
+}
+
+/**
+ * Generate the block J0 with a zero counter
+ */
+static __m128i create_j(private_aesni_gcm_t *this, u_char *iv)
+{
+	u_char j[AES_BLOCK_SIZE];
+
+	memcpy(j, this->salt, SALT_SIZE);
+	memcpy(j + SALT_SIZE, iv, IV_SIZE);
+	memset(j + SALT_SIZE + IV_SIZE, 0, AES_BLOCK_SIZE - SALT_SIZE - IV_SIZE);
+	return _mm_loadu_si128((__m128i*)j);
+}
+
+/**
+ * Create the ICV over associated data and ciphertext
+ */
+static void create_icv(private_aesni_gcm_t *this, __m128i j, chunk_t assoc,
+					   chunk_t crypt, u_char *icv)
+{
+	__m128i ks[AES_ROUNDS_MAX + 1], y, s;
+	u_char tag[AES_BLOCK_SIZE];
+
+	y = _mm_setzero_si128();
+	y = ghash(this, y, assoc.ptr, assoc.len);
+	y = ghash(this, y, crypt.ptr, crypt.len);
+	/* lengths of associated and encrypted data in bits */
+	y = _mm_xor_si128(y, _mm_set_epi64x((u_int64_t)assoc.len * 8,
+										(u_int64_t)crypt.len * 8));
+	y = mult_h(y, _mm_loadu_si128((__m128i*)this->h[0]));
+
+	aesni_key_load(this->key, ks);
+	s = encrypt_block(ks, this->key->rounds, counter_block(j, 1));
+	_mm_storeu_si128((__m128i*)tag, _mm_xor_si128(swap128(y), s));
+	memcpy(icv, tag, this->icv_size);
+	memwipe(ks, sizeof(ks));
+}
+
+METHOD(aead_t, encrypt, bool,
+	private_aesni_gcm_t *this, chunk_t plain, chunk_t assoc, chunk_t iv,
+	chunk_t *encr)
+{
+	u_char *out;
+	__m128i j;
+
+	if (!this->key || iv.len != IV_SIZE)
+	{
+		return FALSE;
+	}
+	j = create_j(this, iv.ptr);
+
+	out = plain.ptr;
+	if (encr)
+	{
+		*encr = chunk_alloc(plain.len + this->icv_size);
+		out = encr->ptr;
+	}
+	gctr(this, j, plain.ptr, plain.len, out);
+	create_icv(this, j, assoc, chunk_create(out, plain.len),
+			   out + plain.len);
+	return TRUE;
+}
+
+METHOD(aead_t, decrypt, bool,
+	private_aesni_gcm_t *this, chunk_t encr, chunk_t assoc, chunk_t iv,
+	chunk_t *plain)
+{
+	u_char icv[this->icv_size], *out;
+	__m128i j;
+
+	if (!this->key || iv.len != IV_SIZE || encr.len < this->icv_size)
+	{
+		return FALSE;
+	}
+	j = create_j(this, iv.ptr);
+
+	encr.len -= this->icv_size;
+	create_icv(this, j, assoc, encr, icv);
+	if (!memeq(icv, encr.ptr + encr.len, this->icv_size))
+	{
+		return FALSE;
+	}
+	out = encr.ptr;
+	if (plain)
+	{
+		*plain = chunk_alloc(encr.len);
+		out = plain->ptr;
+	}
+	gctr(this, j, encr.ptr, encr.len, out);
+	return TRUE;
+}
+
+METHOD(aead_t, get_block_size, size_t,
+	private_aesni_gcm_t *this)
+{
+	return 1;
+}
+
+METHOD(aead_t, get_icv_size, size_t,
+	private_aesni_gcm_t *this)
+{
+	return this->icv_size;
+}
+
+METHOD(aead_t, get_iv_size, size_t,
+	private_aesni_gcm_t *this)
+{
+	return IV_SIZE;
+}
+
+METHOD(aead_t, get_key_size, size_t,
+	private_aesni_gcm_t *this)
+{
+	return this->key_size + SALT_SIZE;
+}
+
+METHOD(aead_t, set_key, bool,
+	private_aesni_gcm_t *this, chunk_t key)
+{
+	__m128i ks[AES_ROUNDS_MAX + 1], h, hn;
+	int i;
+
+	if (key.len != get_key_size(this))
+	{
+		return FALSE;
+	}
+
+	memcpy(this->salt, key.ptr + key.len - SALT_SIZE, SALT_SIZE);
+	key.len -= SALT_SIZE;
+
+	aesni_key_destroy(this->key);
+	this->key = aesni_key_create(TRUE, key);
+	if (!this->key)
+	{
+		return FALSE;
+	}
+
+	/* H = E(K, 0^128), and its powers for the aggregated reduction */
+	aesni_key_load(this->key, ks);
+	h = swap128(encrypt_block(ks, this->key->rounds, _mm_setzero_si128()));
+	hn = h;
+	for (i = 0; i < GCM_CRYPT_PARALLELISM; i++)
+	{
+		_mm_storeu_si128((__m128i*)this->h[i], hn);
+		hn = mult_h(hn, h);
+	}
+	memwipe(ks, sizeof(ks));
+	return TRUE;
+}
+
+METHOD(aead_t, destroy, void,
+	private_aesni_gcm_t *this)
+{
+	aesni_key_destroy(this->key);
+	memwipe(this->h, sizeof(this->h));
+	free(this);
+}
+
+/**
+ * See header
+ */
+aesni_gcm_t *aesni_gcm_create(encryption_algorithm_t algo, size_t key_size)
+{
+	private_aesni_gcm_t *this;
+	size_t icv_size;
+
+	switch (key_size)
+	{
+		case 0:
+			key_size = 16;
+			break;
+		case 16:
+		case 24:
+		case 32:
+			break;
+		default:
+			return NULL;
+	}
+	switch (algo)
+	{
+		case ENCR_AES_GCM_ICV8:
+			icv_size = 8;
+			break;
+		case ENCR_AES_GCM_ICV12:
+			icv_size = 12;
+			break;
+		case ENCR_AES_GCM_ICV16:
+			icv_size = 16;
+			break;
+		default:
+			return NULL;
+	}
+
+	INIT(this,
+		.public = {
+			.aead = {
+				.encrypt = _encrypt,
+				.decrypt = _decrypt,
+				.get_block_size = _get_block_size,
+				.get_icv_size = _get_icv_size,
+				.get_iv_size = _get_iv_size,
+				.get_key_size = _get_key_size,
+				.set_key = _set_key,
+				.destroy = _destroy,
+			},
+		},
+		.key_size = key_size,
+		.icv_size = icv_size,
+	);
+
+	return &this->public;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+
+#include "aesni_key.h"
+
+/**
+ * Round constants, one per Nk words of the expanded key
+ */
+static const u_int32_t rcon[] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36,
+};
+
+/**
+ * Apply the S-box to each byte of a word, rotating it if requested.
+ *
+ * AESKEYGENASSIST does exactly this for the second (rotated) and first
+ * (not rotated) word of its input.
+ */
+static u_int32_t sub_word(u_int32_t word, bool rotate)
+{
+	__m128i in, out;
+
+	in = _mm_set_epi32(0, 0, word, 0);
+	out = _mm_aeskeygenassist_si128(in, 0x00);
+	if (rotate)
+	{
+		out = _mm_srli_si128(out, 4);
+	}
+	return _mm_cvtsi128_si32(out);
+}
+
+/**
+ * Expand an encryption key as specified in FIPS-197, section 5.2
+ */
+static void expand_key(aesni_key_t *this, chunk_t key)
+{
+	u_int32_t w[(AES_ROUNDS_MAX + 1) * 4], temp;
+	int nk, i;
+
+	nk = key.len / 4;
+	/* words are in host (little endian) order, as the bytes in XMM lanes */
+	memcpy(w, key.ptr, key.len);
+	for (i = nk; i < (this->rounds + 1) * 4; i++)
+	{
+		temp = w[i - 1];
+		if (i % nk == 0)
+		{
+			temp = sub_word(temp, TRUE) ^ rcon[i / nk - 1];
+		}
+		else if (nk > 6 && i % nk == 4)
+		{
+			temp = sub_word(temp, FALSE);
+		}
+		w[i] = w[i - nk] ^ temp;
+	}
+	memcpy(this->schedule, w, (this->rounds + 1) * AES_BLOCK_SIZE);
+	memwipe(w, sizeof(w));
+}
+
+/**
+ * Convert an encryption schedule to one for the equivalent inverse cipher
+ */
+static void invert_key(aesni_key_t *this)
+{
+	__m128i ks[AES_ROUNDS_MAX + 1];
+	int i;
+
+	aesni_key_load(this, ks);
+	_mm_storeu_si128((__m128i*)this->schedule[0], ks[this->rounds]);
+	for (i = 1; i < this->rounds; i++)
+	{
+		_mm_storeu_si128((__m128i*)this->schedule[i],
+						 _mm_aesimc_si128(ks[this->rounds - i]));
+	}
+	_mm_storeu_si128((__m128i*)this->schedule[this->rounds], ks[0]);
+	memwipe(ks, sizeof(ks));
+}
+
+/**
+ * See header
+ */
+aesni_key_t *aesni_key_create(bool encrypt, chunk_t key)
+{
+	aesni_key_t *this;
+	int rounds;
+
+	switch (key.len)
+	{
+		case 16:
+			rounds = 10;
+			break;
+		case 24:
+			rounds = 12;
+			break;
+		case 32:
+			rounds = 14;
+			break;
+		default:
+			return NULL;
+	}
+
+	INIT(this,
+		.rounds = rounds,
+	);
+
+	expand_key(this, key);
+	if (!encrypt)
+	{
+		invert_key(this);
+	}
+	return this;
+}
+
+/**
+ * See header
+ */
+void aesni_key_destroy(aesni_key_t *this)
+{
+	if (this)
+	{
+		memwipe(this, sizeof(*this));
+		free(this);
+	}
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2013 agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <http://www.fsf.org/copyleft/gpl.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+
+/**
+ * @defgroup aesni_key aesni_key
+ * @{ @ingroup aesni
+ */
+
+#ifndef AESNI_KEY_H_
+#define AESNI_KEY_H_
+
+#include <library.h>
+
+#include <wmmintrin.h>
+
+/**
+ * AES block size, in bytes
+ */
+#define AES_BLOCK_SIZE 16
+
+/**
+ * Maximum number of rounds, for AES-256
+ */
+#define AES_ROUNDS_MAX 14
+
+typedef struct aesni_key_t aesni_key_t;
+
+/**
+ * Expanded AES key schedule, for encryption or decryption.
+ *
+ * The round keys are stored unaligned, use aesni_key_load() to get aligned
+ * copies of them.  Unused round keys are zero.
+ */
+struct aesni_key_t {
+
+	/**
+	 * Number of AES rounds (10, 12 or 14)
+	 */
+	int rounds;
+
+	/**
+	 * Round keys, rounds + 1 of them
+	 */
+	u_char schedule[AES_ROUNDS_MAX + 1][AES_BLOCK_SIZE];
+};
+
+/**
+ * Load the round keys of a key schedule.
+ *
+ * @param key			key schedule
+ * @param ks			array of AES_ROUNDS_MAX + 1 round keys to load to
+ */
+static inline void aesni_key_load(aesni_key_t *key, __m128i *ks)
+{
+	int i;
+
+	for (i = 0; i <= AES_ROUNDS_MAX; i++)
+	{
+		ks[i] = _mm_loadu_si128((__m128i*)key->schedule[i]);
+	}
+}
+
+/**
+ * Expand an AES key once for encryption or decryption.
+ *
+ * @param encrypt		TRUE for an encryption, FALSE for a decryption schedule
+ * @param key			AES key, 16, 24 or 32 bytes
+ * @return				expanded key schedule, NULL if key size invalid
+ */
+aesni_key_t *aesni_key_create(bool encrypt, chunk_t key);
+
+/**
+ * Destroy a key schedule, wiping the round keys.
+ *
+ * @param key			key schedule to destroy, might be NULL
+ */
+void aesni_key_destroy(aesni_key_t *key);
+
+#endif /** AESNI_KEY_H_ @}*/
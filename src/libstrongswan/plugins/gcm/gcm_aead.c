@@ -15,13 +15,16 @@
 
 #include "gcm_aead.h"
 
-#include <limits.h>
-
 #define BLOCK_SIZE 16
 #define NONCE_SIZE 12
 #define IV_SIZE 8
 #define SALT_SIZE (NONCE_SIZE - IV_SIZE)
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#	define GCM_PCLMUL
+#	include <emmintrin.h>
+#endif
+
 typedef struct private_gcm_aead_t private_gcm_aead_t;
 
 /**
@@ -50,100 +53,221 @@ struct private_gcm_aead_t {
 	char salt[SALT_SIZE];
 
 	/**
-	 * GHASH subkey H
+	 * GHASH subkey H, as two 64-bit words in host order
+	 */
+	u_int64_t h[2];
+
+	/**
+	 * Multiples of H for all 4-bit values, as two 64-bit words each
 	 */
-	char h[BLOCK_SIZE];
+	u_int64_t table[16][2];
+
+	/**
+	 * Multiply a block in GF128 by H, in place
+	 */
+	void (*mult)(private_gcm_aead_t *this, u_int64_t *y);
 };
 
 /**
- * Find a suiteable word size and network order conversion functions
+ * Reduction values for the 4 bits shifted out in mult_table()
  */
-#if ULONG_MAX == 18446744073709551615UL && defined(htobe64)
-#	define htobeword htobe64
-#	define bewordtoh be64toh
-#	define SHIFT_WORD_TYPE u_int64_t
-#else
-#	define htobeword htonl
-#	define bewordtoh ntohl
-#	define SHIFT_WORD_TYPE u_int32_t
-#endif
+static const u_int64_t reduce_4bit[16] = {
+	0x0000ULL << 48, 0x1C20ULL << 48, 0x3840ULL << 48, 0x2460ULL << 48,
+	0x7080ULL << 48, 0x6CA0ULL << 48, 0x48C0ULL << 48, 0x54E0ULL << 48,
+	0xE100ULL << 48, 0xFD20ULL << 48, 0xD940ULL << 48, 0xC560ULL << 48,
+	0x9180ULL << 48, 0x8DA0ULL << 48, 0xA9C0ULL << 48, 0xB5E0ULL << 48,
+};
 
 /**
- * Bitshift a block right by one bit
+ * Precompute the multiples of H for Shoup's 4-bit table method
  */
-static void sr_block(char *block)
+static void create_table(private_gcm_aead_t *this)
 {
-	int i;
-	SHIFT_WORD_TYPE *word = (SHIFT_WORD_TYPE*)block;
-
-	for (i = 0; i < BLOCK_SIZE / sizeof(*word); i++)
+	u_int64_t v[2], reduce;
+	int i, j;
+
+	memset(this->table[0], 0, sizeof(this->table[0]));
+	v[0] = this->h[0];
+	v[1] = this->h[1];
+	/* H, H * x, H * x^2 and H * x^3 go to the indices 8, 4, 2 and 1 */
+	for (i = 8; i > 0; i >>= 1)
 	{
-		word[i] = bewordtoh(word[i]);
+		this->table[i][0] = v[0];
+		this->table[i][1] = v[1];
+		reduce = 0xE100000000000000ULL & (0 - (v[1] & 1));
+		v[1] = (v[0] << 63) | (v[1] >> 1);
+		v[0] = (v[0] >> 1) ^ reduce;
 	}
-	for (i = BLOCK_SIZE / sizeof(*word) - 1; i >= 0; i--)
+	/* all others are sums of those */
+	for (i = 2; i < 16; i <<= 1)
 	{
-		word[i] >>= 1;
-		if (i != 0)
+		for (j = 1; j < i; j++)
 		{
-			word[i] |= word[i - 1] << (sizeof(*word) * 8 - 1);
+			this->table[i + j][0] = this->table[i][0] ^ this->table[j][0];
+			this->table[i + j][1] = this->table[i][1] ^ this->table[j][1];
 		}
 	}
-	for (i = 0; i < BLOCK_SIZE / sizeof(*word); i++)
-	{
-		word[i] = htobeword(word[i]);
-	}
 }
 
 /**
- * Naive implementation of block multiplication in GF128, no tables
+ * Block multiplication in GF128 using Shoup's 4-bit table method
  */
-static void mult_block(char *x, char *y, char *res)
+static void mult_table(private_gcm_aead_t *this, u_int64_t *y)
 {
-	char z[BLOCK_SIZE], v[BLOCK_SIZE], r;
-	int bit, byte;
+	u_int64_t z[2], rem;
+	u_char x[BLOCK_SIZE];
+	int i, lo, hi;
 
-	r = 0xE1;
-	memset(z, 0, BLOCK_SIZE);
-	memcpy(v, y, BLOCK_SIZE);
+	htoun64(x, y[0]);
+	htoun64(x + 8, y[1]);
 
-	for (byte = 0; byte < BLOCK_SIZE; byte++)
+	z[0] = z[1] = 0;
+	for (i = BLOCK_SIZE - 1; i >= 0; i--)
 	{
-		for (bit = 7; bit >= 0; bit--)
+		lo = x[i] & 0x0F;
+		hi = x[i] >> 4;
+
+		if (i != BLOCK_SIZE - 1)
 		{
-			if (x[byte] & (1 << bit))
-			{
-				memxor(z, v, BLOCK_SIZE);
-			}
-			if (v[BLOCK_SIZE - 1] & 0x01)
-			{
-				sr_block(v);
-				v[0] ^= r;
-			}
-			else
-			{
-				sr_block(v);
-			}
+			rem = z[1] & 0x0F;
+			z[1] = (z[0] << 60) | (z[1] >> 4);
+			z[0] = (z[0] >> 4) ^ reduce_4bit[rem];
 		}
+		z[0] ^= this->table[lo][0];
+		z[1] ^= this->table[lo][1];
+
+		rem = z[1] & 0x0F;
+		z[1] = (z[0] << 60) | (z[1] >> 4);
+		z[0] = (z[0] >> 4) ^ reduce_4bit[rem];
+		z[0] ^= this->table[hi][0];
+		z[1] ^= this->table[hi][1];
 	}
-	memcpy(res, z, BLOCK_SIZE);
+	y[0] = z[0];
+	y[1] = z[1];
 }
 
+#ifdef GCM_PCLMUL
+
 /**
- * GHASH function
+ * CPU feature flag for PCLMULQDQ, returned via cpuid(1) in ecx
  */
-static void ghash(private_gcm_aead_t *this, chunk_t x, char *res)
+#define CPUID_PCLMULQDQ (1<<1)
+
+/**
+ * Check if the CPU supports the PCLMULQDQ instruction
+ */
+static bool have_pclmul()
 {
-	char y[BLOCK_SIZE];
+	static int have = -1;
+	u_int a, b, c, d;
 
-	memset(y, 0, BLOCK_SIZE);
+	if (have == -1)
+	{
+		asm("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (1));
+		have = (c & CPUID_PCLMULQDQ) != 0;
+	}
+	return have;
+}
 
-	while (x.len)
+/**
+ * Carry-less multiplication of the 64-bit halves of a and b selected by imm,
+ * stored in a.  Done in assembly so no special compiler flags are required.
+ */
+#define pclmulqdq(a, b, imm) \
+	asm("pclmulqdq $" #imm ", %1, %0" : "+x" (a) : "x" (b))
+
+/**
+ * Block multiplication in GF128 using PCLMULQDQ, as described in Intel's
+ * "Carry-Less Multiplication Instruction and its Usage for Computing the
+ * GCM Mode" white paper
+ */
+static void mult_pclmul(private_gcm_aead_t *this, u_int64_t *y)
+{
+	__m128i a, b, t0, t1, t2, t3, t4, t5;
+	union {
+		__m128i m;
+		u_int64_t w[2];
+	} res;
+
+	/* the 128-bit integers are the byte-reflected blocks */
+	a = _mm_set_epi64x(y[0], y[1]);
+	b = _mm_set_epi64x(this->h[0], this->h[1]);
+
+	t0 = a;
+	pclmulqdq(t0, b, 0x00);
+	t1 = a;
+	pclmulqdq(t1, b, 0x10);
+	t2 = a;
+	pclmulqdq(t2, b, 0x01);
+	t3 = a;
+	pclmulqdq(t3, b, 0x11);
+
+	/* 256-bit product in t3:t0 */
+	t1 = _mm_xor_si128(t1, t2);
+	t2 = _mm_slli_si128(t1, 8);
+	t1 = _mm_srli_si128(t1, 8);
+	t0 = _mm_xor_si128(t0, t2);
+	t3 = _mm_xor_si128(t3, t1);
+
+	/* shift the product left by one bit, as the operands are bit-reflected */
+	t4 = _mm_srli_epi32(t0, 31);
+	t5 = _mm_srli_epi32(t3, 31);
+	t0 = _mm_slli_epi32(t0, 1);
+	t3 = _mm_slli_epi32(t3, 1);
+	t2 = _mm_srli_si128(t4, 12);
+	t5 = _mm_slli_si128(t5, 4);
+	t4 = _mm_slli_si128(t4, 4);
+	t0 = _mm_or_si128(t0, t4);
+	t3 = _mm_or_si128(t3, t5);
+	t3 = _mm_or_si128(t3, t2);
+
+	/* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t4 = _mm_slli_epi32(t0, 31);
+	t5 = _mm_slli_epi32(t0, 30);
+	t2 = _mm_slli_epi32(t0, 25);
+	t4 = _mm_xor_si128(t4, t5);
+	t4 = _mm_xor_si128(t4, t2);
+	t5 = _mm_srli_si128(t4, 4);
+	t4 = _mm_slli_si128(t4, 12);
+	t0 = _mm_xor_si128(t0, t4);
+
+	t2 = _mm_srli_epi32(t0, 1);
+	t1 = _mm_srli_epi32(t0, 2);
+	t4 = _mm_srli_epi32(t0, 7);
+	t2 = _mm_xor_si128(t2, t1);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t0 = _mm_xor_si128(t0, t2);
+	res.m = _mm_xor_si128(t3, t0);
+
+	y[0] = res.w[1];
+	y[1] = res.w[0];
+}
+
+#endif /* GCM_PCLMUL */
+
+/**
+ * GHASH function, processes x (zero padded to the block size) into y
+ */
+static void ghash(private_gcm_aead_t *this, chunk_t x, u_int64_t *y)
+{
+	char block[BLOCK_SIZE];
+
+	while (x.len >= BLOCK_SIZE)
 	{
-		memxor(y, x.ptr, BLOCK_SIZE);
-		mult_block(y, this->h, y);
+		y[0] ^= untoh64(x.ptr);
+		y[1] ^= untoh64(x.ptr + 8);
+		this->mult(this, y);
 		x = chunk_skip(x, BLOCK_SIZE);
 	}
-	memcpy(res, y, BLOCK_SIZE);
+	if (x.len)
+	{
+		memset(block, 0, BLOCK_SIZE);
+		memcpy(block, x.ptr, x.len);
+		y[0] ^= untoh64(block);
+		y[1] ^= untoh64(block + 8);
+		this->mult(this, y);
+	}
 }
 
 /**
@@ -182,17 +306,25 @@ static void create_j(private_gcm_aead_t *this, char *iv, char *j)
 }
 
 /**
- * Create GHASH subkey H
+ * Create GHASH subkey H and the table of its multiples
  */
-static bool create_h(private_gcm_aead_t *this, char *h)
+static bool create_h(private_gcm_aead_t *this)
 {
-	char zero[BLOCK_SIZE];
+	char zero[BLOCK_SIZE], h[BLOCK_SIZE];
 
 	memset(zero, 0, BLOCK_SIZE);
 	memset(h, 0, BLOCK_SIZE);
 
-	return this->crypter->encrypt(this->crypter, chunk_create(h, BLOCK_SIZE),
-								  chunk_from_thing(zero), NULL);
+	if (!this->crypter->encrypt(this->crypter, chunk_from_thing(h),
+								chunk_from_thing(zero), NULL))
+	{
+		return FALSE;
+	}
+	this->h[0] = untoh64(h);
+	this->h[1] = untoh64(h + 8);
+	memwipe(h, BLOCK_SIZE);
+	create_table(this);
+	return TRUE;
 }
 
 /**
@@ -219,40 +351,18 @@ static bool crypt(private_gcm_aead_t *this, char *j, chunk_t in, chunk_t out)
 static bool create_icv(private_gcm_aead_t *this, chunk_t assoc, chunk_t crypt,
 					   char *j, char *icv)
 {
-	size_t assoc_pad, crypt_pad;
-	chunk_t chunk;
-	char s[BLOCK_SIZE], *pos;
-
-	assoc_pad = (BLOCK_SIZE - (assoc.len % BLOCK_SIZE)) % BLOCK_SIZE;
-	crypt_pad = (BLOCK_SIZE - (crypt.len % BLOCK_SIZE)) % BLOCK_SIZE;
-
-	/* concatenate data to a new chunk */
-	chunk = chunk_alloc(assoc.len + assoc_pad +
-						crypt.len + crypt_pad + BLOCK_SIZE);
-	pos = chunk.ptr;
-	/* add associated data */
-	memcpy(pos, assoc.ptr, assoc.len);
-	pos += assoc.len;
-	memset(pos, 0, assoc_pad);
-	pos += assoc_pad;
-	/* add encrypted data */
-	memcpy(pos, crypt.ptr, crypt.len);
-	pos += crypt.len;
-	memset(pos, 0, crypt_pad);
-	pos += crypt_pad;
-	/* write associated len */
-	memset(pos, 0, 4);
-	pos += 4;
-	htoun32(pos, assoc.len * 8);
-	pos += 4;
-	/* write encrypted length */
-	memset(pos, 0, 4);
-	pos += 4;
-	htoun32(pos, crypt.len * 8);
-	pos += 4;
-
-	ghash(this, chunk, s);
-	free(chunk.ptr);
+	u_int64_t y[2] = {};
+	char s[BLOCK_SIZE];
+
+	ghash(this, assoc, y);
+	ghash(this, crypt, y);
+	/* lengths of associated and encrypted data in bits */
+	y[0] ^= (u_int64_t)assoc.len * 8;
+	y[1] ^= (u_int64_t)crypt.len * 8;
+	this->mult(this, y);
+
+	htoun64(s, y[0]);
+	htoun64(s + 8, y[1]);
 	if (!gctr(this, j, chunk_from_thing(s)))
 	{
 		return FALSE;
@@ -349,13 +459,15 @@ METHOD(aead_t, set_key, bool,
 	memcpy(this->salt, key.ptr + key.len - SALT_SIZE, SALT_SIZE);
 	key.len -= SALT_SIZE;
 	return this->crypter->set_key(this->crypter, key) &&
-		   create_h(this, this->h);
+		   create_h(this);
 }
 
 METHOD(aead_t, destroy, void,
 	private_gcm_aead_t *this)
 {
 	this->crypter->destroy(this->crypter);
+	memwipe(this->h, sizeof(this->h));
+	memwipe(this->table, sizeof(this->table));
 	free(this);
 }
 
@@ -412,8 +524,16 @@ gcm_aead_t *gcm_aead_create(encryption_algorithm_t algo, size_t key_size)
 		},
 		.crypter = lib->crypto->create_crypter(lib->crypto, algo, key_size),
 		.icv_size = icv_size,
+		.mult = mult_table,
 	);
 
+#ifdef GCM_PCLMUL
+	if (have_pclmul())
+	{
+		this->mult = mult_pclmul;
+	}
+#endif
+
 	if (!this->crypter)
 	{
 		free(this);
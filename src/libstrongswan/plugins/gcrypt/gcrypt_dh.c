@@ -84,6 +84,11 @@ METHOD(diffie_hellman_t, set_other_public_value, void,
 		gcry_mpi_release(this->yb);
 		this->yb = NULL;
 	}
+	if (this->zz)
+	{
+		gcry_mpi_release(this->zz);
+		this->zz = NULL;
+	}
 	err = gcry_mpi_scan(&this->yb, GCRYMPI_FMT_USG, value.ptr, value.len, NULL);
 	if (err)
 	{
@@ -100,10 +105,7 @@ METHOD(diffie_hellman_t, set_other_public_value, void,
 	if (gcry_mpi_cmp_ui(this->yb, 1) > 0 &&
 		gcry_mpi_cmp(this->yb, p_min_1) < 0)
 	{
-		if (!this->zz)
-		{
-			this->zz = gcry_mpi_new(this->p_len * 8);
-		}
+		this->zz = gcry_mpi_new(this->p_len * 8);
 		gcry_mpi_powm(this->zz, this->yb, this->xa, this->p);
 	}
 	else
@@ -22,12 +22,267 @@
 #include "gmp_diffie_hellman.h"
 
 #include <utils/debug.h>
+#include <threading/mutex.h>
 
 #ifdef HAVE_MPZ_POWM_SEC
 # undef mpz_powm
 # define mpz_powm mpz_powm_sec
 #endif
 
+#ifdef HAVE_MPN_SEC_TABSELECT
+
+/**
+ * Number of teeth of the fixed-base comb, tables have 2^COMB_TEETH entries
+ */
+#define COMB_TEETH 6
+
+typedef struct comb_t comb_t;
+
+/**
+ * Fixed-base comb table to compute g^x mod p for a DH group.
+ *
+ * The exponent is split into COMB_TEETH parts of spacing bits each. Entry j
+ * of the table is the product of g^(2^(k*spacing)) for all bits k set in j,
+ * so g^x is computed with spacing squarings and multiplications, selecting
+ * one entry for the bits k*spacing+i of x in each step i. All values are
+ * kept in Montgomery form to avoid divisions.
+ */
+struct comb_t {
+
+	/**
+	 * DH group
+	 */
+	diffie_hellman_group_t group;
+
+	/**
+	 * Number of exponent bits covered
+	 */
+	u_int bits;
+
+	/**
+	 * Number of bits between two teeth, equals the number of steps
+	 */
+	u_int spacing;
+
+	/**
+	 * Number of limbs of the modulus
+	 */
+	mp_size_t n;
+
+	/**
+	 * Modulus
+	 */
+	mp_limb_t *p;
+
+	/**
+	 * -1/p mod 2^GMP_NUMB_BITS
+	 */
+	mp_limb_t pinv;
+
+	/**
+	 * 2^COMB_TEETH entries of n limbs each, entry 0 is 1 in Montgomery form
+	 */
+	mp_limb_t *table;
+
+	/**
+	 * Next table
+	 */
+	comb_t *next;
+};
+
+/**
+ * Tables built so far, shared read-only by all DH objects
+ */
+static comb_t *combs = NULL;
+
+/**
+ * Mutex to build tables
+ */
+static mutex_t *combs_mutex = NULL;
+
+/**
+ * Montgomery reduction of the 2n limbs in tp, stores the n limb result to rp.
+ * The result is not fully reduced but smaller than 2^(n*GMP_NUMB_BITS).
+ */
+static void redc(comb_t *comb, mp_limb_t *rp, mp_limb_t *tp)
+{
+	mp_size_t i;
+	mp_limb_t cy;
+
+	for (i = 0; i < comb->n; i++)
+	{
+		tp[i] = mpn_addmul_1(tp + i, comb->p, comb->n, tp[i] * comb->pinv);
+	}
+	cy = mpn_add_n(rp, tp + comb->n, tp, comb->n);
+	mpn_cnd_sub_n(cy, rp, rp, comb->p, comb->n);
+}
+
+/**
+ * Build the comb table for a group, exponents of up to bits bits
+ */
+static comb_t *comb_create(diffie_hellman_group_t group, u_int bits,
+						   chunk_t g, chunk_t p)
+{
+	comb_t *comb;
+	mpz_t mp, base, exp, entries[1 << COMB_TEETH], teeth[COMB_TEETH];
+	mp_size_t i;
+	int j, k;
+
+	INIT(comb,
+		.group = group,
+		.bits = bits,
+		.spacing = (bits + COMB_TEETH - 1) / COMB_TEETH,
+	);
+
+	mpz_init(mp);
+	mpz_import(mp, p.len, 1, 1, 1, 0, p.ptr);
+	comb->n = mpz_size(mp);
+	comb->p = malloc(comb->n * sizeof(mp_limb_t));
+	for (i = 0; i < comb->n; i++)
+	{
+		comb->p[i] = mpz_getlimbn(mp, i);
+	}
+	/* Newton iteration doubles the number of correct bits, starting with 3 */
+	comb->pinv = comb->p[0];
+	for (i = 3; i < GMP_NUMB_BITS; i *= 2)
+	{
+		comb->pinv *= 2 - comb->p[0] * comb->pinv;
+	}
+	comb->pinv = -comb->pinv;
+
+	/* teeth[k] = g^(2^(k*spacing)) */
+	mpz_init(base);
+	mpz_import(base, g.len, 1, 1, 1, 0, g.ptr);
+	mpz_init(exp);
+	mpz_setbit(exp, comb->spacing);
+	for (k = 0; k < COMB_TEETH; k++)
+	{
+		mpz_init_set(teeth[k], base);
+		mpz_powm(base, base, exp, mp);
+	}
+
+	comb->table = malloc((1 << COMB_TEETH) * comb->n * sizeof(mp_limb_t));
+	mpz_init_set_ui(entries[0], 1);
+	for (j = 0; j < (1 << COMB_TEETH); j++)
+	{
+		if (j)
+		{	/* add the highest tooth to a previously computed entry */
+			k = COMB_TEETH - 1;
+			while (!(j & (1 << k)))
+			{
+				k--;
+			}
+			mpz_init(entries[j]);
+			mpz_mul(entries[j], entries[j ^ (1 << k)], teeth[k]);
+			mpz_mod(entries[j], entries[j], mp);
+		}
+		/* convert to Montgomery form */
+		mpz_mul_2exp(base, entries[j], comb->n * GMP_NUMB_BITS);
+		mpz_mod(base, base, mp);
+		for (i = 0; i < comb->n; i++)
+		{
+			comb->table[j * comb->n + i] = mpz_getlimbn(base, i);
+		}
+	}
+
+	for (j = 0; j < (1 << COMB_TEETH); j++)
+	{
+		mpz_clear(entries[j]);
+	}
+	for (k = 0; k < COMB_TEETH; k++)
+	{
+		mpz_clear(teeth[k]);
+	}
+	mpz_clear(exp);
+	mpz_clear(base);
+	mpz_clear(mp);
+	return comb;
+}
+
+/**
+ * Get the comb table for a group, build it if necessary
+ */
+static comb_t *get_comb(diffie_hellman_group_t group, u_int bits)
+{
+	diffie_hellman_params_t *params;
+	comb_t *comb;
+
+	combs_mutex->lock(combs_mutex);
+	for (comb = combs; comb; comb = comb->next)
+	{
+		if (comb->group == group && comb->bits >= bits)
+		{
+			break;
+		}
+	}
+	if (!comb)
+	{
+		params = diffie_hellman_get_params(group);
+		if (params)
+		{
+			comb = comb_create(group, bits, params->generator,
+							   params->prime);
+			comb->next = combs;
+			combs = comb;
+		}
+	}
+	combs_mutex->unlock(combs_mutex);
+	return comb;
+}
+
+/**
+ * Compute r = g^e mod p in constant time using a comb table, where e has
+ * at most comb->bits bits
+ */
+static void comb_powm(comb_t *comb, mpz_t r, mpz_t e)
+{
+	mp_limb_t *acc, *entry, *prod, *scratch, *exp, idx, borrow;
+	mp_size_t n = comb->n, exp_len, scratch_len, len;
+	u_int i, k, bit;
+
+	exp_len = (comb->spacing * COMB_TEETH + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+	scratch_len = max(mpn_sec_mul_itch(n, n), mpn_sec_sqr_itch(n));
+	len = 4 * n + scratch_len + exp_len;
+	acc = malloc(len * sizeof(mp_limb_t));
+	entry = acc + n;
+	prod = entry + n;
+	scratch = prod + 2 * n;
+	exp = scratch + scratch_len;
+
+	for (i = 0; i < exp_len; i++)
+	{
+		exp[i] = mpz_getlimbn(e, i);
+	}
+	memcpy(acc, comb->table, n * sizeof(mp_limb_t));
+	for (i = comb->spacing; i-- > 0;)
+	{
+		mpn_sec_sqr(prod, acc, n, scratch);
+		redc(comb, acc, prod);
+		for (idx = 0, k = 0; k < COMB_TEETH; k++)
+		{
+			bit = k * comb->spacing + i;
+			idx |= ((exp[bit / GMP_NUMB_BITS] >>
+					(bit % GMP_NUMB_BITS)) & 1) << k;
+		}
+		/* reads all entries to not leak the index via the cache */
+		mpn_sec_tabselect(entry, comb->table, n, 1 << COMB_TEETH, idx);
+		mpn_sec_mul(prod, acc, n, entry, n, scratch);
+		redc(comb, acc, prod);
+	}
+	/* convert from Montgomery form and reduce fully */
+	memcpy(prod, acc, n * sizeof(mp_limb_t));
+	memset(prod + n, 0, n * sizeof(mp_limb_t));
+	redc(comb, acc, prod);
+	borrow = mpn_sub_n(entry, acc, comb->p, n);
+	mpn_cnd_sub_n(borrow == 0, acc, acc, comb->p, n);
+
+	mpz_import(r, n, -1, sizeof(mp_limb_t), 0, 0, acc);
+	memwipe(acc, len * sizeof(mp_limb_t));
+	free(acc);
+}
+
+#endif /* HAVE_MPN_SEC_TABSELECT */
+
 typedef struct private_gmp_diffie_hellman_t private_gmp_diffie_hellman_t;
 
 /**
@@ -90,6 +345,7 @@ METHOD(diffie_hellman_t, set_other_public_value, void,
 {
 	mpz_t p_min_1;
 
+	this->computed = FALSE;
 	mpz_init(p_min_1);
 	mpz_sub_ui(p_min_1, this->p, 1);
 
@@ -198,6 +454,9 @@ static gmp_diffie_hellman_t *create_generic(diffie_hellman_group_t group,
 	private_gmp_diffie_hellman_t *this;
 	chunk_t random;
 	rng_t *rng;
+#ifdef HAVE_MPN_SEC_TABSELECT
+	comb_t *comb;
+#endif
 
 	INIT(this,
 		.public = {
@@ -249,6 +508,14 @@ static gmp_diffie_hellman_t *create_generic(diffie_hellman_group_t group,
 	DBG2(DBG_LIB, "size of DH secret exponent: %u bits",
 		 mpz_sizeinbase(this->xa, 2));
 
+#ifdef HAVE_MPN_SEC_TABSELECT
+	comb = group == MODP_CUSTOM ? NULL : get_comb(group, exp_len * 8);
+	if (comb)
+	{
+		comb_powm(comb, this->ya, this->xa);
+		return &this->public;
+	}
+#endif
 	mpz_powm(this->ya, this->g, this->xa, this->p);
 
 	return &this->public;
@@ -280,3 +547,33 @@ gmp_diffie_hellman_t *gmp_diffie_hellman_create_custom(
 	}
 	return NULL;
 }
+
+/*
+ * Described in header.
+ */
+void gmp_diffie_hellman_init()
+{
+#ifdef HAVE_MPN_SEC_TABSELECT
+	combs_mutex = mutex_create(MUTEX_TYPE_DEFAULT);
+#endif
+}
+
+/*
+ * Described in header.
+ */
+void gmp_diffie_hellman_deinit()
+{
+#ifdef HAVE_MPN_SEC_TABSELECT
+	comb_t *comb;
+
+	while (combs)
+	{
+		comb = combs;
+		combs = comb->next;
+		free(comb->table);
+		free(comb->p);
+		free(comb);
+	}
+	combs_mutex->destroy(combs_mutex);
+#endif
+}
@@ -118,6 +118,7 @@ METHOD(plugin_t, get_features, int,
 METHOD(plugin_t, destroy, void,
 	private_gmp_plugin_t *this)
 {
+	gmp_diffie_hellman_deinit();
 	free(this);
 }
 
@@ -137,6 +138,7 @@ plugin_t *gmp_plugin_create()
 			},
 		},
 	);
+	gmp_diffie_hellman_init();
 
 	return &this->public.plugin;
 }
@@ -91,6 +91,7 @@ METHOD(diffie_hellman_t, set_other_public_value, void,
 {
 	int len;
 
+	this->computed = FALSE;
 	BN_bin2bn(value.ptr, value.len, this->pub_key);
 	chunk_clear(&this->shared_secret);
 	this->shared_secret.ptr = malloc(DH_size(this->dh));
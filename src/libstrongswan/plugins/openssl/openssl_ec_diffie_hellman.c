@@ -213,6 +213,7 @@ error:
 METHOD(diffie_hellman_t, set_other_public_value, void,
 	private_openssl_ec_diffie_hellman_t *this, chunk_t value)
 {
+	this->computed = FALSE;
 	if (!chunk2ecp(this->ec_group, value, this->pub_key))
 	{
 		DBG1(DBG_LIB, "ECDH public value is malformed");
@@ -115,6 +115,7 @@ static void derive_secret(private_pkcs11_dh_t *this, chunk_t other)
 METHOD(diffie_hellman_t, set_other_public_value, void,
 	private_pkcs11_dh_t *this, chunk_t value)
 {
+	chunk_clear(&this->secret);
 	switch (this->group)
 	{
 		case ECP_192_BIT:
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "processor.h"
 
@@ -31,6 +32,24 @@
 
 typedef struct private_processor_t private_processor_t;
 
+/**
+ * A queue of jobs, workers take jobs from their own queue first, but steal
+ * from the other queues if their queue is empty.
+ */
+typedef struct {
+
+	/**
+	 * A list of queued jobs for each priority
+	 */
+	linked_list_t *jobs[JOB_PRIO_MAX];
+
+	/**
+	 * Lock for the job lists
+	 */
+	mutex_t *mutex;
+
+} job_queue_t;
+
 /**
  * Private data of processor_t class.
  */
@@ -54,7 +73,7 @@ struct private_processor_t {
 	/**
 	 * Number of threads currently working, for each priority
 	 */
-	u_int working_threads[JOB_PRIO_MAX];
+	refcount_t working_threads[JOB_PRIO_MAX];
 
 	/**
 	 * All threads managed in the pool (including threads that have been
@@ -63,9 +82,34 @@ struct private_processor_t {
 	linked_list_t *threads;
 
 	/**
-	 * A list of queued jobs for each priority
+	 * Job queues, by default one per CPU
 	 */
-	linked_list_t *jobs[JOB_PRIO_MAX];
+	job_queue_t *queues;
+
+	/**
+	 * Number of job queues
+	 */
+	u_int queue_count;
+
+	/**
+	 * Queue to add the next job to
+	 */
+	refcount_t next_queue;
+
+	/**
+	 * Queue assigned to the next worker thread
+	 */
+	u_int next_home;
+
+	/**
+	 * Number of queued jobs over all queues, for each priority
+	 */
+	refcount_t queued[JOB_PRIO_MAX];
+
+	/**
+	 * Number of threads waiting on the job_added condvar
+	 */
+	refcount_t sleeping;
 
 	/**
 	 * Threads reserved for each priority
@@ -73,7 +117,13 @@ struct private_processor_t {
 	int prio_threads[JOB_PRIO_MAX];
 
 	/**
-	 * access to job lists is locked through this mutex
+	 * TRUE if threads are reserved for any priority
+	 */
+	bool reserve;
+
+	/**
+	 * Lock for thread management, waiting for jobs and, if threads are
+	 * reserved, for taking jobs
 	 */
 	mutex_t *mutex;
 
@@ -113,10 +163,53 @@ typedef struct {
 	 */
 	job_priority_t priority;
 
+	/**
+	 * Index of the queue this worker takes jobs from first
+	 */
+	u_int home;
+
+	/**
+	 * Protects job against concurrent access by cancel()
+	 */
+	mutex_t *mutex;
+
 } worker_thread_t;
 
 static void process_jobs(worker_thread_t *worker);
 
+/**
+ * Create a worker thread, this->mutex must be held
+ */
+static worker_thread_t *create_worker(private_processor_t *this)
+{
+	worker_thread_t *worker;
+
+	INIT(worker,
+		.processor = this,
+		.home = this->next_home++ % this->queue_count,
+		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
+	);
+	worker->thread = thread_create((thread_main_t)process_jobs, worker);
+	if (!worker->thread)
+	{
+		worker->mutex->destroy(worker->mutex);
+		free(worker);
+		return NULL;
+	}
+	this->threads->insert_last(this->threads, worker);
+	return worker;
+}
+
+/**
+ * Destroy a worker thread after joining it
+ */
+static void destroy_worker(worker_thread_t *worker)
+{
+	worker->thread->join(worker->thread);
+	worker->mutex->destroy(worker->mutex);
+	free(worker);
+}
+
 /**
  * restart a terminated thread
  */
@@ -126,30 +219,21 @@ static void restart(worker_thread_t *worker)
 
 	DBG2(DBG_JOB, "terminated worker thread %.2u", thread_current_id());
 
-	this->mutex->lock(this->mutex);
 	/* cleanup worker thread  */
-	this->working_threads[worker->priority]--;
+	ignore_result(ref_put(&this->working_threads[worker->priority]));
+	worker->mutex->lock(worker->mutex);
 	worker->job->status = JOB_STATUS_CANCELED;
 	worker->job->destroy(worker->job);
 	worker->job = NULL;
+	worker->mutex->unlock(worker->mutex);
 
+	this->mutex->lock(this->mutex);
 	/* respawn thread if required */
-	if (this->desired_threads >= this->total_threads)
+	if (this->desired_threads >= this->total_threads &&
+		create_worker(this))
 	{
-		worker_thread_t *new_worker;
-
-		INIT(new_worker,
-			.processor = this,
-		);
-		new_worker->thread = thread_create((thread_main_t)process_jobs,
-										   new_worker);
-		if (new_worker->thread)
-		{
-			this->threads->insert_last(this->threads, new_worker);
-			this->mutex->unlock(this->mutex);
-			return;
-		}
-		free(new_worker);
+		this->mutex->unlock(this->mutex);
+		return;
 	}
 	this->total_threads--;
 	this->thread_terminated->signal(this->thread_terminated);
@@ -171,113 +255,208 @@ static u_int get_idle_threads_nolock(private_processor_t *this)
 	return count;
 }
 
+/**
+ * Add a job to a queue and wake up a waiting thread
+ */
+static void enqueue(private_processor_t *this, job_queue_t *queue,
+					job_priority_t prio, job_t *job)
+{
+	queue->mutex->lock(queue->mutex);
+	/* the atomic increment acts as barrier, so either we see a thread that
+	 * is about to wait below, or it sees the increased job count */
+	ref_get(&this->queued[prio]);
+	queue->jobs[prio]->insert_last(queue->jobs[prio], job);
+	queue->mutex->unlock(queue->mutex);
+
+	if (this->sleeping)
+	{
+		this->mutex->lock(this->mutex);
+		this->job_added->signal(this->job_added);
+		this->mutex->unlock(this->mutex);
+	}
+}
+
+/**
+ * Take a job of the given priority, from the worker's own queue if possible,
+ * otherwise steal it from one of the other queues. If peek is TRUE, queues
+ * that seem empty are not locked.
+ */
+static bool dequeue(private_processor_t *this, worker_thread_t *worker,
+					job_priority_t prio, bool peek)
+{
+	job_queue_t *queue;
+	job_t *job = NULL;
+	u_int i;
+
+	for (i = 0; i < this->queue_count && this->queued[prio]; i++)
+	{
+		queue = &this->queues[(worker->home + i) % this->queue_count];
+		if (peek && !queue->jobs[prio]->get_count(queue->jobs[prio]))
+		{
+			continue;
+		}
+		queue->mutex->lock(queue->mutex);
+		queue->jobs[prio]->remove_first(queue->jobs[prio], (void**)&job);
+		queue->mutex->unlock(queue->mutex);
+		if (job)
+		{
+			ignore_result(ref_put(&this->queued[prio]));
+			ref_get(&this->working_threads[prio]);
+			job->status = JOB_STATUS_EXECUTING;
+			worker->priority = prio;
+			/* no need to lock, cancel() only needs the mutex to prevent us
+			 * from destroying the job while it accesses it */
+			worker->job = job;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/**
+ * Take the next job to execute, if threads are reserved for higher
+ * priorities this->mutex must be held. Before waiting for jobs this has to be
+ * called with peek set to FALSE.
+ */
+static bool get_job(private_processor_t *this, worker_thread_t *worker,
+					bool peek)
+{
+	int i, reserved = 0, idle;
+
+	idle = get_idle_threads_nolock(this);
+
+	for (i = 0; i < JOB_PRIO_MAX; i++)
+	{
+		if (reserved && reserved >= idle)
+		{
+			DBG2(DBG_JOB, "delaying %N priority jobs: %d threads idle, "
+				 "but %d reserved for higher priorities",
+				 job_priority_names, i, idle, reserved);
+			break;
+		}
+		if (this->working_threads[i] < this->prio_threads[i])
+		{
+			reserved += this->prio_threads[i] - this->working_threads[i];
+		}
+		if (dequeue(this, worker, i, peek))
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/**
+ * Execute the job taken by a worker thread
+ */
+static void execute_job(private_processor_t *this, worker_thread_t *worker)
+{
+	job_requeue_t requeue;
+	job_priority_t i = worker->priority;
+	job_t *job = worker->job;
+
+	/* canceled threads are restarted to get a constant pool */
+	thread_cleanup_push((thread_cleanup_t)restart, worker);
+	while (TRUE)
+	{
+		requeue = job->execute(job);
+		if (requeue.type != JOB_REQUEUE_TYPE_DIRECT)
+		{
+			break;
+		}
+		else if (!job->cancel)
+		{	/* only allow cancelable jobs to requeue directly */
+			requeue.type = JOB_REQUEUE_TYPE_FAIR;
+			break;
+		}
+	}
+	thread_cleanup_pop(FALSE);
+
+	ignore_result(ref_put(&this->working_threads[i]));
+
+	worker->mutex->lock(worker->mutex);
+	worker->job = NULL;
+	if (job->status == JOB_STATUS_CANCELED)
+	{	/* job was canceled via a custom cancel() method or did not
+		 * use JOB_REQUEUE_TYPE_DIRECT */
+		worker->mutex->unlock(worker->mutex);
+		job->destroy(job);
+		return;
+	}
+	worker->mutex->unlock(worker->mutex);
+
+	switch (requeue.type)
+	{
+		case JOB_REQUEUE_TYPE_NONE:
+			job->status = JOB_STATUS_DONE;
+			job->destroy(job);
+			break;
+		case JOB_REQUEUE_TYPE_FAIR:
+			job->status = JOB_STATUS_QUEUED;
+			enqueue(this, &this->queues[worker->home], i, job);
+			break;
+		case JOB_REQUEUE_TYPE_SCHEDULE:
+			switch (requeue.schedule)
+			{
+				case JOB_SCHEDULE:
+					lib->scheduler->schedule_job(lib->scheduler, job,
+												 requeue.time.rel);
+					break;
+				case JOB_SCHEDULE_MS:
+					lib->scheduler->schedule_job_ms(lib->scheduler, job,
+													requeue.time.rel);
+					break;
+				case JOB_SCHEDULE_TV:
+					lib->scheduler->schedule_job_tv(lib->scheduler, job,
+													requeue.time.abs);
+					break;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
 /**
  * Process queued jobs, called by the worker threads
  */
 static void process_jobs(worker_thread_t *worker)
 {
 	private_processor_t *this = worker->processor;
+	bool found;
 
 	/* worker threads are not cancelable by default */
 	thread_cancelability(FALSE);
 
 	DBG2(DBG_JOB, "started worker thread %.2u", thread_current_id());
 
-	this->mutex->lock(this->mutex);
-	while (this->desired_threads >= this->total_threads)
+	while (TRUE)
 	{
-		int i, reserved = 0, idle;
-
-		idle = get_idle_threads_nolock(this);
-
-		for (i = 0; i < JOB_PRIO_MAX; i++)
+		found = FALSE;
+		if (!this->reserve && this->desired_threads >= this->total_threads)
+		{	/* without reserved threads jobs are taken without locking the
+			 * processor, only the job queues get locked */
+			found = get_job(this, worker, TRUE);
+		}
+		if (!found)
 		{
-			if (reserved && reserved >= idle)
+			this->mutex->lock(this->mutex);
+			if (this->desired_threads < this->total_threads)
 			{
-				DBG2(DBG_JOB, "delaying %N priority jobs: %d threads idle, "
-					 "but %d reserved for higher priorities",
-					 job_priority_names, i, idle, reserved);
 				break;
 			}
-			if (this->working_threads[i] < this->prio_threads[i])
+			ref_get(&this->sleeping);
+			if (!get_job(this, worker, FALSE))
 			{
-				reserved += this->prio_threads[i] - this->working_threads[i];
-			}
-			if (this->jobs[i]->remove_first(this->jobs[i],
-											(void**)&worker->job) == SUCCESS)
-			{
-				job_requeue_t requeue;
-
-				this->working_threads[i]++;
-				worker->job->status = JOB_STATUS_EXECUTING;
-				worker->priority = i;
-				this->mutex->unlock(this->mutex);
-				/* canceled threads are restarted to get a constant pool */
-				thread_cleanup_push((thread_cleanup_t)restart, worker);
-				while (TRUE)
-				{
-					requeue = worker->job->execute(worker->job);
-					if (requeue.type != JOB_REQUEUE_TYPE_DIRECT)
-					{
-						break;
-					}
-					else if (!worker->job->cancel)
-					{	/* only allow cancelable jobs to requeue directly */
-						requeue.type = JOB_REQUEUE_TYPE_FAIR;
-						break;
-					}
-				}
-				thread_cleanup_pop(FALSE);
-				this->mutex->lock(this->mutex);
-				this->working_threads[i]--;
-				if (worker->job->status == JOB_STATUS_CANCELED)
-				{	/* job was canceled via a custom cancel() method or did not
-					 * use JOB_REQUEUE_TYPE_DIRECT */
-					worker->job->destroy(worker->job);
-					break;
-				}
-				switch (requeue.type)
-				{
-					case JOB_REQUEUE_TYPE_NONE:
-						worker->job->status = JOB_STATUS_DONE;
-						worker->job->destroy(worker->job);
-						break;
-					case JOB_REQUEUE_TYPE_FAIR:
-						worker->job->status = JOB_STATUS_QUEUED;
-						this->jobs[i]->insert_last(this->jobs[i],
-												   worker->job);
-						this->job_added->signal(this->job_added);
-						break;
-					case JOB_REQUEUE_TYPE_SCHEDULE:
-						/* scheduler_t does not hold its lock when queeuing jobs
-						 * so this should be safe without unlocking our mutex */
-						switch (requeue.schedule)
-						{
-							case JOB_SCHEDULE:
-								lib->scheduler->schedule_job(lib->scheduler,
-											worker->job, requeue.time.rel);
-								break;
-							case JOB_SCHEDULE_MS:
-								lib->scheduler->schedule_job_ms(lib->scheduler,
-											worker->job, requeue.time.rel);
-								break;
-							case JOB_SCHEDULE_TV:
-								lib->scheduler->schedule_job_tv(lib->scheduler,
-											worker->job, requeue.time.abs);
-								break;
-						}
-						break;
-					default:
-						break;
-				}
-				break;
+				this->job_added->wait(this->job_added, this->mutex);
 			}
+			ignore_result(ref_put(&this->sleeping));
+			this->mutex->unlock(this->mutex);
 		}
-		if (!worker->job)
+		if (worker->job)
 		{
-			this->job_added->wait(this->job_added, this->mutex);
+			execute_job(this, worker);
 		}
-		worker->job = NULL;
 	}
 	this->total_threads--;
 	this->thread_terminated->signal(this->thread_terminated);
@@ -321,38 +500,27 @@ static job_priority_t sane_prio(job_priority_t prio)
 METHOD(processor_t, get_working_threads, u_int,
 	private_processor_t *this, job_priority_t prio)
 {
-	u_int count;
-
-	this->mutex->lock(this->mutex);
-	count = this->working_threads[sane_prio(prio)];
-	this->mutex->unlock(this->mutex);
-	return count;
+	return this->working_threads[sane_prio(prio)];
 }
 
 METHOD(processor_t, get_job_load, u_int,
 	private_processor_t *this, job_priority_t prio)
 {
-	u_int load;
-
-	prio = sane_prio(prio);
-	this->mutex->lock(this->mutex);
-	load = this->jobs[prio]->get_count(this->jobs[prio]);
-	this->mutex->unlock(this->mutex);
-	return load;
+	return this->queued[sane_prio(prio)];
 }
 
 METHOD(processor_t, queue_job, void,
 	private_processor_t *this, job_t *job)
 {
+	job_queue_t *queue;
 	job_priority_t prio;
 
 	prio = sane_prio(job->get_priority(job));
 	job->status = JOB_STATUS_QUEUED;
 
-	this->mutex->lock(this->mutex);
-	this->jobs[prio]->insert_last(this->jobs[prio], job);
-	this->job_added->signal(this->job_added);
-	this->mutex->unlock(this->mutex);
+	/* distribute jobs round-robin, idle threads steal them if necessary */
+	queue = &this->queues[ref_get(&this->next_queue) % this->queue_count];
+	enqueue(this, queue, prio, job);
 }
 
 METHOD(processor_t, set_threads, void,
@@ -361,26 +529,16 @@ METHOD(processor_t, set_threads, void,
 	this->mutex->lock(this->mutex);
 	if (count > this->total_threads)
 	{	/* increase thread count */
-		worker_thread_t *worker;
 		int i;
 
 		this->desired_threads = count;
 		DBG1(DBG_JOB, "spawning %d worker threads", count - this->total_threads);
 		for (i = this->total_threads; i < count; i++)
 		{
-			INIT(worker,
-				.processor = this,
-			);
-			worker->thread = thread_create((thread_main_t)process_jobs, worker);
-			if (worker->thread)
+			if (create_worker(this))
 			{
-				this->threads->insert_last(this->threads, worker);
 				this->total_threads++;
 			}
-			else
-			{
-				free(worker);
-			}
 		}
 	}
 	else if (count < this->total_threads)
@@ -403,6 +561,7 @@ METHOD(processor_t, cancel, void,
 	enumerator = this->threads->create_enumerator(this->threads);
 	while (enumerator->enumerate(enumerator, (void**)&worker))
 	{
+		worker->mutex->lock(worker->mutex);
 		if (worker->job && worker->job->cancel)
 		{
 			worker->job->status = JOB_STATUS_CANCELED;
@@ -412,6 +571,7 @@ METHOD(processor_t, cancel, void,
 				worker->thread->cancel(worker->thread);
 			}
 		}
+		worker->mutex->unlock(worker->mutex);
 	}
 	enumerator->destroy(enumerator);
 	while (this->total_threads > 0)
@@ -422,8 +582,7 @@ METHOD(processor_t, cancel, void,
 	while (this->threads->remove_first(this->threads,
 									  (void**)&worker) == SUCCESS)
 	{
-		worker->thread->join(worker->thread);
-		free(worker);
+		destroy_worker(worker);
 	}
 	this->mutex->unlock(this->mutex);
 }
@@ -431,16 +590,24 @@ METHOD(processor_t, cancel, void,
 METHOD(processor_t, destroy, void,
 	private_processor_t *this)
 {
-	int i;
+	job_queue_t *queue;
+	int i, j;
 
 	cancel(this);
 	this->thread_terminated->destroy(this->thread_terminated);
 	this->job_added->destroy(this->job_added);
 	this->mutex->destroy(this->mutex);
-	for (i = 0; i < JOB_PRIO_MAX; i++)
+	for (i = 0; i < this->queue_count; i++)
 	{
-		this->jobs[i]->destroy_offset(this->jobs[i], offsetof(job_t, destroy));
+		queue = &this->queues[i];
+		for (j = 0; j < JOB_PRIO_MAX; j++)
+		{
+			queue->jobs[j]->destroy_offset(queue->jobs[j],
+										   offsetof(job_t, destroy));
+		}
+		queue->mutex->destroy(queue->mutex);
 	}
+	free(this->queues);
 	this->threads->destroy(this->threads);
 	free(this);
 }
@@ -451,7 +618,8 @@ METHOD(processor_t, destroy, void,
 processor_t *processor_create()
 {
 	private_processor_t *this;
-	int i;
+	job_queue_t *queue;
+	int i, j;
 
 	INIT(this,
 		.public = {
@@ -471,10 +639,27 @@ processor_t *processor_create()
 	);
 	for (i = 0; i < JOB_PRIO_MAX; i++)
 	{
-		this->jobs[i] = linked_list_create();
 		this->prio_threads[i] = lib->settings->get_int(lib->settings,
 						"libstrongswan.processor.priority_threads.%N", 0,
 						job_priority_names, i);
+		this->reserve = this->reserve || this->prio_threads[i] > 0;
+	}
+
+	this->queue_count = lib->settings->get_int(lib->settings,
+						"libstrongswan.processor.queues", 0);
+	if (!this->queue_count)
+	{
+		this->queue_count = max(sysconf(_SC_NPROCESSORS_ONLN), 1);
+	}
+	this->queues = calloc(this->queue_count, sizeof(job_queue_t));
+	for (i = 0; i < this->queue_count; i++)
+	{
+		queue = &this->queues[i];
+		for (j = 0; j < JOB_PRIO_MAX; j++)
+		{
+			queue->jobs[j] = linked_list_create();
+		}
+		queue->mutex = mutex_create(MUTEX_TYPE_DEFAULT);
 	}
 
 	return &this->public;
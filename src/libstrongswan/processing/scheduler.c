@@ -16,6 +16,7 @@
  */
 
 #include <stdlib.h>
+#include <strings.h>
 
 #include "scheduler.h"
 
@@ -25,9 +26,25 @@
 #include <threading/thread.h>
 #include <threading/condvar.h>
 #include <threading/mutex.h>
+#include <collections/hashtable.h>
 
-/* the initial size of the heap */
-#define HEAP_SIZE_DEFAULT 64
+/* number of bits of the tick used as index in each wheel level */
+#define WHEEL_BITS 8
+
+/* number of slots per wheel level */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+/* mask to get the slot index from a tick */
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+/* number of levels, events further in the future go to the overflow list */
+#define WHEEL_LEVELS 4
+
+/* number of 32-bit words in the bitmap of a level */
+#define BITMAP_WORDS (WHEEL_SLOTS / 32)
+
+/* tick value used if there is no next event */
+#define TICK_NONE (~(u_int64_t)0)
 
 typedef struct event_t event_t;
 
@@ -36,14 +53,39 @@ typedef struct event_t event_t;
  */
 struct event_t {
 	/**
-	 * Time to fire the event.
+	 * Tick (ms based on time_monotonic()) at which to fire the event.
 	 */
-	timeval_t time;
+	u_int64_t tick;
 
 	/**
 	 * Every event has its assigned job.
 	 */
 	job_t *job;
+
+	/**
+	 * ID to unschedule the event, 0 if it can't be unscheduled
+	 */
+	u_int64_t id;
+
+	/**
+	 * Level this event is stored in, WHEEL_LEVELS for the overflow list
+	 */
+	u_int level;
+
+	/**
+	 * Slot this event is stored in
+	 */
+	u_int slot;
+
+	/**
+	 * Next event in the same slot
+	 */
+	event_t *next;
+
+	/**
+	 * Previous event in the same slot
+	 */
+	event_t *prev;
 };
 
 /**
@@ -68,22 +110,47 @@ struct private_scheduler_t {
 	 scheduler_t public;
 
 	/**
-	 * The heap in which the events are stored.
+	 * Slots of each level of the timing wheel, as list of events
+	 */
+	event_t *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+	/**
+	 * Bitmap of non-empty slots of each level
 	 */
-	event_t **heap;
+	u_int32_t bitmap[WHEEL_LEVELS][BITMAP_WORDS];
 
 	/**
-	 * The size of the heap.
+	 * Events scheduled too far in the future to fit into the wheel
 	 */
-	u_int heap_size;
+	event_t *overflow;
 
 	/**
-	 * The number of scheduled events.
+	 * The next tick to process
 	 */
-	u_int event_count;
+	u_int64_t current;
 
 	/**
-	 * Exclusive access to list
+	 * The tick at which the scheduler thread wakes up next
+	 */
+	u_int64_t wakeup;
+
+	/**
+	 * Events that can be unscheduled, u_int64_t* => event_t
+	 */
+	hashtable_t *events;
+
+	/**
+	 * ID assigned to the next event that can be unscheduled
+	 */
+	u_int64_t next_id;
+
+	/**
+	 * Number of scheduled events
+	 */
+	u_int count;
+
+	/**
+	 * Exclusive access to the wheel
 	 */
 	mutex_t *mutex;
 
@@ -94,134 +161,288 @@ struct private_scheduler_t {
 };
 
 /**
- * Comparse two timevals, return >0 if a > b, <0 if a < b and =0 if equal
+ * Convert a timeval to a tick, rounded up so events never fire early
+ */
+static u_int64_t tv2tick(timeval_t *tv)
+{
+	return (u_int64_t)tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+}
+
+/**
+ * Convert a tick to a timeval
+ */
+static timeval_t tick2tv(u_int64_t tick)
+{
+	timeval_t tv = {
+		.tv_sec = tick / 1000,
+		.tv_usec = (tick % 1000) * 1000,
+	};
+	return tv;
+}
+
+/**
+ * Get the current tick, rounded down
+ */
+static u_int64_t now_tick()
+{
+	timeval_t tv;
+
+	time_monotonic(&tv);
+	return (u_int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/**
+ * Find the next non-empty slot of a level, starting at the given slot and
+ * wrapping around. Returns the distance to the found slot, -1 if all are empty.
  */
-static int timeval_cmp(timeval_t *a, timeval_t *b)
+static int find_slot(u_int32_t *bitmap, u_int start)
 {
-	if (a->tv_sec > b->tv_sec)
+	u_int32_t bits;
+	u_int i, word;
+
+	for (i = 0; i <= BITMAP_WORDS; i++)
 	{
-		return 1;
+		word = (start / 32 + i) % BITMAP_WORDS;
+		bits = bitmap[word];
+		if (i == 0)
+		{	/* ignore slots before start in the first word */
+			bits &= ~0U << (start % 32);
+		}
+		else if (i == BITMAP_WORDS)
+		{	/* only the slots before start after wrapping around */
+			bits &= (1U << (start % 32)) - 1;
+		}
+		if (bits)
+		{
+			return (word * 32 + ffs(bits) - 1 - start) & WHEEL_MASK;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Add an event to the wheel relative to the current tick
+ */
+static void insert_event(private_scheduler_t *this, event_t *event)
+{
+	event_t **head = &this->overflow;
+	u_int64_t delta;
+	u_int level;
+
+	if (event->tick < this->current)
+	{	/* already due, fire with the next tick */
+		event->tick = this->current;
 	}
-	if (a->tv_sec < b->tv_sec)
+	delta = event->tick - this->current;
+
+	event->level = WHEEL_LEVELS;
+	for (level = 0; level < WHEEL_LEVELS; level++)
 	{
-		return -1;
+		if (delta < ((u_int64_t)1 << ((level + 1) * WHEEL_BITS)))
+		{
+			event->level = level;
+			event->slot = (event->tick >> (level * WHEEL_BITS)) & WHEEL_MASK;
+			head = &this->wheel[level][event->slot];
+			this->bitmap[level][event->slot / 32] |= 1U << (event->slot % 32);
+			break;
+		}
 	}
-	if (a->tv_usec > b->tv_usec)
+	event->prev = NULL;
+	event->next = *head;
+	if (event->next)
 	{
-		return 1;
+		event->next->prev = event;
 	}
-	if (a->tv_usec < b->tv_usec)
+	*head = event;
+}
+
+/**
+ * Remove an event from the wheel
+ */
+static void remove_event(private_scheduler_t *this, event_t *event)
+{
+	event_t **head = &this->overflow;
+
+	if (event->level < WHEEL_LEVELS)
+	{
+		head = &this->wheel[event->level][event->slot];
+	}
+	if (event->prev)
+	{
+		event->prev->next = event->next;
+	}
+	else
+	{
+		*head = event->next;
+	}
+	if (event->next)
+	{
+		event->next->prev = event->prev;
+	}
+	if (event->level < WHEEL_LEVELS && !*head)
 	{
-		return -1;
+		this->bitmap[event->level][event->slot / 32] &=
+											~(1U << (event->slot % 32));
 	}
-	return 0;
 }
 
 /**
- * Returns the top event without removing it. Returns NULL if the heap is empty.
+ * Take all events from a slot, returns them as list
  */
-static event_t *peek_event(private_scheduler_t *this)
+static event_t *take_slot(private_scheduler_t *this, u_int level, u_int slot)
 {
-	return this->event_count > 0 ? this->heap[1] : NULL;
+	event_t *events;
+
+	events = this->wheel[level][slot];
+	this->wheel[level][slot] = NULL;
+	this->bitmap[level][slot / 32] &= ~(1U << (slot % 32));
+	return events;
 }
 
 /**
- * Removes the top event from the heap and returns it. Returns NULL if the heap
- * is empty.
+ * Move the events of a list to their new slots relative to the current tick
  */
-static event_t *remove_event(private_scheduler_t *this)
+static void cascade(private_scheduler_t *this, event_t *events)
 {
-	event_t *event, *top;
-	if (!this->event_count)
+	event_t *event;
+
+	while (events)
 	{
-		return NULL;
+		event = events;
+		events = events->next;
+		insert_event(this, event);
 	}
+}
 
-	/* store the value to return */
-	event = this->heap[1];
-	/* move the bottom event to the top */
-	top = this->heap[1] = this->heap[this->event_count];
+/**
+ * Get the next tick at which events have to be fired or moved to a lower
+ * level, TICK_NONE if no events are scheduled
+ */
+static u_int64_t next_tick(private_scheduler_t *this)
+{
+	u_int64_t tick = TICK_NONE, block;
+	u_int level, shift;
+	int distance;
 
-	if (--this->event_count > 1)
+	distance = find_slot(this->bitmap[0], this->current & WHEEL_MASK);
+	if (distance >= 0)
+	{
+		tick = this->current + distance;
+	}
+	for (level = 1; level < WHEEL_LEVELS; level++)
 	{
-		/* seep down the top event */
-		u_int position = 1;
-		while ((position << 1) <= this->event_count)
+		/* unless we are exactly at its start, the slot of the current block
+		 * has already been moved down, events in it belong to the next round */
+		shift = level * WHEEL_BITS;
+		block = (this->current + ((u_int64_t)1 << shift) - 1) >> shift;
+		distance = find_slot(this->bitmap[level], block & WHEEL_MASK);
+		if (distance >= 0)
 		{
-			u_int child = position << 1;
+			tick = min(tick, (block + distance) << shift);
+		}
+	}
+	if (this->overflow)
+	{
+		shift = WHEEL_LEVELS * WHEEL_BITS;
+		block = (this->current + ((u_int64_t)1 << shift) - 1) >> shift;
+		tick = min(tick, block << shift);
+	}
+	return tick;
+}
 
-			if ((child + 1) <= this->event_count &&
-				timeval_cmp(&this->heap[child + 1]->time,
-							&this->heap[child]->time) < 0)
-			{
-				/* the "right" child is smaller */
-				child++;
-			}
+/**
+ * Advance the wheel to the given tick, returns the events due at this tick
+ */
+static event_t *advance(private_scheduler_t *this, u_int64_t tick)
+{
+	u_int level, shift;
 
-			if (timeval_cmp(&top->time, &this->heap[child]->time) <= 0)
-			{
-				/* the top event fires before the smaller of the two children,
-				 * stop */
-				break;
-			}
+	this->current = tick;
+
+	shift = WHEEL_LEVELS * WHEEL_BITS;
+	if (!(tick & (((u_int64_t)1 << shift) - 1)))
+	{
+		event_t *overflow = this->overflow;
 
-			/* swap with the smaller child */
-			this->heap[position] = this->heap[child];
-			position = child;
+		this->overflow = NULL;
+		cascade(this, overflow);
+	}
+	for (level = WHEEL_LEVELS - 1; level > 0; level--)
+	{
+		shift = level * WHEEL_BITS;
+		if (!(tick & (((u_int64_t)1 << shift) - 1)))
+		{
+			cascade(this, take_slot(this, level,
+									(tick >> shift) & WHEEL_MASK));
 		}
-		this->heap[position] = top;
 	}
-	return event;
+	this->current = tick + 1;
+	return take_slot(this, 0, tick & WHEEL_MASK);
 }
 
 /**
- * Get events from the queue and pass it to the processor
+ * Get events from the wheel and pass them to the processor
  */
 static job_requeue_t schedule(private_scheduler_t * this)
 {
-	timeval_t now;
-	event_t *event;
-	bool timed = FALSE, oldstate;
+	event_t *due = NULL, *events, *event;
+	u_int64_t now, tick;
+	bool oldstate;
+	u_int count = 0;
 
 	this->mutex->lock(this->mutex);
 
-	time_monotonic(&now);
+	now = now_tick();
+	while ((tick = next_tick(this)) <= now)
+	{
+		events = advance(this, tick);
+		while (events)
+		{
+			event = events;
+			events = events->next;
+			if (event->id)
+			{
+				this->events->remove(this->events, &event->id);
+			}
+			this->count--;
+			event->next = due;
+			due = event;
+			count++;
+		}
+	}
+	/* all slots up to now are empty, so we can skip ahead */
+	this->current = max(this->current, now + 1);
 
-	if ((event = peek_event(this)) != NULL)
+	if (due)
 	{
-		if (timeval_cmp(&now, &event->time) >= 0)
+		this->mutex->unlock(this->mutex);
+		DBG2(DBG_JOB, "got %u events, queuing jobs for execution", count);
+		while (due)
 		{
-			remove_event(this);
-			this->mutex->unlock(this->mutex);
-			DBG2(DBG_JOB, "got event, queuing job for execution");
+			event = due;
+			due = due->next;
 			lib->processor->queue_job(lib->processor, event->job);
 			free(event);
-			return JOB_REQUEUE_DIRECT;
-		}
-		timersub(&event->time, &now, &now);
-		if (now.tv_sec)
-		{
-			DBG2(DBG_JOB, "next event in %ds %dms, waiting",
-				 now.tv_sec, now.tv_usec/1000);
 		}
-		else
-		{
-			DBG2(DBG_JOB, "next event in %dms, waiting", now.tv_usec/1000);
-		}
-		timed = TRUE;
+		return JOB_REQUEUE_DIRECT;
 	}
+
+	this->wakeup = tick;
 	thread_cleanup_push((thread_cleanup_t)this->mutex->unlock, this->mutex);
 	oldstate = thread_cancelability(TRUE);
 
-	if (timed)
+	if (tick != TICK_NONE)
 	{
-		this->condvar->timed_wait_abs(this->condvar, this->mutex, event->time);
+		DBG2(DBG_JOB, "next event in %ums, waiting", (u_int)(tick - now));
+		this->condvar->timed_wait_abs(this->condvar, this->mutex,
+									  tick2tv(tick));
 	}
 	else
 	{
 		DBG2(DBG_JOB, "no events, waiting");
 		this->condvar->wait(this->condvar, this->mutex);
 	}
+	this->wakeup = 0;
 	thread_cancelability(oldstate);
 	thread_cleanup_pop(TRUE);
 	return JOB_REQUEUE_DIRECT;
@@ -230,49 +451,49 @@ static job_requeue_t schedule(private_scheduler_t * this)
 METHOD(scheduler_t, get_job_load, u_int,
 	private_scheduler_t *this)
 {
-	int count;
+	u_int count;
+
 	this->mutex->lock(this->mutex);
-	count = this->event_count;
+	count = this->count;
 	this->mutex->unlock(this->mutex);
 	return count;
 }
 
-METHOD(scheduler_t, schedule_job_tv, void,
-	private_scheduler_t *this, job_t *job, timeval_t tv)
+/**
+ * Schedule a job, returns the ID of the event if it should be unschedulable
+ */
+static u_int64_t schedule_event(private_scheduler_t *this, job_t *job,
+								timeval_t tv, bool unschedulable)
 {
 	event_t *event;
-	u_int position;
+	u_int64_t id = 0;
 
-	event = malloc_thing(event_t);
-	event->job = job;
-	event->job->status = JOB_STATUS_QUEUED;
-	event->time = tv;
+	INIT(event,
+		.job = job,
+		.tick = tv2tick(&tv),
+	);
+	job->status = JOB_STATUS_QUEUED;
 
 	this->mutex->lock(this->mutex);
-
-	this->event_count++;
-	if (this->event_count > this->heap_size)
+	insert_event(this, event);
+	this->count++;
+	if (unschedulable)
 	{
-		/* double the size of the heap */
-		this->heap_size <<= 1;
-		this->heap = (event_t**)realloc(this->heap,
-									(this->heap_size + 1) * sizeof(event_t*));
+		id = event->id = ++this->next_id;
+		this->events->put(this->events, &event->id, event);
 	}
-	/* "put" the event to the bottom */
-	position = this->event_count;
-
-	/* then bubble it up */
-	while (position > 1 && timeval_cmp(&this->heap[position >> 1]->time,
-									   &event->time) > 0)
-	{
-		/* parent has to be fired after the new event, move up */
-		this->heap[position] = this->heap[position >> 1];
-		position >>= 1;
+	if (tv2tick(&tv) < this->wakeup)
+	{	/* the scheduler thread sleeps longer than this event allows */
+		this->condvar->signal(this->condvar);
 	}
-	this->heap[position] = event;
-
-	this->condvar->signal(this->condvar);
 	this->mutex->unlock(this->mutex);
+	return id;
+}
+
+METHOD(scheduler_t, schedule_job_tv, void,
+	private_scheduler_t *this, job_t *job, timeval_t tv)
+{
+	schedule_event(this, job, tv, FALSE);
 }
 
 METHOD(scheduler_t, schedule_job, void,
@@ -300,17 +521,90 @@ METHOD(scheduler_t, schedule_job_ms, void,
 	schedule_job_tv(this, job, tv);
 }
 
+METHOD(scheduler_t, schedule_job_ms_id, u_int64_t,
+	private_scheduler_t *this, job_t *job, u_int32_t ms)
+{
+	timeval_t tv, add;
+
+	time_monotonic(&tv);
+	add.tv_sec = ms / 1000;
+	add.tv_usec = (ms % 1000) * 1000;
+
+	timeradd(&tv, &add, &tv);
+
+	return schedule_event(this, job, tv, TRUE);
+}
+
+METHOD(scheduler_t, unschedule_job, bool,
+	private_scheduler_t *this, u_int64_t id)
+{
+	event_t *event;
+
+	this->mutex->lock(this->mutex);
+	event = this->events->remove(this->events, &id);
+	if (event)
+	{
+		remove_event(this, event);
+		this->count--;
+	}
+	this->mutex->unlock(this->mutex);
+
+	if (!event)
+	{
+		return FALSE;
+	}
+	event->job->status = JOB_STATUS_CANCELED;
+	event_destroy(event);
+	return TRUE;
+}
+
+/**
+ * Hash an event ID
+ */
+static u_int hash_id(u_int64_t *id)
+{
+	return chunk_hash(chunk_from_thing(*id));
+}
+
+/**
+ * Compare two event IDs
+ */
+static bool equals_id(u_int64_t *a, u_int64_t *b)
+{
+	return *a == *b;
+}
+
+/**
+ * Destroy a list of events and their jobs
+ */
+static void destroy_events(event_t *events)
+{
+	event_t *event;
+
+	while (events)
+	{
+		event = events;
+		events = events->next;
+		event_destroy(event);
+	}
+}
+
 METHOD(scheduler_t, destroy, void,
 	private_scheduler_t *this)
 {
-	event_t *event;
+	u_int level, slot;
+
 	this->condvar->destroy(this->condvar);
 	this->mutex->destroy(this->mutex);
-	while ((event = remove_event(this)) != NULL)
+	for (level = 0; level < WHEEL_LEVELS; level++)
 	{
-		event_destroy(event);
+		for (slot = 0; slot < WHEEL_SLOTS; slot++)
+		{
+			destroy_events(this->wheel[level][slot]);
+		}
 	}
-	free(this->heap);
+	destroy_events(this->overflow);
+	this->events->destroy(this->events);
 	free(this);
 }
 
@@ -328,19 +622,20 @@ scheduler_t * scheduler_create()
 			.schedule_job = _schedule_job,
 			.schedule_job_ms = _schedule_job_ms,
 			.schedule_job_tv = _schedule_job_tv,
+			.schedule_job_ms_id = _schedule_job_ms_id,
+			.unschedule_job = _unschedule_job,
 			.destroy = _destroy,
 		},
-		.heap_size = HEAP_SIZE_DEFAULT,
+		.current = now_tick(),
+		.events = hashtable_create((hashtable_hash_t)hash_id,
+								   (hashtable_equals_t)equals_id, 1024),
 		.mutex = mutex_create(MUTEX_TYPE_DEFAULT),
 		.condvar = condvar_create(CONDVAR_TYPE_DEFAULT),
 	);
 
-	this->heap = (event_t**)calloc(this->heap_size + 1, sizeof(event_t*));
-
 	job = callback_job_create_with_prio((callback_job_cb_t)schedule, this,
 										NULL, return_false, JOB_PRIO_CRITICAL);
 	lib->processor->queue_job(lib->processor, (job_t*)job);
 
 	return &this->public;
 }
-
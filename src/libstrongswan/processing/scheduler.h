@@ -31,52 +31,26 @@ typedef struct scheduler_t scheduler_t;
 /**
  * The scheduler queues timed events which are then passed to the processor.
  *
- * The scheduler is implemented as a heap. A heap is a special kind of tree-
- * based data structure that satisfies the following property: if B is a child
- * node of A, then key(A) >= (or <=) key(B). So either the element with the
- * greatest (max-heap) or the smallest (min-heap) key is the root of the heap.
- * We use a min-heap with the key being the absolute unix time at which an
- * event is scheduled. So the root is always the event that will fire next.
+ * The scheduler is implemented as a hierarchical timing wheel. Time is divided
+ * into ticks of 1 ms. The wheel has 4 levels with 256 slots each, where a slot
+ * on level 0 covers a single tick, a slot on level 1 covers 256 ticks, and so
+ * on. An event is stored in the slot of the lowest level that covers the
+ * distance from the current tick to the event's tick. Events more than
+ * 2^32 ms (about 49 days) in the future are kept in an overflow list.
  *
- * An earlier implementation of the scheduler used a sorted linked list to store
- * the events. That had the advantage that removing the next event was extremely
- * fast, also, adding an event scheduled before or after all other events was
- * equally fast (all in O(1)). The problem was, though, that adding an event
- * in-between got slower, as the number of events grew larger (O(n)).
- * For each connection there could be several events: IKE-rekey, NAT-keepalive,
- * retransmissions, expire (half-open), and others. So a gateway that probably
- * has to handle thousands of concurrent connnections has to be able to queue a
- * large number of events as fast as possible. Locking makes this even worse, to
- * provide thread-safety, no events can be processed, while an event is queued,
- * so making the insertion fast is even more important.
+ * Each slot is a doubly linked list of events, so adding and removing an event
+ * is done in O(1), independent of the number of scheduled events. Whenever the
+ * current tick reaches the start of a block covered by a slot on a higher
+ * level, the events in that slot are moved to the lower levels (cascaded).
+ * When a tick is reached, all events in its slot on level 0 are fired at once.
  *
- * That's the advantage of the heap. Adding an element to the heap can be
- * achieved in O(log n) - on the other hand, removing the root node also
- * requires O(log n) operations. Consider 10000 queued events. Inserting a new
- * event in the list implementation required up to 10000 comparisons. In the
- * heap implementation, the worst case is about 13.3 comparisons. That's a
- * drastic improvement.
+ * A bitmap of non-empty slots per level allows the scheduler thread to find
+ * the next tick that requires processing quickly. So the thread only wakes up
+ * if an event has to be fired or cascaded, and idle ticks are skipped.
  *
- * The implementation itself uses a binary tree mapped to a one-based array to
- * store the elements. This reduces storage overhead and simplifies navigation:
- * the children of the node at position n are at position 2n and 2n+1 (likewise
- * the parent node of the node at position n is at position [n/2]). Thus,
- * navigating up and down the tree is reduced to simple index computations.
- *
- * Adding an element to the heap works as follows: The heap is always filled
- * from left to right, until a row is full, then the next row is filled. Mapped
- * to an array this gets as simple as putting the new element to the first free
- * position. In a one-based array that position equals the number of elements
- * currently stored in the heap. Then the heap property has to be restored, i.e.
- * the new element has to be "bubbled up" the tree until the parent node's key
- * is smaller or the element got the new root of the tree.
- *
- * Removing the next event from the heap works similarly. The event itself is
- * the root node and stored at position 1 of the array. After removing it, the
- * root has to be replaced and the heap property has to be restored. This is
- * done by moving the bottom element (last row, rightmost element) to the root
- * and then "seep it down" by swapping it with child nodes until none of the
- * children has a smaller key or it is again a leaf node.
+ * Events are never fired early, but might fire up to one tick late. Only
+ * events scheduled with schedule_job_ms_id() are additionally kept in a
+ * hashtable, so they can be looked up and removed by their ID.
  */
 struct scheduler_t {
 
@@ -107,6 +81,29 @@ struct scheduler_t {
 	 */
 	void (*schedule_job_tv) (scheduler_t *this, job_t *job, timeval_t tv);
 
+	/**
+	 * Adds a event to the queue that can be removed again with
+	 * unschedule_job(), using a relative time offset in ms.
+	 *
+	 * @param job			job to schedule
+	 * @param time			relative time to schedule job, in ms
+	 * @return				unique ID of the event, never 0
+	 */
+	u_int64_t (*schedule_job_ms_id) (scheduler_t *this, job_t *job,
+									 u_int32_t ms);
+
+	/**
+	 * Remove an event scheduled with schedule_job_ms_id() before it fires.
+	 *
+	 * The job of a removed event gets destroyed. IDs of events that already
+	 * fired are ignored, so the caller does not have to know if the job got
+	 * executed in the mean time.
+	 *
+	 * @param id			ID returned by schedule_job_ms_id()
+	 * @return				TRUE if the event was removed
+	 */
+	bool (*unschedule_job) (scheduler_t *this, u_int64_t id);
+
 	/**
 	 * Returns number of jobs scheduled.
 	 *
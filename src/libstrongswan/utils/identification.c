@@ -21,6 +21,7 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
 
 #include "identification.h"
 
@@ -666,6 +667,66 @@ METHOD(identification_t, equals_strcasecmp,  bool,
 	return FALSE;
 }
 
+METHOD(identification_t, hash_binary, u_int,
+	private_identification_t *this, u_int inc)
+{
+	u_int hash;
+
+	hash = chunk_hash_inc(chunk_from_thing(this->type), inc);
+	if (this->type == ID_ANY)
+	{
+		return hash;
+	}
+	return chunk_hash_inc(this->encoded, hash);
+}
+
+/**
+ * Hash a chunk case insensitively
+ */
+static u_int hash_lower(chunk_t chunk, u_int hash)
+{
+	u_char lower[64];
+	int i, len;
+
+	while (chunk.len)
+	{
+		len = min(chunk.len, sizeof(lower));
+		for (i = 0; i < len; i++)
+		{
+			lower[i] = tolower(chunk.ptr[i]);
+		}
+		hash = chunk_hash_inc(chunk_create(lower, len), hash);
+		chunk = chunk_skip(chunk, len);
+	}
+	return hash;
+}
+
+METHOD(identification_t, hash_strcasecmp, u_int,
+	private_identification_t *this, u_int inc)
+{
+	return hash_lower(this->encoded,
+					  chunk_hash_inc(chunk_from_thing(this->type), inc));
+}
+
+METHOD(identification_t, hash_dn, u_int,
+	private_identification_t *this, u_int inc)
+{
+	enumerator_t *rdns;
+	chunk_t oid, data;
+	u_char type;
+	u_int hash;
+
+	/* compare_dn() ignores the case of some RDNs, so we ignore it for all */
+	hash = chunk_hash_inc(chunk_from_thing(this->type), inc);
+	rdns = create_rdn_enumerator(this->encoded);
+	while (rdns->enumerate(rdns, &oid, &type, &data))
+	{
+		hash = hash_lower(data, chunk_hash_inc(oid, hash));
+	}
+	rdns->destroy(rdns);
+	return hash;
+}
+
 METHOD(identification_t, matches_binary, id_match_t,
 	private_identification_t *this, identification_t *other)
 {
@@ -867,6 +928,7 @@ static private_identification_t *identification_create(id_type_t type)
 		case ID_ANY:
 			this->public.matches = _matches_any;
 			this->public.equals = _equals_binary;
+			this->public.hash = _hash_binary;
 			this->public.contains_wildcards = return_true;
 			break;
 		case ID_FQDN:
@@ -874,16 +936,19 @@ static private_identification_t *identification_create(id_type_t type)
 		case ID_USER_ID:
 			this->public.matches = _matches_string;
 			this->public.equals = _equals_strcasecmp;
+			this->public.hash = _hash_strcasecmp;
 			this->public.contains_wildcards = _contains_wildcards_memchr;
 			break;
 		case ID_DER_ASN1_DN:
 			this->public.equals = _equals_dn;
 			this->public.matches = _matches_dn;
+			this->public.hash = _hash_dn;
 			this->public.contains_wildcards = _contains_wildcards_dn;
 			break;
 		default:
 			this->public.equals = _equals_binary;
 			this->public.matches = _matches_binary;
+			this->public.hash = _hash_binary;
 			this->public.contains_wildcards = return_false;
 			break;
 	}
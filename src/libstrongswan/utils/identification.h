@@ -226,6 +226,19 @@ struct identification_t {
 	 */
 	bool (*equals) (identification_t *this, identification_t *other);
 
+	/**
+	 * Get a hash value for this identification.
+	 *
+	 * IDs of the same type that are equal according to equals() have the
+	 * same hash value.  As equals() ignores the type of the other ID for
+	 * some types (e.g. ID_FQDN equals an ID_USER_FQDN with the same value),
+	 * hashtables keyed by IDs have to compare their types, too.
+	 *
+	 * @param inc		value to incorporate into the hash
+	 * @return 			hash value
+	 */
+	u_int (*hash) (identification_t *this, u_int inc);
+
 	/**
 	 * Check if an ID matches a wildcard ID.
 	 *
@@ -31,8 +31,10 @@
 
 #include "settings.h"
 
+#include "utils/chunk.h"
 #include "collections/linked_list.h"
 #include "threading/rwlock.h"
+#include "threading/thread_value.h"
 #include "utils/debug.h"
 
 #define MAX_INCLUSION_LEVEL		10
@@ -40,6 +42,8 @@
 typedef struct private_settings_t private_settings_t;
 typedef struct section_t section_t;
 typedef struct kv_t kv_t;
+typedef struct snapshot_t snapshot_t;
+typedef struct reader_t reader_t;
 
 /**
  * private data of settings
@@ -65,6 +69,68 @@ struct private_settings_t {
 	 * lock to safely access the settings
 	 */
 	rwlock_t *lock;
+
+	/**
+	 * compiled snapshot of the tree used by readers, NULL if outdated
+	 */
+	snapshot_t *snapshot;
+
+	/**
+	 * incremented whenever a snapshot gets replaced
+	 */
+	volatile u_int epoch;
+
+	/**
+	 * state of the current thread reading snapshots, as reader_t
+	 */
+	thread_value_t *reader;
+
+	/**
+	 * states of all threads reading snapshots, as reader_t
+	 */
+	linked_list_t *readers;
+
+	/**
+	 * replaced snapshots possibly still in use by readers, oldest first, as
+	 * snapshot_t
+	 */
+	linked_list_t *retired;
+
+	/**
+	 * TRUE if retired contains snapshots, checked by readers without lock
+	 */
+	volatile bool has_retired;
+
+	/**
+	 * epoch in which the oldest retired snapshot got replaced
+	 */
+	volatile u_int oldest_retired;
+};
+
+/**
+ * State of a thread reading snapshots
+ */
+struct reader_t {
+
+	/**
+	 * settings this state belongs to
+	 */
+	private_settings_t *settings;
+
+	/**
+	 * number of snapshots currently acquired by the thread
+	 */
+	volatile u_int depth;
+
+	/**
+	 * epoch in which the thread acquired its first snapshot, if depth > 0
+	 */
+	volatile u_int epoch;
+
+	/**
+	 * TRUE if the state is assigned to a thread
+	 */
+	bool used;
 };
 
 /**
@@ -178,6 +244,595 @@ static bool kv_find(kv_t *this, char *key)
 	return streq(this->key, key);
 }
 
+/**
+ * Type of an entry in the hash table of a snapshot
+ */
+typedef enum {
+	ENTRY_EMPTY = 0,
+	ENTRY_SECTION,
+	ENTRY_KV,
+} entry_type_t;
+
+/**
+ * Entry in the hash table of a snapshot, maps a name in a section to an index
+ */
+typedef struct {
+
+	/**
+	 * hash of the name and the parent section
+	 */
+	u_int hash;
+
+	/**
+	 * index of the parent section
+	 */
+	u_int parent;
+
+	/**
+	 * index of the section or key/value pair
+	 */
+	u_int index;
+
+	/**
+	 * type of this entry
+	 */
+	entry_type_t type;
+
+} snapshot_entry_t;
+
+/**
+ * Compiled section in a snapshot
+ */
+typedef struct {
+
+	/**
+	 * name of the section
+	 */
+	char *name;
+
+	/**
+	 * index of the first subsection, all subsections are stored consecutively
+	 */
+	u_int first_section;
+
+	/**
+	 * number of subsections
+	 */
+	u_int sections;
+
+	/**
+	 * index of the first key/value pair, stored consecutively
+	 */
+	u_int first_kv;
+
+	/**
+	 * number of key/value pairs
+	 */
+	u_int kvs;
+
+} snapshot_section_t;
+
+/**
+ * Immutable snapshot of the settings tree, compiled into a hash table.
+ *
+ * Readers access a snapshot without locking, changes to the tree replace it.
+ */
+struct snapshot_t {
+
+	/**
+	 * sections in breadth-first order, the top level section has index 0
+	 */
+	snapshot_section_t *sections;
+
+	/**
+	 * key/value pairs of all sections (the strings are not owned)
+	 */
+	kv_t *kvs;
+
+	/**
+	 * hash table with open addressing, mapping names to sections and pairs
+	 */
+	snapshot_entry_t *table;
+
+	/**
+	 * size of the hash table - 1
+	 */
+	u_int mask;
+
+	/**
+	 * copies of all section names and keys
+	 */
+	char *names;
+
+	/**
+	 * epoch in which the snapshot got replaced, if retired
+	 */
+	u_int retired;
+};
+
+/**
+ * Hash a name in the section with the given index
+ */
+static inline u_int entry_hash(u_int parent, entry_type_t type, char *name)
+{
+	return chunk_hash_inc(chunk_from_str(name), (parent << 1) | (type - 1));
+}
+
+/**
+ * Get the name of a hash table entry
+ */
+static inline char *entry_name(snapshot_t *this, snapshot_entry_t *entry)
+{
+	if (entry->type == ENTRY_SECTION)
+	{
+		return this->sections[entry->index].name;
+	}
+	return this->kvs[entry->index].key;
+}
+
+/**
+ * Add a name to the hash table of a snapshot, the first one wins like with
+ * the linked lists in the tree
+ */
+static void snapshot_insert(snapshot_t *this, u_int parent, entry_type_t type,
+							u_int index, char *name)
+{
+	snapshot_entry_t *entry;
+	u_int hash, i;
+
+	hash = entry_hash(parent, type, name);
+	for (i = hash & this->mask;; i = (i + 1) & this->mask)
+	{
+		entry = &this->table[i];
+		if (entry->type == ENTRY_EMPTY)
+		{
+			*entry = (snapshot_entry_t){
+				.hash = hash,
+				.parent = parent,
+				.index = index,
+				.type = type,
+			};
+			return;
+		}
+		if (entry->hash == hash && entry->parent == parent &&
+			entry->type == type && streq(entry_name(this, entry), name))
+		{
+			return;
+		}
+	}
+}
+
+/**
+ * Look up a name in the section with the given index
+ */
+static bool snapshot_find(snapshot_t *this, u_int parent, entry_type_t type,
+						  char *name, u_int *index)
+{
+	snapshot_entry_t *entry;
+	u_int hash, i;
+
+	hash = entry_hash(parent, type, name);
+	for (i = hash & this->mask;; i = (i + 1) & this->mask)
+	{
+		entry = &this->table[i];
+		if (entry->type == ENTRY_EMPTY)
+		{
+			return FALSE;
+		}
+		if (entry->hash == hash && entry->parent == parent &&
+			entry->type == type && streq(entry_name(this, entry), name))
+		{
+			*index = entry->index;
+			return TRUE;
+		}
+	}
+}
+
+/**
+ * Count the sections, key/value pairs and name bytes below a section
+ */
+static void section_count(section_t *this, u_int *sections, u_int *kvs,
+						  size_t *names)
+{
+	enumerator_t *enumerator;
+	section_t *section;
+	kv_t *kv;
+
+	enumerator = this->sections->create_enumerator(this->sections);
+	while (enumerator->enumerate(enumerator, &section))
+	{
+		*sections += 1;
+		*names += strlen(section->name) + 1;
+		section_count(section, sections, kvs, names);
+	}
+	enumerator->destroy(enumerator);
+
+	enumerator = this->kv->create_enumerator(this->kv);
+	while (enumerator->enumerate(enumerator, &kv))
+	{
+		*kvs += 1;
+		*names += strlen(kv->key) + 1;
+	}
+	enumerator->destroy(enumerator);
+}
+
+/**
+ * Copy a name to the name buffer of a snapshot
+ */
+static char *copy_name(char **pos, char *name)
+{
+	char *copy = *pos;
+	size_t len;
+
+	len = strlen(name) + 1;
+	memcpy(copy, name, len);
+	*pos += len;
+	return copy;
+}
+
+/**
+ * Compile the tree below the given top level section to a snapshot
+ */
+static snapshot_t *snapshot_create(section_t *top)
+{
+	snapshot_t *this;
+	section_t **queue, *section;
+	enumerator_t *enumerator;
+	u_int sections = 1, kvs = 0, size = 8, i, next = 1, kv_next = 0;
+	size_t names = 1;
+	char *pos;
+	kv_t *kv;
+
+	section_count(top, &sections, &kvs, &names);
+	while (size < 2 * (sections + kvs))
+	{
+		size <<= 1;
+	}
+
+	INIT(this,
+		.sections = calloc(sections, sizeof(snapshot_section_t)),
+		.kvs = calloc(max(kvs, 1), sizeof(kv_t)),
+		.table = calloc(size, sizeof(snapshot_entry_t)),
+		.mask = size - 1,
+		.names = malloc(names),
+	);
+	pos = this->names;
+	queue = malloc(sizeof(section_t*) * sections);
+	queue[0] = top;
+	this->sections[0].name = copy_name(&pos, "");
+
+	/* the children of each section get consecutive indices */
+	for (i = 0; i < next; i++)
+	{
+		this->sections[i].first_section = next;
+		enumerator = queue[i]->sections->create_enumerator(queue[i]->sections);
+		while (enumerator->enumerate(enumerator, &section))
+		{
+			queue[next] = section;
+			this->sections[next].name = copy_name(&pos, section->name);
+			snapshot_insert(this, i, ENTRY_SECTION, next,
+							this->sections[next].name);
+			this->sections[i].sections++;
+			next++;
+		}
+		enumerator->destroy(enumerator);
+
+		this->sections[i].first_kv = kv_next;
+		enumerator = queue[i]->kv->create_enumerator(queue[i]->kv);
+		while (enumerator->enumerate(enumerator, &kv))
+		{
+			this->kvs[kv_next] = (kv_t){
+				.key = copy_name(&pos, kv->key),
+				.value = kv->value,
+			};
+			snapshot_insert(this, i, ENTRY_KV, kv_next,
+							this->kvs[kv_next].key);
+			this->sections[i].kvs++;
+			kv_next++;
+		}
+		enumerator->destroy(enumerator);
+	}
+	free(queue);
+	return this;
+}
+
+/**
+ * Destroy a snapshot
+ */
+static void snapshot_destroy(snapshot_t *this)
+{
+	free(this->sections);
+	free(this->kvs);
+	free(this->table);
+	free(this->names);
+	free(this);
+}
+
+/**
+ * Check if epoch a is before epoch b, the counter might wrap around
+ */
+static inline bool epoch_before(u_int a, u_int b)
+{
+	return (int)(a - b) < 0;
+}
+
+/**
+ * Release the reader state of a terminating thread
+ */
+static void reader_cleanup(reader_t *reader)
+{
+	private_settings_t *this = reader->settings;
+
+	this->lock->write_lock(this->lock);
+	reader->depth = 0;
+	reader->used = FALSE;
+	this->lock->unlock(this->lock);
+}
+
+/**
+ * Get the reader state of the current thread, assigning one if necessary
+ */
+static reader_t *get_reader(private_settings_t *this)
+{
+	enumerator_t *enumerator;
+	reader_t *reader, *current;
+
+	reader = this->reader->get(this->reader);
+	if (!reader)
+	{
+		this->lock->write_lock(this->lock);
+		enumerator = this->readers->create_enumerator(this->readers);
+		while (enumerator->enumerate(enumerator, &current))
+		{	/* reuse the state of a terminated thread */
+			if (!current->used)
+			{
+				reader = current;
+				break;
+			}
+		}
+		enumerator->destroy(enumerator);
+		if (!reader)
+		{
+			INIT(reader,
+				.settings = this,
+			);
+			this->readers->insert_last(this->readers, reader);
+		}
+		reader->used = TRUE;
+		this->lock->unlock(this->lock);
+		this->reader->set(this->reader, reader);
+	}
+	return reader;
+}
+
+/**
+ * Get the current snapshot, compiling it if necessary.  Has to be released
+ * with release_snapshot().
+ *
+ * Each thread announces the epoch in which it started reading in its own
+ * reader state, so readers don't share any writable memory.
+ */
+static snapshot_t *acquire_snapshot(private_settings_t *this)
+{
+	snapshot_t *snapshot;
+	reader_t *reader;
+
+	reader = get_reader(this);
+	if (!reader->depth++)
+	{
+		reader->epoch = this->epoch;
+		/* invalidate() replaces the snapshot before it checks the readers,
+		 * so either it sees our epoch or we don't see the old snapshot */
+		memory_barrier();
+	}
+	snapshot = this->snapshot;
+	if (!snapshot)
+	{
+		this->lock->read_lock(this->lock);
+		snapshot = this->snapshot;
+		if (!snapshot)
+		{	/* concurrent readers might compile it too, the first one wins */
+			snapshot = snapshot_create(this->top);
+			if (!cas_ptr((void**)&this->snapshot, NULL, snapshot))
+			{
+				snapshot_destroy(snapshot);
+				snapshot = this->snapshot;
+			}
+		}
+		this->lock->unlock(this->lock);
+	}
+	return snapshot;
+}
+
+/**
+ * Destroy replaced snapshots that no active reader might still use, the write
+ * lock must be held.
+ *
+ * Readers that started reading after a snapshot got replaced can't see it, so
+ * only those in the same or an earlier epoch keep it alive.
+ */
+static void destroy_retired(private_settings_t *this)
+{
+	enumerator_t *enumerator;
+	snapshot_t *snapshot;
+	reader_t *reader;
+	u_int oldest;
+
+	if (!this->has_retired)
+	{
+		return;
+	}
+	oldest = this->epoch;
+	enumerator = this->readers->create_enumerator(this->readers);
+	while (enumerator->enumerate(enumerator, &reader))
+	{
+		if (reader->depth && epoch_before(reader->epoch, oldest))
+		{
+			oldest = reader->epoch;
+		}
+	}
+	enumerator->destroy(enumerator);
+
+	while (this->retired->get_first(this->retired,
+									(void**)&snapshot) == SUCCESS)
+	{
+		if (!epoch_before(snapshot->retired, oldest))
+		{
+			this->oldest_retired = snapshot->retired;
+			return;
+		}
+		this->retired->remove_first(this->retired, (void**)&snapshot);
+		snapshot_destroy(snapshot);
+	}
+	this->has_retired = FALSE;
+}
+
+/**
+ * Release a snapshot acquired with acquire_snapshot()
+ *
+ * A reader that might have kept the oldest retired snapshot alive tries to
+ * destroy it when it stops reading.
+ */
+static void release_snapshot(private_settings_t *this)
+{
+	reader_t *reader;
+
+	reader = this->reader->get(this->reader);
+	if (!--reader->depth)
+	{
+		/* orders this against invalidate(), see acquire_snapshot() */
+		memory_barrier();
+		if (this->has_retired &&
+			!epoch_before(this->oldest_retired, reader->epoch))
+		{
+			this->lock->write_lock(this->lock);
+			destroy_retired(this);
+			this->lock->unlock(this->lock);
+		}
+	}
+}
+
+/**
+ * Mark the current snapshot as outdated after changing the tree, the write
+ * lock must be held.
+ *
+ * Replaced snapshots are destroyed as soon as all readers started reading in
+ * a later epoch, either here or in release_snapshot().
+ */
+static void invalidate(private_settings_t *this)
+{
+	snapshot_t *snapshot;
+
+	snapshot = this->snapshot;
+	if (snapshot)
+	{
+		this->snapshot = NULL;
+		snapshot->retired = this->epoch;
+		if (!this->has_retired)
+		{
+			this->oldest_retired = snapshot->retired;
+		}
+		this->retired->insert_last(this->retired, snapshot);
+		this->has_retired = TRUE;
+		/* readers that see the new epoch must not see the old snapshot */
+		memory_barrier();
+		this->epoch++;
+	}
+	memory_barrier();
+	destroy_retired(this);
+}
+
+/**
+ * Format a key into the given buffer.  The sections and the final key are
+ * each terminated by '\0', dots in arguments are not treated as separators.
+ *
+ * @return			number of formatted segments, 0 on failure
+ */
+static int format_key(char *buf, int len, char *key, va_list args)
+{
+	va_list copy;
+	char *end = buf + len, *str;
+	enum_name_t *names;
+	int segments = 1, written = 0;
+
+	va_copy(copy, args);
+	for (; *key; key++)
+	{
+		if (buf >= end)
+		{
+			break;
+		}
+		switch (*key)
+		{
+			case '.':
+				*buf++ = '\0';
+				segments++;
+				continue;
+			case '%':
+				break;
+			default:
+				*buf++ = *key;
+				continue;
+		}
+		key++;
+		switch (*key)
+		{
+			case 'd':
+				written = snprintf(buf, end - buf, "%d", va_arg(copy, int));
+				break;
+			case 's':
+				str = va_arg(copy, char*);
+				written = snprintf(buf, end - buf, "%s", str ?: "(null)");
+				break;
+			case 'N':
+				names = va_arg(copy, enum_name_t*);
+				written = snprintf(buf, end - buf, "%N", names,
+								   va_arg(copy, int));
+				break;
+			case '%':
+				written = snprintf(buf, end - buf, "%%");
+				break;
+			default:
+				DBG1(DBG_CFG, "settings with %%%c not supported!", *key);
+				va_end(copy);
+				return 0;
+		}
+		if (written < 0 || written >= end - buf)
+		{
+			va_end(copy);
+			return 0;
+		}
+		buf += written;
+	}
+	va_end(copy);
+	if (buf >= end)
+	{
+		return 0;
+	}
+	*buf = '\0';
+	return segments;
+}
+
+/**
+ * Look up a formatted key in a snapshot, with the given type of the last
+ * segment
+ */
+static bool snapshot_lookup(snapshot_t *this, char *buf, int segments,
+							entry_type_t type, u_int *index)
+{
+	u_int parent = 0;
+
+	for (; segments > 1; segments--)
+	{
+		if (!snapshot_find(this, parent, ENTRY_SECTION, buf, &parent))
+		{
+			return FALSE;
+		}
+		buf += strlen(buf) + 1;
+	}
+	return snapshot_find(this, parent, type, buf, index);
+}
+
 /**
  * Print a format key, but consume already processed arguments
  */
@@ -268,26 +923,6 @@ static section_t *find_section_buffered(section_t *section,
 	return found;
 }
 
-/**
- * Find a section by a given key (thread-safe).
- */
-static section_t *find_section(private_settings_t *this, section_t *section,
-							   char *key, va_list args)
-{
-	char buf[128], keybuf[512];
-	section_t *found;
-
-	if (snprintf(keybuf, sizeof(keybuf), "%s", key) >= sizeof(keybuf))
-	{
-		return NULL;
-	}
-	this->lock->read_lock(this->lock);
-	found = find_section_buffered(section, keybuf, keybuf, args, buf,
-								  sizeof(buf), FALSE);
-	this->lock->unlock(this->lock);
-	return found;
-}
-
 /**
  * Ensure that the section with the given key exists (thread-safe).
  */
@@ -305,6 +940,7 @@ static section_t *ensure_section(private_settings_t *this, section_t *section,
 	this->lock->write_lock(this->lock);
 	found = find_section_buffered(section, keybuf, keybuf, args, buf,
 								  sizeof(buf), TRUE);
+	invalidate(this);
 	this->lock->unlock(this->lock);
 	return found;
 }
@@ -370,26 +1006,26 @@ static kv_t *find_value_buffered(section_t *section, char *start, char *key,
 }
 
 /**
- * Find the string value for a key (thread-safe).
+ * Find the string value for a key (thread-safe, lock-free).
  */
-static char *find_value(private_settings_t *this, section_t *section,
-						char *key, va_list args)
+static char *find_value(private_settings_t *this, char *key, va_list args)
 {
-	char buf[128], keybuf[512], *value = NULL;
-	kv_t *kv;
+	snapshot_t *snapshot;
+	char buf[512], *value = NULL;
+	u_int index;
+	int segments;
 
-	if (snprintf(keybuf, sizeof(keybuf), "%s", key) >= sizeof(keybuf))
+	segments = format_key(buf, sizeof(buf), key, args);
+	if (!segments)
 	{
 		return NULL;
 	}
-	this->lock->read_lock(this->lock);
-	kv = find_value_buffered(section, keybuf, keybuf, args, buf, sizeof(buf),
-							 FALSE);
-	if (kv)
+	snapshot = acquire_snapshot(this);
+	if (snapshot_lookup(snapshot, buf, segments, ENTRY_KV, &index))
 	{
-		value = kv->value;
+		value = snapshot->kvs[index].value;
 	}
-	this->lock->unlock(this->lock);
+	release_snapshot(this);
 	return value;
 }
 
@@ -425,6 +1061,7 @@ static void set_value(private_settings_t *this, section_t *section,
 			this->contents->insert_last(this->contents, kv->value);
 		}
 	}
+	invalidate(this);
 	this->lock->unlock(this->lock);
 }
 
@@ -435,7 +1072,7 @@ METHOD(settings_t, get_str, char*,
 	va_list args;
 
 	va_start(args, def);
-	value = find_value(this, this->top, key, args);
+	value = find_value(this, key, args);
 	va_end(args);
 	if (value)
 	{
@@ -476,7 +1113,7 @@ METHOD(settings_t, get_bool, bool,
 	va_list args;
 
 	va_start(args, def);
-	value = find_value(this, this->top, key, args);
+	value = find_value(this, key, args);
 	va_end(args);
 	return settings_value_as_bool(value, def);
 }
@@ -506,7 +1143,7 @@ METHOD(settings_t, get_int, int,
 	va_list args;
 
 	va_start(args, def);
-	value = find_value(this, this->top, key, args);
+	value = find_value(this, key, args);
 	va_end(args);
 	return settings_value_as_int(value, def);
 }
@@ -536,7 +1173,7 @@ METHOD(settings_t, get_double, double,
 	va_list args;
 
 	va_start(args, def);
-	value = find_value(this, this->top, key, args);
+	value = find_value(this, key, args);
 	va_end(args);
 	return settings_value_as_double(value, def);
 }
@@ -582,7 +1219,7 @@ METHOD(settings_t, get_time, u_int32_t,
 	va_list args;
 
 	va_start(args, def);
-	value = find_value(this, this->top, key, args);
+	value = find_value(this, key, args);
 	va_end(args);
 	return settings_value_as_time(value, def);
 }
@@ -651,7 +1288,7 @@ METHOD(settings_t, set_default_str, bool,
 	va_list args;
 
 	va_start(args, value);
-	old = find_value(this, this->top, key, args);
+	old = find_value(this, key, args);
 	va_end(args);
 
 	if (!old)
@@ -665,63 +1302,136 @@ METHOD(settings_t, set_default_str, bool,
 }
 
 /**
- * Enumerate section names, not sections
+ * Enumerator over the subsections or key/value pairs of a snapshot section
  */
-static bool section_filter(void *null, section_t **in, char **out)
+typedef struct {
+
+	/**
+	 * implements enumerator_t
+	 */
+	enumerator_t public;
+
+	/**
+	 * settings the snapshot was acquired from
+	 */
+	private_settings_t *settings;
+
+	/**
+	 * snapshot to enumerate
+	 */
+	snapshot_t *snapshot;
+
+	/**
+	 * index of the next subsection or key/value pair
+	 */
+	u_int pos;
+
+	/**
+	 * index after the last subsection or key/value pair
+	 */
+	u_int end;
+
+} snapshot_enumerator_t;
+
+METHOD(enumerator_t, enumerate_sections, bool,
+	snapshot_enumerator_t *this, char **name)
 {
-	*out = (*in)->name;
-	return TRUE;
+	if (this->pos < this->end)
+	{
+		*name = this->snapshot->sections[this->pos++].name;
+		return TRUE;
+	}
+	return FALSE;
 }
 
-METHOD(settings_t, create_section_enumerator, enumerator_t*,
-	   private_settings_t *this, char *key, ...)
+METHOD(enumerator_t, enumerate_kvs, bool,
+	snapshot_enumerator_t *this, char **key, char **value)
 {
-	section_t *section;
-	va_list args;
+	if (this->pos < this->end)
+	{
+		*key = this->snapshot->kvs[this->pos].key;
+		*value = this->snapshot->kvs[this->pos].value;
+		this->pos++;
+		return TRUE;
+	}
+	return FALSE;
+}
 
-	va_start(args, key);
-	section = find_section(this, this->top, key, args);
-	va_end(args);
+METHOD(enumerator_t, enumerator_destroy, void,
+	snapshot_enumerator_t *this)
+{
+	release_snapshot(this->settings);
+	free(this);
+}
 
-	if (!section)
+/**
+ * Create an enumerator over the subsections or key/value pairs of a section,
+ * the snapshot is held until the enumerator gets destroyed
+ */
+static enumerator_t *create_snapshot_enumerator(private_settings_t *this,
+								char *key, va_list args, entry_type_t type)
+{
+	snapshot_enumerator_t *enumerator;
+	snapshot_section_t *section;
+	snapshot_t *snapshot;
+	char buf[512];
+	u_int index;
+	int segments;
+
+	segments = format_key(buf, sizeof(buf), key, args);
+	if (!segments)
+	{
+		return enumerator_create_empty();
+	}
+	snapshot = acquire_snapshot(this);
+	if (!snapshot_lookup(snapshot, buf, segments, ENTRY_SECTION, &index))
 	{
+		release_snapshot(this);
 		return enumerator_create_empty();
 	}
-	this->lock->read_lock(this->lock);
-	return enumerator_create_filter(
-				section->sections->create_enumerator(section->sections),
-				(void*)section_filter, this->lock, (void*)this->lock->unlock);
+	section = &snapshot->sections[index];
+
+	INIT(enumerator,
+		.public = {
+			.enumerate = (void*)_enumerate_kvs,
+			.destroy = _enumerator_destroy,
+		},
+		.settings = this,
+		.snapshot = snapshot,
+		.pos = section->first_kv,
+		.end = section->first_kv + section->kvs,
+	);
+	if (type == ENTRY_SECTION)
+	{
+		enumerator->public.enumerate = (void*)_enumerate_sections;
+		enumerator->pos = section->first_section;
+		enumerator->end = section->first_section + section->sections;
+	}
+	return &enumerator->public;
 }
 
-/**
- * Enumerate key and values, not kv_t entries
- */
-static bool kv_filter(void *null, kv_t **in, char **key,
-					  void *none, char **value)
+METHOD(settings_t, create_section_enumerator, enumerator_t*,
+	   private_settings_t *this, char *key, ...)
 {
-	*key = (*in)->key;
-	*value = (*in)->value;
-	return TRUE;
+	enumerator_t *enumerator;
+	va_list args;
+
+	va_start(args, key);
+	enumerator = create_snapshot_enumerator(this, key, args, ENTRY_SECTION);
+	va_end(args);
+	return enumerator;
 }
 
 METHOD(settings_t, create_key_value_enumerator, enumerator_t*,
 	   private_settings_t *this, char *key, ...)
 {
-	section_t *section;
+	enumerator_t *enumerator;
 	va_list args;
 
 	va_start(args, key);
-	section = find_section(this, this->top, key, args);
+	enumerator = create_snapshot_enumerator(this, key, args, ENTRY_KV);
 	va_end(args);
-
-	if (!section)
-	{
-		return enumerator_create_empty();
-	}
-	this->lock->read_lock(this->lock);
-	return enumerator_create_filter(
-					section->kv->create_enumerator(section->kv),
-					(void*)kv_filter, this->lock, (void*)this->lock->unlock);
+	return enumerator;
 }
 
 /**
@@ -1166,6 +1876,7 @@ static bool load_files_internal(private_settings_t *this, section_t *parent,
 	}
 	/* extend parent section */
 	section_extend(parent, section);
+	invalidate(this);
 	/* move contents of loaded files to main store */
 	while (contents->remove_first(contents, (void**)&text) == SUCCESS)
 	{
@@ -1204,6 +1915,13 @@ METHOD(settings_t, load_files_section, bool,
 METHOD(settings_t, destroy, void,
 	   private_settings_t *this)
 {
+	if (this->snapshot)
+	{
+		snapshot_destroy(this->snapshot);
+	}
+	this->reader->destroy(this->reader);
+	this->readers->destroy_function(this->readers, free);
+	this->retired->destroy_function(this->retired, (void*)snapshot_destroy);
 	section_destroy(this->top);
 	this->contents->destroy_function(this->contents, (void*)free);
 	this->lock->destroy(this->lock);
@@ -1239,6 +1957,9 @@ settings_t *settings_create(char *file)
 		.top = section_create(NULL),
 		.contents = linked_list_create(),
 		.lock = rwlock_create(RWLOCK_TYPE_DEFAULT),
+		.reader = thread_value_create((thread_cleanup_t)reader_cleanup),
+		.readers = linked_list_create(),
+		.retired = linked_list_create(),
 	);
 
 	load_files(this, file, FALSE);
@@ -474,11 +474,14 @@ static pthread_mutex_t ref_mutex = PTHREAD_MUTEX_INITIALIZER;
 /**
  * Increase refcount
  */
-void ref_get(refcount_t *ref)
+refcount_t ref_get(refcount_t *ref)
 {
+	refcount_t current;
+
 	pthread_mutex_lock(&ref_mutex);
-	(*ref)++;
+	current = ++(*ref);
 	pthread_mutex_unlock(&ref_mutex);
+	return current;
 }
 
 /**
@@ -515,6 +518,15 @@ bool cas_##name(type *ptr, type oldval, type newval) \
 _cas_impl(bool, bool)
 _cas_impl(ptr, void*)
 
+/**
+ * Full memory barrier, implied by locking and unlocking a mutex
+ */
+void memory_barrier()
+{
+	pthread_mutex_lock(&cas_mutex);
+	pthread_mutex_unlock(&cas_mutex);
+}
+
 #endif /* HAVE_GCC_ATOMIC_OPERATIONS */
 
 /**
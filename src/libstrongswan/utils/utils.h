@@ -666,7 +666,7 @@ typedef volatile u_int refcount_t;
 
 #ifdef HAVE_GCC_ATOMIC_OPERATIONS
 
-#define ref_get(ref) {__sync_fetch_and_add(ref, 1); }
+#define ref_get(ref) __sync_add_and_fetch(ref, 1)
 #define ref_put(ref) (!__sync_sub_and_fetch(ref, 1))
 
 #define cas_bool(ptr, oldval, newval) \
@@ -674,6 +674,8 @@ typedef volatile u_int refcount_t;
 #define cas_ptr(ptr, oldval, newval) \
 					(__sync_bool_compare_and_swap(ptr, oldval, newval))
 
+#define memory_barrier() __sync_synchronize()
+
 #else /* !HAVE_GCC_ATOMIC_OPERATIONS */
 
 /**
@@ -682,8 +684,9 @@ typedef volatile u_int refcount_t;
  * Increments the reference counter atomic.
  *
  * @param ref	pointer to ref counter
+ * @return		new value of ref
  */
-void ref_get(refcount_t *ref);
+refcount_t ref_get(refcount_t *ref);
 
 /**
  * Put back a unused reference.
@@ -716,6 +719,13 @@ bool cas_bool(bool *ptr, bool oldval, bool newval);
  */
 bool cas_ptr(void **ptr, void *oldval, void *newval);
 
+/**
+ * Issue a full memory barrier.
+ *
+ * Neither the compiler nor the CPU move memory accesses across the barrier.
+ */
+void memory_barrier();
+
 #endif /* HAVE_GCC_ATOMIC_OPERATIONS */
 
 /**